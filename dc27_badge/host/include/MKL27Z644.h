@@ -0,0 +1,347 @@
+/*
+ * Host simulation stand-in for the MKL27Z644 device header.
+ *
+ * Only the peripherals and register fields used by the badge firmware are
+ * declared. Register layouts match CMSIS/MKL27Z644.h so that code touching
+ * registers directly (SIM->UIDL, SysTick->VAL, PORTE->PCR[n], ...) compiles
+ * unchanged. Peripheral instances live in host RAM (see sim_hal.c) instead of
+ * at their memory-mapped addresses.
+ */
+
+#ifndef _MKL27Z644_H_
+#define _MKL27Z644_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+#define MCU_MKL27Z644
+
+#define __I     volatile const
+#define __O     volatile
+#define __IO    volatile
+
+#define __ASM   __asm
+#define __INLINE inline
+#define __STATIC_INLINE static inline
+
+/* Interrupt vector numbers */
+typedef enum IRQn {
+  NotAvail_IRQn                = -128,
+  NonMaskableInt_IRQn          = -14,
+  HardFault_IRQn               = -13,
+  SVCall_IRQn                  = -5,
+  PendSV_IRQn                  = -2,
+  SysTick_IRQn                 = -1,
+  DMA0_IRQn                    = 0,
+  DMA1_IRQn                    = 1,
+  DMA2_IRQn                    = 2,
+  DMA3_IRQn                    = 3,
+  Reserved20_IRQn              = 4,
+  FTFA_IRQn                    = 5,
+  PMC_IRQn                     = 6,
+  LLWU_IRQn                    = 7,
+  I2C0_IRQn                    = 8,
+  I2C1_IRQn                    = 9,
+  SPI0_IRQn                    = 10,
+  SPI1_IRQn                    = 11,
+  LPUART0_IRQn                 = 12,
+  LPUART1_IRQn                 = 13,
+  UART2_FLEXIO_IRQn            = 14,
+  ADC0_IRQn                    = 15,
+  CMP0_IRQn                    = 16,
+  TPM0_IRQn                    = 17,
+  TPM1_IRQn                    = 18,
+  TPM2_IRQn                    = 19,
+  RTC_IRQn                     = 20,
+  RTC_Seconds_IRQn             = 21,
+  PIT_IRQn                     = 22,
+  Reserved39_IRQn              = 23,
+  USB0_IRQn                    = 24,
+  Reserved41_IRQn              = 25,
+  Reserved42_IRQn              = 26,
+  Reserved43_IRQn              = 27,
+  LPTMR0_IRQn                  = 28,
+  Reserved45_IRQn              = 29,
+  PORTA_IRQn                   = 30,
+  PORTB_PORTC_PORTD_PORTE_IRQn = 31
+} IRQn_Type;
+
+#define NUMBER_OF_INT_VECTORS 48
+
+/* GPIO */
+typedef struct {
+  __IO uint32_t PDOR;
+  __O  uint32_t PSOR;
+  __O  uint32_t PCOR;
+  __O  uint32_t PTOR;
+  __IO uint32_t PDIR;       /* read-only on silicon, driven by the simulator */
+  __IO uint32_t PDDR;
+} GPIO_Type;
+
+/* PORT */
+typedef struct {
+  __IO uint32_t PCR[32];
+  __O  uint32_t GPCLR;
+  __O  uint32_t GPCHR;
+       uint8_t RESERVED_0[24];
+  __IO uint32_t ISFR;
+} PORT_Type;
+
+#define PORT_PCR_PS_MASK                         (0x1U)
+#define PORT_PCR_PS_SHIFT                        (0U)
+#define PORT_PCR_PS(x)                           (((uint32_t)(((uint32_t)(x)) << PORT_PCR_PS_SHIFT)) & PORT_PCR_PS_MASK)
+#define PORT_PCR_PE_MASK                         (0x2U)
+#define PORT_PCR_PE_SHIFT                        (1U)
+#define PORT_PCR_PE(x)                           (((uint32_t)(((uint32_t)(x)) << PORT_PCR_PE_SHIFT)) & PORT_PCR_PE_MASK)
+#define PORT_PCR_MUX_MASK                        (0x700U)
+#define PORT_PCR_MUX_SHIFT                       (8U)
+#define PORT_PCR_MUX(x)                          (((uint32_t)(((uint32_t)(x)) << PORT_PCR_MUX_SHIFT)) & PORT_PCR_MUX_MASK)
+#define PORT_PCR_IRQC_MASK                       (0xF0000U)
+#define PORT_PCR_IRQC_SHIFT                      (16U)
+#define PORT_PCR_IRQC(x)                         (((uint32_t)(((uint32_t)(x)) << PORT_PCR_IRQC_SHIFT)) & PORT_PCR_IRQC_MASK)
+#define PORT_PCR_ISF_MASK                        (0x1000000U)
+#define PORT_PCR_ISF_SHIFT                       (24U)
+#define PORT_PCR_ISF(x)                          (((uint32_t)(((uint32_t)(x)) << PORT_PCR_ISF_SHIFT)) & PORT_PCR_ISF_MASK)
+
+/* LPUART */
+typedef struct {
+  __IO uint32_t BAUD;
+  __IO uint32_t STAT;
+  __IO uint32_t CTRL;
+  __IO uint32_t DATA;
+  __IO uint32_t MATCH;
+} LPUART_Type;
+
+#define LPUART_STAT_OR_MASK                      (0x80000U)
+#define LPUART_STAT_RDRF_MASK                    (0x200000U)
+#define LPUART_STAT_TC_MASK                      (0x400000U)
+#define LPUART_STAT_TDRE_MASK                    (0x800000U)
+#define LPUART_STAT_IDLE_MASK                    (0x100000U)
+#define LPUART_CTRL_RE_MASK                      (0x40000U)
+#define LPUART_CTRL_TE_MASK                      (0x80000U)
+#define LPUART_CTRL_RIE_MASK                     (0x200000U)
+#define LPUART_CTRL_ORIE_MASK                    (0x8000000U)
+
+/* UART (UART2, debug console) */
+typedef struct {
+  __IO uint8_t BDH;
+  __IO uint8_t BDL;
+  __IO uint8_t C1;
+  __IO uint8_t C2;
+  __IO uint8_t S1;         /* read-only on silicon, driven by the simulator */
+  __IO uint8_t S2;
+  __IO uint8_t C3;
+  __IO uint8_t D;
+  __IO uint8_t C4;
+} UART_Type;
+
+#define UART_C2_RE_MASK                          (0x4U)
+#define UART_C2_TE_MASK                          (0x8U)
+#define UART_C2_RIE_MASK                         (0x20U)
+#define UART_S1_RDRF_MASK                        (0x20U)
+#define UART_S1_OR_MASK                          (0x8U)
+
+/* LPTMR */
+typedef struct {
+  __IO uint32_t CSR;
+  __IO uint32_t PSR;
+  __IO uint32_t CMR;
+  __IO uint32_t CNR;
+} LPTMR_Type;
+
+#define LPTMR_CSR_TEN_MASK                       (0x1U)
+#define LPTMR_CSR_TFC_MASK                       (0x4U)
+#define LPTMR_CSR_TIE_MASK                       (0x40U)
+#define LPTMR_CSR_TCF_MASK                       (0x80U)
+
+/* TPM */
+typedef struct {
+  __IO uint32_t SC;
+  __IO uint32_t CNT;
+  __IO uint32_t MOD;
+  struct {
+    __IO uint32_t CnSC;
+    __IO uint32_t CnV;
+  } CONTROLS[6];
+       uint8_t RESERVED_0[20];
+  __IO uint32_t STATUS;
+       uint8_t RESERVED_1[28];
+  __IO uint32_t POL;
+       uint8_t RESERVED_2[16];
+  __IO uint32_t CONF;
+} TPM_Type;
+
+#define TPM_SC_PS_MASK                           (0x7U)
+#define TPM_SC_PS_SHIFT                          (0U)
+#define TPM_SC_PS(x)                             (((uint32_t)(((uint32_t)(x)) << TPM_SC_PS_SHIFT)) & TPM_SC_PS_MASK)
+#define TPM_SC_CMOD_MASK                         (0x18U)
+#define TPM_SC_CMOD_SHIFT                        (3U)
+#define TPM_SC_CMOD(x)                           (((uint32_t)(((uint32_t)(x)) << TPM_SC_CMOD_SHIFT)) & TPM_SC_CMOD_MASK)
+#define TPM_SC_TOIE_MASK                         (0x40U)
+#define TPM_SC_TOF_MASK                          (0x80U)
+
+/* I2C */
+typedef struct {
+  __IO uint8_t A1;
+  __IO uint8_t F;
+  __IO uint8_t C1;
+  __IO uint8_t S;
+  __IO uint8_t D;
+  __IO uint8_t C2;
+  __IO uint8_t FLT;
+  __IO uint8_t RA;
+  __IO uint8_t SMB;
+  __IO uint8_t A2;
+  __IO uint8_t SLTH;
+  __IO uint8_t SLTL;
+  __IO uint8_t S2;
+} I2C_Type;
+
+#define I2C_C1_IICEN_MASK                        (0x80U)
+#define I2C_C1_MST_MASK                          (0x20U)
+
+/* SIM */
+typedef struct {
+  __IO uint32_t SOPT1;
+  __IO uint32_t SOPT2;
+  __IO uint32_t SOPT4;
+  __IO uint32_t SOPT5;
+  __IO uint32_t SOPT7;
+  __IO uint32_t SDID;      /* identification registers are set by the simulator */
+  __IO uint32_t SCGC4;
+  __IO uint32_t SCGC5;
+  __IO uint32_t SCGC6;
+  __IO uint32_t SCGC7;
+  __IO uint32_t CLKDIV1;
+  __IO uint32_t FCFG1;
+  __I  uint32_t FCFG2;
+  __IO uint32_t UIDMH;
+  __IO uint32_t UIDML;
+  __IO uint32_t UIDL;
+  __IO uint32_t COPC;
+  __O  uint32_t SRVCOP;
+} SIM_Type;
+
+#define SIM_SOPT2_CLKOUTSEL_MASK                 (0xE0U)
+#define SIM_SOPT2_CLKOUTSEL_SHIFT                (5U)
+#define SIM_SOPT2_CLKOUTSEL(x)                   (((uint32_t)(((uint32_t)(x)) << SIM_SOPT2_CLKOUTSEL_SHIFT)) & SIM_SOPT2_CLKOUTSEL_MASK)
+#define SIM_SOPT5_LPUART0TXSRC_MASK              (0x3U)
+#define SIM_SOPT5_LPUART0TXSRC_SHIFT             (0U)
+#define SIM_SOPT5_LPUART0TXSRC(x)                (((uint32_t)(((uint32_t)(x)) << SIM_SOPT5_LPUART0TXSRC_SHIFT)) & SIM_SOPT5_LPUART0TXSRC_MASK)
+#define SIM_SOPT5_LPUART0RXSRC_MASK              (0x4U)
+#define SIM_SOPT5_LPUART0RXSRC_SHIFT             (2U)
+#define SIM_SOPT5_LPUART0RXSRC(x)                (((uint32_t)(((uint32_t)(x)) << SIM_SOPT5_LPUART0RXSRC_SHIFT)) & SIM_SOPT5_LPUART0RXSRC_MASK)
+
+/* SMC */
+typedef struct {
+  __IO uint8_t PMPROT;
+  __IO uint8_t PMCTRL;
+  __IO uint8_t STOPCTRL;
+  __I  uint8_t PMSTAT;
+} SMC_Type;
+
+/* CRC */
+typedef struct {
+  __IO uint32_t DATA;
+  __IO uint32_t GPOLY;
+  __IO uint32_t CTRL;
+} CRC_Type;
+
+/* Cortex-M0+ SysTick */
+typedef struct {
+  __IO uint32_t CTRL;
+  __IO uint32_t LOAD;
+  __IO uint32_t VAL;
+  __I  uint32_t CALIB;
+} SysTick_Type;
+
+#define SysTick_CTRL_COUNTFLAG_Msk         (1UL << 16U)
+#define SysTick_CTRL_CLKSOURCE_Msk         (1UL << 2U)
+#define SysTick_CTRL_TICKINT_Msk           (1UL << 1U)
+#define SysTick_CTRL_ENABLE_Msk            (1UL)
+#define SysTick_LOAD_RELOAD_Msk            (0xFFFFFFUL)
+
+/* Cortex-M0+ System Control Block (SysTick pending, vector table and sleep control only) */
+typedef struct {
+  __IO uint32_t ICSR;
+  __IO uintptr_t VTOR;      /* host address of the vector table */
+  __IO uint32_t SCR;
+} SCB_Type;
+
+#define SCB_ICSR_PENDSTSET_Msk             (1UL << 26U)
+#define SCB_SCR_SLEEPDEEP_Msk              (1UL << 2U)
+
+#define SMC_PMCTRL_STOPM_MASK                    (0x7U)
+#define SMC_PMCTRL_STOPA_MASK                    (0x8U)
+#define SMC_PMCTRL_RUNM_MASK                     (0x60U)
+#define TPM_CnSC_ELSB_MASK                       (0x8U)
+#define TPM_CnSC_MSB_MASK                        (0x20U)
+
+/* Peripheral instances (defined in sim_hal.c) */
+extern GPIO_Type    g_hostGPIOA, g_hostGPIOB, g_hostGPIOC, g_hostGPIOD, g_hostGPIOE;
+extern PORT_Type    g_hostPORTA, g_hostPORTB, g_hostPORTC, g_hostPORTD, g_hostPORTE;
+extern LPUART_Type  g_hostLPUART0, g_hostLPUART1;
+extern UART_Type    g_hostUART2;
+extern LPTMR_Type   g_hostLPTMR0;
+extern TPM_Type     g_hostTPM0;
+extern I2C_Type     g_hostI2C0;
+extern SIM_Type     g_hostSIM;
+extern SMC_Type     g_hostSMC;
+extern CRC_Type     g_hostCRC0;
+extern SysTick_Type g_hostSysTick;
+extern SCB_Type     g_hostSCB;
+
+#define GPIOA       (&g_hostGPIOA)
+#define GPIOB       (&g_hostGPIOB)
+#define GPIOC       (&g_hostGPIOC)
+#define GPIOD       (&g_hostGPIOD)
+#define GPIOE       (&g_hostGPIOE)
+#define PORTA       (&g_hostPORTA)
+#define PORTB       (&g_hostPORTB)
+#define PORTC       (&g_hostPORTC)
+#define PORTD       (&g_hostPORTD)
+#define PORTE       (&g_hostPORTE)
+#define LPUART0     (&g_hostLPUART0)
+#define LPUART1     (&g_hostLPUART1)
+#define UART2       (&g_hostUART2)
+#define UART2_BASE  ((uint32_t)2U)  /* debug console instance tag, never dereferenced */
+#define LPTMR0      (&g_hostLPTMR0)
+#define TPM0        (&g_hostTPM0)
+#define I2C0        (&g_hostI2C0)
+#define SIM         (&g_hostSIM)
+#define SMC         (&g_hostSMC)
+#define CRC0        (&g_hostCRC0)
+#define SysTick     (&g_hostSysTick)
+#define SCB         (&g_hostSCB)
+
+/* CMSIS core functions, implemented by the simulator */
+extern uint32_t SystemCoreClock;
+
+void __disable_irq(void);
+void __enable_irq(void);
+void __WFI(void);
+void __DSB(void);
+void __ISB(void);
+void __NOP(void);
+void NVIC_EnableIRQ(IRQn_Type IRQn);
+void NVIC_DisableIRQ(IRQn_Type IRQn);
+uint32_t NVIC_GetEnableIRQ(IRQn_Type IRQn);
+void NVIC_SetPendingIRQ(IRQn_Type IRQn);
+void NVIC_ClearPendingIRQ(IRQn_Type IRQn);
+void NVIC_SetPriority(IRQn_Type IRQn, uint32_t priority);
+uint32_t SysTick_Config(uint32_t ticks);
+void NVIC_SystemReset(void) __attribute__((noreturn));
+
+/* Called from firmware wait loops (KL_IDLE) to let virtual time advance */
+void HOST_Idle(void);
+#define KL_IDLE()	HOST_Idle()
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif /* _MKL27Z644_H_ */
@@ -0,0 +1,14 @@
+/*
+ * Host simulation stand-in for the MCUXpresso cr_section_macros.h.
+ *
+ * Functions placed in RAM with __RAMFUNC() land in the host "ramfunc" section,
+ * so the simulator can tell whether a handler could run while a flash command
+ * stalls fetches from flash (see SIM_Deliver()).
+ */
+
+#ifndef __CR_SECTION_MACROS_H__
+#define __CR_SECTION_MACROS_H__
+
+#define __RAMFUNC(bank)		__attribute__((section("ramfunc"), noinline))
+
+#endif /* __CR_SECTION_MACROS_H__ */
@@ -0,0 +1,79 @@
+/*
+ * Host simulation stand-in for the SDK fsl_clock.h.
+ */
+
+#ifndef _FSL_CLOCK_H_
+#define _FSL_CLOCK_H_
+
+#include "fsl_common.h"
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+#define SYS_CLK kCLOCK_CoreSysClk
+#define BUS_CLK kCLOCK_BusClk
+
+#define I2C0_CLK_SRC SYS_CLK
+#define I2C1_CLK_SRC SYS_CLK
+#define UART2_CLK_SRC BUS_CLK
+
+typedef enum _clock_name
+{
+    kCLOCK_CoreSysClk,
+    kCLOCK_PlatClk,
+    kCLOCK_BusClk,
+    kCLOCK_FlashClk,
+    kCLOCK_Er32kClk,
+    kCLOCK_Osc0ErClk,
+    kCLOCK_McgIrc48MClk,
+    kCLOCK_McgPeriphClk,
+    kCLOCK_McgInternalRefClk,
+    kCLOCK_LpoClk,
+} clock_name_t;
+
+typedef enum _clock_ip_name
+{
+    kCLOCK_IpInvalid = 0U,
+    kCLOCK_PortA,
+    kCLOCK_PortB,
+    kCLOCK_PortC,
+    kCLOCK_PortD,
+    kCLOCK_PortE,
+    kCLOCK_Lpuart0,
+    kCLOCK_Uart2,
+    kCLOCK_I2c0,
+    kCLOCK_Tpm0,
+    kCLOCK_Lptmr0,
+    kCLOCK_Crc0,
+    kCLOCK_Pit0,
+    kCLOCK_Ftf0,
+} clock_ip_name_t;
+
+/* Clock configuration structures referenced by board/clock_config.h */
+typedef struct _mcglite_config
+{
+    uint8_t outSrc;
+} mcglite_config_t;
+
+typedef struct _sim_clock_config
+{
+    uint8_t er32kSrc;
+    uint32_t clkdiv1;
+} sim_clock_config_t;
+
+typedef struct _osc_config
+{
+    uint32_t freq;
+} osc_config_t;
+
+uint32_t CLOCK_GetFreq(clock_name_t clockName);
+void CLOCK_EnableClock(clock_ip_name_t name);
+void CLOCK_DisableClock(clock_ip_name_t name);
+void CLOCK_SetClkOutClock(uint32_t src);
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif /* _FSL_CLOCK_H_ */
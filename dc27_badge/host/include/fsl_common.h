@@ -0,0 +1,89 @@
+/*
+ * Host simulation stand-in for the SDK fsl_common.h.
+ *
+ * Provides the status codes and interrupt helpers used by the firmware. The
+ * remaining SDK driver headers in this directory follow the same pattern: the
+ * public types and prototypes match the SDK 2.4.1 drivers, and the bodies are
+ * implemented against simulated peripherals in sim_hal.c.
+ */
+
+#ifndef _FSL_COMMON_H_
+#define _FSL_COMMON_H_
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "fsl_device_registers.h"
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+typedef int32_t status_t;
+
+#define MAKE_STATUS(group, code) ((((group)*100) + (code)))
+#define MAKE_VERSION(major, minor, bugfix) (((major) << 16) | ((minor) << 8) | (bugfix))
+
+#define DEBUG_CONSOLE_DEVICE_TYPE_UART          1U
+
+enum _status_groups
+{
+    kStatusGroup_Generic = 0,
+    kStatusGroup_FLASH = 1,
+    kStatusGroup_I2C = 11,
+    kStatusGroup_LPUART = 13,
+    kStatusGroup_UART = 10,
+    kStatusGroup_LPTMR = 43,
+    kStatusGroupGeneric = 0,
+    kStatusGroupFtfxDriver = 1,
+};
+
+enum _generic_status
+{
+    kStatus_Success = MAKE_STATUS(kStatusGroup_Generic, 0),
+    kStatus_Fail = MAKE_STATUS(kStatusGroup_Generic, 1),
+    kStatus_ReadOnly = MAKE_STATUS(kStatusGroup_Generic, 2),
+    kStatus_OutOfRange = MAKE_STATUS(kStatusGroup_Generic, 3),
+    kStatus_InvalidArgument = MAKE_STATUS(kStatusGroup_Generic, 4),
+    kStatus_Timeout = MAKE_STATUS(kStatusGroup_Generic, 5),
+    kStatus_NoTransferInProgress = MAKE_STATUS(kStatusGroup_Generic, 6),
+};
+
+#ifndef ARRAY_SIZE
+#define ARRAY_SIZE(x) (sizeof(x) / sizeof((x)[0]))
+#endif
+
+static inline status_t EnableIRQ(IRQn_Type interrupt)
+{
+    if (NotAvail_IRQn == interrupt)
+    {
+        return kStatus_Fail;
+    }
+    NVIC_EnableIRQ(interrupt);
+    return kStatus_Success;
+}
+
+static inline status_t DisableIRQ(IRQn_Type interrupt)
+{
+    if (NotAvail_IRQn == interrupt)
+    {
+        return kStatus_Fail;
+    }
+    NVIC_DisableIRQ(interrupt);
+    return kStatus_Success;
+}
+
+uint32_t DisableGlobalIRQ(void);
+void EnableGlobalIRQ(uint32_t primask);
+
+#if defined(__cplusplus)
+}
+#endif
+
+#include "fsl_clock.h"
+
+#endif /* _FSL_COMMON_H_ */
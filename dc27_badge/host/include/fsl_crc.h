@@ -0,0 +1,55 @@
+/*
+ * Host simulation stand-in for the SDK fsl_crc.h.
+ *
+ * The checksum is computed bit by bit as data is written, like the CRC module
+ * does, and is ready at once (the module takes a bus cycle per write).
+ */
+
+#ifndef _FSL_CRC_H_
+#define _FSL_CRC_H_
+
+#include "fsl_common.h"
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+typedef enum _crc_bits
+{
+    kCrcBits16 = 0U,
+    kCrcBits32 = 1U,
+} crc_bits_t;
+
+typedef enum _crc_result
+{
+    kCrcFinalChecksum = 0U,
+    kCrcIntermediateChecksum = 1U,
+} crc_result_t;
+
+typedef struct _crc_config
+{
+    uint32_t polynomial;
+    uint32_t seed;
+    bool reflectIn;
+    bool reflectOut;
+    bool complementChecksum;
+    crc_bits_t crcBits;
+    crc_result_t crcResult;
+} crc_config_t;
+
+void CRC_Init(CRC_Type *base, const crc_config_t *config);
+void CRC_GetDefaultConfig(crc_config_t *config);
+void CRC_WriteData(CRC_Type *base, const uint8_t *data, size_t dataSize);
+uint32_t CRC_Get32bitResult(CRC_Type *base);
+uint16_t CRC_Get16bitResult(CRC_Type *base);
+
+static inline void CRC_Deinit(CRC_Type *base)
+{
+    (void)base;
+}
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif /* _FSL_CRC_H_ */
@@ -0,0 +1,38 @@
+/*
+ * Host simulation stand-in for the SDK fsl_debug_console.h.
+ *
+ * PRINTF output is timed as UART2 traffic at the console baud rate and echoed
+ * to the host's stdout. GETCHAR blocks in virtual time until the simulated
+ * host sends a character.
+ */
+
+#ifndef _FSL_DEBUGCONSOLE_H_
+#define _FSL_DEBUGCONSOLE_H_
+
+#include "fsl_common.h"
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+#define DEBUG_CONSOLE_DEVICE_TYPE_NONE 0U
+#define DEBUG_CONSOLE_DEVICE_TYPE_UART 1U
+#define DEBUG_CONSOLE_DEVICE_TYPE_LPUART 2U
+
+#define PRINTF DbgConsole_Printf
+#define SCANF DbgConsole_Scanf
+#define PUTCHAR DbgConsole_Putchar
+#define GETCHAR DbgConsole_Getchar
+
+status_t DbgConsole_Init(uint32_t baseAddr, uint32_t baudRate, uint8_t device, uint32_t clkSrcFreq);
+status_t DbgConsole_Deinit(void);
+int DbgConsole_Printf(const char *fmt_s, ...);
+int DbgConsole_Putchar(int ch);
+int DbgConsole_Getchar(void);
+status_t DbgConsole_Flush(void);
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif /* _FSL_DEBUGCONSOLE_H_ */
@@ -0,0 +1,10 @@
+/*
+ * Host simulation stand-in for fsl_device_registers.h.
+ */
+
+#ifndef __FSL_DEVICE_REGISTERS_H__
+#define __FSL_DEVICE_REGISTERS_H__
+
+#include "MKL27Z644.h"
+
+#endif /* __FSL_DEVICE_REGISTERS_H__ */
@@ -0,0 +1,93 @@
+/*
+ * Host simulation stand-in for the SDK fsl_flash.h (FTFA program flash).
+ *
+ * The program flash array is mapped at a fixed low host address so that the
+ * 32-bit addresses the firmware computes can be dereferenced directly.
+ * Erase and program commands take their typical datasheet execution time in
+ * virtual time and obey NOR semantics (programming can only clear bits).
+ */
+
+#ifndef _FSL_FLASH_H_
+#define _FSL_FLASH_H_
+
+#include "fsl_common.h"
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+enum _ftfx_status
+{
+    kStatus_FTFx_Success = MAKE_STATUS(kStatusGroupGeneric, 0),
+    kStatus_FTFx_InvalidArgument = MAKE_STATUS(kStatusGroupGeneric, 4),
+    kStatus_FTFx_SizeError = MAKE_STATUS(kStatusGroupFtfxDriver, 0),
+    kStatus_FTFx_AlignmentError = MAKE_STATUS(kStatusGroupFtfxDriver, 1),
+    kStatus_FTFx_AddressError = MAKE_STATUS(kStatusGroupFtfxDriver, 2),
+    kStatus_FTFx_AccessError = MAKE_STATUS(kStatusGroupFtfxDriver, 3),
+    kStatus_FTFx_ProtectionViolation = MAKE_STATUS(kStatusGroupFtfxDriver, 4),
+    kStatus_FTFx_CommandFailure = MAKE_STATUS(kStatusGroupFtfxDriver, 5),
+    kStatus_FTFx_UnknownProperty = MAKE_STATUS(kStatusGroupFtfxDriver, 6),
+    kStatus_FTFx_EraseKeyError = MAKE_STATUS(kStatusGroupFtfxDriver, 7),
+};
+
+enum _ftfx_driver_api_keys
+{
+    kFTFx_ApiEraseKey = 0x6B65666BU,
+};
+
+typedef enum _ftfx_security_state
+{
+    kFTFx_SecurityStateNotSecure = 0xc33cc33cU,
+    kFTFx_SecurityStateBackdoorEnabled = 0x5aa55aa5U,
+    kFTFx_SecurityStateBackdoorDisabled = 0x5ac33ca5U,
+} ftfx_security_state_t;
+
+typedef enum _ftfx_margin_value
+{
+    kFTFx_MarginValueNormal,
+    kFTFx_MarginValueUser,
+    kFTFx_MarginValueFactory,
+} ftfx_margin_value_t;
+
+typedef enum _flash_property_tag
+{
+    kFLASH_PropertyPflash0SectorSize = 0x00U,
+    kFLASH_PropertyPflash0TotalSize = 0x01U,
+    kFLASH_PropertyPflash0BlockSize = 0x02U,
+    kFLASH_PropertyPflash0BlockCount = 0x03U,
+    kFLASH_PropertyPflash0BlockBaseAddr = 0x04U,
+} flash_property_tag_t;
+
+typedef struct _flash_config
+{
+    uint32_t blockBase;
+    uint32_t totalSize;
+    uint32_t sectorSize;
+} flash_config_t;
+
+typedef struct _ftfx_cache_config
+{
+    uint32_t reserved;
+} ftfx_cache_config_t;
+
+status_t FLASH_Init(flash_config_t *config);
+status_t FLASH_Erase(flash_config_t *config, uint32_t start, uint32_t lengthInBytes, uint32_t key);
+status_t FLASH_Program(flash_config_t *config, uint32_t start, uint8_t *src, uint32_t lengthInBytes);
+status_t FLASH_VerifyProgram(flash_config_t *config,
+                             uint32_t start,
+                             uint32_t lengthInBytes,
+                             const uint8_t *expectedData,
+                             ftfx_margin_value_t margin,
+                             uint32_t *failedAddress,
+                             uint32_t *failedData);
+status_t FLASH_VerifyErase(flash_config_t *config, uint32_t start, uint32_t lengthInBytes, ftfx_margin_value_t margin);
+status_t FLASH_GetSecurityState(flash_config_t *config, ftfx_security_state_t *state);
+status_t FLASH_GetProperty(flash_config_t *config, flash_property_tag_t whichProperty, uint32_t *value);
+status_t FTFx_CACHE_Init(ftfx_cache_config_t *config);
+status_t FTFx_CACHE_ClearCachePrefetchSpeculation(ftfx_cache_config_t *config, bool isPreProcess);
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif /* _FSL_FLASH_H_ */
@@ -0,0 +1,58 @@
+/*
+ * Host simulation stand-in for the SDK fsl_gpio.h.
+ *
+ * Output writes are reported to the simulator so that attached device models
+ * see pin edges (NXH_UPDATE, NXH_nRESET, LED_EN, ...).
+ */
+
+#ifndef _FSL_GPIO_H_
+#define _FSL_GPIO_H_
+
+#include "fsl_common.h"
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+typedef enum _gpio_pin_direction
+{
+    kGPIO_DigitalInput = 0U,
+    kGPIO_DigitalOutput = 1U,
+} gpio_pin_direction_t;
+
+typedef struct _gpio_pin_config
+{
+    gpio_pin_direction_t pinDirection;
+    uint8_t outputLogic;
+} gpio_pin_config_t;
+
+void GPIO_PinInit(GPIO_Type *base, uint32_t pin, const gpio_pin_config_t *config);
+void GPIO_PinWrite(GPIO_Type *base, uint32_t pin, uint8_t output);
+uint32_t GPIO_PortGetInterruptFlags(GPIO_Type *base);
+void GPIO_PortClearInterruptFlags(GPIO_Type *base, uint32_t mask);
+
+static inline uint32_t GPIO_PinRead(GPIO_Type *base, uint32_t pin)
+{
+    return (((base->PDIR) >> pin) & 0x01U);
+}
+
+static inline void GPIO_WritePinOutput(GPIO_Type *base, uint32_t pin, uint8_t output)
+{
+    GPIO_PinWrite(base, pin, output);
+}
+
+static inline uint32_t GPIO_GetPinsInterruptFlags(GPIO_Type *base)
+{
+    return GPIO_PortGetInterruptFlags(base);
+}
+
+static inline void GPIO_ClearPinsInterruptFlags(GPIO_Type *base, uint32_t mask)
+{
+    GPIO_PortClearInterruptFlags(base, mask);
+}
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif /* _FSL_GPIO_H_ */
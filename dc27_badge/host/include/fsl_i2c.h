@@ -0,0 +1,69 @@
+/*
+ * Host simulation stand-in for the SDK fsl_i2c.h.
+ *
+ * Blocking transfers are routed to the device model attached at the slave
+ * address and take the bus time of the bytes on the wire at the configured
+ * baud rate.
+ */
+
+#ifndef _FSL_I2C_H_
+#define _FSL_I2C_H_
+
+#include "fsl_common.h"
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+enum _i2c_status
+{
+    kStatus_I2C_Busy = MAKE_STATUS(kStatusGroup_I2C, 0),
+    kStatus_I2C_Idle = MAKE_STATUS(kStatusGroup_I2C, 1),
+    kStatus_I2C_Nak = MAKE_STATUS(kStatusGroup_I2C, 2),
+    kStatus_I2C_ArbitrationLost = MAKE_STATUS(kStatusGroup_I2C, 3),
+    kStatus_I2C_Timeout = MAKE_STATUS(kStatusGroup_I2C, 4),
+    kStatus_I2C_Addr_Nak = MAKE_STATUS(kStatusGroup_I2C, 5),
+};
+
+typedef enum _i2c_direction
+{
+    kI2C_Write = 0x0U,
+    kI2C_Read = 0x1U,
+} i2c_direction_t;
+
+enum _i2c_master_transfer_flags
+{
+    kI2C_TransferDefaultFlag = 0x0U,
+    kI2C_TransferNoStartFlag = 0x1U,
+    kI2C_TransferRepeatedStartFlag = 0x2U,
+    kI2C_TransferNoStopFlag = 0x4U,
+};
+
+typedef struct _i2c_master_config
+{
+    bool enableMaster;
+    bool enableStopHold;
+    uint32_t baudRate_Bps;
+    uint8_t glitchFilterWidth;
+} i2c_master_config_t;
+
+typedef struct _i2c_master_transfer
+{
+    uint32_t flags;
+    uint8_t slaveAddress;
+    i2c_direction_t direction;
+    uint32_t subaddress;
+    uint8_t subaddressSize;
+    uint8_t *volatile data;
+    volatile size_t dataSize;
+} i2c_master_transfer_t;
+
+void I2C_MasterInit(I2C_Type *base, const i2c_master_config_t *masterConfig, uint32_t srcClock_Hz);
+void I2C_MasterDeinit(I2C_Type *base);
+status_t I2C_MasterTransferBlocking(I2C_Type *base, i2c_master_transfer_t *xfer);
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif /* _FSL_I2C_H_ */
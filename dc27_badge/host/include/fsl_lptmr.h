@@ -0,0 +1,86 @@
+/*
+ * Host simulation stand-in for the SDK fsl_lptmr.h.
+ *
+ * The timer counts at LPTMR0_CLK_FREQ (1 kHz) in virtual time and keeps
+ * running in VLPS, so it can wake the core from KL_Sleep().
+ */
+
+#ifndef _FSL_LPTMR_H_
+#define _FSL_LPTMR_H_
+
+#include "fsl_common.h"
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+typedef enum _lptmr_pin_select
+{
+    kLPTMR_PinSelectInput_0 = 0x0U,
+    kLPTMR_PinSelectInput_1 = 0x1U,
+    kLPTMR_PinSelectInput_2 = 0x2U,
+    kLPTMR_PinSelectInput_3 = 0x3U,
+} lptmr_pin_select_t;
+
+typedef enum _lptmr_pin_polarity
+{
+    kLPTMR_PinPolarityActiveHigh = 0x0U,
+    kLPTMR_PinPolarityActiveLow = 0x1U,
+} lptmr_pin_polarity_t;
+
+typedef enum _lptmr_timer_mode
+{
+    kLPTMR_TimerModeTimeCounter = 0x0U,
+    kLPTMR_TimerModePulseCounter = 0x1U,
+} lptmr_timer_mode_t;
+
+typedef enum _lptmr_prescaler_glitch_value
+{
+    kLPTMR_Prescale_Glitch_0 = 0x0U,
+} lptmr_prescaler_glitch_value_t;
+
+typedef enum _lptmr_prescaler_clock_select
+{
+    kLPTMR_PrescalerClock_0 = 0x0U,
+    kLPTMR_PrescalerClock_1 = 0x1U,
+    kLPTMR_PrescalerClock_2 = 0x2U,
+    kLPTMR_PrescalerClock_3 = 0x3U,
+} lptmr_prescaler_clock_select_t;
+
+typedef enum _lptmr_interrupt_enable
+{
+    kLPTMR_TimerInterruptEnable = LPTMR_CSR_TIE_MASK,
+} lptmr_interrupt_enable_t;
+
+typedef enum _lptmr_status_flags
+{
+    kLPTMR_TimerCompareFlag = LPTMR_CSR_TCF_MASK,
+} lptmr_status_flags_t;
+
+typedef struct _lptmr_config
+{
+    lptmr_timer_mode_t timerMode;
+    lptmr_pin_select_t pinSelect;
+    lptmr_pin_polarity_t pinPolarity;
+    bool enableFreeRunning;
+    bool bypassPrescaler;
+    lptmr_prescaler_clock_select_t prescalerClockSource;
+    lptmr_prescaler_glitch_value_t value;
+} lptmr_config_t;
+
+void LPTMR_Init(LPTMR_Type *base, const lptmr_config_t *config);
+void LPTMR_Deinit(LPTMR_Type *base);
+void LPTMR_EnableInterrupts(LPTMR_Type *base, uint32_t mask);
+void LPTMR_DisableInterrupts(LPTMR_Type *base, uint32_t mask);
+uint32_t LPTMR_GetStatusFlags(LPTMR_Type *base);
+void LPTMR_ClearStatusFlags(LPTMR_Type *base, uint32_t mask);
+void LPTMR_SetTimerPeriod(LPTMR_Type *base, uint32_t ticks);
+uint32_t LPTMR_GetCurrentTimerCount(LPTMR_Type *base);
+void LPTMR_StartTimer(LPTMR_Type *base);
+void LPTMR_StopTimer(LPTMR_Type *base);
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif /* _FSL_LPTMR_H_ */
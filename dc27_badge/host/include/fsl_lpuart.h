@@ -0,0 +1,97 @@
+/*
+ * Host simulation stand-in for the SDK fsl_lpuart.h.
+ *
+ * LPUART0 has a single-byte receive data register on the KL27: a byte that
+ * arrives while RDRF is still set is lost and raises the overrun flag, just as
+ * on silicon.
+ */
+
+#ifndef _FSL_LPUART_H_
+#define _FSL_LPUART_H_
+
+#include "fsl_common.h"
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+enum _lpuart_status
+{
+    kStatus_LPUART_TxBusy = MAKE_STATUS(kStatusGroup_LPUART, 0),
+    kStatus_LPUART_RxBusy = MAKE_STATUS(kStatusGroup_LPUART, 1),
+    kStatus_LPUART_FlagCannotClearManually = MAKE_STATUS(kStatusGroup_LPUART, 6),
+    kStatus_LPUART_RxHardwareOverrun = MAKE_STATUS(kStatusGroup_LPUART, 8),
+};
+
+typedef enum _lpuart_parity_mode
+{
+    kLPUART_ParityDisabled = 0x0U,
+    kLPUART_ParityEven = 0x2U,
+    kLPUART_ParityOdd = 0x3U,
+} lpuart_parity_mode_t;
+
+typedef enum _lpuart_data_bits
+{
+    kLPUART_EightDataBits = 0x0U,
+} lpuart_data_bits_t;
+
+typedef enum _lpuart_stop_bit_count
+{
+    kLPUART_OneStopBit = 0U,
+    kLPUART_TwoStopBit = 1U,
+} lpuart_stop_bit_count_t;
+
+typedef enum _lpuart_idle_type_select
+{
+    kLPUART_IdleTypeStartBit = 0U,
+    kLPUART_IdleTypeStopBit = 1U,
+} lpuart_idle_type_select_t;
+
+typedef enum _lpuart_idle_config
+{
+    kLPUART_IdleCharacter1 = 0U,
+} lpuart_idle_config_t;
+
+enum _lpuart_interrupt_enable
+{
+    kLPUART_RxDataRegFullInterruptEnable = (LPUART_CTRL_RIE_MASK),
+    kLPUART_RxOverrunInterruptEnable = (LPUART_CTRL_ORIE_MASK),
+};
+
+enum _lpuart_flags
+{
+    kLPUART_TxDataRegEmptyFlag = (LPUART_STAT_TDRE_MASK),
+    kLPUART_TransmissionCompleteFlag = (LPUART_STAT_TC_MASK),
+    kLPUART_RxDataRegFullFlag = (LPUART_STAT_RDRF_MASK),
+    kLPUART_RxOverrunFlag = (LPUART_STAT_OR_MASK),
+};
+
+typedef struct _lpuart_config
+{
+    uint32_t baudRate_Bps;
+    lpuart_parity_mode_t parityMode;
+    lpuart_data_bits_t dataBitsCount;
+    bool isMsb;
+    lpuart_stop_bit_count_t stopBitCount;
+    lpuart_idle_type_select_t rxIdleType;
+    lpuart_idle_config_t rxIdleConfig;
+    bool enableTx;
+    bool enableRx;
+} lpuart_config_t;
+
+status_t LPUART_Init(LPUART_Type *base, const lpuart_config_t *config, uint32_t srcClock_Hz);
+void LPUART_Deinit(LPUART_Type *base);
+uint32_t LPUART_GetStatusFlags(LPUART_Type *base);
+status_t LPUART_ClearStatusFlags(LPUART_Type *base, uint32_t mask);
+void LPUART_EnableInterrupts(LPUART_Type *base, uint32_t mask);
+void LPUART_DisableInterrupts(LPUART_Type *base, uint32_t mask);
+uint32_t LPUART_GetEnabledInterrupts(LPUART_Type *base);
+uint8_t LPUART_ReadByte(LPUART_Type *base);
+void LPUART_WriteByte(LPUART_Type *base, uint8_t data);
+void LPUART_WriteBlocking(LPUART_Type *base, const uint8_t *data, size_t length);
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif /* _FSL_LPUART_H_ */
@@ -0,0 +1,52 @@
+/*
+ * Host simulation stand-in for the SDK fsl_smc.h.
+ *
+ * Entering a low-power mode advances virtual time to the next wake-up source
+ * instead of stopping the core.
+ */
+
+#ifndef _FSL_SMC_H_
+#define _FSL_SMC_H_
+
+#include "fsl_common.h"
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+typedef enum _smc_power_mode_protection
+{
+    kSMC_AllowPowerModeVlls = 0x2U,
+    kSMC_AllowPowerModeLls = 0x8U,
+    kSMC_AllowPowerModeVlp = 0x20U,
+    kSMC_AllowPowerModeAll = 0x2AU,
+} smc_power_mode_protection_t;
+
+typedef enum _smc_power_state
+{
+    kSMC_PowerStateRun = 0x01U,
+    kSMC_PowerStateStop = 0x02U,
+    kSMC_PowerStateVlpr = 0x04U,
+    kSMC_PowerStateVlpw = 0x08U,
+    kSMC_PowerStateVlps = 0x10U,
+} smc_power_state_t;
+
+static inline void SMC_SetPowerModeProtection(SMC_Type *base, uint8_t allowedModes)
+{
+    base->PMPROT = allowedModes;
+}
+
+smc_power_state_t SMC_GetPowerModeState(SMC_Type *base);
+void SMC_PreEnterStopModes(void);
+void SMC_PostExitStopModes(void);
+void SMC_PreEnterWaitModes(void);
+void SMC_PostExitWaitModes(void);
+status_t SMC_SetPowerModeRun(SMC_Type *base);
+status_t SMC_SetPowerModeWait(SMC_Type *base);
+status_t SMC_SetPowerModeVlps(SMC_Type *base);
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif /* _FSL_SMC_H_ */
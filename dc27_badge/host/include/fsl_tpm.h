@@ -0,0 +1,120 @@
+/*
+ * Host simulation stand-in for the SDK fsl_tpm.h.
+ */
+
+#ifndef _FSL_TPM_H_
+#define _FSL_TPM_H_
+
+#include "fsl_common.h"
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+typedef enum _tpm_chnl
+{
+    kTPM_Chnl_0 = 0U,
+    kTPM_Chnl_1,
+    kTPM_Chnl_2,
+    kTPM_Chnl_3,
+    kTPM_Chnl_4,
+    kTPM_Chnl_5,
+} tpm_chnl_t;
+
+typedef enum _tpm_pwm_mode
+{
+    kTPM_EdgeAlignedPwm = 0U,
+    kTPM_CenterAlignedPwm,
+} tpm_pwm_mode_t;
+
+typedef enum _tpm_pwm_level_select
+{
+    kTPM_NoPwmSignal = 0U,
+    kTPM_LowTrue,
+    kTPM_HighTrue,
+} tpm_pwm_level_select_t;
+
+typedef enum _tpm_trigger_select
+{
+    kTPM_Trigger_Select_0 = 0U,
+} tpm_trigger_select_t;
+
+typedef enum _tpm_trigger_source
+{
+    kTPM_TriggerSource_External = 0U,
+    kTPM_TriggerSource_Internal,
+} tpm_trigger_source_t;
+
+typedef enum _tpm_clock_source
+{
+    kTPM_SystemClock = 1U,
+    kTPM_ExternalClock,
+} tpm_clock_source_t;
+
+typedef enum _tpm_clock_prescale
+{
+    kTPM_Prescale_Divide_1 = 0U,
+    kTPM_Prescale_Divide_2,
+    kTPM_Prescale_Divide_4,
+    kTPM_Prescale_Divide_8,
+    kTPM_Prescale_Divide_16,
+    kTPM_Prescale_Divide_32,
+    kTPM_Prescale_Divide_64,
+    kTPM_Prescale_Divide_128,
+} tpm_clock_prescale_t;
+
+typedef enum _tpm_interrupt_enable
+{
+    kTPM_TimeOverflowInterruptEnable = (1U << 8),
+} tpm_interrupt_enable_t;
+
+typedef enum _tpm_status_flags
+{
+    kTPM_TimeOverflowFlag = (1U << 8),
+} tpm_status_flags_t;
+
+typedef struct _tpm_chnl_pwm_signal_param
+{
+    tpm_chnl_t chnlNumber;
+    tpm_pwm_level_select_t level;
+    uint8_t dutyCyclePercent;
+} tpm_chnl_pwm_signal_param_t;
+
+typedef struct _tpm_config
+{
+    tpm_clock_prescale_t prescale;
+    bool useGlobalTimeBase;
+    tpm_trigger_select_t triggerSelect;
+    tpm_trigger_source_t triggerSource;
+    bool enableDoze;
+    bool enableDebugMode;
+    bool enableReloadOnTrigger;
+    bool enableStopOnOverflow;
+    bool enableStartOnTrigger;
+    bool enablePauseOnTrigger;
+} tpm_config_t;
+
+void TPM_Init(TPM_Type *base, const tpm_config_t *config);
+void TPM_Deinit(TPM_Type *base);
+status_t TPM_SetupPwm(TPM_Type *base,
+                      const tpm_chnl_pwm_signal_param_t *chnlParams,
+                      uint8_t numOfChnls,
+                      tpm_pwm_mode_t mode,
+                      uint32_t pwmFreq_Hz,
+                      uint32_t srcClock_Hz);
+void TPM_UpdatePwmDutycycle(TPM_Type *base,
+                            tpm_chnl_t chnlNumber,
+                            tpm_pwm_mode_t currentPwmMode,
+                            uint8_t dutyCyclePercent);
+void TPM_EnableInterrupts(TPM_Type *base, uint32_t mask);
+void TPM_DisableInterrupts(TPM_Type *base, uint32_t mask);
+uint32_t TPM_GetStatusFlags(TPM_Type *base);
+void TPM_ClearStatusFlags(TPM_Type *base, uint32_t mask);
+void TPM_StartTimer(TPM_Type *base, tpm_clock_source_t clockSource);
+void TPM_StopTimer(TPM_Type *base);
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif /* _FSL_TPM_H_ */
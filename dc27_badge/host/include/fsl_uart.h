@@ -0,0 +1,60 @@
+/*
+ * Host simulation stand-in for the SDK fsl_uart.h (UART2, host console).
+ */
+
+#ifndef _FSL_UART_H_
+#define _FSL_UART_H_
+
+#include "fsl_common.h"
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+typedef enum _uart_parity_mode
+{
+    kUART_ParityDisabled = 0x0U,
+    kUART_ParityEven = 0x2U,
+    kUART_ParityOdd = 0x3U,
+} uart_parity_mode_t;
+
+typedef enum _uart_idle_type_select
+{
+    kUART_IdleTypeStartBit = 0U,
+    kUART_IdleTypeStopBit = 1U,
+} uart_idle_type_select_t;
+
+enum _uart_interrupt_enable
+{
+    kUART_RxDataRegFullInterruptEnable = (UART_C2_RIE_MASK),
+};
+
+enum _uart_flags
+{
+    kUART_RxDataRegFullFlag = (UART_S1_RDRF_MASK),
+    kUART_RxOverrunFlag = (UART_S1_OR_MASK),
+};
+
+typedef struct _uart_config
+{
+    uint32_t baudRate_Bps;
+    uart_parity_mode_t parityMode;
+    uart_idle_type_select_t idleType;
+    bool enableTx;
+    bool enableRx;
+} uart_config_t;
+
+status_t UART_Init(UART_Type *base, const uart_config_t *config, uint32_t srcClock_Hz);
+void UART_Deinit(UART_Type *base);
+uint32_t UART_GetStatusFlags(UART_Type *base);
+status_t UART_ClearStatusFlags(UART_Type *base, uint32_t mask);
+void UART_EnableInterrupts(UART_Type *base, uint32_t mask);
+void UART_DisableInterrupts(UART_Type *base, uint32_t mask);
+uint8_t UART_ReadByte(UART_Type *base);
+void UART_WriteBlocking(UART_Type *base, const uint8_t *data, size_t length);
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif /* _FSL_UART_H_ */
@@ -0,0 +1,328 @@
+/*
+ * DEFCON 27 Official Badge - show compiler
+ *
+ * Turns a show written as text into the bytecode played by FX_Show() (see
+ * ../source/dc27_show.h), one instruction per line, # starts a comment:
+ *
+ *   # D-E-F-C-O-N
+ *   loop 2
+ *     set 0 0
+ *     ramp 0x3F 255 15 20
+ *     wait 500
+ *     ramp 0x3F 0 15 20
+ *   next
+ *   note C7 100
+ *   quiet G6 50
+ *   end
+ *
+ * Numbers are decimal, or hex with 0x. A note's pitch is rest or a name from
+ * B0 to DS8 (S for sharp: C7, CS7, D7...), or its number in SHOW_PITCHES; quiet
+ * plays it at a 25% duty cycle instead of 50%. A missing END is added at the end.
+ * The show is checked like the badge checks it before saving it, then written
+ * as console lines for uploading ('P' on a badge in COMPLETE state), as a
+ * binary file (for dc27_sim --show) or as a C initializer for a built-in show.
+ *
+ * Usage: dc27_show [options] [file]   (stdin if there's no file)
+ *   -o, --output <file>     write the bytecode to file instead of console lines
+ *   -c, --c-array <name>    write a C array instead of console lines
+ */
+
+#include <getopt.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "dc27_show.h"
+
+
+/***************************************************************************
+ **************************** Definitions **********************************
+ ***************************************************************************/
+
+#define SHOW_LINE_SIZE				256		// Longest source line
+#define SHOW_UPLOAD_BYTES			8		// Bytes per 'P' line (console lines hold 19 characters)
+
+typedef struct
+{
+	const char *name;
+	uint8_t op;
+	uint8_t args;
+	uint32_t max[4];		// largest value of each argument
+	uint8_t set;			// bits added to the first operand
+} show_syntax_t;
+
+static const show_syntax_t show_syntax[] =
+{
+	{ "end", SHOW_END, 0, { 0 }, 0 },
+	{ "set", SHOW_SET, 2, { 0xFF, 0xFF }, 0 },
+	{ "ramp", SHOW_RAMP, 4, { 0xFF, 0xFF, 0xFF, 0xFF }, 0 },
+	{ "wait", SHOW_WAIT, 1, { 0xFFFF }, 0 },
+	{ "note", SHOW_NOTE, 2, { SHOW_PITCH_COUNT - 1, 0xFFFF }, 0 },
+	{ "quiet", SHOW_NOTE, 2, { SHOW_PITCH_COUNT - 1, 0xFFFF }, SHOW_QUIET },
+	{ "random", SHOW_RANDOM, 2, { 0xFF, 0xFF }, 0 },
+	{ "loop", SHOW_LOOP, 1, { 0xFF }, 0 },
+	{ "next", SHOW_NEXT, 0, { 0 }, 0 }
+};
+
+#define SHOW_PITCH_NAME(name)	#name,
+
+static const char *const show_pitch_names[SHOW_PITCH_COUNT] = { "rest", SHOW_PITCHES(SHOW_PITCH_NAME) };
+
+static const uint8_t show_op_sizes[SHOW_OP_COUNT] = SHOW_OP_SIZES;
+
+
+/***************************************************************************
+ ******************************* Functions *********************************
+ ***************************************************************************/
+
+static void Show_Usage(const char *name)
+{
+	fprintf(stderr, "Usage: %s [-o file.bin | -c name] [file]\n", name);
+}
+
+/**************************************************************/
+
+// A pitch by name (C7, CS7, rest...) for NOTE. Returns 0 if OK
+static int Show_Pitch(const char *word, uint32_t *pitch)
+{
+	uint32_t i;
+
+	for (i = 0; i < SHOW_PITCH_COUNT; ++i)
+	{
+		if (!strcasecmp(word, show_pitch_names[i]))
+		{
+			*pitch = i;
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+/**************************************************************/
+
+// Compile one line, appending to code (size so far in *size). Returns 0 if OK
+static int Show_Line(char *line, unsigned lineNo, uint8_t *code, uint32_t *size, uint32_t *depth)
+{
+	const show_syntax_t *syntax = NULL;
+	uint32_t value[4];
+	uint8_t *out;
+	char *word, *end;
+	size_t i;
+
+	word = strtok(line, " \t\r\n");
+	if (!word)
+		return 0;
+
+	for (i = 0; i < sizeof(show_syntax) / sizeof(show_syntax[0]); ++i)
+	{
+		if (!strcasecmp(word, show_syntax[i].name))
+			syntax = &show_syntax[i];
+	}
+	if (!syntax)
+	{
+		fprintf(stderr, "line %u: unknown instruction '%s'\n", lineNo, word);
+		return 1;
+	}
+
+	for (i = 0; i < syntax->args; ++i)
+	{
+		word = strtok(NULL, " \t\r\n");
+		if (word && syntax->op == SHOW_NOTE && i == 0 && Show_Pitch(word, &value[i]) == 0)
+			continue;
+		value[i] = word ? strtoul(word, &end, 0) : 0;
+		if (!word || *end || value[i] > syntax->max[i])
+		{
+			fprintf(stderr, "line %u: %s takes %u numbers", lineNo, syntax->name, syntax->args);
+			fprintf(stderr, (word && !*end) ? ", %s is too big\n" : "\n", word);
+			return 1;
+		}
+	}
+	if (strtok(NULL, " \t\r\n"))
+	{
+		fprintf(stderr, "line %u: too many numbers for %s\n", lineNo, syntax->name);
+		return 1;
+	}
+
+	if (*size + show_op_sizes[syntax->op] > SHOW_MAX_SIZE)
+	{
+		fprintf(stderr, "line %u: show is longer than %u bytes\n", lineNo, SHOW_MAX_SIZE);
+		return 1;
+	}
+
+	switch (syntax->op)
+	{
+		case SHOW_RANDOM:
+			if (value[0] == 0)
+			{
+				fprintf(stderr, "line %u: random needs at least one LED\n", lineNo);
+				return 1;
+			}
+			break;
+
+		case SHOW_LOOP:
+			if (value[0] == 0 || *depth == SHOW_LOOP_DEPTH)
+			{
+				fprintf(stderr, "line %u: loop needs a count of 1-255 and nests %u deep at most\n", lineNo, SHOW_LOOP_DEPTH);
+				return 1;
+			}
+			(*depth)++;
+			break;
+
+		case SHOW_NEXT:
+			if (*depth == 0)
+			{
+				fprintf(stderr, "line %u: next without loop\n", lineNo);
+				return 1;
+			}
+			(*depth)--;
+			break;
+
+		default:
+			break;
+	}
+
+	out = &code[*size];
+	*out++ = syntax->op;
+	switch (syntax->op)
+	{
+		case SHOW_WAIT:
+			*out++ = value[0] & 0xFF;
+			*out++ = value[0] >> 8;
+			break;
+
+		case SHOW_NOTE:
+			*out++ = value[0] | syntax->set;
+			*out++ = value[1] & 0xFF;
+			*out++ = value[1] >> 8;
+			break;
+
+		default:
+			for (i = 0; i < syntax->args; ++i)
+				*out++ = value[i];
+			break;
+	}
+
+	*size += show_op_sizes[syntax->op];
+	return 0;
+}
+
+/**************************************************************/
+
+// Compile a whole show, returns its size (END included) or 0 on error
+static uint32_t Show_Compile(FILE *in, uint8_t *code)
+{
+	char line[SHOW_LINE_SIZE];
+	uint32_t size = 0, depth = 0, last;
+	unsigned lineNo = 0;
+	bool ended = false;
+	char *comment;
+
+	while (fgets(line, sizeof(line), in))
+	{
+		lineNo++;
+		comment = strchr(line, '#');
+		if (comment)
+			*comment = '\0';
+
+		last = size;
+		if (Show_Line(line, lineNo, code, &size, &depth))
+			return 0;
+
+		if (size > last && code[last] == SHOW_END)
+		{
+			ended = true;
+			break;
+		}
+	}
+
+	if (depth)
+	{
+		fprintf(stderr, "%u loop(s) without next\n", depth);
+		return 0;
+	}
+
+	if (!ended)
+	{
+		if (size == SHOW_MAX_SIZE)
+		{
+			fprintf(stderr, "no room for END, show is longer than %u bytes\n", SHOW_MAX_SIZE);
+			return 0;
+		}
+		code[size++] = SHOW_END;
+	}
+
+	return size;
+}
+
+/**************************************************************/
+
+int main(int argc, char **argv)
+{
+	static const struct option options[] = {
+		{ "output", required_argument, NULL, 'o' },
+		{ "c-array", required_argument, NULL, 'c' },
+		{ "help", no_argument, NULL, 'h' },
+		{ NULL, 0, NULL, 0 }
+	};
+	uint8_t code[SHOW_MAX_SIZE];
+	const char *output = NULL, *array = NULL;
+	uint32_t size, i;
+	FILE *in = stdin, *out;
+	int opt;
+
+	while ((opt = getopt_long(argc, argv, "o:c:h", options, NULL)) != -1)
+	{
+		switch (opt)
+		{
+			case 'o': output = optarg; break;
+			case 'c': array = optarg; break;
+
+			case 'h':
+			default:
+				Show_Usage(argv[0]);
+				return (opt == 'h') ? 0 : 1;
+		}
+	}
+
+	if (optind < argc && !(in = fopen(argv[optind], "r")))
+	{
+		perror(argv[optind]);
+		return 1;
+	}
+
+	size = Show_Compile(in, code);
+	if (in != stdin)
+		fclose(in);
+	if (size == 0)
+		return 1;
+
+	if (output)
+	{
+		out = fopen(output, "wb");
+		if (!out || fwrite(code, 1, size, out) != size || fclose(out))
+		{
+			perror(output);
+			return 1;
+		}
+	}
+	else if (array)
+	{
+		printf("const uint8_t %s[] = {", array);
+		for (i = 0; i < size; ++i)
+			printf("%s0x%02X%s", (i % 12) ? " " : "\n\t", code[i], (i + 1 < size) ? "," : "");
+		printf("\n};\n");
+	}
+	else
+	{
+		for (i = 0; i < size; ++i)
+			printf("%s%02X%s", (i % SHOW_UPLOAD_BYTES) ? "" : "P ", code[i], ((i + 1) % SHOW_UPLOAD_BYTES && i + 1 < size) ? "" : "\n");
+		printf("P\n");
+	}
+
+	fprintf(stderr, "%u bytes\n", size);
+	return 0;
+}
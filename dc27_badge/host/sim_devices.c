@@ -0,0 +1,432 @@
+/*
+ * DEFCON 27 Official Badge - host simulation
+ *
+ * Device model for the LP5569 LED driver (I2C register file and the three
+ * execution engines). The NXH2261 has its own model in sim_nxh2261.c.
+ *
+ * Engines run the LP5523-family instruction set used by the firmware's
+ * assembler (ramp/wait, set_pwm, mux tables, branch, end) on the 32.768 kHz
+ * internal clock, independently of the MCU, so animations carry on while it
+ * is in VLPS. Addresses in branch and mux instructions are absolute. An engine
+ * runs while its operating mode (ENGINE_CONTROL2) is run and its execution
+ * mode (ENGINE_CONTROL1) is free run or run once; setting it to disabled puts
+ * the PC back at the engine's starting address and clears its LED mapping.
+ */
+
+#include "sim_devices.h"
+#include "fsl_i2c.h"
+#include "pin_mux.h"
+
+
+/***************************************************************************
+ **************************** Definitions **********************************
+ ***************************************************************************/
+
+#define LP5569_REG_CONFIG			0x00
+#define LP5569_REG_ENGINE_CONTROL1	0x01
+#define LP5569_REG_ENGINE_CONTROL2	0x02
+#define LP5569_REG_LED0_CONTROL		0x07
+#define LP5569_REG_LED0_PWM			0x16
+#define LP5569_REG_MISC				0x2F
+#define LP5569_REG_ENGINE1_PC		0x30
+#define LP5569_REG_ENGINE_STATUS	0x3C
+#define LP5569_REG_RESET			0x3F
+#define LP5569_REG_ENGINE1_START	0x4B
+#define LP5569_REG_PAGE_SELECT		0x4F
+#define LP5569_REG_PROGRAM_MEM		0x50	// 0x50-0x6F: 16 instructions, MSB first
+#define LP5569_CONFIG_CHIP_EN		0x40
+#define LP5569_MISC_EN_AUTO_INCR	0x40
+#define LP5569_RESET_VALUE			0xFF
+
+#define LP5569_ENGINE_NUM			3U
+#define LP5569_PROG_PAGE			16U
+#define LP5569_PROG_SIZE			256U
+#define LP5569_OP_DISABLED			0U
+#define LP5569_OP_LOAD				1U
+#define LP5569_OP_RUN				2U
+#define LP5569_EXEC_HOLD			0U
+#define LP5569_MODE(reg, e)			(((reg) >> (6 - 2 * (e))) & 0x03)	// engine 0 = bits 7:6
+#define LP5569_CYCLE_TIME			(SIM_SEC(1) / 32768)	// internal oscillator, truncated to 30517 ns
+#define LP5569_ENGINE_BURST			64U		// instructions without a wait before an engine is considered stuck
+
+
+/**************************************************************************
+************************** Structs ****************************************
+***************************************************************************/
+
+typedef struct
+{
+	uint8_t pc;
+	uint8_t loops;		// branch loop counter, 0 = not in a loop
+	uint8_t mapFirst, mapLast, mapRow;	// mux mapping table
+	uint16_t leds;		// LEDs the engine drives (bit 0 = LED0)
+	uint8_t pwm;
+	uint8_t rampLeft;	// steps left in the ramp being executed
+	bool running;
+	uint32_t event;
+} lp5569_engine_t;
+
+typedef struct
+{
+	uint8_t reg[256];
+	uint8_t ptr;		// register address for the next read/write
+	bool enabled;		// LED_EN high
+	uint16_t prog[LP5569_PROG_SIZE];
+	lp5569_engine_t engine[LP5569_ENGINE_NUM];
+} lp5569_t;
+
+
+/****************************************************************************
+ ************************** Global variables ********************************
+ ***************************************************************************/
+
+sim_lp5569_stats_t g_simLP5569;
+
+static lp5569_t s_lp;
+
+static sim_i2c_device_t s_lpDevice;
+
+
+/****************************************************************************
+ ******************************** LP5569 ************************************
+ ***************************************************************************/
+
+static void LP5569_Engine_Stop(uint8_t e, bool reset)
+{
+	lp5569_engine_t *eng = &s_lp.engine[e];
+
+	SIM_Cancel(eng->event);
+	eng->event = 0;
+	eng->running = false;
+	eng->rampLeft = 0;
+
+	if (reset)
+	{
+		eng->pc = s_lp.reg[LP5569_REG_ENGINE1_START + e];
+		eng->loops = 0;
+		eng->leds = 0;
+		eng->pwm = 0;
+		eng->mapFirst = eng->mapLast = eng->mapRow = 0;
+	}
+}
+
+/**************************************************************/
+
+static void LP5569_Model_Reset(void)
+{
+	uint8_t e;
+
+	for (e = 0; e < LP5569_ENGINE_NUM; ++e)
+		SIM_Cancel(s_lp.engine[e].event);
+
+	memset(s_lp.reg, 0, sizeof(s_lp.reg));
+	memset(s_lp.prog, 0, sizeof(s_lp.prog));
+	memset(s_lp.engine, 0, sizeof(s_lp.engine));
+	s_lp.ptr = 0;
+	memset(g_simLP5569.pwm, 0, sizeof(g_simLP5569.pwm));
+}
+
+/**************************************************************/
+
+static void LP5569_Model_SetPWM(uint8_t led, uint8_t value)
+{
+	s_lp.reg[LP5569_REG_LED0_PWM + led] = value;
+
+	if (g_simLP5569.pwm[led] != value)
+	{
+		g_simLP5569.pwm[led] = value;
+		if ((s_lp.reg[LP5569_REG_CONFIG] & LP5569_CONFIG_CHIP_EN) && s_lp.reg[LP5569_REG_LED0_CONTROL + led])
+		{
+			g_simLP5569.ledChanges++;
+			SIM_Trace("LED%u PWM 0x%02X", led, value);
+		}
+	}
+}
+
+/**************************************************************/
+
+static void LP5569_Engine_Output(lp5569_engine_t *eng)	// engine PWM to the LEDs it's mapped to
+{
+	uint8_t led;
+
+	for (led = 0; led < SIM_LP5569_LED_NUM; ++led)
+	{
+		if (eng->leds & (1U << led))
+			LP5569_Model_SetPWM(led, eng->pwm);
+	}
+}
+
+/**************************************************************/
+
+static void LP5569_Engine_Map(lp5569_engine_t *eng, uint8_t row)
+{
+	eng->mapRow = row;
+	eng->leds = s_lp.prog[row] & 0x1FF;
+}
+
+/**************************************************************/
+
+// Execute from the PC until the engine has to wait (a ramp step or a wait instruction)
+static void LP5569_Engine_Step(void *arg)
+{
+	uint8_t e = (uint8_t)(uintptr_t)arg;
+	lp5569_engine_t *eng = &s_lp.engine[e];
+	uint16_t ins, step;
+	uint8_t count, addr;
+	uint32_t n;
+
+	eng->event = 0;
+
+	if (eng->rampLeft)	// one PWM step of the ramp in progress
+	{
+		ins = s_lp.prog[(uint8_t)(eng->pc - 1)];
+		eng->pwm = (ins & 0x0100) ? ((eng->pwm > 0) ? eng->pwm - 1 : 0) : ((eng->pwm < 0xFF) ? eng->pwm + 1 : 0xFF);
+		LP5569_Engine_Output(eng);
+		if (--eng->rampLeft)
+		{
+			step = ((ins >> 9) & 0x1F) * ((ins & 0x4000) ? 512U : 16U);
+			eng->event = SIM_ScheduleIn(step * LP5569_CYCLE_TIME, LP5569_Engine_Step, arg);
+			return;
+		}
+	}
+
+	for (n = 0; n < LP5569_ENGINE_BURST; ++n)
+	{
+		ins = s_lp.prog[eng->pc];
+		eng->pc++;
+		g_simLP5569.engineInstructions++;
+
+		if ((ins & 0x8000) == 0)
+		{
+			step = (ins >> 9) & 0x1F;
+			if (ins & 0x4000 && step == 0 && !(ins & 0x0100))	// set_pwm
+			{
+				eng->pwm = ins & 0xFF;
+				LP5569_Engine_Output(eng);
+				continue;
+			}
+			if (step == 0)	// rst, or a ramp without a step time
+			{
+				SIM_Trace("LP5569 engine %u: instruction 0x%04X at 0x%02X, reset", e + 1, ins, eng->pc - 1);
+				LP5569_Engine_Stop(e, true);
+				return;
+			}
+
+			step *= (ins & 0x4000) ? 512U : 16U;
+			eng->rampLeft = ins & 0xFF;	// 0 = wait
+			eng->event = SIM_ScheduleIn(step * LP5569_CYCLE_TIME, LP5569_Engine_Step, arg);
+			return;
+		}
+
+		switch (ins & 0xE000)
+		{
+			case 0x8000:	// mux
+				addr = ins & 0x7F;
+				switch (ins & 0xFF80)
+				{
+					case 0x9E00: eng->mapFirst = addr; break;				// mux_ld_start
+					case 0x9C00: eng->mapFirst = addr; LP5569_Engine_Map(eng, addr); break;	// mux_map_start
+					case 0x9C80: eng->mapLast = addr; break;				// mux_ld_end
+					case 0x9D80:											// mux_map_next
+						LP5569_Engine_Map(eng, (eng->mapRow >= eng->mapLast) ? eng->mapFirst : eng->mapRow + 1);
+						break;
+					case 0x9D00:											// mux_sel, mux_clr
+						eng->leds = (addr && addr <= SIM_LP5569_LED_NUM) ? (1U << (addr - 1)) : 0;
+						break;
+					default:
+						SIM_Trace("LP5569 engine %u: mux instruction 0x%04X not modelled", e + 1, ins);
+						break;
+				}
+				break;
+
+			case 0xA000:	// branch: run from addr again loops more times, forever if 0
+				count = (ins >> 7) & 0x3F;
+				addr = ins & 0x7F;
+				if (count == 0)
+					eng->pc = addr;
+				else if (eng->loops == 0)
+				{
+					eng->loops = count;
+					eng->pc = addr;
+				}
+				else if (--eng->loops)
+					eng->pc = addr;
+				break;
+
+			case 0xC000:	// end (and int, not wired to the KL27)
+				if (ins & 0x0800)
+					eng->pc = s_lp.reg[LP5569_REG_ENGINE1_START + e];
+				eng->running = false;
+				return;
+
+			case 0xE000:	// trigger: engines don't wait on each other in this model
+				break;
+
+			default:
+				SIM_Trace("LP5569 engine %u: instruction 0x%04X not modelled", e + 1, ins);
+				break;
+		}
+	}
+
+	SIM_Trace("LP5569 engine %u: no wait in %u instructions, stopped", e + 1, LP5569_ENGINE_BURST);
+	eng->running = false;
+}
+
+/**************************************************************/
+
+// ENGINE_CONTROL1/2 changed: start, stop or reset engines
+static void LP5569_Engine_Control(void)
+{
+	uint8_t e, op, exec;
+	lp5569_engine_t *eng;
+
+	for (e = 0; e < LP5569_ENGINE_NUM; ++e)
+	{
+		eng = &s_lp.engine[e];
+		op = LP5569_MODE(s_lp.reg[LP5569_REG_ENGINE_CONTROL2], e);
+		exec = LP5569_MODE(s_lp.reg[LP5569_REG_ENGINE_CONTROL1], e);
+
+		if (op == LP5569_OP_DISABLED || op == LP5569_OP_LOAD)
+		{
+			if (eng->running || eng->leds || eng->pc != s_lp.reg[LP5569_REG_ENGINE1_START + e])
+				LP5569_Engine_Stop(e, true);
+		}
+		else if (op == LP5569_OP_RUN && exec != LP5569_EXEC_HOLD)
+		{
+			if (!eng->running && (s_lp.reg[LP5569_REG_CONFIG] & LP5569_CONFIG_CHIP_EN))
+			{
+				eng->running = true;
+				g_simLP5569.engineStarts++;
+				eng->event = SIM_ScheduleIn(0, LP5569_Engine_Step, (void *)(uintptr_t)e);
+			}
+		}
+		else if (eng->running)	// halt or hold: stays where it is
+		{
+			LP5569_Engine_Stop(e, false);
+		}
+	}
+}
+
+/**************************************************************/
+
+static bool LP5569_Model_Loading(void)
+{
+	uint8_t e;
+
+	for (e = 0; e < LP5569_ENGINE_NUM; ++e)
+	{
+		if (LP5569_MODE(s_lp.reg[LP5569_REG_ENGINE_CONTROL2], e) == LP5569_OP_LOAD)
+			return true;
+	}
+
+	return false;
+}
+
+/**************************************************************/
+
+static void LP5569_Model_Store(uint8_t addr, uint8_t value)
+{
+	uint16_t *word;
+
+	g_simLP5569.writes++;
+
+	if (addr == LP5569_REG_RESET && value == LP5569_RESET_VALUE)
+	{
+		LP5569_Model_Reset();
+		return;
+	}
+
+	if (addr >= LP5569_REG_PROGRAM_MEM && addr < LP5569_REG_PROGRAM_MEM + 2 * LP5569_PROG_PAGE)
+	{
+		if (!LP5569_Model_Loading())	// program memory is only writable in load mode
+			return;
+
+		word = &s_lp.prog[((s_lp.reg[LP5569_REG_PAGE_SELECT] & 0x0F) * LP5569_PROG_PAGE + (addr - LP5569_REG_PROGRAM_MEM) / 2) % LP5569_PROG_SIZE];
+		*word = ((addr - LP5569_REG_PROGRAM_MEM) & 1) ? ((*word & 0xFF00) | value) : ((*word & 0x00FF) | (value << 8));
+		s_lp.reg[addr] = value;
+		return;
+	}
+
+	s_lp.reg[addr] = value;
+
+	if (addr >= LP5569_REG_LED0_PWM && addr < LP5569_REG_LED0_PWM + SIM_LP5569_LED_NUM)
+		LP5569_Model_SetPWM(addr - LP5569_REG_LED0_PWM, value);
+
+	if (addr == LP5569_REG_ENGINE_CONTROL1 || addr == LP5569_REG_ENGINE_CONTROL2 || addr == LP5569_REG_CONFIG)
+		LP5569_Engine_Control();
+
+	if (addr >= LP5569_REG_ENGINE1_PC && addr < LP5569_REG_ENGINE1_PC + LP5569_ENGINE_NUM && !s_lp.engine[addr - LP5569_REG_ENGINE1_PC].running)
+		s_lp.engine[addr - LP5569_REG_ENGINE1_PC].pc = value;
+}
+
+/**************************************************************/
+
+// First byte of a write sets the register address, the rest are data
+static status_t LP5569_Model_Write(void *ctx, const uint8_t *data, size_t len)
+{
+	size_t i;
+
+	(void)ctx;
+
+	if (!s_lp.enabled || len == 0)
+		return kStatus_I2C_Addr_Nak;
+
+	s_lp.ptr = data[0];
+	for (i = 1; i < len; ++i)
+	{
+		LP5569_Model_Store(s_lp.ptr, data[i]);
+		if (s_lp.reg[LP5569_REG_MISC] & LP5569_MISC_EN_AUTO_INCR)
+			s_lp.ptr++;
+	}
+
+	return kStatus_Success;
+}
+
+/**************************************************************/
+
+static status_t LP5569_Model_Read(void *ctx, uint8_t *data, size_t len)
+{
+	size_t i;
+
+	(void)ctx;
+
+	if (!s_lp.enabled)
+		return kStatus_I2C_Addr_Nak;
+
+	for (i = 0; i < len; ++i)
+	{
+		if (s_lp.ptr >= LP5569_REG_ENGINE1_PC && s_lp.ptr < LP5569_REG_ENGINE1_PC + LP5569_ENGINE_NUM)
+			s_lp.reg[s_lp.ptr] = s_lp.engine[s_lp.ptr - LP5569_REG_ENGINE1_PC].pc;
+		data[i] = s_lp.reg[s_lp.ptr];
+		g_simLP5569.reads++;
+		if (s_lp.reg[LP5569_REG_MISC] & LP5569_MISC_EN_AUTO_INCR)
+			s_lp.ptr++;
+	}
+
+	return kStatus_Success;
+}
+
+/**************************************************************/
+
+static void LP5569_Model_Enable(void *ctx, uint32_t level)
+{
+	(void)ctx;
+
+	s_lp.enabled = (level != 0);
+	if (!s_lp.enabled)
+		LP5569_Model_Reset();	// EN low puts the device in shutdown, registers reset
+}
+
+/**************************************************************/
+
+void SIM_LP5569_Attach(void)
+{
+	LP5569_Model_Reset();
+
+	s_lpDevice.address = SIM_LP5569_ADDR;
+	s_lpDevice.write = LP5569_Model_Write;
+	s_lpDevice.read = LP5569_Model_Read;
+	SIM_AttachI2C(&s_lpDevice);
+	SIM_AttachPin(BOARD_INITPINS_LED_EN_GPIO, BOARD_INITPINS_LED_EN_GPIO_PIN, LP5569_Model_Enable, NULL);
+}
+
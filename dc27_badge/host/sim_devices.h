@@ -0,0 +1,47 @@
+/*
+ * DEFCON 27 Official Badge - host simulation
+ *
+ * Model of the LP5569 LED driver on the badge, including its execution
+ * engines. The NXH2261 NFMI radio is modelled in sim_nxh2261.h.
+ */
+
+#ifndef _SIM_DEVICES_H_
+#define _SIM_DEVICES_H_
+
+#include "sim_hal.h"
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+/***************************************************************************
+ **************************** Definitions **********************************
+ ***************************************************************************/
+
+#define SIM_LP5569_ADDR			0x32
+#define SIM_LP5569_LED_NUM		9U
+
+typedef struct
+{
+	uint32_t writes;			// register writes (each byte of a transfer)
+	uint32_t reads;
+	uint32_t ledChanges;		// PWM register changes on enabled LED outputs
+	uint32_t engineStarts;		// execution engines set running
+	uint32_t engineInstructions;
+	uint8_t pwm[SIM_LP5569_LED_NUM];
+} sim_lp5569_stats_t;
+
+extern sim_lp5569_stats_t g_simLP5569;
+
+
+/****************************************************************************
+ ********************* Function Prototypes **********************************
+ ***************************************************************************/
+
+void SIM_LP5569_Attach(void);
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif /* _SIM_DEVICES_H_ */
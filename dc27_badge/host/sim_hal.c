@@ -0,0 +1,2268 @@
+/*
+ * DEFCON 27 Official Badge - host simulation
+ *
+ * Simulated HAL: virtual clock, event queue, NVIC and register-level models of
+ * the SDK drivers used by dc27_badge.c (GPIO/PORT, LPUART0, UART2 console,
+ * I2C0, TPM0, LPTMR0, SMC, CRC, SysTick and FTFA flash).
+ */
+
+#include <setjmp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "sim_hal.h"
+#include "fsl_clock.h"
+#include "fsl_crc.h"
+#include "fsl_debug_console.h"
+#include "fsl_flash.h"
+#include "fsl_gpio.h"
+#include "fsl_i2c.h"
+#include "fsl_lptmr.h"
+#include "fsl_lpuart.h"
+#include "fsl_port.h"
+#include "fsl_smc.h"
+#include "fsl_tpm.h"
+#include "fsl_uart.h"
+
+
+/***************************************************************************
+ **************************** Definitions **********************************
+ ***************************************************************************/
+
+#define SIM_MAX_EVENTS			4096U
+#define SIM_MAX_PIN_WATCHERS	32U
+#define SIM_MAX_ISR_BURST		100000U		// back-to-back ISRs before we call it a livelock
+#define SIM_PRINTF_BUF_SIZE		1024U
+#define SIM_CONSOLE_LINE_SIZE	256U
+
+#define SIM_CORE_CLOCK_HZ		8000000U	// LIRC 8MHz (clock_config.c)
+#define SIM_BUS_CLOCK_HZ		4000000U	// OUTDIV4 /2
+#define SIM_LPO_CLOCK_HZ		1000U		// LPTMR0 clock
+
+#define SIM_FLASH_MAP_HINT		0x10000000UL	// mapped below 4GB so 32-bit flash addresses work
+
+#define SIM_VECTOR_COUNT		48U			// 16 Cortex-M0+ exceptions, then 32 interrupts
+#define SIM_VECTOR_SYSTICK		15U
+#define SIM_VECTOR_IRQ0			16U
+
+
+/**************************************************************************
+************************** Structs ****************************************
+***************************************************************************/
+
+typedef struct
+{
+	sim_time_t when;
+	uint64_t seq;		// FIFO order for events scheduled at the same time
+	bool input;			// drives MCU inputs: runs ahead of other events at the same time
+	uint32_t id;
+	sim_event_fn_t fn;
+	void *arg;
+} sim_event_t;
+
+typedef struct
+{
+	GPIO_Type *gpio;
+	uint32_t pin;
+	sim_pin_fn_t fn;
+	void *ctx;
+} sim_pin_watcher_t;
+
+
+/****************************************************************************
+ ************************** Global variables ********************************
+ ***************************************************************************/
+
+// Peripheral register blocks (see include/MKL27Z644.h)
+GPIO_Type    g_hostGPIOA, g_hostGPIOB, g_hostGPIOC, g_hostGPIOD, g_hostGPIOE;
+PORT_Type    g_hostPORTA, g_hostPORTB, g_hostPORTC, g_hostPORTD, g_hostPORTE;
+LPUART_Type  g_hostLPUART0, g_hostLPUART1;
+UART_Type    g_hostUART2;
+LPTMR_Type   g_hostLPTMR0;
+TPM_Type     g_hostTPM0;
+I2C_Type     g_hostI2C0;
+SIM_Type     g_hostSIM;
+SMC_Type     g_hostSMC;
+CRC_Type     g_hostCRC0;
+SysTick_Type g_hostSysTick;
+SCB_Type     g_hostSCB;
+
+uint32_t SystemCoreClock = SIM_CORE_CLOCK_HZ;
+
+sim_stats_t g_simStats;
+
+// Run control
+static jmp_buf s_exitJump;
+static sim_exit_t s_exitReason;
+static sim_time_t s_now, s_deadline;
+static sim_probe_fn_t s_probe;
+static FILE *s_trace;
+
+// Event queue (binary min-heap)
+static sim_event_t s_events[SIM_MAX_EVENTS];
+static uint32_t s_eventCount;
+static uint64_t s_eventSeq;
+static uint32_t s_eventId;
+
+// Core
+static bool s_primask;
+static uint32_t s_nvicEnabled, s_nvicPending;
+static bool s_sysTickPending;
+static bool s_inHandler;
+static bool s_sleeping;		// in VLPS: SysTick and LPUART0 are unclocked
+static bool s_flashBusy;	// FTFA command in progress: core stalls on flash fetches
+static uint32_t s_savedPrimask;
+static sim_time_t s_sysTickPeriod, s_sysTickEpoch;
+static uint32_t s_sysTickEvent;
+
+// External inputs (recording and replay)
+static uint64_t s_eventSerial;		// events run so far
+static sim_byte_fn_t s_tapByte;
+static sim_edge_fn_t s_tapEdge;
+static void *s_tapCtx;
+static bool s_inputsMuted;
+
+// Pins
+static uint32_t s_pinExternal[5];	// levels driven onto each port from outside
+static sim_pin_watcher_t s_pinWatchers[SIM_MAX_PIN_WATCHERS];
+static uint32_t s_pinWatcherCount;
+
+// I2C0
+static sim_i2c_device_t *s_i2cDevices;
+static uint32_t s_i2cBaud = 100000U;
+
+// LPUART0
+static uint32_t s_lpuartBaud = 115200U;
+static sim_time_t s_lpuartRxLatched;	// when RDRF was last set
+static sim_byte_fn_t s_lpuartTx;
+static void *s_lpuartTxCtx;
+
+// UART2 console
+static uint32_t s_consoleBaud = 115200U;
+static sim_line_fn_t s_consoleLine;
+static void *s_consoleLineCtx;
+static FILE *s_consoleEcho;
+static char s_consoleLineBuf[SIM_CONSOLE_LINE_SIZE];
+static size_t s_consoleLineLen;
+
+// TPM0
+static sim_tone_fn_t s_piezo;
+static void *s_piezoCtx;
+
+// LPTMR0
+static uint32_t s_lptmrEvent;
+static sim_time_t s_lptmrStart;
+
+// CRC
+static crc_config_t s_crcConfig;
+
+// Flash
+static uint8_t *s_flash;
+
+
+/****************************************************************************
+ ********************* Function Prototypes **********************************
+ ***************************************************************************/
+
+static void SIM_Exit(sim_exit_t) __attribute__((noreturn));
+static void SIM_SetNow(sim_time_t);
+static bool SIM_Step(void);
+static void SIM_Deliver(void);
+static bool SIM_WakePending(void);
+static void SIM_SysTickEvent(void *);
+static void SIM_LptmrEvent(void *);
+static void SIM_ConsoleRxEvent(void *);
+static int SIM_PortIndex(GPIO_Type *);
+static void SIM_PinEdge(int, uint32_t, uint32_t, uint32_t);
+static void SIM_FlashCommand(sim_time_t);
+
+void SIM_DefaultHandler(void);
+void SysTick_Handler(void) __attribute__((weak, alias("SIM_DefaultHandler")));
+void LPUART0_IRQHandler(void) __attribute__((weak, alias("SIM_DefaultHandler")));
+void UART2_FLEXIO_IRQHandler(void) __attribute__((weak, alias("SIM_DefaultHandler")));
+void I2C0_IRQHandler(void) __attribute__((weak, alias("SIM_DefaultHandler")));
+void TPM0_IRQHandler(void) __attribute__((weak, alias("SIM_DefaultHandler")));
+void LPTMR0_IRQHandler(void) __attribute__((weak, alias("SIM_DefaultHandler")));
+void PORTA_IRQHandler(void) __attribute__((weak, alias("SIM_DefaultHandler")));
+void PORTB_PORTC_PORTD_PORTE_IRQHandler(void) __attribute__((weak, alias("SIM_DefaultHandler")));
+
+// The vector table in flash, where VTOR points out of reset
+static void (*const s_vectors[SIM_VECTOR_COUNT])(void) = {
+	[SIM_VECTOR_SYSTICK] = SysTick_Handler,
+	[SIM_VECTOR_IRQ0 + I2C0_IRQn] = I2C0_IRQHandler,
+	[SIM_VECTOR_IRQ0 + LPUART0_IRQn] = LPUART0_IRQHandler,
+	[SIM_VECTOR_IRQ0 + UART2_FLEXIO_IRQn] = UART2_FLEXIO_IRQHandler,
+	[SIM_VECTOR_IRQ0 + TPM0_IRQn] = TPM0_IRQHandler,
+	[SIM_VECTOR_IRQ0 + LPTMR0_IRQn] = LPTMR0_IRQHandler,
+	[SIM_VECTOR_IRQ0 + PORTA_IRQn] = PORTA_IRQHandler,
+	[SIM_VECTOR_IRQ0 + PORTB_PORTC_PORTD_PORTE_IRQn] = PORTB_PORTC_PORTD_PORTE_IRQHandler,
+};
+
+// Functions the firmware placed in RAM with __RAMFUNC() (include/cr_section_macros.h)
+extern const char __start_ramfunc[] __attribute__((weak));
+extern const char __stop_ramfunc[] __attribute__((weak));
+
+static GPIO_Type *const s_gpios[5] = { &g_hostGPIOA, &g_hostGPIOB, &g_hostGPIOC, &g_hostGPIOD, &g_hostGPIOE };
+static PORT_Type *const s_ports[5] = { &g_hostPORTA, &g_hostPORTB, &g_hostPORTC, &g_hostPORTD, &g_hostPORTE };
+
+
+/****************************************************************************
+ ************************** Run control *************************************
+ ***************************************************************************/
+
+sim_exit_t SIM_Run(void (*entry)(void), sim_time_t duration)
+{
+	s_deadline = (duration == SIM_TIME_NEVER) ? SIM_TIME_NEVER : s_now + duration;
+	SCB->VTOR = (uintptr_t)s_vectors;
+
+	if (setjmp(s_exitJump) == 0)
+	{
+		entry();
+		s_exitReason = SIM_EXIT_RETURNED;
+	}
+
+	s_inHandler = false;
+	return s_exitReason;
+}
+
+/**************************************************************/
+
+static void SIM_Exit(sim_exit_t reason)
+{
+	s_exitReason = reason;
+	longjmp(s_exitJump, 1);
+}
+
+/**************************************************************/
+
+void SIM_Stop(void)
+{
+	SIM_Exit(SIM_EXIT_STOPPED);
+}
+
+/**************************************************************/
+
+const char *SIM_ExitName(sim_exit_t reason)
+{
+	switch (reason)
+	{
+		case SIM_EXIT_DEADLINE:
+			return "deadline";
+		case SIM_EXIT_STOPPED:
+			return "stopped";
+		case SIM_EXIT_RESET:
+			return "system reset";
+		case SIM_EXIT_RETURNED:
+			return "main returned";
+		case SIM_EXIT_DEADLOCK:
+			return "deadlock";
+		default:
+			return "unknown";
+	}
+}
+
+/**************************************************************/
+
+void SIM_SetProbe(sim_probe_fn_t fn)
+{
+	s_probe = fn;
+}
+
+
+/****************************************************************************
+ ******************** Virtual clock and event queue *************************
+ ***************************************************************************/
+
+sim_time_t SIM_Now(void)
+{
+	return s_now;
+}
+
+/**************************************************************/
+
+// Inputs go first at equal times, so a recording replayed with SIM_ScheduleInput()
+// interleaves with the rest of the queue the same way the original inputs did
+static bool SIM_EventBefore(const sim_event_t *a, const sim_event_t *b)
+{
+	if (a->when != b->when)
+		return a->when < b->when;
+	if (a->input != b->input)
+		return a->input;
+	return a->seq < b->seq;
+}
+
+/**************************************************************/
+
+static void SIM_EventSwap(uint32_t a, uint32_t b)
+{
+	sim_event_t tmp = s_events[a];
+
+	s_events[a] = s_events[b];
+	s_events[b] = tmp;
+}
+
+/**************************************************************/
+
+static void SIM_EventSiftDown(uint32_t i)
+{
+	for (;;)
+	{
+		uint32_t l = 2 * i + 1, r = l + 1, m = i;
+
+		if (l < s_eventCount && SIM_EventBefore(&s_events[l], &s_events[m]))
+			m = l;
+		if (r < s_eventCount && SIM_EventBefore(&s_events[r], &s_events[m]))
+			m = r;
+		if (m == i)
+			return;
+		SIM_EventSwap(i, m);
+		i = m;
+	}
+}
+
+/**************************************************************/
+
+static uint32_t SIM_Enqueue(sim_time_t when, bool input, sim_event_fn_t fn, void *arg)
+{
+	uint32_t i;
+
+	if (s_eventCount >= SIM_MAX_EVENTS)
+	{
+		fprintf(stderr, "sim: event queue full\n");
+		abort();
+	}
+
+	if (when < s_now)
+		when = s_now;
+
+	i = s_eventCount++;
+	s_events[i].when = when;
+	s_events[i].seq = s_eventSeq++;
+	s_events[i].input = input;
+	s_events[i].id = ++s_eventId;
+	s_events[i].fn = fn;
+	s_events[i].arg = arg;
+
+	while (i > 0 && SIM_EventBefore(&s_events[i], &s_events[(i - 1) / 2]))
+	{
+		SIM_EventSwap(i, (i - 1) / 2);
+		i = (i - 1) / 2;
+	}
+
+	return s_events[i].id;
+}
+
+/**************************************************************/
+
+uint32_t SIM_Schedule(sim_time_t when, sim_event_fn_t fn, void *arg)
+{
+	return SIM_Enqueue(when, false, fn, arg);
+}
+
+/**************************************************************/
+
+// For events that drive LPUART0 RX or an input pin (see SIM_EventBefore)
+uint32_t SIM_ScheduleInput(sim_time_t when, sim_event_fn_t fn, void *arg)
+{
+	return SIM_Enqueue(when, true, fn, arg);
+}
+
+/**************************************************************/
+
+uint32_t SIM_ScheduleIn(sim_time_t delay, sim_event_fn_t fn, void *arg)
+{
+	return SIM_Schedule(s_now + delay, fn, arg);
+}
+
+/**************************************************************/
+
+void SIM_Cancel(uint32_t id)
+{
+	uint32_t i;
+
+	if (id == 0)
+		return;
+
+	for (i = 0; i < s_eventCount; ++i)
+	{
+		if (s_events[i].id == id)
+		{
+			s_events[i].fn = NULL;	// left in the heap, skipped when it comes due
+			return;
+		}
+	}
+}
+
+/**************************************************************/
+
+static void SIM_SetNow(sim_time_t t)
+{
+	if (t <= s_now)
+		return;
+
+	if (s_sleeping)
+		g_simStats.vlpsTime += t - s_now;
+	else
+		g_simStats.runTime += t - s_now;
+	s_now = t;
+
+	// SysTick current value counts down from LOAD once per core clock
+	if (s_sysTickPeriod)
+	{
+		uint64_t cycles = ((s_now - s_sysTickEpoch) % s_sysTickPeriod) * SystemCoreClock / SIM_SEC(1);
+		SysTick->VAL = SysTick->LOAD - (uint32_t)(cycles % (SysTick->LOAD + 1));
+	}
+}
+
+/**************************************************************/
+
+// Run the next event in the queue, stopping the run if it falls after the deadline
+static bool SIM_Step(void)
+{
+	sim_event_t ev;
+
+	if (s_eventCount == 0)
+	{
+		SIM_Exit(SIM_EXIT_DEADLOCK);
+	}
+
+	if (s_events[0].when > s_deadline)
+	{
+		SIM_SetNow(s_deadline);
+		SIM_Exit(SIM_EXIT_DEADLINE);
+	}
+
+	ev = s_events[0];
+	s_events[0] = s_events[--s_eventCount];
+	SIM_EventSiftDown(0);
+
+	if (ev.fn == NULL)  // cancelled
+		return false;
+
+	SIM_SetNow(ev.when);
+	s_eventSerial++;
+	ev.fn(ev.arg);
+	SIM_Deliver();
+
+	if (s_probe)
+		s_probe();
+
+	return true;
+}
+
+/**************************************************************/
+
+// Busy the CPU for the given duration (blocking driver call)
+void SIM_Advance(sim_time_t duration)
+{
+	sim_time_t target = s_now + duration;
+
+	while (s_eventCount && s_events[0].when <= target)
+	{
+		SIM_Step();
+	}
+
+	if (target > s_deadline)
+	{
+		SIM_SetNow(s_deadline);
+		SIM_Exit(SIM_EXIT_DEADLINE);
+	}
+
+	SIM_SetNow(target);
+	SIM_Deliver();
+
+	if (s_probe)
+		s_probe();
+}
+
+/**************************************************************/
+
+// Skip ahead to the next thing that can happen (firmware is spinning on a flag)
+void SIM_WaitForEvent(void)
+{
+	SIM_Deliver();
+	while (!SIM_Step()){};
+}
+
+/**************************************************************/
+
+void HOST_Idle(void)
+{
+	SIM_WaitForEvent();
+}
+
+
+/****************************************************************************
+ ******************************* Tracing ************************************
+ ***************************************************************************/
+
+void SIM_SetTrace(FILE *fp)
+{
+	s_trace = fp;
+}
+
+/**************************************************************/
+
+double SIM_Seconds(sim_time_t t)
+{
+	return (double)t / 1e9;
+}
+
+/**************************************************************/
+
+void SIM_Trace(const char *fmt, ...)
+{
+	va_list ap;
+
+	if (!s_trace)
+		return;
+
+	fprintf(s_trace, "[%12.6f] ", SIM_Seconds(s_now));
+	va_start(ap, fmt);
+	vfprintf(s_trace, fmt, ap);
+	va_end(ap);
+	fputc('\n', s_trace);
+}
+
+
+/****************************************************************************
+ *************************** NVIC / core ************************************
+ ***************************************************************************/
+
+void SIM_DefaultHandler(void)
+{
+}
+
+/**************************************************************/
+
+// Interrupt request lines are level sensitive: derive them from peripheral state
+static bool SIM_IrqLine(uint32_t irq)
+{
+	switch (irq)
+	{
+		case LPUART0_IRQn:
+			return ((LPUART0->STAT & LPUART_STAT_RDRF_MASK) && (LPUART0->CTRL & LPUART_CTRL_RIE_MASK)) ||
+				   ((LPUART0->STAT & LPUART_STAT_OR_MASK) && (LPUART0->CTRL & LPUART_CTRL_ORIE_MASK));
+		case UART2_FLEXIO_IRQn:
+			return (UART2->S1 & UART_S1_RDRF_MASK) && (UART2->C2 & UART_C2_RIE_MASK);
+		case LPTMR0_IRQn:
+			return (LPTMR0->CSR & LPTMR_CSR_TCF_MASK) && (LPTMR0->CSR & LPTMR_CSR_TIE_MASK);
+		case TPM0_IRQn:
+			return (TPM0->SC & TPM_SC_TOF_MASK) && (TPM0->SC & TPM_SC_TOIE_MASK);
+		case PORTA_IRQn:
+			return PORTA->ISFR != 0;
+		case PORTB_PORTC_PORTD_PORTE_IRQn:
+			return (PORTB->ISFR | PORTC->ISFR | PORTD->ISFR | PORTE->ISFR) != 0;
+		default:
+			return false;
+	}
+}
+
+/**************************************************************/
+
+static int SIM_NextIrq(void)
+{
+	uint32_t irq;
+
+	for (irq = 0; irq < 32; ++irq)  // equal priorities: lowest vector number wins
+	{
+		if ((s_nvicEnabled & (1U << irq)) && ((s_nvicPending & (1U << irq)) || SIM_IrqLine(irq)))
+			return (int)irq;
+	}
+
+	return -1;
+}
+
+/**************************************************************/
+
+// Can the core fetch this handler? While a flash command runs, only from RAM: both the
+// vector table (VTOR moved off the one in flash) and the handler itself (__RAMFUNC)
+static bool SIM_Fetchable(void (*handler)(void))
+{
+	const char *code = (const char *)handler;
+
+	if (!s_flashBusy)
+		return true;
+
+	return SCB->VTOR != (uintptr_t)s_vectors && code >= __start_ramfunc && code < __stop_ramfunc;
+}
+
+/**************************************************************/
+
+// Take any pending exceptions (Cortex-M0+: no nesting at equal priority)
+// If the one to take can't be fetched the core stalls, and takes it once the flash command is done
+static void SIM_Deliver(void)
+{
+	void (*const *vectors)(void);
+	uint32_t burst = 0;
+	int irq;
+
+	if (s_inHandler || s_primask || s_sleeping)
+		return;
+
+	for (;;)
+	{
+		if (++burst > SIM_MAX_ISR_BURST)
+		{
+			fprintf(stderr, "sim: interrupt storm (handler not clearing its source?)\n");
+			SIM_Stop();
+		}
+
+		vectors = (void (*const *)(void))SCB->VTOR;
+
+		if (SCB->ICSR & SCB_ICSR_PENDSTSET_Msk)	// pended by the firmware too
+			s_sysTickPending = true;
+
+		if (s_sysTickPending)
+		{
+			if (!SIM_Fetchable(vectors[SIM_VECTOR_SYSTICK]))
+				break;
+			s_sysTickPending = false;
+			SCB->ICSR &= ~SCB_ICSR_PENDSTSET_Msk;
+			g_simStats.sysTickCount++;
+			s_inHandler = true;
+			vectors[SIM_VECTOR_SYSTICK]();
+			s_inHandler = false;
+			continue;
+		}
+
+		irq = SIM_NextIrq();
+		if (irq < 0 || !SIM_Fetchable(vectors[SIM_VECTOR_IRQ0 + irq]))
+			break;
+
+		s_nvicPending &= ~(1U << irq);
+		g_simStats.irqCount[irq]++;
+		if (s_flashBusy)
+			g_simStats.flashIrqCount++;
+		s_inHandler = true;
+		if (vectors[SIM_VECTOR_IRQ0 + irq])
+			vectors[SIM_VECTOR_IRQ0 + irq]();
+		s_inHandler = false;
+	}
+}
+
+/**************************************************************/
+
+// Would an enabled interrupt wake the core from WFI, regardless of PRIMASK?
+static bool SIM_WakePending(void)
+{
+	return SIM_NextIrq() >= 0;
+}
+
+/**************************************************************/
+
+// Sleep until an enabled interrupt is pending
+// In VLPS (deep), SysTick and MCGIRCLK-clocked peripherals stop
+static void SIM_Sleep(bool deep)
+{
+	if (deep)
+	{
+		s_sleeping = true;
+		g_simStats.vlpsEntries++;
+		SIM_Trace("VLPS enter");
+	}
+
+	while (!SIM_WakePending() && !(s_sysTickPending && !deep))
+	{
+		SIM_Step();
+	}
+
+	if (deep)
+	{
+		SIM_Advance(SIM_VLPS_WAKEUP_TIME);
+		s_sleeping = false;
+		SIM_Trace("VLPS exit");
+	}
+
+	SIM_Deliver();
+}
+
+/**************************************************************/
+
+void __disable_irq(void)
+{
+	s_primask = true;
+}
+
+/**************************************************************/
+
+void __enable_irq(void)
+{
+	s_primask = false;
+	SIM_Deliver();
+}
+
+/**************************************************************/
+
+uint32_t DisableGlobalIRQ(void)
+{
+	uint32_t primask = s_primask;
+
+	s_primask = true;
+	return primask;
+}
+
+/**************************************************************/
+
+void EnableGlobalIRQ(uint32_t primask)
+{
+	s_primask = (primask != 0);
+	SIM_Deliver();
+}
+
+/**************************************************************/
+
+void __WFI(void)
+{
+	SIM_Sleep((SCB->SCR & SCB_SCR_SLEEPDEEP_Msk) != 0);
+}
+
+/**************************************************************/
+
+void __DSB(void)
+{
+}
+
+void __ISB(void)
+{
+}
+
+void __NOP(void)
+{
+}
+
+/**************************************************************/
+
+void NVIC_EnableIRQ(IRQn_Type irq)
+{
+	if (irq >= 0)
+		s_nvicEnabled |= 1U << irq;
+	SIM_Deliver();
+}
+
+/**************************************************************/
+
+void NVIC_DisableIRQ(IRQn_Type irq)
+{
+	if (irq >= 0)
+		s_nvicEnabled &= ~(1U << irq);
+}
+
+/**************************************************************/
+
+uint32_t NVIC_GetEnableIRQ(IRQn_Type irq)
+{
+	return (irq >= 0 && (s_nvicEnabled & (1U << irq))) ? 1U : 0U;
+}
+
+/**************************************************************/
+
+void NVIC_SetPendingIRQ(IRQn_Type irq)
+{
+	if (irq >= 0)
+		s_nvicPending |= 1U << irq;
+	SIM_Deliver();
+}
+
+/**************************************************************/
+
+void NVIC_ClearPendingIRQ(IRQn_Type irq)
+{
+	if (irq >= 0)
+		s_nvicPending &= ~(1U << irq);
+}
+
+/**************************************************************/
+
+void NVIC_SetPriority(IRQn_Type irq, uint32_t priority)
+{
+	(void)irq;
+	(void)priority;
+}
+
+/**************************************************************/
+
+void NVIC_SystemReset(void)
+{
+	SIM_Trace("NVIC_SystemReset");
+	SIM_Exit(SIM_EXIT_RESET);
+}
+
+/**************************************************************/
+
+uint32_t SysTick_Config(uint32_t ticks)
+{
+	if ((ticks - 1UL) > SysTick_LOAD_RELOAD_Msk)
+		return 1UL;
+
+	SysTick->LOAD = ticks - 1UL;
+	SysTick->VAL = 0UL;
+	SysTick->CTRL = SysTick_CTRL_CLKSOURCE_Msk | SysTick_CTRL_TICKINT_Msk | SysTick_CTRL_ENABLE_Msk;
+
+	SIM_Cancel(s_sysTickEvent);
+	s_sysTickPeriod = (sim_time_t)ticks * SIM_SEC(1) / SystemCoreClock;
+	s_sysTickEpoch = s_now;
+	s_sysTickEvent = SIM_Schedule(s_now + s_sysTickPeriod, SIM_SysTickEvent, NULL);
+
+	return 0UL;
+}
+
+/**************************************************************/
+
+static void SIM_SysTickEvent(void *arg)
+{
+	(void)arg;
+
+	s_sysTickEvent = SIM_Schedule(s_now + s_sysTickPeriod, SIM_SysTickEvent, NULL);
+
+	if (s_sleeping || !(SysTick->CTRL & SysTick_CTRL_ENABLE_Msk))
+		return;
+
+	SysTick->CTRL |= SysTick_CTRL_COUNTFLAG_Msk;
+	if (SysTick->CTRL & SysTick_CTRL_TICKINT_Msk)
+	{
+		s_sysTickPending = true;
+		SCB->ICSR |= SCB_ICSR_PENDSTSET_Msk;
+	}
+}
+
+
+/****************************************************************************
+ ******************************* Clocks *************************************
+ ***************************************************************************/
+
+void BOARD_InitBootClocks(void)
+{
+	SystemCoreClock = SIM_CORE_CLOCK_HZ;
+}
+
+/**************************************************************/
+
+uint32_t CLOCK_GetFreq(clock_name_t clockName)
+{
+	switch (clockName)
+	{
+		case kCLOCK_CoreSysClk:
+		case kCLOCK_PlatClk:
+		case kCLOCK_McgInternalRefClk:
+			return SIM_CORE_CLOCK_HZ;
+		case kCLOCK_BusClk:
+		case kCLOCK_FlashClk:
+			return SIM_BUS_CLOCK_HZ;
+		case kCLOCK_Er32kClk:
+		case kCLOCK_Osc0ErClk:
+			return 32768U;
+		case kCLOCK_LpoClk:
+			return SIM_LPO_CLOCK_HZ;
+		default:
+			return 0U;
+	}
+}
+
+/**************************************************************/
+
+void CLOCK_EnableClock(clock_ip_name_t name)
+{
+	(void)name;
+}
+
+void CLOCK_DisableClock(clock_ip_name_t name)
+{
+	(void)name;
+}
+
+/**************************************************************/
+
+void CLOCK_SetClkOutClock(uint32_t src)
+{
+	SIM->SOPT2 = (SIM->SOPT2 & ~SIM_SOPT2_CLKOUTSEL_MASK) | SIM_SOPT2_CLKOUTSEL(src);
+	SIM_Trace("CLKOUT select %u", src);
+}
+
+/**************************************************************/
+
+void SIM_SetUID(uint32_t uidmh, uint32_t uidml, uint32_t uidl)
+{
+	SIM->SDID = 0x16231495U;	// KL27 family/series ID
+	SIM->UIDMH = uidmh;
+	SIM->UIDML = uidml;
+	SIM->UIDL = uidl;
+}
+
+
+/****************************************************************************
+ **************************** External inputs *******************************
+ ***************************************************************************/
+
+// Observe every LPUART0 RX byte and driven pin level as it reaches the MCU
+void SIM_TapInputs(sim_byte_fn_t byteFn, sim_edge_fn_t edgeFn, void *ctx)
+{
+	s_tapByte = byteFn;
+	s_tapEdge = edgeFn;
+	s_tapCtx = ctx;
+}
+
+/**************************************************************/
+
+// Discard SIM_LPUART0_Receive() and SIM_DrivePin() from device models, so that
+// a recording fed in with the SIM_*Inject* calls is the only source of input
+void SIM_MuteInputs(bool mute)
+{
+	s_inputsMuted = mute;
+}
+
+/**************************************************************/
+
+// Changes whenever a new event starts: inputs with the same serial arrived
+// together, with no chance for an interrupt in between
+uint64_t SIM_EventSerial(void)
+{
+	return s_eventSerial;
+}
+
+
+/****************************************************************************
+ ****************************** GPIO / PORT *********************************
+ ***************************************************************************/
+
+static int SIM_PortIndex(GPIO_Type *base)
+{
+	int i;
+
+	for (i = 0; i < 5; ++i)
+	{
+		if (s_gpios[i] == base)
+			return i;
+	}
+
+	return -1;
+}
+
+/**************************************************************/
+
+void SIM_AttachPin(GPIO_Type *base, uint32_t pin, sim_pin_fn_t fn, void *ctx)
+{
+	if (s_pinWatcherCount >= SIM_MAX_PIN_WATCHERS)
+		return;
+
+	s_pinWatchers[s_pinWatcherCount].gpio = base;
+	s_pinWatchers[s_pinWatcherCount].pin = pin;
+	s_pinWatchers[s_pinWatcherCount].fn = fn;
+	s_pinWatchers[s_pinWatcherCount].ctx = ctx;
+	s_pinWatcherCount++;
+}
+
+/**************************************************************/
+
+uint32_t SIM_PinOutput(GPIO_Type *base, uint32_t pin)
+{
+	return (base->PDOR >> pin) & 0x01U;
+}
+
+/**************************************************************/
+
+// Latch the pin interrupt flag if the edge matches the PORT IRQC setting
+static void SIM_PinEdge(int port, uint32_t pin, uint32_t prev, uint32_t level)
+{
+	PORT_Type *p = s_ports[port];
+	uint32_t irqc = (p->PCR[pin] & PORT_PCR_IRQC_MASK) >> PORT_PCR_IRQC_SHIFT;
+	bool hit = false;
+
+	switch (irqc)
+	{
+		case kPORT_InterruptLogicZero:
+			hit = (level == 0);
+			break;
+		case kPORT_InterruptRisingEdge:
+			hit = (prev == 0 && level == 1);
+			break;
+		case kPORT_InterruptFallingEdge:
+			hit = (prev == 1 && level == 0);
+			break;
+		case kPORT_InterruptEitherEdge:
+			hit = (prev != level);
+			break;
+		case kPORT_InterruptLogicOne:
+			hit = (level == 1);
+			break;
+		default:
+			break;
+	}
+
+	if (hit)
+	{
+		p->ISFR |= 1U << pin;
+		p->PCR[pin] |= PORT_PCR_ISF_MASK;
+	}
+}
+
+/**************************************************************/
+
+// Drive an input pin from outside the MCU (device model, USB-to-serial adapter)
+void SIM_DrivePin(GPIO_Type *base, uint32_t pin, uint32_t level)
+{
+	if (!s_inputsMuted)
+		SIM_InjectPin(base, pin, level);
+}
+
+/**************************************************************/
+
+// Drive an input pin even while device models are muted (replay)
+void SIM_InjectPin(GPIO_Type *base, uint32_t pin, uint32_t level)
+{
+	int port = SIM_PortIndex(base);
+	uint32_t prev;
+
+	if (port < 0)
+		return;
+
+	if (s_tapEdge)
+		s_tapEdge(s_tapCtx, base, pin, level ? 1U : 0U);
+
+	level = level ? 1U : 0U;
+	prev = (s_pinExternal[port] >> pin) & 0x01U;
+	if (level)
+		s_pinExternal[port] |= 1U << pin;
+	else
+		s_pinExternal[port] &= ~(1U << pin);
+
+	if (!(base->PDDR & (1U << pin)))
+	{
+		base->PDIR = (base->PDIR & ~(1U << pin)) | (level << pin);
+	}
+
+	SIM_PinEdge(port, pin, prev, level);
+	SIM_Deliver();
+}
+
+/**************************************************************/
+
+void GPIO_PinInit(GPIO_Type *base, uint32_t pin, const gpio_pin_config_t *config)
+{
+	int port = SIM_PortIndex(base);
+
+	if (config->pinDirection == kGPIO_DigitalInput)
+	{
+		base->PDDR &= ~(1U << pin);
+		if (port >= 0)
+			base->PDIR = (base->PDIR & ~(1U << pin)) | (s_pinExternal[port] & (1U << pin));
+	}
+	else
+	{
+		GPIO_PinWrite(base, pin, config->outputLogic);
+		base->PDDR |= 1U << pin;
+		base->PDIR = (base->PDIR & ~(1U << pin)) | (base->PDOR & (1U << pin));
+	}
+}
+
+/**************************************************************/
+
+void GPIO_PinWrite(GPIO_Type *base, uint32_t pin, uint8_t output)
+{
+	uint32_t prev = (base->PDOR >> pin) & 0x01U;
+	uint32_t level = output ? 1U : 0U;
+	uint32_t i;
+
+	if (level)
+		base->PDOR |= 1U << pin;
+	else
+		base->PDOR &= ~(1U << pin);
+
+	if (base->PDDR & (1U << pin))
+		base->PDIR = (base->PDIR & ~(1U << pin)) | (level << pin);
+
+	if (prev == level)
+		return;
+
+	for (i = 0; i < s_pinWatcherCount; ++i)
+	{
+		if (s_pinWatchers[i].gpio == base && s_pinWatchers[i].pin == pin)
+			s_pinWatchers[i].fn(s_pinWatchers[i].ctx, level);
+	}
+}
+
+/**************************************************************/
+
+uint32_t GPIO_PortGetInterruptFlags(GPIO_Type *base)
+{
+	int port = SIM_PortIndex(base);
+
+	return (port < 0) ? 0U : s_ports[port]->ISFR;
+}
+
+/**************************************************************/
+
+void GPIO_PortClearInterruptFlags(GPIO_Type *base, uint32_t mask)
+{
+	int port = SIM_PortIndex(base);
+	uint32_t pin;
+
+	if (port < 0)
+		return;
+
+	s_ports[port]->ISFR &= ~mask;
+	for (pin = 0; pin < 32; ++pin)
+	{
+		if (mask & (1U << pin))
+		{
+			s_ports[port]->PCR[pin] &= ~PORT_PCR_ISF_MASK;
+			// level-sensitive modes re-assert while the level persists
+			uint32_t level = (s_pinExternal[port] >> pin) & 0x01U;
+			SIM_PinEdge(port, pin, level, level);
+		}
+	}
+}
+
+
+/****************************************************************************
+ ******************************** I2C0 **************************************
+ ***************************************************************************/
+
+void SIM_AttachI2C(sim_i2c_device_t *dev)
+{
+	dev->next = s_i2cDevices;
+	s_i2cDevices = dev;
+}
+
+/**************************************************************/
+
+void I2C_MasterInit(I2C_Type *base, const i2c_master_config_t *masterConfig, uint32_t srcClock_Hz)
+{
+	(void)srcClock_Hz;
+
+	s_i2cBaud = masterConfig->baudRate_Bps ? masterConfig->baudRate_Bps : 100000U;
+	base->C1 = masterConfig->enableMaster ? I2C_C1_IICEN_MASK : 0U;
+}
+
+/**************************************************************/
+
+void I2C_MasterDeinit(I2C_Type *base)
+{
+	base->C1 = 0U;
+}
+
+/**************************************************************/
+
+status_t I2C_MasterTransferBlocking(I2C_Type *base, i2c_master_transfer_t *xfer)
+{
+	sim_i2c_device_t *dev;
+	uint8_t wbuf[4 + 512];
+	size_t wlen = 0, bytes, i;
+	sim_time_t bitTime = SIM_SEC(1) / s_i2cBaud, busTime;
+	status_t result = kStatus_Success;
+
+	if (!(base->C1 & I2C_C1_IICEN_MASK))
+		return kStatus_I2C_Busy;
+
+	for (dev = s_i2cDevices; dev; dev = dev->next)
+	{
+		if (dev->address == xfer->slaveAddress)
+			break;
+	}
+
+	// 9 clocks per byte (8 data + ACK), plus START/STOP and any repeated START
+	bytes = 1 + xfer->subaddressSize + xfer->dataSize;
+	if (xfer->direction == kI2C_Read && xfer->subaddressSize)
+		bytes += 1;
+	busTime = bitTime * (9 * bytes + 2);
+
+	if (!dev)
+	{
+		busTime = bitTime * (9 + 2);	// address byte NAKed, then STOP
+		result = kStatus_I2C_Addr_Nak;
+	}
+
+	g_simStats.i2cTransfers++;
+	g_simStats.i2cBusTime += busTime;
+	SIM_Advance(busTime);
+
+	if (dev)
+	{
+		g_simStats.i2cBytes += bytes;
+
+		for (i = xfer->subaddressSize; i > 0; --i)  // subaddress goes out MSB first
+		{
+			wbuf[wlen++] = (uint8_t)(xfer->subaddress >> (8 * (i - 1)));
+		}
+
+		if (xfer->direction == kI2C_Write)
+		{
+			if (xfer->dataSize > sizeof(wbuf) - wlen)
+				return kStatus_InvalidArgument;
+			memcpy(&wbuf[wlen], xfer->data, xfer->dataSize);
+			wlen += xfer->dataSize;
+			result = dev->write(dev->ctx, wbuf, wlen);
+		}
+		else
+		{
+			if (wlen)
+				result = dev->write(dev->ctx, wbuf, wlen);
+			if (result == kStatus_Success)
+				result = dev->read(dev->ctx, xfer->data, xfer->dataSize);
+		}
+	}
+
+	if (result != kStatus_Success)
+	{
+		g_simStats.i2cNaks++;
+		SIM_Trace("I2C 0x%02X %s NAK", xfer->slaveAddress, xfer->direction == kI2C_Write ? "write" : "read");
+	}
+
+	return result;
+}
+
+
+/****************************************************************************
+ ******************************* LPUART0 ************************************
+ ***************************************************************************/
+
+void SIM_AttachLPUART0(sim_byte_fn_t fn, void *ctx)
+{
+	s_lpuartTx = fn;
+	s_lpuartTxCtx = ctx;
+}
+
+/**************************************************************/
+
+sim_time_t SIM_LPUART0_ByteTime(void)
+{
+	return SIM_SEC(10) / s_lpuartBaud;	// start + 8 data + stop
+}
+
+/**************************************************************/
+
+// A byte has finished arriving on LPUART0_RX
+void SIM_LPUART0_Receive(uint8_t data)
+{
+	if (!s_inputsMuted)
+		SIM_LPUART0_Inject(data);
+}
+
+/**************************************************************/
+
+// A byte on the NXH_TX line even while device models are muted (replay)
+void SIM_LPUART0_Inject(uint8_t data)
+{
+	if (s_tapByte)
+		s_tapByte(s_tapCtx, data);
+
+	if (!(LPUART0->CTRL & LPUART_CTRL_RE_MASK))
+		return;
+
+	if (s_sleeping)  // MCGIRCLK is disabled in STOP modes (clock_config.c)
+	{
+		g_simStats.lpuartRxSleepDrops++;
+		return;
+	}
+
+	// While OR is set no further data is stored, even if RDRF has been cleared
+	if (LPUART0->STAT & (LPUART_STAT_RDRF_MASK | LPUART_STAT_OR_MASK))
+	{
+		LPUART0->STAT |= LPUART_STAT_OR_MASK;
+		g_simStats.lpuartRxOverruns++;
+	}
+	else
+	{
+		LPUART0->DATA = data;
+		LPUART0->STAT |= LPUART_STAT_RDRF_MASK;
+		g_simStats.lpuartRxBytes++;
+		s_lpuartRxLatched = s_now;
+	}
+	// Not delivered here: the interrupt is taken once the calling event returns, so two
+	// bytes received in the same event overrun exactly as they would on the line
+}
+
+/**************************************************************/
+
+status_t LPUART_Init(LPUART_Type *base, const lpuart_config_t *config, uint32_t srcClock_Hz)
+{
+	(void)srcClock_Hz;
+
+	if (base == LPUART0)
+		s_lpuartBaud = config->baudRate_Bps;
+
+	base->STAT = LPUART_STAT_TDRE_MASK | LPUART_STAT_TC_MASK;
+	base->CTRL = (config->enableTx ? LPUART_CTRL_TE_MASK : 0U) | (config->enableRx ? LPUART_CTRL_RE_MASK : 0U);
+
+	return kStatus_Success;
+}
+
+/**************************************************************/
+
+void LPUART_Deinit(LPUART_Type *base)
+{
+	base->CTRL = 0U;
+	base->STAT = 0U;
+}
+
+/**************************************************************/
+
+uint32_t LPUART_GetStatusFlags(LPUART_Type *base)
+{
+	return base->STAT;
+}
+
+/**************************************************************/
+
+status_t LPUART_ClearStatusFlags(LPUART_Type *base, uint32_t mask)
+{
+	base->STAT &= ~(mask & (LPUART_STAT_OR_MASK | LPUART_STAT_IDLE_MASK));
+
+	if (mask & (LPUART_STAT_RDRF_MASK | LPUART_STAT_TDRE_MASK | LPUART_STAT_TC_MASK))
+		return kStatus_LPUART_FlagCannotClearManually;
+
+	return kStatus_Success;
+}
+
+/**************************************************************/
+
+void LPUART_EnableInterrupts(LPUART_Type *base, uint32_t mask)
+{
+	base->CTRL |= mask & (LPUART_CTRL_RIE_MASK | LPUART_CTRL_ORIE_MASK);
+	SIM_Deliver();
+}
+
+/**************************************************************/
+
+void LPUART_DisableInterrupts(LPUART_Type *base, uint32_t mask)
+{
+	base->CTRL &= ~(mask & (LPUART_CTRL_RIE_MASK | LPUART_CTRL_ORIE_MASK));
+}
+
+/**************************************************************/
+
+uint32_t LPUART_GetEnabledInterrupts(LPUART_Type *base)
+{
+	return base->CTRL & (LPUART_CTRL_RIE_MASK | LPUART_CTRL_ORIE_MASK);
+}
+
+/**************************************************************/
+
+uint8_t LPUART_ReadByte(LPUART_Type *base)
+{
+	if (base == LPUART0 && (base->STAT & LPUART_STAT_RDRF_MASK) && s_now - s_lpuartRxLatched > g_simStats.lpuartRxWaitMax)
+		g_simStats.lpuartRxWaitMax = s_now - s_lpuartRxLatched;
+
+	base->STAT &= ~LPUART_STAT_RDRF_MASK;
+	return (uint8_t)base->DATA;
+}
+
+/**************************************************************/
+
+void LPUART_WriteByte(LPUART_Type *base, uint8_t data)
+{
+	LPUART_WriteBlocking(base, &data, 1);
+}
+
+/**************************************************************/
+
+void LPUART_WriteBlocking(LPUART_Type *base, const uint8_t *data, size_t length)
+{
+	size_t i;
+
+	if (base != LPUART0 || !(base->CTRL & LPUART_CTRL_TE_MASK))
+		return;
+
+	for (i = 0; i < length; ++i)
+	{
+		SIM_Advance(SIM_LPUART0_ByteTime());
+		g_simStats.lpuartTxBytes++;
+		if (s_lpuartTx)
+			s_lpuartTx(s_lpuartTxCtx, data[i]);
+	}
+}
+
+
+/****************************************************************************
+ **************************** UART2 / console *******************************
+ ***************************************************************************/
+
+void SIM_AttachConsole(sim_line_fn_t fn, void *ctx)
+{
+	s_consoleLine = fn;
+	s_consoleLineCtx = ctx;
+}
+
+/**************************************************************/
+
+void SIM_SetConsoleEcho(FILE *fp)
+{
+	s_consoleEcho = fp;
+}
+
+/**************************************************************/
+
+static sim_time_t SIM_ConsoleCharTime(void)
+{
+	return SIM_SEC(10) / s_consoleBaud;
+}
+
+/**************************************************************/
+
+static void SIM_ConsoleRxEvent(void *arg)
+{
+	uint8_t ch = (uint8_t)(uintptr_t)arg;
+	uint32_t mux = (PORTE->PCR[23] & PORT_PCR_MUX_MASK) >> PORT_PCR_MUX_SHIFT;
+
+	// KL_RX is borrowed as a GPIO by KL_Check_RX(); UART2 sees nothing then
+	if (!(UART2->C2 & UART_C2_RE_MASK) || mux != kPORT_MuxAlt4 || (UART2->S1 & UART_S1_RDRF_MASK))
+	{
+		if (UART2->S1 & UART_S1_RDRF_MASK)
+			UART2->S1 |= UART_S1_OR_MASK;
+		g_simStats.consoleRxLost++;
+		return;
+	}
+
+	UART2->D = ch;
+	UART2->S1 |= UART_S1_RDRF_MASK;
+}
+
+/**************************************************************/
+
+// Queue characters from the host side of the USB-to-serial adapter
+void SIM_ConsoleType(sim_time_t when, const char *text, sim_time_t charGap)
+{
+	if (charGap < SIM_ConsoleCharTime())
+		charGap = SIM_ConsoleCharTime();
+
+	for (; *text; ++text, when += charGap)
+	{
+		SIM_Schedule(when, SIM_ConsoleRxEvent, (void *)(uintptr_t)(uint8_t)*text);
+	}
+}
+
+/**************************************************************/
+
+status_t UART_Init(UART_Type *base, const uart_config_t *config, uint32_t srcClock_Hz)
+{
+	(void)srcClock_Hz;
+
+	s_consoleBaud = config->baudRate_Bps;
+	base->C2 = (config->enableTx ? UART_C2_TE_MASK : 0U) | (config->enableRx ? UART_C2_RE_MASK : 0U);
+	base->S1 = 0U;
+
+	return kStatus_Success;
+}
+
+/**************************************************************/
+
+void UART_Deinit(UART_Type *base)
+{
+	base->C2 = 0U;
+}
+
+/**************************************************************/
+
+uint32_t UART_GetStatusFlags(UART_Type *base)
+{
+	return base->S1;
+}
+
+/**************************************************************/
+
+status_t UART_ClearStatusFlags(UART_Type *base, uint32_t mask)
+{
+	base->S1 &= ~(mask & UART_S1_OR_MASK);
+	return kStatus_Success;
+}
+
+/**************************************************************/
+
+void UART_EnableInterrupts(UART_Type *base, uint32_t mask)
+{
+	base->C2 |= mask & UART_C2_RIE_MASK;
+}
+
+/**************************************************************/
+
+void UART_DisableInterrupts(UART_Type *base, uint32_t mask)
+{
+	base->C2 &= ~(mask & UART_C2_RIE_MASK);
+}
+
+/**************************************************************/
+
+uint8_t UART_ReadByte(UART_Type *base)
+{
+	base->S1 &= ~(UART_S1_RDRF_MASK | UART_S1_OR_MASK);
+	return base->D;
+}
+
+/**************************************************************/
+
+void UART_WriteBlocking(UART_Type *base, const uint8_t *data, size_t length)
+{
+	(void)base;
+
+	while (length--)
+	{
+		DbgConsole_Putchar(*data++);
+	}
+}
+
+/**************************************************************/
+
+status_t DbgConsole_Init(uint32_t baseAddr, uint32_t baudRate, uint8_t device, uint32_t clkSrcFreq)
+{
+	(void)baseAddr;
+	(void)device;
+	(void)clkSrcFreq;
+
+	s_consoleBaud = baudRate;
+	return kStatus_Success;
+}
+
+/**************************************************************/
+
+status_t DbgConsole_Deinit(void)
+{
+	return kStatus_Success;
+}
+
+/**************************************************************/
+
+// Blocking transmit: each character holds the CPU for one frame time
+int DbgConsole_Putchar(int ch)
+{
+	if (!(UART2->C2 & UART_C2_TE_MASK))
+		return ch;
+
+	SIM_Advance(SIM_ConsoleCharTime());
+	g_simStats.consoleTxBytes++;
+
+	if (ch == '\r')
+		return ch;
+
+	if (s_consoleEcho)
+		fputc(ch, s_consoleEcho);
+
+	if (ch == '\n' || s_consoleLineLen >= SIM_CONSOLE_LINE_SIZE - 1)
+	{
+		s_consoleLineBuf[s_consoleLineLen] = '\0';
+		s_consoleLineLen = 0;
+		if (s_consoleLine)
+			s_consoleLine(s_consoleLineCtx, s_consoleLineBuf);
+	}
+
+	if (ch != '\n')
+		s_consoleLineBuf[s_consoleLineLen++] = (char)ch;
+
+	return ch;
+}
+
+/**************************************************************/
+
+int DbgConsole_Printf(const char *fmt_s, ...)
+{
+	char buf[SIM_PRINTF_BUF_SIZE];
+	va_list ap;
+	int len, i;
+
+	va_start(ap, fmt_s);
+	len = vsnprintf(buf, sizeof(buf), fmt_s, ap);
+	va_end(ap);
+
+	if (len > (int)sizeof(buf) - 1)
+		len = sizeof(buf) - 1;
+
+	for (i = 0; i < len; ++i)
+	{
+		DbgConsole_Putchar((uint8_t)buf[i]);
+	}
+
+	return len;
+}
+
+/**************************************************************/
+
+// Blocking receive: time passes until the host sends a character
+int DbgConsole_Getchar(void)
+{
+	while (!(UART2->S1 & UART_S1_RDRF_MASK))
+	{
+		SIM_WaitForEvent();
+	}
+
+	return UART_ReadByte(UART2);
+}
+
+/**************************************************************/
+
+status_t DbgConsole_Flush(void)
+{
+	return kStatus_Success;	// transmit is already synchronous
+}
+
+
+/****************************************************************************
+ ******************************** TPM0 **************************************
+ ***************************************************************************/
+
+void SIM_AttachPiezo(sim_tone_fn_t fn, void *ctx)
+{
+	s_piezo = fn;
+	s_piezoCtx = ctx;
+}
+
+/**************************************************************/
+
+static uint32_t SIM_TpmClock(TPM_Type *base)
+{
+	return SIM_CORE_CLOCK_HZ >> (base->SC & TPM_SC_PS_MASK);
+}
+
+/**************************************************************/
+
+static uint32_t SIM_TpmCnv(uint32_t mod, uint8_t dutyCyclePercent)
+{
+	uint32_t cnv = (mod * dutyCyclePercent) / 100U;
+
+	return (cnv >= mod) ? mod + 1U : cnv;
+}
+
+/**************************************************************/
+
+static void SIM_TpmNotify(TPM_Type *base, bool on)
+{
+	uint32_t duty = base->CONTROLS[kTPM_Chnl_4].CnV;
+
+	if (base != TPM0)
+		return;
+
+	if (on && duty)
+	{
+		uint32_t freq = SIM_TpmClock(base) / (base->MOD + 1U);
+		SIM_Trace("piezo %u Hz", freq);
+		if (s_piezo)
+			s_piezo(s_piezoCtx, freq, true);
+	}
+	else
+	{
+		if (s_piezo)
+			s_piezo(s_piezoCtx, 0, false);
+	}
+}
+
+/**************************************************************/
+
+void TPM_Init(TPM_Type *base, const tpm_config_t *config)
+{
+	base->SC = TPM_SC_PS(config->prescale);
+	base->CNT = 0U;
+	base->MOD = 0xFFFFU;
+}
+
+/**************************************************************/
+
+void TPM_Deinit(TPM_Type *base)
+{
+	TPM_StopTimer(base);
+}
+
+/**************************************************************/
+
+status_t TPM_SetupPwm(TPM_Type *base,
+                      const tpm_chnl_pwm_signal_param_t *chnlParams,
+                      uint8_t numOfChnls,
+                      tpm_pwm_mode_t mode,
+                      uint32_t pwmFreq_Hz,
+                      uint32_t srcClock_Hz)
+{
+	uint32_t mod, i;
+
+	(void)srcClock_Hz;
+
+	if (pwmFreq_Hz == 0U || mode != kTPM_EdgeAlignedPwm)
+		return kStatus_Fail;
+
+	mod = (SIM_TpmClock(base) / pwmFreq_Hz) - 1U;
+	if (mod > 65535U)  // same limit as the SDK driver: note is left unchanged
+		return kStatus_Fail;
+
+	base->MOD = mod;
+	for (i = 0; i < numOfChnls; ++i)
+	{
+		base->CONTROLS[chnlParams[i].chnlNumber].CnSC = TPM_CnSC_MSB_MASK | TPM_CnSC_ELSB_MASK;
+		base->CONTROLS[chnlParams[i].chnlNumber].CnV = SIM_TpmCnv(mod, chnlParams[i].dutyCyclePercent);
+	}
+
+	return kStatus_Success;
+}
+
+/**************************************************************/
+
+void TPM_UpdatePwmDutycycle(TPM_Type *base,
+                            tpm_chnl_t chnlNumber,
+                            tpm_pwm_mode_t currentPwmMode,
+                            uint8_t dutyCyclePercent)
+{
+	(void)currentPwmMode;
+
+	base->CONTROLS[chnlNumber].CnV = SIM_TpmCnv(base->MOD, dutyCyclePercent);
+}
+
+/**************************************************************/
+
+void TPM_EnableInterrupts(TPM_Type *base, uint32_t mask)
+{
+	if (mask & kTPM_TimeOverflowInterruptEnable)
+		base->SC |= TPM_SC_TOIE_MASK;
+}
+
+void TPM_DisableInterrupts(TPM_Type *base, uint32_t mask)
+{
+	if (mask & kTPM_TimeOverflowInterruptEnable)
+		base->SC &= ~TPM_SC_TOIE_MASK;
+}
+
+uint32_t TPM_GetStatusFlags(TPM_Type *base)
+{
+	return (base->SC & TPM_SC_TOF_MASK) ? kTPM_TimeOverflowFlag : 0U;
+}
+
+void TPM_ClearStatusFlags(TPM_Type *base, uint32_t mask)
+{
+	if (mask & kTPM_TimeOverflowFlag)
+		base->SC &= ~TPM_SC_TOF_MASK;
+}
+
+/**************************************************************/
+
+void TPM_StartTimer(TPM_Type *base, tpm_clock_source_t clockSource)
+{
+	base->SC = (base->SC & ~TPM_SC_CMOD_MASK) | TPM_SC_CMOD(clockSource);
+	SIM_TpmNotify(base, true);
+}
+
+/**************************************************************/
+
+void TPM_StopTimer(TPM_Type *base)
+{
+	bool running = (base->SC & TPM_SC_CMOD_MASK) != 0;
+
+	base->SC &= ~TPM_SC_CMOD_MASK;
+	if (running)
+		SIM_TpmNotify(base, false);
+}
+
+
+/****************************************************************************
+ ******************************* LPTMR0 *************************************
+ ***************************************************************************/
+
+static sim_time_t SIM_LptmrPeriod(LPTMR_Type *base)
+{
+	return (sim_time_t)(base->CMR + 1U) * SIM_SEC(1) / SIM_LPO_CLOCK_HZ;
+}
+
+/**************************************************************/
+
+static void SIM_LptmrEvent(void *arg)
+{
+	(void)arg;
+
+	if (!(LPTMR0->CSR & LPTMR_CSR_TEN_MASK))
+		return;
+
+	LPTMR0->CSR |= LPTMR_CSR_TCF_MASK;	// counter resets on compare (TFC = 0)
+	s_lptmrStart = s_now;
+	s_lptmrEvent = SIM_Schedule(s_now + SIM_LptmrPeriod(LPTMR0), SIM_LptmrEvent, NULL);
+}
+
+/**************************************************************/
+
+void LPTMR_Init(LPTMR_Type *base, const lptmr_config_t *config)
+{
+	base->CSR = 0U;
+	base->PSR = (config->bypassPrescaler ? 0x4U : 0U) | config->prescalerClockSource;
+	base->CMR = 0U;
+	base->CNR = 0U;
+}
+
+/**************************************************************/
+
+void LPTMR_Deinit(LPTMR_Type *base)
+{
+	LPTMR_StopTimer(base);
+}
+
+/**************************************************************/
+
+void LPTMR_EnableInterrupts(LPTMR_Type *base, uint32_t mask)
+{
+	base->CSR = (base->CSR & ~LPTMR_CSR_TCF_MASK) | (mask & LPTMR_CSR_TIE_MASK) | (base->CSR & LPTMR_CSR_TCF_MASK);
+	SIM_Deliver();
+}
+
+/**************************************************************/
+
+void LPTMR_DisableInterrupts(LPTMR_Type *base, uint32_t mask)
+{
+	base->CSR &= ~(mask & LPTMR_CSR_TIE_MASK);
+}
+
+/**************************************************************/
+
+uint32_t LPTMR_GetStatusFlags(LPTMR_Type *base)
+{
+	return base->CSR & LPTMR_CSR_TCF_MASK;
+}
+
+/**************************************************************/
+
+void LPTMR_ClearStatusFlags(LPTMR_Type *base, uint32_t mask)
+{
+	base->CSR &= ~(mask & LPTMR_CSR_TCF_MASK);	// w1c
+}
+
+/**************************************************************/
+
+void LPTMR_SetTimerPeriod(LPTMR_Type *base, uint32_t ticks)
+{
+	base->CMR = ticks - 1U;
+}
+
+/**************************************************************/
+
+uint32_t LPTMR_GetCurrentTimerCount(LPTMR_Type *base)
+{
+	if (!(base->CSR & LPTMR_CSR_TEN_MASK))
+		return 0U;
+
+	return (uint32_t)((s_now - s_lptmrStart) * SIM_LPO_CLOCK_HZ / SIM_SEC(1));
+}
+
+/**************************************************************/
+
+void LPTMR_StartTimer(LPTMR_Type *base)
+{
+	if (base->CSR & LPTMR_CSR_TEN_MASK)
+		return;
+
+	base->CSR |= LPTMR_CSR_TEN_MASK;
+	s_lptmrStart = s_now;
+	s_lptmrEvent = SIM_Schedule(s_now + SIM_LptmrPeriod(base), SIM_LptmrEvent, NULL);
+}
+
+/**************************************************************/
+
+void LPTMR_StopTimer(LPTMR_Type *base)
+{
+	base->CSR &= ~(LPTMR_CSR_TEN_MASK | LPTMR_CSR_TCF_MASK);	// disabling also clears the counter and TCF
+	SIM_Cancel(s_lptmrEvent);
+	s_lptmrEvent = 0;
+}
+
+
+/****************************************************************************
+ ********************************* SMC **************************************
+ ***************************************************************************/
+
+smc_power_state_t SMC_GetPowerModeState(SMC_Type *base)
+{
+	(void)base;
+	return kSMC_PowerStateRun;
+}
+
+/**************************************************************/
+
+void SMC_PreEnterStopModes(void)
+{
+	s_savedPrimask = DisableGlobalIRQ();
+}
+
+void SMC_PostExitStopModes(void)
+{
+	EnableGlobalIRQ(s_savedPrimask);
+}
+
+void SMC_PreEnterWaitModes(void)
+{
+	s_savedPrimask = DisableGlobalIRQ();
+}
+
+void SMC_PostExitWaitModes(void)
+{
+	EnableGlobalIRQ(s_savedPrimask);
+}
+
+/**************************************************************/
+
+status_t SMC_SetPowerModeRun(SMC_Type *base)
+{
+	(void)base;
+	return kStatus_Success;
+}
+
+/**************************************************************/
+
+status_t SMC_SetPowerModeWait(SMC_Type *base)
+{
+	(void)base;
+
+	SCB->SCR &= ~SCB_SCR_SLEEPDEEP_Msk;
+	__WFI();
+	return kStatus_Success;
+}
+
+/**************************************************************/
+
+status_t SMC_SetPowerModeVlps(SMC_Type *base)
+{
+	base->PMCTRL = (base->PMCTRL & ~SMC_PMCTRL_STOPM_MASK) | 0x2U;	// STOPM = VLPS
+	SCB->SCR |= SCB_SCR_SLEEPDEEP_Msk;
+	__WFI();
+	SCB->SCR &= ~SCB_SCR_SLEEPDEEP_Msk;
+	return kStatus_Success;
+}
+
+
+/****************************************************************************
+ ********************************* CRC **************************************
+ ***************************************************************************/
+
+static uint32_t SIM_CrcReflect(uint32_t value, uint32_t bits)
+{
+	uint32_t out = 0;
+
+	while (bits--)
+	{
+		out = (out << 1) | (value & 1U);
+		value >>= 1;
+	}
+	return out;
+}
+
+/**************************************************************/
+
+void CRC_GetDefaultConfig(crc_config_t *config)	// CRC-16/CCITT-FALSE
+{
+	config->polynomial = 0x1021U;
+	config->seed = 0xFFFFU;
+	config->reflectIn = false;
+	config->reflectOut = false;
+	config->complementChecksum = false;
+	config->crcBits = kCrcBits16;
+	config->crcResult = kCrcFinalChecksum;
+}
+
+/**************************************************************/
+
+void CRC_Init(CRC_Type *base, const crc_config_t *config)
+{
+	s_crcConfig = *config;
+	base->GPOLY = config->polynomial;
+	base->DATA = config->seed;
+}
+
+/**************************************************************/
+
+void CRC_WriteData(CRC_Type *base, const uint8_t *data, size_t dataSize)
+{
+	uint32_t width = (s_crcConfig.crcBits == kCrcBits32) ? 32U : 16U;
+	uint32_t top = 1UL << (width - 1U);
+	uint32_t mask = (width == 32U) ? 0xFFFFFFFFUL : 0xFFFFUL;
+	uint32_t crc = base->DATA;
+	uint32_t bit;
+
+	while (dataSize--)
+	{
+		crc ^= (s_crcConfig.reflectIn ? SIM_CrcReflect(*data, 8U) : *data) << (width - 8U);
+		data++;
+		for (bit = 0; bit < 8U; bit++)
+			crc = (crc & top) ? (crc << 1) ^ base->GPOLY : crc << 1;
+		crc &= mask;
+	}
+
+	base->DATA = crc;
+}
+
+/**************************************************************/
+
+uint32_t CRC_Get32bitResult(CRC_Type *base)
+{
+	uint32_t width = (s_crcConfig.crcBits == kCrcBits32) ? 32U : 16U;
+	uint32_t crc = base->DATA;
+
+	if (s_crcConfig.crcResult == kCrcFinalChecksum)
+	{
+		if (s_crcConfig.reflectOut)
+			crc = SIM_CrcReflect(crc, width);
+		if (s_crcConfig.complementChecksum)
+			crc = ~crc & ((width == 32U) ? 0xFFFFFFFFUL : 0xFFFFUL);
+	}
+	return crc;
+}
+
+/**************************************************************/
+
+uint16_t CRC_Get16bitResult(CRC_Type *base)
+{
+	return (uint16_t)CRC_Get32bitResult(base);
+}
+
+
+/****************************************************************************
+ ******************************** Flash *************************************
+ ***************************************************************************/
+
+uint8_t *SIM_FlashBase(void)
+{
+	void *p;
+	int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+
+	if (s_flash)
+		return s_flash;
+
+#if defined(MAP_32BIT)
+	flags |= MAP_32BIT;
+#endif
+
+	// The firmware passes flash addresses around as uint32_t, so the array has
+	// to be reachable through a 32-bit pointer
+	p = mmap((void *)SIM_FLASH_MAP_HINT, SIM_FLASH_SIZE, PROT_READ | PROT_WRITE, flags, -1, 0);
+	if (p == MAP_FAILED || (uintptr_t)p + SIM_FLASH_SIZE > 0xFFFFFFFFUL)
+	{
+		fprintf(stderr, "sim: unable to map program flash below 4GB\n");
+		abort();
+	}
+
+	s_flash = p;
+	memset(s_flash, 0xFF, SIM_FLASH_SIZE);
+	return s_flash;
+}
+
+/**************************************************************/
+
+int SIM_FlashLoad(const char *path)
+{
+	FILE *fp = fopen(path, "rb");
+
+	if (!fp)
+		return 1;
+
+	if (fread(SIM_FlashBase(), 1, SIM_FLASH_SIZE, fp) == 0)
+	{
+		fclose(fp);
+		return 1;
+	}
+
+	fclose(fp);
+	return 0;
+}
+
+/**************************************************************/
+
+int SIM_FlashSave(const char *path)
+{
+	FILE *fp = fopen(path, "wb");
+	size_t n;
+
+	if (!fp)
+		return 1;
+
+	n = fwrite(SIM_FlashBase(), 1, SIM_FLASH_SIZE, fp);
+	fclose(fp);
+
+	return (n == SIM_FLASH_SIZE) ? 0 : 1;
+}
+
+/**************************************************************/
+
+// The core stalls on flash fetches while a command runs
+static void SIM_FlashCommand(sim_time_t duration)
+{
+	s_flashBusy = true;
+	g_simStats.flashBusyTime += duration;
+	SIM_Advance(duration);
+	s_flashBusy = false;
+	SIM_Deliver();
+}
+
+/**************************************************************/
+
+static status_t SIM_FlashCheckRange(flash_config_t *config, uint32_t start, uint32_t lengthInBytes, uint32_t align)
+{
+	if (start < config->blockBase || start + lengthInBytes > config->blockBase + config->totalSize)
+		return kStatus_FTFx_AddressError;
+
+	if ((start - config->blockBase) % align || lengthInBytes % align)
+		return kStatus_FTFx_AlignmentError;
+
+	return kStatus_FTFx_Success;
+}
+
+/**************************************************************/
+
+status_t FLASH_Init(flash_config_t *config)
+{
+	config->blockBase = (uint32_t)(uintptr_t)SIM_FlashBase();
+	config->totalSize = SIM_FLASH_SIZE;
+	config->sectorSize = SIM_FLASH_SECTOR_SIZE;
+
+	return kStatus_FTFx_Success;
+}
+
+/**************************************************************/
+
+status_t FLASH_Erase(flash_config_t *config, uint32_t start, uint32_t lengthInBytes, uint32_t key)
+{
+	status_t result;
+	uint32_t addr;
+
+	if (key != kFTFx_ApiEraseKey)
+		return kStatus_FTFx_EraseKeyError;
+
+	result = SIM_FlashCheckRange(config, start, lengthInBytes, config->sectorSize);
+	if (result != kStatus_FTFx_Success)
+		return result;
+
+	for (addr = start; addr < start + lengthInBytes; addr += config->sectorSize)
+	{
+		SIM_FlashCommand(SIM_FLASH_ERASE_SECTOR_TIME);
+		memset((uint8_t *)(uintptr_t)addr, 0xFF, config->sectorSize);
+		g_simStats.flashErases++;
+		g_simStats.flashSectorErases[(addr - config->blockBase) / config->sectorSize]++;
+		SIM_Trace("flash erase sector %u", (addr - config->blockBase) / config->sectorSize);
+	}
+
+	return kStatus_FTFx_Success;
+}
+
+/**************************************************************/
+
+status_t FLASH_Program(flash_config_t *config, uint32_t start, uint8_t *src, uint32_t lengthInBytes)
+{
+	status_t result;
+	uint32_t i;
+	uint8_t *dst = (uint8_t *)(uintptr_t)start;
+
+	result = SIM_FlashCheckRange(config, start, lengthInBytes, 4U);
+	if (result != kStatus_FTFx_Success)
+		return result;
+
+	for (i = 0; i < lengthInBytes; i += 4)
+	{
+		SIM_FlashCommand(SIM_FLASH_PROGRAM_LONGWORD_TIME);
+		dst[i + 0] &= src[i + 0];	// programming can only clear bits
+		dst[i + 1] &= src[i + 1];
+		dst[i + 2] &= src[i + 2];
+		dst[i + 3] &= src[i + 3];
+		g_simStats.flashPrograms++;
+	}
+
+	return kStatus_FTFx_Success;
+}
+
+/**************************************************************/
+
+status_t FLASH_VerifyProgram(flash_config_t *config,
+                             uint32_t start,
+                             uint32_t lengthInBytes,
+                             const uint8_t *expectedData,
+                             ftfx_margin_value_t margin,
+                             uint32_t *failedAddress,
+                             uint32_t *failedData)
+{
+	status_t result;
+	uint32_t i;
+	const uint8_t *p = (const uint8_t *)(uintptr_t)start;
+
+	(void)margin;
+
+	result = SIM_FlashCheckRange(config, start, lengthInBytes, 4U);
+	if (result != kStatus_FTFx_Success)
+		return result;
+
+	for (i = 0; i < lengthInBytes; i += 4)
+	{
+		if (memcmp(p + i, expectedData + i, 4) != 0)
+		{
+			if (failedAddress)
+				*failedAddress = start + i;
+			if (failedData)
+				memcpy(failedData, p + i, 4);
+			return kStatus_FTFx_CommandFailure;
+		}
+	}
+
+	return kStatus_FTFx_Success;
+}
+
+/**************************************************************/
+
+status_t FLASH_VerifyErase(flash_config_t *config, uint32_t start, uint32_t lengthInBytes, ftfx_margin_value_t margin)
+{
+	status_t result;
+	uint32_t i;
+	const uint8_t *p = (const uint8_t *)(uintptr_t)start;
+
+	(void)margin;
+
+	result = SIM_FlashCheckRange(config, start, lengthInBytes, 4U);
+	if (result != kStatus_FTFx_Success)
+		return result;
+
+	for (i = 0; i < lengthInBytes; ++i)
+	{
+		if (p[i] != 0xFF)
+			return kStatus_FTFx_CommandFailure;
+	}
+
+	return kStatus_FTFx_Success;
+}
+
+/**************************************************************/
+
+status_t FLASH_GetSecurityState(flash_config_t *config, ftfx_security_state_t *state)
+{
+	(void)config;
+
+	*state = kFTFx_SecurityStateNotSecure;
+	return kStatus_FTFx_Success;
+}
+
+/**************************************************************/
+
+status_t FLASH_GetProperty(flash_config_t *config, flash_property_tag_t whichProperty, uint32_t *value)
+{
+	switch (whichProperty)
+	{
+		case kFLASH_PropertyPflash0SectorSize:
+			*value = config->sectorSize;
+			break;
+		case kFLASH_PropertyPflash0TotalSize:
+		case kFLASH_PropertyPflash0BlockSize:
+			*value = config->totalSize;
+			break;
+		case kFLASH_PropertyPflash0BlockCount:
+			*value = 1U;
+			break;
+		case kFLASH_PropertyPflash0BlockBaseAddr:
+			*value = config->blockBase;
+			break;
+		default:
+			return kStatus_FTFx_UnknownProperty;
+	}
+
+	return kStatus_FTFx_Success;
+}
+
+/**************************************************************/
+
+status_t FTFx_CACHE_Init(ftfx_cache_config_t *config)
+{
+	(void)config;
+	return kStatus_FTFx_Success;
+}
+
+/**************************************************************/
+
+status_t FTFx_CACHE_ClearCachePrefetchSpeculation(ftfx_cache_config_t *config, bool isPreProcess)
+{
+	(void)config;
+	(void)isPreProcess;
+	return kStatus_FTFx_Success;
+}
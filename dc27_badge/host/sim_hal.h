@@ -0,0 +1,175 @@
+/*
+ * DEFCON 27 Official Badge - host simulation
+ *
+ * Simulated HAL for running dc27_badge.c on a Linux host.
+ *
+ * Time is virtual (nanoseconds) and only moves when the firmware blocks:
+ * SysTick_DelayTicks() (via the KL_IDLE() hook), VLPS sleep, GETCHAR, PRINTF,
+ * blocking I2C and LPUART transfers, and flash commands. Peripheral events
+ * live in a single time-ordered queue, and interrupts are delivered at those
+ * points whenever they are enabled and PRIMASK is clear, so ISR interleaving
+ * is deterministic from run to run.
+ */
+
+#ifndef _SIM_HAL_H_
+#define _SIM_HAL_H_
+
+#include <stdarg.h>
+#include <stdio.h>
+
+#include "fsl_common.h"
+#include "fsl_gpio.h"
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+/***************************************************************************
+ **************************** Definitions **********************************
+ ***************************************************************************/
+
+typedef uint64_t sim_time_t;	// virtual time (ns since power-up)
+
+#define SIM_NS(x)			((sim_time_t)(x))
+#define SIM_US(x)			((sim_time_t)(x) * 1000ULL)
+#define SIM_MS(x)			((sim_time_t)(x) * 1000000ULL)
+#define SIM_SEC(x)			((sim_time_t)(x) * 1000000000ULL)
+#define SIM_TIME_NEVER		UINT64_MAX
+
+#define SIM_FLASH_SIZE			(64U * 1024U)	// MKL27Z64 program flash
+#define SIM_FLASH_SECTOR_SIZE	1024U
+#define SIM_FLASH_SECTORS		(SIM_FLASH_SIZE / SIM_FLASH_SECTOR_SIZE)
+
+// Datasheet typical timings (MKL27Z64 Table 23, I2C/UART from bit rates)
+#define SIM_FLASH_ERASE_SECTOR_TIME		SIM_MS(14)		// tersscr
+#define SIM_FLASH_PROGRAM_LONGWORD_TIME	SIM_US(65)		// tpgm4
+#define SIM_VLPS_WAKEUP_TIME			SIM_NS(7500)	// VLPS -> RUN recovery
+
+typedef enum
+{
+	SIM_EXIT_DEADLINE = 0,	// ran for the requested amount of virtual time
+	SIM_EXIT_STOPPED,		// SIM_Stop() called by a device model or probe
+	SIM_EXIT_RESET,			// firmware called NVIC_SystemReset()
+	SIM_EXIT_RETURNED,		// firmware entry point returned
+	SIM_EXIT_DEADLOCK		// firmware is waiting and nothing is scheduled
+} sim_exit_t;
+
+typedef void (*sim_event_fn_t)(void *arg);
+typedef void (*sim_pin_fn_t)(void *ctx, uint32_t level);
+typedef void (*sim_byte_fn_t)(void *ctx, uint8_t data);
+typedef void (*sim_edge_fn_t)(void *ctx, GPIO_Type *gpio, uint32_t pin, uint32_t level);
+typedef void (*sim_line_fn_t)(void *ctx, const char *line);
+typedef void (*sim_tone_fn_t)(void *ctx, uint32_t freq_Hz, bool on);
+typedef void (*sim_probe_fn_t)(void);
+
+// I2C slave attached to I2C0
+// A master read with a subaddress is presented as write(subaddress) followed
+// by read(data), matching the repeated-start sequence on the bus.
+typedef struct sim_i2c_device
+{
+	uint8_t address;	// 7-bit slave address
+	void *ctx;
+	status_t (*write)(void *ctx, const uint8_t *data, size_t len);
+	status_t (*read)(void *ctx, uint8_t *data, size_t len);
+	struct sim_i2c_device *next;
+} sim_i2c_device_t;
+
+// Counters collected over a run
+typedef struct
+{
+	sim_time_t runTime;			// time spent in RUN mode
+	sim_time_t vlpsTime;		// time spent in VLPS
+	uint32_t vlpsEntries;
+
+	uint32_t irqCount[32];		// delivered interrupts by IRQ number
+	uint32_t sysTickCount;
+
+	uint32_t i2cTransfers;
+	uint32_t i2cBytes;
+	uint32_t i2cNaks;
+	sim_time_t i2cBusTime;
+
+	uint32_t lpuartRxBytes;		// bytes latched into LPUART0
+	uint32_t lpuartRxOverruns;	// bytes lost to a full receive data register
+	uint32_t lpuartRxSleepDrops;	// bytes lost while LPUART0 was unclocked in VLPS
+	sim_time_t lpuartRxWaitMax;	// longest a received byte sat in the data register before being read
+	uint32_t lpuartTxBytes;
+
+	uint32_t consoleTxBytes;
+	uint32_t consoleRxLost;		// typed characters lost to overrun or pin muxing
+
+	uint32_t flashErases;
+	uint32_t flashPrograms;		// longwords programmed
+	uint32_t flashSectorErases[SIM_FLASH_SECTORS];
+	sim_time_t flashBusyTime;
+	uint32_t flashIrqCount;		// interrupts taken while a flash command ran (handlers in RAM)
+} sim_stats_t;
+
+extern sim_stats_t g_simStats;
+
+
+/****************************************************************************
+ ********************* Function Prototypes **********************************
+ ***************************************************************************/
+
+// Run control
+sim_exit_t SIM_Run(void (*entry)(void), sim_time_t duration);
+void SIM_Stop(void);
+const char *SIM_ExitName(sim_exit_t);
+void SIM_SetProbe(sim_probe_fn_t);
+
+// Virtual clock and event queue
+sim_time_t SIM_Now(void);
+uint32_t SIM_Schedule(sim_time_t when, sim_event_fn_t, void *arg);
+uint32_t SIM_ScheduleInput(sim_time_t when, sim_event_fn_t, void *arg);
+uint32_t SIM_ScheduleIn(sim_time_t delay, sim_event_fn_t, void *arg);
+void SIM_Cancel(uint32_t id);
+void SIM_Advance(sim_time_t duration);
+void SIM_WaitForEvent(void);
+
+// Tracing
+void SIM_SetTrace(FILE *);
+void SIM_Trace(const char *fmt, ...);
+double SIM_Seconds(sim_time_t);
+
+// External inputs (record/replay)
+void SIM_TapInputs(sim_byte_fn_t, sim_edge_fn_t, void *ctx);
+void SIM_MuteInputs(bool);
+uint64_t SIM_EventSerial(void);
+
+// Pins
+void SIM_AttachPin(GPIO_Type *, uint32_t pin, sim_pin_fn_t, void *ctx);
+void SIM_DrivePin(GPIO_Type *, uint32_t pin, uint32_t level);
+void SIM_InjectPin(GPIO_Type *, uint32_t pin, uint32_t level);
+uint32_t SIM_PinOutput(GPIO_Type *, uint32_t pin);
+
+// I2C0
+void SIM_AttachI2C(sim_i2c_device_t *);
+
+// LPUART0 (NXH2261 link)
+void SIM_AttachLPUART0(sim_byte_fn_t, void *ctx);
+void SIM_LPUART0_Receive(uint8_t data);
+void SIM_LPUART0_Inject(uint8_t data);
+sim_time_t SIM_LPUART0_ByteTime(void);
+
+// UART2 (host console)
+void SIM_AttachConsole(sim_line_fn_t, void *ctx);
+void SIM_SetConsoleEcho(FILE *);
+void SIM_ConsoleType(sim_time_t when, const char *text, sim_time_t charGap);
+
+// TPM0 (piezo)
+void SIM_AttachPiezo(sim_tone_fn_t, void *ctx);
+
+// Program flash
+uint8_t *SIM_FlashBase(void);
+int SIM_FlashLoad(const char *path);
+int SIM_FlashSave(const char *path);
+
+// Device identity
+void SIM_SetUID(uint32_t uidmh, uint32_t uidml, uint32_t uidl);
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif /* _SIM_HAL_H_ */
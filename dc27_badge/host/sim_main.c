@@ -0,0 +1,786 @@
+/*
+ * DEFCON 27 Official Badge - host simulation
+ *
+ * Runs the unmodified badge application (source/dc27_badge.c) against the
+ * simulated HAL and device models, then reports boot time, badge state
+ * transitions, packet throughput and peripheral statistics.
+ *
+ * Usage: dc27_sim [options]
+ *   --time <ms>                         virtual time to run (default 60000)
+ *   --uid <hex>:<hex>:<hex>             MKL27Z64 UIDMH:UIDML:UIDL
+ *   --flash <file>                      load/save program flash image
+ *   --rx <ms>:<uid>:<type>:<magic>:<flags>   inject one received NFMI packet
+ *   --rx-every <ms>                     inject a packet from a new badge periodically
+ *   --adapter <ms>                      plug in a USB-to-serial adapter (KL_RX high)
+ *   --type <ms>:<text>                  type text on the console ("\r" for Enter)
+ *   --quiet                             don't echo the badge console
+ *   --nxh-eeprom <file>                 load/save NXH2261 EEPROM contents and wear counters
+ *   --nxh-fault <key>=<n>,...           inject NXH2261 faults once every n opportunities:
+ *                                       drop, corrupt, overrun, nak, miss (seed=<n> sets the seed)
+ *   --nxh-timing <key>=<us>,...         override NXH2261 latencies: window, boot, command,
+ *                                       page, update, timeout, detect (page-size=, endurance=
+ *                                       take plain numbers)
+ *   --record <file>                     record LPUART0 RX bytes and input pin edges
+ *   --replay <file>                     drive LPUART0 RX and input pins from a recording
+ *                                       instead of the device models (runs for its length)
+ *   --from-console <capture>            convert a __NXH_RECORD badge's console capture
+ *                                       into the --record file and exit
+ *   --dump <file>                       list a recording and exit
+ *   --trace                             trace peripheral activity to stderr
+ *   --bench-leds                        time the LED compositor on typical effects and exit
+ *   --show <file>                       play a compiled show (dc27_show -o) and print its
+ *                                       LED levels and piezo tones as they change, then exit
+ */
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "sim_hal.h"
+#include "sim_devices.h"
+#include "sim_nxh2261.h"
+#include "sim_record.h"
+
+// The firmware is compiled into this file so its static state can be observed
+#define main DC27_FirmwareMain
+#include "dc27_badge.c"
+#undef main
+
+
+/***************************************************************************
+ **************************** Definitions **********************************
+ ***************************************************************************/
+
+#define SIM_DEFAULT_RUN_TIME	SIM_MS(60000)
+#define SIM_MAX_TRANSITIONS		64U
+#define SIM_TYPE_CHAR_GAP		SIM_MS(2)	// typing speed for --type
+#define SIM_BENCH_FRAMES		4096U		// distinct frames per --bench-leds effect
+#define SIM_BENCH_PASSES		256U		// times each is composed
+#define SIM_SHOW_MAX_MS			600000U		// --show gives up on a show after this
+
+
+/**************************************************************************
+************************** Structs ****************************************
+***************************************************************************/
+
+typedef struct
+{
+	sim_time_t when;
+	badge_state_t state;
+} sim_transition_t;
+
+
+/****************************************************************************
+ ************************** Global variables ********************************
+ ***************************************************************************/
+
+static badge_state_t s_lastState = ATTRACT;
+static sim_transition_t s_transitions[SIM_MAX_TRANSITIONS];
+static uint32_t s_transitionCount;
+static sim_time_t s_bootTime, s_firstComplete;
+static uint32_t s_packetsProcessed;		// printed by DC27_ProcessPacket()
+static uint32_t s_packetsConsumed;		// frame headers taken out of the ring buffer
+static uint16_t s_ringIndex, s_ringHead;
+static sim_time_t s_ringTime[LPUART0_RING_BUFFER_SIZE];	// when each frame header was stored
+static sim_time_t s_frameWaitMax, s_frameWaitTotal;		// ring buffer to firmware
+
+static sim_time_t s_rxEvery;
+static uint32_t s_rxEveryUid = 0x5EED0000;
+static uint32_t s_packetsInjected;
+
+static uint32_t s_showFreq;		// piezo tone for --show (0 = silent)
+
+static const char *s_stateNames[] = { "Attract", "D", "E", "F", "C", "O", "N", "Hax0r" };
+
+
+/****************************************************************************
+ ************************** Functions ***************************************
+ ***************************************************************************/
+
+static void Sim_Firmware(void)
+{
+	DC27_FirmwareMain();
+}
+
+/**************************************************************/
+
+// Called after every simulation event
+static void Sim_Probe(void)
+{
+	if (badge_state != s_lastState)
+	{
+		s_lastState = badge_state;
+		if (s_transitionCount < SIM_MAX_TRANSITIONS)
+		{
+			s_transitions[s_transitionCount].when = SIM_Now();
+			s_transitions[s_transitionCount].state = badge_state;
+			s_transitionCount++;
+		}
+		if (badge_state == COMPLETE && s_firstComplete == 0)
+			s_firstComplete = SIM_Now();
+	}
+
+	while (s_ringHead != nxhRxIndex)
+	{
+		s_ringTime[s_ringHead] = SIM_Now();
+		s_ringHead = (s_ringHead + 1) % LPUART0_RING_BUFFER_SIZE;
+	}
+
+	while (s_ringIndex != nxhTxIndex)
+	{
+		if (nxhRingBuffer[s_ringIndex] == 'B')
+		{
+			sim_time_t wait = SIM_Now() - s_ringTime[s_ringIndex];
+
+			s_packetsConsumed++;
+			s_frameWaitTotal += wait;
+			if (wait > s_frameWaitMax)
+				s_frameWaitMax = wait;
+		}
+		s_ringIndex = (s_ringIndex + 1) % LPUART0_RING_BUFFER_SIZE;
+	}
+}
+
+/**************************************************************/
+
+static void Sim_ConsoleLine(void *ctx, const char *line)
+{
+	(void)ctx;
+
+	if (s_bootTime == 0 && strstr(line, "[*] Initialization Complete"))
+		s_bootTime = SIM_Now();
+
+	// DC27_PrintPacket() is also used for the 'T' console command
+	if (strncmp(line, "-> Unique ID:", 13) == 0 && strtoul(line + 13, NULL, 16) != nxhTxPacket.uid)
+		s_packetsProcessed++;
+}
+
+/**************************************************************/
+
+static void Sim_RxEvery(void *arg)
+{
+	(void)arg;
+
+	SIM_NXH2261_QueuePacket(SIM_Now(), s_rxEveryUid++, s_packetsInjected % 10, 1, 0x01);
+	s_packetsInjected++;
+	SIM_ScheduleInput(SIM_Now() + s_rxEvery, Sim_RxEvery, NULL);
+}
+
+/**************************************************************/
+
+static void Sim_AdapterIn(void *arg)
+{
+	(void)arg;
+
+	SIM_Trace("USB-to-serial adapter connected");
+	SIM_DrivePin(GPIOE, BOARD_INITPINS_KL_RX_PIN, 1);	// idle UART line is high
+}
+
+/**************************************************************/
+
+// Expand "\r" and "\n" escapes from the command line
+static char *Sim_Unescape(const char *in)
+{
+	char *out = malloc(strlen(in) + 1), *p = out;
+
+	if (!out)
+		return NULL;
+
+	for (; *in; ++in)
+	{
+		if (in[0] == '\\' && (in[1] == 'r' || in[1] == 'n'))
+		{
+			*p++ = (in[1] == 'r') ? '\r' : '\n';
+			++in;
+		}
+		else if (in[0] == '\\' && in[1] == 'x')	// Ctrl-X is \x
+		{
+			*p++ = 24;
+			++in;
+		}
+		else
+		{
+			*p++ = *in;
+		}
+	}
+	*p = '\0';
+
+	return out;
+}
+
+/**************************************************************/
+
+// "key=value,key=value" option lists
+static int Sim_ParseList(const char *list, const char *const *keys, unsigned long long *values)
+{
+	char key[16];
+	unsigned long long value;
+	int n, i;
+
+	while (*list)
+	{
+		if (sscanf(list, "%15[^=]=%llu%n", key, &value, &n) != 2)
+			return 1;
+
+		for (i = 0; keys[i]; ++i)
+		{
+			if (strcmp(key, keys[i]) == 0)
+				break;
+		}
+		if (!keys[i])
+			return 1;
+
+		values[i] = value;
+		list += n;
+		if (*list == ',')
+			++list;
+		else if (*list)
+			return 1;
+	}
+
+	return 0;
+}
+
+/**************************************************************/
+
+static int Sim_NXHFaults(const char *list, sim_nxh2261_faults_t *faults)
+{
+	static const char *const keys[] = { "seed", "drop", "corrupt", "overrun", "nak", "miss", NULL };
+	unsigned long long v[6] = { 0 };
+
+	if (Sim_ParseList(list, keys, v))
+		return 1;
+
+	faults->seed = (uint32_t)v[0];
+	faults->dropByte = (uint32_t)v[1];
+	faults->corruptByte = (uint32_t)v[2];
+	faults->overrunByte = (uint32_t)v[3];
+	faults->nakTransfer = (uint32_t)v[4];
+	faults->missUpdate = (uint32_t)v[5];
+
+	return 0;
+}
+
+/**************************************************************/
+
+static int Sim_NXHTiming(const char *list, sim_nxh2261_config_t *config)
+{
+	static const char *const keys[] = { "window", "boot", "command", "page", "update", "timeout", "detect",
+		"page-size", "endurance", NULL };
+	sim_time_t *times[] = { &config->bootWindow, &config->bootTime, &config->commandTime, &config->pageWriteTime,
+		&config->updateLatency, &config->frameTimeout, &config->detectLead };
+	unsigned long long v[9];
+	uint32_t i;
+
+	for (i = 0; i < 9; ++i)
+	{
+		v[i] = ~0ULL;	// not given
+	}
+
+	if (Sim_ParseList(list, keys, v))
+		return 1;
+
+	for (i = 0; i < 7; ++i)
+	{
+		if (v[i] != ~0ULL)
+			*times[i] = SIM_US(v[i]);
+	}
+	if (v[7] != ~0ULL && v[7] != 0)
+		config->pageSize = (uint32_t)v[7];
+	if (v[8] != ~0ULL)
+		config->endurance = (uint32_t)v[8];
+
+	return 0;
+}
+
+/**************************************************************/
+
+static double Sim_WallClock(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/**************************************************************/
+
+// Draw frame n of a typical effect on the firmware's layers (FX_Tick() draws them on the badge)
+static void Sim_BenchDraw(uint32_t effect, uint32_t n)
+{
+	uint8_t led = (uint8_t)((n * 7U + (n >> 3)) % LP5569_LED_NUM);
+
+	switch (effect)
+	{
+		case 0:	// state display ramping up and down
+			LED_Fill(LED_LAYER_STATE, LED_ALL_CHANNELS, state_leds[D], (uint8_t)((n & 0x100) ? ~n : n));
+			break;
+
+		case 1:	// rickroll: one LED per note over the state display
+			LED_Fill(LED_LAYER_STATE, LED_ALL_CHANNELS, state_leds[N], LED_LEVEL_MAX);
+			if (n & 1)
+				LED_Fill(LED_LAYER_MUSIC, 1U << led, 1U << led, LED_LEVEL_MAX);
+			else
+				LED_Fill(LED_LAYER_MUSIC, 0, 0, 0);
+			break;
+
+		case 2:	// packet flash over the state display
+			LED_Fill(LED_LAYER_STATE, LED_ALL_CHANNELS, state_leds[C], LED_LEVEL_MAX);
+			LED_Fill(LED_LAYER_NOTIFY, (n & 1) ? FX_ALL_LEDS : 0, FX_ALL_LEDS, LED_LEVEL_MAX);
+			break;
+
+		default:	// every layer different every frame
+			LED_Fill(LED_LAYER_STATE, LED_ALL_CHANNELS, n * 0x9E37U, (uint8_t)n);
+			LED_Fill(LED_LAYER_NOTIFY, n * 0x3B1DU, n * 0x5A5AU, (uint8_t)(n >> 1));
+			LED_Fill(LED_LAYER_MUSIC, 1U << (n % LED_CHANNELS), 0x1FF, (uint8_t)(n >> 2));
+			break;
+	}
+}
+
+/**************************************************************/
+
+// Compositor cost per frame for typical effects, and the I2C it saves over writing every
+// channel (address, register and one byte per channel in the burst)
+static void Sim_BenchLEDs(void)
+{
+	static const char *effects[] = { "state ramp", "rickroll", "packet flash", "random" };
+	static led_layer_t layers[SIM_BENCH_FRAMES][LED_LAYER_COUNT];
+	uint8_t frame[LED_CHANNELS];
+	uint32_t e, i, pass, channels, bursts, bytes, first, last;
+	uint16_t changed;
+	double t0, t, sink = 0;
+
+	printf("\n%u frames of each effect composed %u times\n", SIM_BENCH_FRAMES, SIM_BENCH_PASSES);
+	printf("  effect         compose   channels   frames     I2C bytes\n");
+	printf("                 (ns)      changed    written    (vs all %u channels)\n", LED_CHANNELS);
+
+	for (e = 0; e < sizeof(effects) / sizeof(effects[0]); ++e)
+	{
+		memset(ledLayer, 0, sizeof(ledLayer));
+		for (i = 0; i < SIM_BENCH_FRAMES; ++i)
+		{
+			Sim_BenchDraw(e, i);
+			memcpy(layers[i], ledLayer, sizeof(ledLayer));
+		}
+
+		memset(frame, 0, sizeof(frame));
+		t0 = Sim_WallClock();
+		for (pass = 0; pass < SIM_BENCH_PASSES; ++pass)
+		{
+			for (i = 0; i < SIM_BENCH_FRAMES; ++i)
+				sink += LED_Compose(layers[i], LED_LAYER_COUNT, frame);
+		}
+		t = Sim_WallClock() - t0;
+
+		// What FX_Service() would write for one pass
+		channels = bursts = bytes = 0;
+		memset(frame, 0, sizeof(frame));
+		for (i = 0; i < SIM_BENCH_FRAMES; ++i)
+		{
+			changed = LED_Compose(layers[i], LED_LAYER_COUNT, frame);
+			if (!changed)
+				continue;
+			for (first = 0; !(changed & (1U << first)); first++);
+			for (last = LED_CHANNELS - 1; !(changed & (1U << last)); last--);
+			channels += __builtin_popcount(changed);
+			bursts++;
+			bytes += 2 + last - first + 1;
+		}
+
+		printf("  %-13s %7.1f %10.2f %9.1f%% %9.1f%%\n", effects[e], t * 1e9 / (SIM_BENCH_FRAMES * SIM_BENCH_PASSES),
+			(double)channels / SIM_BENCH_FRAMES, 100.0 * bursts / SIM_BENCH_FRAMES,
+			100.0 * bytes / (SIM_BENCH_FRAMES * (2.0 + LED_CHANNELS)));
+	}
+
+	if (sink < 0)	// keep the compositor from being optimised away
+		printf("%f\n", sink);
+}
+
+/**************************************************************/
+
+static void Sim_ShowTone(void *ctx, uint32_t freq_Hz, bool on)
+{
+	s_showFreq = on ? freq_Hz : 0;
+}
+
+/**************************************************************/
+
+// Play a show with the firmware's interpreter, 1 ms at a time like SysTick_Handler, and
+// print the composed LEDs (perceptual levels) and the piezo whenever they change
+static int Sim_Show(const char *file)
+{
+	static uint8_t code[SHOW_MAX_SIZE + 1];
+	uint8_t frame[LED_CHANNELS] = { 0 };
+	uint32_t ms, i, freq = 0;
+	uint16_t changed;
+	size_t size;
+	FILE *f;
+
+	f = fopen(file, "rb");
+	if (!f)
+	{
+		perror(file);
+		return 1;
+	}
+	size = fread(code, 1, sizeof(code), f);
+	fclose(f);
+
+	if (size > SHOW_MAX_SIZE || FX_ShowCheck(code, size))
+	{
+		fprintf(stderr, "dc27_sim: %s is not a valid show\n", file);
+		return 1;
+	}
+
+	SIM_AttachPiezo(Sim_ShowTone, NULL);
+	g_random = 1;	// same RANDOM picks every time
+
+	FX_Begin(FX_EVENT);
+	FX_Add(&(fx_step_t){ .layer = LED_LAYER_NOTIFY, .show = code, .flags = FX_KEEP });
+	FX_End();
+
+	printf("%s: %zu bytes\n\n      ms  LED 0   1   2   3   4   5   piezo\n", file, size);
+	for (ms = 0; FX_Busy() && ms < SIM_SHOW_MAX_MS; ms++)
+	{
+		FX_Tick();
+		changed = LED_Compose(ledLayer, LED_LAYER_COUNT, frame);
+		if (!changed && s_showFreq == freq)
+			continue;
+
+		freq = s_showFreq;
+		printf("%8u  ", ms);
+		for (i = 0; i < LP5569_LED_NUM; ++i)
+			printf("%4u", frame[i]);
+		if (freq)
+			printf("   %u Hz", freq);
+		printf("\n");
+	}
+
+	printf("\n%s after %u ms\n", FX_Busy() ? "Still playing" : "Ended", ms);
+	return 0;
+}
+
+/**************************************************************/
+
+static void Sim_Usage(const char *prog)
+{
+	fprintf(stderr,
+		"Usage: %s [--time ms] [--uid H:M:L] [--flash file] [--rx ms:uid:type:magic:flags]\n"
+		"       [--rx-every ms] [--adapter ms] [--type ms:text] [--nxh-eeprom file]\n"
+		"       [--nxh-fault key=n,...] [--nxh-timing key=us,...] [--record file]\n"
+		"       [--replay file] [--from-console capture --record file] [--dump file]\n"
+		"       [--quiet] [--trace] [--bench-leds] [--show file]\n", prog);
+}
+
+/**************************************************************/
+
+static void Sim_Report(sim_exit_t reason)
+{
+	sim_time_t now = SIM_Now();
+	double seconds = SIM_Seconds(now);
+	uint32_t i, maxErase = 0;
+
+	printf("\n\n===== dc27_sim report =====\n");
+	printf("Exit:               %s at %.3f s\n", SIM_ExitName(reason), seconds);
+	printf("Boot time:          ");
+	if (s_bootTime)
+		printf("%.3f s\n", SIM_Seconds(s_bootTime));
+	else
+		printf("not reached\n");
+
+	printf("Time to complete:   ");
+	if (s_firstComplete)
+		printf("%.3f s\n", SIM_Seconds(s_firstComplete));
+	else
+		printf("not reached\n");
+
+	printf("State transitions:  %u\n", s_transitionCount);
+	for (i = 0; i < s_transitionCount; ++i)
+	{
+		printf("  %10.3f s  -> %s\n", SIM_Seconds(s_transitions[i].when), s_stateNames[s_transitions[i].state]);
+	}
+
+	printf("Packets:            %u injected, %u sent by NXH2261, %u consumed, %u processed",
+		s_packetsInjected, g_simNXH2261.rxFrames, s_packetsConsumed, s_packetsProcessed);
+	if (s_bootTime && now > s_bootTime)
+		printf(" (%.2f/s after boot)", s_packetsConsumed / SIM_Seconds(now - s_bootTime));
+	printf("\n");
+	printf("Packet service:     longest %.1f ms for LPUART0 RX to be read, %.1f ms for a frame to be taken",
+		SIM_Seconds(g_simStats.lpuartRxWaitMax) * 1000.0, SIM_Seconds(s_frameWaitMax) * 1000.0);
+	if (s_packetsConsumed)
+		printf(" (mean %.1f ms)", SIM_Seconds(s_frameWaitTotal) * 1000.0 / s_packetsConsumed);
+	printf("\n");
+	printf("TX packet updates:  %u frames (%u malformed), %u update requests\n",
+		g_simNXH2261.txFrames, g_simNXH2261.txFramesBad, g_simNXH2261.updateRequests);
+	printf("LPUART0 RX:         %u bytes, %u overruns, %u lost in VLPS\n",
+		g_simStats.lpuartRxBytes, g_simStats.lpuartRxOverruns, g_simStats.lpuartRxSleepDrops);
+	printf("Power:              RUN %.3f s, VLPS %.3f s (%u entries)\n",
+		SIM_Seconds(g_simStats.runTime), SIM_Seconds(g_simStats.vlpsTime), g_simStats.vlpsEntries);
+	printf("Interrupts:         SysTick %u, LPUART0 %u, LPTMR0 %u, PORTB-E %u\n",
+		g_simStats.sysTickCount, g_simStats.irqCount[LPUART0_IRQn], g_simStats.irqCount[LPTMR0_IRQn],
+		g_simStats.irqCount[PORTB_PORTC_PORTD_PORTE_IRQn]);
+	printf("I2C0:               %u transfers, %u bytes, %u NAKs, %.3f s bus time\n",
+		g_simStats.i2cTransfers, g_simStats.i2cBytes, g_simStats.i2cNaks, SIM_Seconds(g_simStats.i2cBusTime));
+	printf("LP5569:             %u register writes, %u LED changes, %u engine starts (%u instructions)\n",
+		g_simLP5569.writes, g_simLP5569.ledChanges, g_simLP5569.engineStarts, g_simLP5569.engineInstructions);
+	printf("NXH2261:            %u resets, %u bootloader entries, %u EEPROM boots, %u blank boots\n",
+		g_simNXH2261.resets, g_simNXH2261.bootloaderEntries, g_simNXH2261.eepromBoots, g_simNXH2261.blankBoots);
+	printf("  programming:      ");
+	if (g_simNXH2261.programTime)
+		printf("%.3f s", SIM_Seconds(g_simNXH2261.programTime));
+	else
+		printf("not completed");
+	printf(", %u commands (%u errors), %.3f s clock stretched\n",
+		g_simNXH2261.i2cCommands, g_simNXH2261.i2cErrors, SIM_Seconds(g_simNXH2261.i2cStretchTime));
+	printf("  EEPROM:           %u bytes written, %u words unchanged, max %u cycles/word, %u refused (worn)\n",
+		g_simNXH2261.eepromBytesWritten, g_simNXH2261.eepromWordsUnchanged, g_simNXH2261.eepromMaxCycles,
+		g_simNXH2261.eepromWornWrites);
+	printf("  application:      %u calibrations (%u without CLKOUT), %u updates missed, %u timed out, %u RX dropped\n",
+		g_simNXH2261.calibrations, g_simNXH2261.calibrationsNoClock, g_simNXH2261.updatesMissed,
+		g_simNXH2261.updateTimeouts, g_simNXH2261.rxFramesDropped);
+	printf("  faults:           %u bytes dropped, %u corrupted, %u overrun, %u NAKs\n",
+		g_simNXH2261.bytesDropped, g_simNXH2261.bytesCorrupted, g_simNXH2261.bytesOverrun, g_simNXH2261.naks);
+
+	for (i = 0; i < SIM_FLASH_SECTORS; ++i)
+	{
+		if (g_simStats.flashSectorErases[i] > maxErase)
+			maxErase = g_simStats.flashSectorErases[i];
+	}
+	printf("Flash:              %u sector erases (max %u/sector), %u longwords, %.3f s busy, %u interrupts meanwhile\n",
+		g_simStats.flashErases, maxErase, g_simStats.flashPrograms, SIM_Seconds(g_simStats.flashBusyTime),
+		g_simStats.flashIrqCount);
+	printf("Console:            %u bytes out, %u typed characters lost\n",
+		g_simStats.consoleTxBytes, g_simStats.consoleRxLost);
+	if (g_simRecord.records)
+		printf("Recorded:           %u LPUART0 bytes, %u pin changes, %u bytes written\n",
+			g_simRecord.bytes, g_simRecord.pinChanges, g_simRecord.fileSize);
+	if (g_simReplay.fileSize)
+		printf("Replayed:           %u LPUART0 bytes, %u pin changes of %.3f s recording\n",
+			g_simReplay.bytes, g_simReplay.pinChanges, SIM_Seconds(g_simReplay.length));
+}
+
+/**************************************************************/
+
+int main(int argc, char **argv)
+{
+	static const struct option options[] = {
+		{ "time", required_argument, NULL, 't' },
+		{ "uid", required_argument, NULL, 'u' },
+		{ "flash", required_argument, NULL, 'f' },
+		{ "rx", required_argument, NULL, 'r' },
+		{ "rx-every", required_argument, NULL, 'R' },
+		{ "adapter", required_argument, NULL, 'a' },
+		{ "type", required_argument, NULL, 'k' },
+		{ "quiet", no_argument, NULL, 'q' },
+		{ "nxh-eeprom", required_argument, NULL, 'e' },
+		{ "nxh-fault", required_argument, NULL, 'F' },
+		{ "nxh-timing", required_argument, NULL, 'L' },
+		{ "record", required_argument, NULL, 'w' },
+		{ "replay", required_argument, NULL, 'p' },
+		{ "from-console", required_argument, NULL, 'c' },
+		{ "dump", required_argument, NULL, 'd' },
+		{ "trace", no_argument, NULL, 'v' },
+		{ "bench-leds", no_argument, NULL, 'b' },
+		{ "show", required_argument, NULL, 's' },
+		{ "help", no_argument, NULL, 'h' },
+		{ NULL, 0, NULL, 0 }
+	};
+	sim_time_t runTime = 0;
+	uint32_t uid[3] = { 0x0027DC27, 0x4B4C3237, 0x00C0FFEE };
+	const char *flashFile = NULL, *eepromFile = NULL;
+	const char *recordFile = NULL, *replayFile = NULL, *consoleFile = NULL;
+	bool uidGiven = false;
+	sim_nxh2261_config_t nxhConfig;
+	sim_nxh2261_faults_t nxhFaults = { 0 };
+	bool quiet = false;
+	sim_exit_t reason;
+	int opt;
+
+	SIM_NXH2261_DefaultConfig(&nxhConfig);
+
+	while ((opt = getopt_long(argc, argv, "t:u:f:r:R:a:k:e:F:L:w:p:c:d:qvbs:h", options, NULL)) != -1)
+	{
+		switch (opt)
+		{
+			case 't':
+				runTime = SIM_MS(strtoull(optarg, NULL, 0));
+				break;
+
+			case 'u':
+				if (sscanf(optarg, "%x:%x:%x", &uid[0], &uid[1], &uid[2]) != 3)
+				{
+					Sim_Usage(argv[0]);
+					return 1;
+				}
+				uidGiven = true;
+				break;
+
+			case 'f':
+				flashFile = optarg;
+				break;
+
+			case 'r':
+			{
+				unsigned long long ms;
+				unsigned int rxUid, rxType, rxMagic, rxFlags;
+
+				if (sscanf(optarg, "%llu:%x:%u:%u:%x", &ms, &rxUid, &rxType, &rxMagic, &rxFlags) != 5)
+				{
+					Sim_Usage(argv[0]);
+					return 1;
+				}
+				SIM_NXH2261_QueuePacket(SIM_MS(ms), rxUid, rxType, rxMagic, rxFlags);
+				s_packetsInjected++;
+				break;
+			}
+
+			case 'R':
+				s_rxEvery = SIM_MS(strtoull(optarg, NULL, 0));
+				if (s_rxEvery)
+					SIM_ScheduleInput(s_rxEvery, Sim_RxEvery, NULL);
+				break;
+
+			case 'a':
+				SIM_ScheduleInput(SIM_MS(strtoull(optarg, NULL, 0)), Sim_AdapterIn, NULL);
+				break;
+
+			case 'k':
+			{
+				char *sep = strchr(optarg, ':'), *text;
+
+				if (!sep)
+				{
+					Sim_Usage(argv[0]);
+					return 1;
+				}
+				text = Sim_Unescape(sep + 1);
+				SIM_ConsoleType(SIM_MS(strtoull(optarg, NULL, 0)), text, SIM_TYPE_CHAR_GAP);
+				free(text);
+				break;
+			}
+
+			case 'e':
+				eepromFile = optarg;
+				break;
+
+			case 'F':
+				if (Sim_NXHFaults(optarg, &nxhFaults))
+				{
+					Sim_Usage(argv[0]);
+					return 1;
+				}
+				break;
+
+			case 'L':
+				if (Sim_NXHTiming(optarg, &nxhConfig))
+				{
+					Sim_Usage(argv[0]);
+					return 1;
+				}
+				break;
+
+			case 'w':
+				recordFile = optarg;
+				break;
+
+			case 'p':
+				replayFile = optarg;
+				break;
+
+			case 'c':
+				consoleFile = optarg;
+				break;
+
+			case 'd':
+				return SIM_RecordDump(optarg, stdout) ? 1 : 0;
+
+			case 'q':
+				quiet = true;
+				break;
+
+			case 'v':
+				SIM_SetTrace(stderr);
+				break;
+
+			case 'b':
+				Sim_BenchLEDs();
+				return 0;
+
+			case 's':
+				return Sim_Show(optarg);
+
+			case 'h':
+			default:
+				Sim_Usage(argv[0]);
+				return (opt == 'h') ? 0 : 1;
+		}
+	}
+
+	if (consoleFile)
+	{
+		if (!recordFile)
+		{
+			Sim_Usage(argv[0]);
+			return 1;
+		}
+		if (SIM_RecordFromConsole(consoleFile, recordFile, quiet ? NULL : stdout))
+		{
+			fprintf(stderr, "dc27_sim: unable to convert %s to %s\n", consoleFile, recordFile);
+			return 1;
+		}
+		printf("\n%s: %u LPUART0 bytes, %u pin changes over %.3f s in %u bytes\n", recordFile,
+			g_simRecord.bytes, g_simRecord.pinChanges, SIM_Seconds(g_simRecord.length), g_simRecord.fileSize);
+		return 0;
+	}
+
+	SIM_LP5569_Attach();
+	SIM_NXH2261_Attach(&nxhConfig);
+	SIM_NXH2261_SetFaults(&nxhFaults);
+
+	if (replayFile)
+	{
+		uint32_t recordedUid[3] = { uid[0], uid[1], uid[2] };
+
+		if (SIM_ReplayStart(replayFile, recordedUid))
+		{
+			fprintf(stderr, "dc27_sim: %s is not a valid recording\n", replayFile);
+			return 1;
+		}
+		if (!uidGiven)
+			memcpy(uid, recordedUid, sizeof(uid));
+		if (!runTime)
+			runTime = SIM_ReplayLength();
+	}
+	if (!runTime)
+		runTime = SIM_DEFAULT_RUN_TIME;
+	if (recordFile && SIM_RecordStart(recordFile, uid))
+	{
+		fprintf(stderr, "dc27_sim: unable to create %s\n", recordFile);
+		recordFile = NULL;
+	}
+
+	SIM_SetUID(uid[0], uid[1], uid[2]);
+	if (flashFile && SIM_FlashLoad(flashFile))
+		fprintf(stderr, "dc27_sim: %s not loaded, starting with erased flash\n", flashFile);
+	if (eepromFile && SIM_NXH2261_LoadEEPROM(eepromFile))
+		fprintf(stderr, "dc27_sim: %s not loaded, starting with blank NXH2261 EEPROM\n", eepromFile);
+
+	SIM_SetConsoleEcho(quiet ? NULL : stdout);
+	SIM_AttachConsole(Sim_ConsoleLine, NULL);
+	SIM_SetProbe(Sim_Probe);
+
+	reason = SIM_Run(Sim_Firmware, runTime);
+
+	if (recordFile && SIM_RecordStop())
+		fprintf(stderr, "dc27_sim: unable to write %s\n", recordFile);
+
+	if (flashFile && SIM_FlashSave(flashFile))
+		fprintf(stderr, "dc27_sim: unable to save %s\n", flashFile);
+	if (eepromFile && SIM_NXH2261_SaveEEPROM(eepromFile))
+		fprintf(stderr, "dc27_sim: unable to save %s\n", eepromFile);
+
+	Sim_Report(reason);
+
+	return 0;
+}
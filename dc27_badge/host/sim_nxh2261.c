@@ -0,0 +1,839 @@
+/*
+ * DEFCON 27 Official Badge - host simulation
+ *
+ * Behavioural model of the NXH2261 NFMI radio (see sim_nxh2261.h)
+ */
+
+#include <stdio.h>
+
+#include "sim_nxh2261.h"
+#include "fsl_i2c.h"
+#include "pin_mux.h"
+
+
+/***************************************************************************
+ **************************** Definitions **********************************
+ ***************************************************************************/
+
+// Bootloader opcodes (same values as NXH2261_CMD_* in dc27_badge.c)
+#define NXH_CMD_START_APP			0x0F00
+#define NXH_CMD_EEPROM_WRITE		0x0F0A
+#define NXH_CMD_EEPROM_READ			0x0F0B
+#define NXH_CMD_EEPROM_UNLOCK		0x0F0C
+#define NXH_CMD_EEPROM_BOOT			0x0F0F
+#define NXH_CMD_PREVENT_BOOT		0x0F16
+#define NXH_CMD_EEPROM_ENABLE		0x0F18
+#define NXH_CMD_EEPROM_DISABLE		0x0F19
+#define NXH_CMD_GET_VERSION			0x0F80
+
+// Status codes returned in byte 0 of the reply
+// Only "zero means success" is known from the firmware; the rest are the model's own
+#define NXH_STATUS_OK				0x00
+#define NXH_STATUS_UNKNOWN_CMD		0x01
+#define NXH_STATUS_BAD_PARAM		0x02
+#define NXH_STATUS_EEPROM_DISABLED	0x03
+#define NXH_STATUS_EEPROM_LOCKED	0x04
+#define NXH_STATUS_EEPROM_WORN		0x05
+#define NXH_STATUS_NO_IMAGE			0x06
+
+#define NXH_STATUS_SIZE				4U
+#define NXH_WRITE_HEADER_SIZE		11U		// opcode, tag, address (4), length (4)
+#define NXH_RESPONSE_SIZE			(NXH_STATUS_SIZE + 256U)
+#define NXH_IMAGE_MAGIC				0xBEBAFECAUL	// 0xCAFEBABE, little endian in EEPROM
+
+#define NXH_CLKOUT_OSCERCLK			6U		// CLKOUT select used as the calibration reference
+
+
+/**************************************************************************
+************************** Structs ****************************************
+***************************************************************************/
+
+typedef enum
+{
+	NXH_OFF,			// held in reset
+	NXH_BOOT_WINDOW,	// listening for Prevent Boot
+	NXH_BOOTLOADER,
+	NXH_BOOTING,		// copying the image from EEPROM
+	NXH_APP				// LPBroadcast application running
+} nxh_state_t;
+
+typedef struct
+{
+	sim_nxh2261_config_t config;
+	sim_nxh2261_faults_t faults;
+	uint32_t random;
+
+	nxh_state_t state;
+	uint32_t stateEvent;		// pending boot window/boot completion
+	sim_time_t busyUntil;		// command or EEPROM write in progress
+
+	uint8_t response[NXH_RESPONSE_SIZE];
+	size_t responseLen;
+
+	bool eepromEnabled;
+	uint32_t unlockStart, unlockEnd;	// byte range open for a single write
+	uint8_t eeprom[SIM_NXH2261_EEPROM_SIZE];
+	uint32_t cycles[SIM_NXH2261_EEPROM_WORDS];
+
+	bool receiving;				// "RO" sent, taking a frame from the KL27
+	uint32_t frameEvent;
+	uint8_t frame[SIM_NXH2261_FRAME_SIZE];
+	size_t frameLen;
+	bool txValid;
+	uint8_t txPayload[SIM_NXH2261_PAYLOAD_SIZE];
+
+	sim_time_t lineFree;		// NXH_TX is busy until this time
+	uint32_t detectEvent;
+} nxh2261_t;
+
+
+/****************************************************************************
+ ************************** Global variables ********************************
+ ***************************************************************************/
+
+sim_nxh2261_stats_t g_simNXH2261;
+
+static nxh2261_t s_nxh;
+static sim_i2c_device_t s_nxhDevice;
+
+
+/****************************************************************************
+ ************************** Helpers *****************************************
+ ***************************************************************************/
+
+// xorshift32: fault injection has to be repeatable from the seed
+static uint32_t NXH_Random(void)
+{
+	s_nxh.random ^= s_nxh.random << 13;
+	s_nxh.random ^= s_nxh.random >> 17;
+	s_nxh.random ^= s_nxh.random << 5;
+	return s_nxh.random;
+}
+
+/**************************************************************/
+
+static bool NXH_Fault(uint32_t oneIn)
+{
+	return oneIn && (NXH_Random() % oneIn) == 0;
+}
+
+/**************************************************************/
+
+static void NXH_SetState(nxh_state_t state)
+{
+	static const char *names[] = { "off", "boot window", "bootloader", "booting", "running" };
+
+	if (s_nxh.state != state)
+		SIM_Trace("NXH2261 %s", names[state]);
+	s_nxh.state = state;
+}
+
+/**************************************************************/
+
+// The bootloader holds SCL low until the previous command has finished
+static void NXH_Stretch(void)
+{
+	sim_time_t now = SIM_Now();
+
+	if (s_nxh.busyUntil > now)
+	{
+		g_simNXH2261.i2cStretches++;
+		g_simNXH2261.i2cStretchTime += s_nxh.busyUntil - now;
+		SIM_Advance(s_nxh.busyUntil - now);
+	}
+}
+
+/**************************************************************/
+
+static void NXH_Status(uint8_t status, uint8_t tag)
+{
+	memset(s_nxh.response, 0, NXH_STATUS_SIZE);
+	s_nxh.response[0] = status;
+	s_nxh.response[1] = tag;
+	s_nxh.responseLen = NXH_STATUS_SIZE;
+
+	if (status != NXH_STATUS_OK)
+	{
+		g_simNXH2261.i2cErrors++;
+		SIM_Trace("NXH2261 command error 0x%02X", status);
+	}
+}
+
+/**************************************************************/
+
+static uint32_t NXH_Get16(const uint8_t *p)
+{
+	return (uint32_t)(p[0] | (p[1] << 8));
+}
+
+static uint32_t NXH_Get32(const uint8_t *p)
+{
+	return (uint32_t)(p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24));
+}
+
+
+/****************************************************************************
+ ************************** Boot sequence ***********************************
+ ***************************************************************************/
+
+static bool NXH_ImageValid(void)
+{
+	return NXH_Get32(s_nxh.eeprom) == NXH_IMAGE_MAGIC;
+}
+
+/**************************************************************/
+
+static void NXH_AppStarted(void *arg)
+{
+	(void)arg;
+
+	s_nxh.stateEvent = 0;
+	s_nxh.receiving = false;
+	s_nxh.txValid = false;	// nothing to broadcast until the KL27 loads a packet
+	NXH_SetState(NXH_APP);
+}
+
+/**************************************************************/
+
+static void NXH_Boot(void)
+{
+	if (!NXH_ImageValid())
+	{
+		g_simNXH2261.blankBoots++;
+		NXH_SetState(NXH_BOOTLOADER);	// nothing to run, stay in the bootloader
+		return;
+	}
+
+	g_simNXH2261.eepromBoots++;
+	NXH_SetState(NXH_BOOTING);
+	s_nxh.stateEvent = SIM_ScheduleIn(s_nxh.config.bootTime, NXH_AppStarted, NULL);
+}
+
+/**************************************************************/
+
+static void NXH_BootWindowEnd(void *arg)
+{
+	(void)arg;
+
+	s_nxh.stateEvent = 0;
+	if (s_nxh.state == NXH_BOOT_WINDOW)
+		NXH_Boot();
+}
+
+/**************************************************************/
+
+static void NXH_Reset(void *ctx, uint32_t level)
+{
+	(void)ctx;
+
+	SIM_Cancel(s_nxh.stateEvent);
+	SIM_Cancel(s_nxh.frameEvent);
+	s_nxh.stateEvent = 0;
+	s_nxh.frameEvent = 0;
+	s_nxh.responseLen = 0;
+	s_nxh.eepromEnabled = false;
+	s_nxh.unlockStart = s_nxh.unlockEnd = 0;
+	s_nxh.receiving = false;
+	s_nxh.txValid = false;
+	s_nxh.busyUntil = 0;
+
+	if (level)
+	{
+		g_simNXH2261.resets++;
+		NXH_SetState(NXH_BOOT_WINDOW);
+		s_nxh.stateEvent = SIM_ScheduleIn(s_nxh.config.bootWindow, NXH_BootWindowEnd, NULL);
+	}
+	else
+	{
+		NXH_SetState(NXH_OFF);
+	}
+}
+
+
+/****************************************************************************
+ ************************** I2C bootloader **********************************
+ ***************************************************************************/
+
+static uint8_t NXH_EepromWrite(uint32_t start, const uint8_t *data, uint32_t len)
+{
+	uint32_t i, word, pages;
+
+	if (!s_nxh.eepromEnabled)
+		return NXH_STATUS_EEPROM_DISABLED;
+
+	if (start + len > SIM_NXH2261_EEPROM_SIZE || len == 0)
+		return NXH_STATUS_BAD_PARAM;
+
+	if (start < s_nxh.unlockStart || start + len > s_nxh.unlockEnd)
+		return NXH_STATUS_EEPROM_LOCKED;
+
+	s_nxh.unlockStart = s_nxh.unlockEnd = 0;	// unlock is good for one write
+
+	for (word = start / 4; word <= (start + len - 1) / 4; ++word)
+	{
+		if (s_nxh.cycles[word] >= s_nxh.config.endurance)
+		{
+			g_simNXH2261.eepromWornWrites++;
+			return NXH_STATUS_EEPROM_WORN;
+		}
+	}
+
+	for (word = start / 4; word <= (start + len - 1) / 4; ++word)
+	{
+		uint32_t lo = (word * 4 > start) ? word * 4 : start;
+		uint32_t hi = (word * 4 + 4 < start + len) ? word * 4 + 4 : start + len;
+
+		if (memcmp(&s_nxh.eeprom[lo], &data[lo - start], hi - lo) == 0)
+			g_simNXH2261.eepromWordsUnchanged++;
+
+		if (++s_nxh.cycles[word] > g_simNXH2261.eepromMaxCycles)
+			g_simNXH2261.eepromMaxCycles = s_nxh.cycles[word];
+	}
+
+	for (i = 0; i < len; ++i)
+	{
+		s_nxh.eeprom[start + i] = data[i];
+	}
+	g_simNXH2261.eepromBytesWritten += len;
+
+	pages = (start + len - 1) / s_nxh.config.pageSize - start / s_nxh.config.pageSize + 1;
+	s_nxh.busyUntil += pages * s_nxh.config.pageWriteTime;
+
+	return NXH_STATUS_OK;
+}
+
+/**************************************************************/
+
+static void NXH_Command(const uint8_t *data, size_t len)
+{
+	static const uint8_t version[9] = { 0x01, 0x00, 0x00, 0x61, 0x22, 0x00, 0x01, 0x00, 0x01 };
+	uint32_t cmd = NXH_Get16(data), addr, count;
+	uint8_t tag = data[2], status = NXH_STATUS_OK;
+
+	g_simNXH2261.i2cCommands++;
+	s_nxh.busyUntil = SIM_Now() + s_nxh.config.commandTime;
+
+	switch (cmd)
+	{
+		case NXH_CMD_PREVENT_BOOT:
+			break;
+
+		case NXH_CMD_GET_VERSION:
+			memcpy(s_nxh.response, version, sizeof(version));
+			s_nxh.responseLen = sizeof(version);
+			return;
+
+		case NXH_CMD_EEPROM_ENABLE:
+			s_nxh.eepromEnabled = true;
+			break;
+
+		case NXH_CMD_EEPROM_DISABLE:
+			s_nxh.eepromEnabled = false;
+			if (g_simNXH2261.programStart)
+				g_simNXH2261.programTime = SIM_Now() - g_simNXH2261.programStart;
+			break;
+
+		case NXH_CMD_EEPROM_UNLOCK:	// word address (2), byte count (2)
+			if (len < 7)
+			{
+				status = NXH_STATUS_BAD_PARAM;
+				break;
+			}
+			addr = NXH_Get16(&data[3]) * 4;
+			count = NXH_Get16(&data[5]);
+			if (addr + count > SIM_NXH2261_EEPROM_SIZE)
+			{
+				status = NXH_STATUS_BAD_PARAM;
+				break;
+			}
+			s_nxh.unlockStart = addr;
+			s_nxh.unlockEnd = addr + count;
+			break;
+
+		case NXH_CMD_EEPROM_WRITE:	// word address (4), byte count (4), data
+			if (len < NXH_WRITE_HEADER_SIZE || len - NXH_WRITE_HEADER_SIZE != NXH_Get32(&data[7]))
+			{
+				status = NXH_STATUS_BAD_PARAM;
+				break;
+			}
+			status = NXH_EepromWrite(NXH_Get32(&data[3]) * 4, &data[NXH_WRITE_HEADER_SIZE], (uint32_t)(len - NXH_WRITE_HEADER_SIZE));
+			break;
+
+		case NXH_CMD_EEPROM_READ:	// word address (4), byte count (4); status followed by data
+			if (len < NXH_WRITE_HEADER_SIZE)
+			{
+				status = NXH_STATUS_BAD_PARAM;
+				break;
+			}
+			addr = NXH_Get32(&data[3]) * 4;
+			count = NXH_Get32(&data[7]);
+			if (!s_nxh.eepromEnabled)
+				status = NXH_STATUS_EEPROM_DISABLED;
+			else if (count > sizeof(s_nxh.response) - NXH_STATUS_SIZE || addr + count > SIM_NXH2261_EEPROM_SIZE)
+				status = NXH_STATUS_BAD_PARAM;
+			else
+			{
+				NXH_Status(NXH_STATUS_OK, tag);
+				memcpy(&s_nxh.response[NXH_STATUS_SIZE], &s_nxh.eeprom[addr], count);
+				s_nxh.responseLen += count;
+				return;
+			}
+			break;
+
+		case NXH_CMD_START_APP:
+		case NXH_CMD_EEPROM_BOOT:
+			if (!NXH_ImageValid())
+			{
+				status = NXH_STATUS_NO_IMAGE;
+				break;
+			}
+			NXH_Status(NXH_STATUS_OK, tag);
+			NXH_Boot();
+			return;
+
+		default:
+			status = NXH_STATUS_UNKNOWN_CMD;
+			break;
+	}
+
+	NXH_Status(status, tag);
+}
+
+/**************************************************************/
+
+static bool NXH_I2CActive(void)
+{
+	if (s_nxh.state != NXH_BOOT_WINDOW && s_nxh.state != NXH_BOOTLOADER)
+		return false;	// the application does not use I2C
+
+	if (NXH_Fault(s_nxh.faults.nakTransfer))
+	{
+		g_simNXH2261.naks++;
+		return false;
+	}
+
+	return true;
+}
+
+/**************************************************************/
+
+static status_t NXH_I2CWrite(void *ctx, const uint8_t *data, size_t len)
+{
+	(void)ctx;
+
+	if (!NXH_I2CActive())
+		return kStatus_I2C_Addr_Nak;
+
+	NXH_Stretch();
+
+	if (len < 3)
+		return kStatus_I2C_Nak;
+
+	if (s_nxh.state == NXH_BOOT_WINDOW)
+	{
+		if (NXH_Get16(data) != NXH_CMD_PREVENT_BOOT)
+			return kStatus_I2C_Nak;
+
+		SIM_Cancel(s_nxh.stateEvent);
+		s_nxh.stateEvent = 0;
+		NXH_SetState(NXH_BOOTLOADER);
+		g_simNXH2261.bootloaderEntries++;
+		g_simNXH2261.programStart = SIM_Now();
+	}
+
+	NXH_Command(data, len);
+	return kStatus_Success;
+}
+
+/**************************************************************/
+
+static status_t NXH_I2CRead(void *ctx, uint8_t *data, size_t len)
+{
+	size_t i;
+
+	(void)ctx;
+
+	if (!NXH_I2CActive())
+		return kStatus_I2C_Addr_Nak;
+
+	NXH_Stretch();
+
+	for (i = 0; i < len; ++i)
+	{
+		data[i] = (i < s_nxh.responseLen) ? s_nxh.response[i] : 0xFF;
+	}
+	s_nxh.responseLen = 0;
+
+	return kStatus_Success;
+}
+
+
+/****************************************************************************
+ **************************** UART / DETECT *********************************
+ ***************************************************************************/
+
+static void NXH_SendByte(void *arg)
+{
+	uint8_t data = (uint8_t)(uintptr_t)arg;
+
+	if (NXH_Fault(s_nxh.faults.dropByte))
+	{
+		g_simNXH2261.bytesDropped++;
+		return;
+	}
+
+	if (NXH_Fault(s_nxh.faults.corruptByte))
+	{
+		g_simNXH2261.bytesCorrupted++;
+		data ^= (uint8_t)(1U << (NXH_Random() % 8));
+	}
+
+	SIM_LPUART0_Receive(data);
+
+	if (NXH_Fault(s_nxh.faults.overrunByte))
+	{
+		g_simNXH2261.bytesOverrun++;
+		SIM_LPUART0_Receive((uint8_t)NXH_Random());	// glitch: second byte before RDRF could be serviced
+	}
+}
+
+/**************************************************************/
+
+// Queue bytes onto NXH_TX after anything already being sent
+static sim_time_t NXH_Send(sim_time_t when, const uint8_t *data, size_t len)
+{
+	size_t i;
+
+	if (when < s_nxh.lineFree)
+		when = s_nxh.lineFree;
+
+	for (i = 0; i < len; ++i)
+	{
+		when += SIM_LPUART0_ByteTime();
+		SIM_ScheduleInput(when, NXH_SendByte, (void *)(uintptr_t)data[i]);
+	}
+
+	s_nxh.lineFree = when;
+	return when;
+}
+
+/**************************************************************/
+
+static void NXH_FrameTimeout(void *arg)
+{
+	(void)arg;
+
+	s_nxh.frameEvent = 0;
+	if (s_nxh.receiving)
+	{
+		g_simNXH2261.updateTimeouts++;
+		s_nxh.receiving = false;
+		SIM_Trace("NXH2261 update timed out after %u bytes", (uint32_t)s_nxh.frameLen);
+	}
+}
+
+/**************************************************************/
+
+static void NXH_Update(void *ctx, uint32_t level)
+{
+	static const uint8_t ready[2] = { 'R', 'O' };
+	sim_time_t end;
+
+	(void)ctx;
+
+	if (level || s_nxh.state != NXH_APP)  // falling edge of NXH_UPDATE
+		return;
+
+	if (NXH_Fault(s_nxh.faults.missUpdate))
+	{
+		g_simNXH2261.updatesMissed++;
+		return;
+	}
+
+	g_simNXH2261.updateRequests++;
+	s_nxh.receiving = true;
+	s_nxh.frameLen = 0;
+	end = NXH_Send(SIM_Now() + s_nxh.config.updateLatency, ready, sizeof(ready));
+
+	SIM_Cancel(s_nxh.frameEvent);
+	s_nxh.frameEvent = SIM_Schedule(end + s_nxh.config.frameTimeout, NXH_FrameTimeout, NULL);
+}
+
+/**************************************************************/
+
+static void NXH_Calibrate(void *ctx, uint32_t level)
+{
+	uint32_t clkout = (SIM->SOPT2 & SIM_SOPT2_CLKOUTSEL_MASK) >> SIM_SOPT2_CLKOUTSEL_SHIFT;
+
+	(void)ctx;
+
+	if (level || s_nxh.state != NXH_APP)
+		return;
+
+	if (clkout == NXH_CLKOUT_OSCERCLK)
+		g_simNXH2261.calibrations++;
+	else
+		g_simNXH2261.calibrationsNoClock++;
+}
+
+/**************************************************************/
+
+static bool NXH_Decode(const uint8_t *frame, uint8_t *payload)
+{
+	size_t i;
+
+	if (frame[0] != 'B' || frame[SIM_NXH2261_FRAME_SIZE - 1] != 'E')
+		return false;
+
+	for (i = 1; i < SIM_NXH2261_FRAME_SIZE - 1; ++i)
+	{
+		if ((frame[i] & 0xF0) != 0xD0)
+			return false;
+	}
+
+	for (i = 0; i < SIM_NXH2261_PAYLOAD_SIZE; ++i)
+	{
+		payload[i] = (uint8_t)(((frame[1 + i * 2] & 0x0F) << 4) | (frame[2 + i * 2] & 0x0F));
+	}
+
+	return true;
+}
+
+/**************************************************************/
+
+// Data packet from the KL27 to broadcast
+static void NXH_Receive(void *ctx, uint8_t data)
+{
+	(void)ctx;
+
+	if (s_nxh.state != NXH_APP || !s_nxh.receiving)
+		return;
+
+	if (s_nxh.frameLen == 0 && data != 'B')
+		return;
+
+	s_nxh.frame[s_nxh.frameLen++] = data;
+	if (s_nxh.frameLen < SIM_NXH2261_FRAME_SIZE)
+		return;
+
+	s_nxh.receiving = false;
+	SIM_Cancel(s_nxh.frameEvent);
+	s_nxh.frameEvent = 0;
+
+	if (NXH_Decode(s_nxh.frame, s_nxh.txPayload))
+	{
+		s_nxh.txValid = true;
+		g_simNXH2261.txFrames++;
+	}
+	else
+	{
+		g_simNXH2261.txFramesBad++;
+	}
+}
+
+/**************************************************************/
+
+static void NXH_DetectLow(void *arg)
+{
+	(void)arg;
+
+	s_nxh.detectEvent = 0;
+	SIM_DrivePin(BOARD_INITPINS_NXH_DETECT_GPIO, BOARD_INITPINS_NXH_DETECT_GPIO_PIN, 0);
+}
+
+/**************************************************************/
+
+static void NXH_Packet(void *arg)
+{
+	uint8_t *frame = arg;
+	sim_time_t end;
+
+	if (s_nxh.state == NXH_APP)
+	{
+		g_simNXH2261.rxFrames++;
+		SIM_DrivePin(BOARD_INITPINS_NXH_DETECT_GPIO, BOARD_INITPINS_NXH_DETECT_GPIO_PIN, 1);
+		end = NXH_Send(SIM_Now() + s_nxh.config.detectLead, frame, SIM_NXH2261_FRAME_SIZE);
+		SIM_Cancel(s_nxh.detectEvent);
+		s_nxh.detectEvent = SIM_ScheduleInput(end, NXH_DetectLow, NULL);
+	}
+	else
+	{
+		g_simNXH2261.rxFramesDropped++;
+	}
+
+	free(frame);
+}
+
+
+/****************************************************************************
+ ******************************** API ***************************************
+ ***************************************************************************/
+
+void SIM_NXH2261_DefaultConfig(sim_nxh2261_config_t *config)
+{
+	config->bootWindow = SIM_MS(30);	// from KL_Program_NXH2261()
+	config->bootTime = SIM_MS(5);
+	config->commandTime = SIM_US(100);
+	config->pageWriteTime = SIM_MS(4);
+	config->pageSize = 64U;
+	config->updateLatency = SIM_MS(1);
+	config->frameTimeout = SIM_MS(500);	// KL_UpdatePacket_NXH2261() waits 100ms before sending
+	config->detectLead = SIM_MS(1);
+	config->endurance = 100000U;		// "EEPROM has a write endurance of 100k cycles"
+}
+
+/**************************************************************/
+
+void SIM_NXH2261_Attach(const sim_nxh2261_config_t *config)
+{
+	memset(&s_nxh, 0, sizeof(s_nxh));
+	memset(s_nxh.eeprom, 0xFF, sizeof(s_nxh.eeprom));
+	s_nxh.random = 1;
+	s_nxh.state = NXH_OFF;
+
+	if (config)
+		s_nxh.config = *config;
+	else
+		SIM_NXH2261_DefaultConfig(&s_nxh.config);
+
+	s_nxhDevice.address = SIM_NXH2261_ADDR;
+	s_nxhDevice.write = NXH_I2CWrite;
+	s_nxhDevice.read = NXH_I2CRead;
+	SIM_AttachI2C(&s_nxhDevice);
+
+	SIM_AttachPin(BOARD_INITPINS_NXH_nRESET_GPIO, BOARD_INITPINS_NXH_nRESET_GPIO_PIN, NXH_Reset, NULL);
+	SIM_AttachPin(BOARD_INITPINS_NXH_UPDATE_GPIO, BOARD_INITPINS_NXH_UPDATE_GPIO_PIN, NXH_Update, NULL);
+	SIM_AttachPin(BOARD_INITPINS_NXH_CAL_GPIO, BOARD_INITPINS_NXH_CAL_GPIO_PIN, NXH_Calibrate, NULL);
+	SIM_AttachLPUART0(NXH_Receive, NULL);
+}
+
+/**************************************************************/
+
+void SIM_NXH2261_SetFaults(const sim_nxh2261_faults_t *faults)
+{
+	s_nxh.faults = *faults;
+	s_nxh.random = faults->seed ? faults->seed : 1;
+}
+
+/**************************************************************/
+
+uint8_t *SIM_NXH2261_EEPROM(void)
+{
+	return s_nxh.eeprom;
+}
+
+/**************************************************************/
+
+uint32_t SIM_NXH2261_EEPROMCycles(uint32_t word)
+{
+	return (word < SIM_NXH2261_EEPROM_WORDS) ? s_nxh.cycles[word] : 0;
+}
+
+/**************************************************************/
+
+// Image file: EEPROM contents followed by the per-word write counters
+int SIM_NXH2261_LoadEEPROM(const char *path)
+{
+	FILE *fp = fopen(path, "rb");
+	uint32_t i;
+
+	if (!fp)
+		return 1;
+
+	if (fread(s_nxh.eeprom, 1, sizeof(s_nxh.eeprom), fp) != sizeof(s_nxh.eeprom))
+	{
+		fclose(fp);
+		return 1;
+	}
+
+	if (fread(s_nxh.cycles, 1, sizeof(s_nxh.cycles), fp) != sizeof(s_nxh.cycles))
+		memset(s_nxh.cycles, 0, sizeof(s_nxh.cycles));	// contents only
+
+	fclose(fp);
+
+	for (i = 0; i < SIM_NXH2261_EEPROM_WORDS; ++i)
+	{
+		if (s_nxh.cycles[i] > g_simNXH2261.eepromMaxCycles)
+			g_simNXH2261.eepromMaxCycles = s_nxh.cycles[i];
+	}
+
+	return 0;
+}
+
+/**************************************************************/
+
+int SIM_NXH2261_SaveEEPROM(const char *path)
+{
+	FILE *fp = fopen(path, "wb");
+	int result = 0;
+
+	if (!fp)
+		return 1;
+
+	if (fwrite(s_nxh.eeprom, 1, sizeof(s_nxh.eeprom), fp) != sizeof(s_nxh.eeprom) ||
+		fwrite(s_nxh.cycles, 1, sizeof(s_nxh.cycles), fp) != sizeof(s_nxh.cycles))
+		result = 1;
+
+	fclose(fp);
+	return result;
+}
+
+/**************************************************************/
+
+bool SIM_NXH2261_Running(void)
+{
+	return s_nxh.state == NXH_APP;
+}
+
+/**************************************************************/
+
+// Packet the radio is currently broadcasting, in over-the-air order
+bool SIM_NXH2261_TxPayload(uint8_t payload[SIM_NXH2261_PAYLOAD_SIZE])
+{
+	if (s_nxh.state != NXH_APP || !s_nxh.txValid)
+		return false;
+
+	memcpy(payload, s_nxh.txPayload, SIM_NXH2261_PAYLOAD_SIZE);
+	return true;
+}
+
+/**************************************************************/
+
+// Another badge's broadcast arrives over the air
+void SIM_NXH2261_QueueFrame(sim_time_t when, const uint8_t payload[SIM_NXH2261_PAYLOAD_SIZE])
+{
+	uint8_t *frame;
+	size_t i;
+
+	frame = malloc(SIM_NXH2261_FRAME_SIZE);
+	if (!frame)
+		return;
+
+	frame[0] = 'B';
+	for (i = 0; i < SIM_NXH2261_PAYLOAD_SIZE; ++i)
+	{
+		frame[1 + i * 2] = 0xD0 | (payload[i] >> 4);
+		frame[2 + i * 2] = 0xD0 | (payload[i] & 0x0F);
+	}
+	frame[SIM_NXH2261_FRAME_SIZE - 1] = 'E';
+
+	SIM_ScheduleInput(when, NXH_Packet, frame);
+}
+
+/**************************************************************/
+
+void SIM_NXH2261_QueuePacket(sim_time_t when, uint32_t uid, uint8_t type, uint8_t magic, uint8_t flags)
+{
+	uint8_t payload[SIM_NXH2261_PAYLOAD_SIZE];
+
+	payload[0] = (uint8_t)(uid >> 24);	// uid is sent big endian
+	payload[1] = (uint8_t)(uid >> 16);
+	payload[2] = (uint8_t)(uid >> 8);
+	payload[3] = (uint8_t)uid;
+	payload[4] = type;
+	payload[5] = magic;
+	payload[6] = flags;
+	payload[7] = 0;
+
+	SIM_NXH2261_QueueFrame(when, payload);
+}
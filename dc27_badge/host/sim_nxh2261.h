@@ -0,0 +1,125 @@
+/*
+ * DEFCON 27 Official Badge - host simulation
+ *
+ * Behavioural model of the NXH2261 NFMI radio, covering every interface the
+ * badge firmware uses:
+ *
+ *  - nRESET (PTC4): 30ms boot window after release in which Prevent Boot
+ *    holds the part in its I2C bootloader, otherwise it boots the image in
+ *    EEPROM (if one starting with 0xCAFEBABE is present)
+ *  - I2C bootloader at 0x10: 16-bit little endian opcode + tag + parameters,
+ *    4-byte status reply (all zero on success, tag echoed in byte 1). EEPROM
+ *    writes must be enabled and unlocked, take page write time, and the part
+ *    stretches SCL on the next transfer until it is done
+ *  - NXH_UPDATE (PTC1): falling edge makes the application answer "RO" on
+ *    LPUART0 and accept one 'B' + 16 nibble bytes (0xD0 | nibble) + 'E' frame
+ *    holding the packet to broadcast
+ *  - NXH_CAL (PTC2): calibration pulse, only valid with CLKOUT enabled
+ *  - NXH_DETECT (PTC7): raised when a packet is received over the air, followed
+ *    by the same B...E frame format on LPUART0
+ *
+ * Latencies come from sim_nxh2261_config_t; faults (dropped, corrupted and
+ * overrunning bytes, I2C NAKs, ignored update requests) are injected
+ * deterministically from a seed.
+ */
+
+#ifndef _SIM_NXH2261_H_
+#define _SIM_NXH2261_H_
+
+#include "sim_hal.h"
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+/***************************************************************************
+ **************************** Definitions **********************************
+ ***************************************************************************/
+
+#define SIM_NXH2261_ADDR			0x10
+#define SIM_NXH2261_FRAME_SIZE		18U		// 'B' + 16 nibble bytes + 'E'
+#define SIM_NXH2261_PAYLOAD_SIZE	8U		// uid (big endian), type, magic, flags, unused
+#define SIM_NXH2261_EEPROM_SIZE		(32U * 1024U)
+#define SIM_NXH2261_EEPROM_WORDS	(SIM_NXH2261_EEPROM_SIZE / 4U)	// addressed in 32-bit words
+
+typedef struct
+{
+	sim_time_t bootWindow;		// reset release to automatic boot
+	sim_time_t bootTime;		// EEPROM to RAM copy before the application runs
+	sim_time_t commandTime;		// bootloader command processing
+	sim_time_t pageWriteTime;	// EEPROM page program time
+	uint32_t pageSize;			// EEPROM page size (bytes)
+	sim_time_t updateLatency;	// NXH_UPDATE falling edge to "RO"
+	sim_time_t frameTimeout;	// "RO" to end of the KL27's frame
+	sim_time_t detectLead;		// NXH_DETECT rising edge to first frame byte
+	uint32_t endurance;			// EEPROM write cycles per word
+} sim_nxh2261_config_t;
+
+// Each fault fires on average once every N opportunities (0 = never)
+typedef struct
+{
+	uint32_t seed;
+	uint32_t dropByte;			// byte to the KL27 is never sent
+	uint32_t corruptByte;		// byte to the KL27 has one bit flipped
+	uint32_t overrunByte;		// byte to the KL27 is followed by a stray byte in the same character time
+	uint32_t nakTransfer;		// I2C transfer is NAKed
+	uint32_t missUpdate;		// NXH_UPDATE pulse is ignored
+} sim_nxh2261_faults_t;
+
+typedef struct
+{
+	uint32_t resets;			// nRESET releases
+	uint32_t bootloaderEntries;	// resets caught by Prevent Boot
+	uint32_t eepromBoots;		// application started from EEPROM
+	uint32_t blankBoots;		// boot attempted with no valid image
+	uint32_t i2cCommands;
+	uint32_t i2cErrors;			// commands answered with a non-zero status
+	uint32_t i2cStretches;
+	sim_time_t i2cStretchTime;
+	uint32_t eepromBytesWritten;
+	uint32_t eepromWordsUnchanged;	// words rewritten with the data they already held
+	uint32_t eepromMaxCycles;		// highest write count of any word
+	uint32_t eepromWornWrites;		// writes refused to words past their endurance
+	sim_time_t programStart;		// Prevent Boot accepted
+	sim_time_t programTime;			// Prevent Boot to EEPROM Disable
+	uint32_t calibrations;
+	uint32_t calibrationsNoClock;	// NXH_CAL pulsed with CLKOUT disabled
+	uint32_t updateRequests;		// NXH_UPDATE pulses answered with "RO"
+	uint32_t updatesMissed;
+	uint32_t updateTimeouts;		// "RO" sent but no complete frame followed
+	uint32_t txFrames;				// B...E frames received from the KL27
+	uint32_t txFramesBad;
+	uint32_t rxFrames;				// B...E frames sent to the KL27
+	uint32_t rxFramesDropped;		// received over the air while not running
+	uint32_t bytesDropped;
+	uint32_t bytesCorrupted;
+	uint32_t bytesOverrun;
+	uint32_t naks;
+} sim_nxh2261_stats_t;
+
+extern sim_nxh2261_stats_t g_simNXH2261;
+
+
+/****************************************************************************
+ ********************* Function Prototypes **********************************
+ ***************************************************************************/
+
+void SIM_NXH2261_DefaultConfig(sim_nxh2261_config_t *);
+void SIM_NXH2261_Attach(const sim_nxh2261_config_t *);
+void SIM_NXH2261_SetFaults(const sim_nxh2261_faults_t *);
+
+uint8_t *SIM_NXH2261_EEPROM(void);
+uint32_t SIM_NXH2261_EEPROMCycles(uint32_t word);
+int SIM_NXH2261_LoadEEPROM(const char *path);
+int SIM_NXH2261_SaveEEPROM(const char *path);
+
+bool SIM_NXH2261_Running(void);
+bool SIM_NXH2261_TxPayload(uint8_t payload[SIM_NXH2261_PAYLOAD_SIZE]);
+void SIM_NXH2261_QueueFrame(sim_time_t when, const uint8_t payload[SIM_NXH2261_PAYLOAD_SIZE]);
+void SIM_NXH2261_QueuePacket(sim_time_t when, uint32_t uid, uint8_t type, uint8_t magic, uint8_t flags);
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif /* _SIM_NXH2261_H_ */
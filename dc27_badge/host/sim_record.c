@@ -0,0 +1,582 @@
+/*
+ * DEFCON 27 Official Badge - host simulation
+ *
+ * Input record and replay (see sim_record.h)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sim_record.h"
+
+
+/***************************************************************************
+ **************************** Definitions **********************************
+ ***************************************************************************/
+
+#define REC_MAGIC				"DC27REC"
+#define REC_PORTS				5U
+#define REC_MAX_VARINT			10U		// bytes in a 64-bit LEB128 value
+
+// Console frames from a badge built with __NXH_RECORD (dc27_badge.c)
+#define REC_CONSOLE_SYNC		0x00
+#define REC_CONSOLE_FRAME_SIZE	7U		// sync, kind, time (us, u32), data
+#define REC_CONSOLE_TICK_NS		1000U
+
+
+/**************************************************************************
+************************** Structs ****************************************
+***************************************************************************/
+
+typedef struct
+{
+	FILE *fp;
+	uint64_t last;				// ticks
+	sim_record_stats_t *stats;
+	uint32_t tick;				// ns
+} rec_writer_t;
+
+typedef struct
+{
+	uint8_t *buf;
+	size_t len, pos;
+	uint32_t tick;
+	uint32_t uid[3];
+	uint64_t time;				// ticks
+	bool error;
+} rec_reader_t;
+
+typedef struct
+{
+	sim_time_t when;
+	uint8_t kind;
+	uint8_t data;
+	bool sameEvent;
+} rec_record_t;
+
+
+/****************************************************************************
+ ************************** Global variables ********************************
+ ***************************************************************************/
+
+sim_record_stats_t g_simRecord;
+sim_record_stats_t g_simReplay;
+
+static GPIO_Type *const s_gpios[REC_PORTS] = { GPIOA, GPIOB, GPIOC, GPIOD, GPIOE };
+
+static rec_writer_t s_writer;
+static uint64_t s_writerSerial;
+
+static rec_reader_t s_reader;
+static rec_record_t s_next;
+static sim_time_t s_replayLength;
+
+
+/****************************************************************************
+ ************************** Writing *****************************************
+ ***************************************************************************/
+
+static void Rec_PutU32(uint8_t *p, uint32_t v)
+{
+	p[0] = (uint8_t)v;
+	p[1] = (uint8_t)(v >> 8);
+	p[2] = (uint8_t)(v >> 16);
+	p[3] = (uint8_t)(v >> 24);
+}
+
+/**************************************************************/
+
+static uint32_t Rec_GetU32(const uint8_t *p)
+{
+	return p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+/**************************************************************/
+
+static int Rec_Open(rec_writer_t *w, const char *path, uint32_t tick, const uint32_t uid[3], sim_record_stats_t *stats)
+{
+	uint8_t header[SIM_RECORD_HEADER_SIZE];
+
+	memset(w, 0, sizeof(*w));
+	w->fp = fopen(path, "wb");
+	if (!w->fp)
+		return 1;
+
+	memcpy(header, REC_MAGIC, 7);
+	header[7] = SIM_RECORD_VERSION;
+	Rec_PutU32(&header[8], tick);
+	Rec_PutU32(&header[12], uid[0]);
+	Rec_PutU32(&header[16], uid[1]);
+	Rec_PutU32(&header[20], uid[2]);
+	fwrite(header, 1, sizeof(header), w->fp);
+
+	w->tick = tick;
+	w->stats = stats;
+	memset(stats, 0, sizeof(*stats));
+	stats->fileSize = sizeof(header);
+
+	return 0;
+}
+
+/**************************************************************/
+
+static void Rec_Write(rec_writer_t *w, uint64_t ticks, uint8_t kind, uint8_t data, bool sameEvent)
+{
+	uint8_t out[2 + REC_MAX_VARINT];
+	uint64_t delta = ticks - w->last;
+	size_t n = 0;
+
+	out[n++] = kind | (sameEvent ? SIM_RECORD_SAME_EVENT : 0U);
+	if (!sameEvent)
+	{
+		do
+		{
+			out[n++] = (uint8_t)((delta & 0x7F) | (delta > 0x7F ? 0x80 : 0x00));
+			delta >>= 7;
+		} while (delta);
+	}
+	if (kind != SIM_RECORD_END)
+		out[n++] = data;
+
+	fwrite(out, 1, n, w->fp);
+	w->last = ticks;
+
+	w->stats->records++;
+	w->stats->fileSize += n;
+	if (kind == SIM_RECORD_BYTE)
+		w->stats->bytes++;
+	else if (kind != SIM_RECORD_END)
+		w->stats->pinChanges++;
+}
+
+/**************************************************************/
+
+static int Rec_Close(rec_writer_t *w, uint64_t ticks)
+{
+	int err;
+
+	Rec_Write(w, ticks, SIM_RECORD_END, 0, false);
+	w->stats->length = ticks * w->tick;
+
+	err = ferror(w->fp);
+	err |= fclose(w->fp);
+	w->fp = NULL;
+
+	return err ? 1 : 0;
+}
+
+
+/****************************************************************************
+ ************************** Reading *****************************************
+ ***************************************************************************/
+
+static uint8_t *Rec_Load(const char *path, size_t *len)
+{
+	FILE *fp = fopen(path, "rb");
+	uint8_t *buf = NULL, *p;
+	size_t size = 0, n;
+
+	if (!fp)
+		return NULL;
+
+	*len = 0;
+	for (;;)
+	{
+		if (*len == size)
+		{
+			size = size ? size * 2 : 65536;
+			p = realloc(buf, size);
+			if (!p)
+			{
+				free(buf);
+				fclose(fp);
+				return NULL;
+			}
+			buf = p;
+		}
+
+		n = fread(buf + *len, 1, size - *len, fp);
+		if (n == 0)
+			break;
+		*len += n;
+	}
+
+	fclose(fp);
+	return buf;
+}
+
+/**************************************************************/
+
+static int Rec_Read(rec_reader_t *r, const char *path)
+{
+	memset(r, 0, sizeof(*r));
+
+	r->buf = Rec_Load(path, &r->len);
+	if (!r->buf)
+		return 1;
+
+	if (r->len < SIM_RECORD_HEADER_SIZE || memcmp(r->buf, REC_MAGIC, 7) != 0 ||
+		r->buf[7] != SIM_RECORD_VERSION || Rec_GetU32(&r->buf[8]) == 0)
+	{
+		free(r->buf);
+		r->buf = NULL;
+		return 1;
+	}
+
+	r->tick = Rec_GetU32(&r->buf[8]);
+	r->uid[0] = Rec_GetU32(&r->buf[12]);
+	r->uid[1] = Rec_GetU32(&r->buf[16]);
+	r->uid[2] = Rec_GetU32(&r->buf[20]);
+	r->pos = SIM_RECORD_HEADER_SIZE;
+
+	return 0;
+}
+
+/**************************************************************/
+
+// False at the end of the data or on a truncated record (r->error)
+static bool Rec_Next(rec_reader_t *r, rec_record_t *rec)
+{
+	uint64_t delta = 0;
+	uint32_t shift = 0;
+	uint8_t tag, b;
+
+	if (r->pos >= r->len)
+		return false;
+
+	tag = r->buf[r->pos++];
+	rec->kind = tag & SIM_RECORD_KIND_MASK;
+	rec->sameEvent = (tag & SIM_RECORD_SAME_EVENT) != 0;
+	rec->data = 0;
+
+	if (!rec->sameEvent)
+	{
+		do
+		{
+			if (r->pos >= r->len || shift >= 64)
+			{
+				r->error = true;
+				return false;
+			}
+			b = r->buf[r->pos++];
+			delta |= (uint64_t)(b & 0x7F) << shift;
+			shift += 7;
+		} while (b & 0x80);
+	}
+
+	if (rec->kind != SIM_RECORD_END)
+	{
+		if (r->pos >= r->len)
+		{
+			r->error = true;
+			return false;
+		}
+		rec->data = r->buf[r->pos++];
+	}
+
+	r->time += delta;
+	rec->when = r->time * r->tick;
+	return true;
+}
+
+
+/****************************************************************************
+ ************************** Recording ***************************************
+ ***************************************************************************/
+
+static void Rec_Input(uint8_t kind, uint8_t data)
+{
+	uint64_t serial = SIM_EventSerial();
+	sim_time_t now = SIM_Now();
+
+	Rec_Write(&s_writer, now, kind, data, g_simRecord.records && serial == s_writerSerial && now == s_writer.last);
+	s_writerSerial = serial;
+}
+
+/**************************************************************/
+
+static void Rec_Byte(void *ctx, uint8_t data)
+{
+	(void)ctx;
+
+	Rec_Input(SIM_RECORD_BYTE, data);
+}
+
+/**************************************************************/
+
+// Every drive is kept, not just changes: level-sensitive interrupts re-latch on a repeat
+static void Rec_Edge(void *ctx, GPIO_Type *gpio, uint32_t pin, uint32_t level)
+{
+	uint32_t port;
+
+	(void)ctx;
+
+	for (port = 0; port < REC_PORTS; ++port)
+	{
+		if (s_gpios[port] == gpio)
+		{
+			Rec_Input(level ? SIM_RECORD_PIN_HIGH : SIM_RECORD_PIN_LOW, SIM_RECORD_PIN(port, pin));
+			return;
+		}
+	}
+}
+
+/**************************************************************/
+
+int SIM_RecordStart(const char *path, const uint32_t uid[3])
+{
+	if (Rec_Open(&s_writer, path, 1U, uid, &g_simRecord))
+		return 1;
+
+	SIM_TapInputs(Rec_Byte, Rec_Edge, NULL);
+	return 0;
+}
+
+/**************************************************************/
+
+int SIM_RecordStop(void)
+{
+	if (!s_writer.fp)
+		return 1;
+
+	SIM_TapInputs(NULL, NULL, NULL);
+	return Rec_Close(&s_writer, SIM_Now());
+}
+
+
+/****************************************************************************
+ ************************** Replay ******************************************
+ ***************************************************************************/
+
+static void Rec_Inject(const rec_record_t *rec)
+{
+	uint32_t port = rec->data >> 5, pin = rec->data & 0x1F;
+
+	switch (rec->kind)
+	{
+		case SIM_RECORD_BYTE:
+			SIM_LPUART0_Inject(rec->data);
+			g_simReplay.bytes++;
+			break;
+
+		case SIM_RECORD_PIN_LOW:
+		case SIM_RECORD_PIN_HIGH:
+			if (port < REC_PORTS)
+			{
+				SIM_InjectPin(s_gpios[port], pin, rec->kind == SIM_RECORD_PIN_HIGH);
+				g_simReplay.pinChanges++;
+			}
+			break;
+
+		default:
+			break;
+	}
+
+	g_simReplay.records++;
+}
+
+/**************************************************************/
+
+// Inject the next group of records that arrived in the same event
+static void Rec_ReplayEvent(void *arg)
+{
+	(void)arg;
+
+	do
+	{
+		Rec_Inject(&s_next);
+		if (!Rec_Next(&s_reader, &s_next))
+			return;
+	} while (s_next.sameEvent);
+
+	if (s_next.kind != SIM_RECORD_END)
+		SIM_ScheduleInput(s_next.when, Rec_ReplayEvent, NULL);
+}
+
+/**************************************************************/
+
+// Device models keep running (the NXH2261 still boots over I2C) but only the
+// recording reaches LPUART0 RX and the input pins. uid is replaced by the
+// recorded badge's UID when the recording has one.
+int SIM_ReplayStart(const char *path, uint32_t uid[3])
+{
+	rec_record_t rec;
+
+	memset(&g_simReplay, 0, sizeof(g_simReplay));
+	if (Rec_Read(&s_reader, path))
+		return 1;
+
+	// Check the whole file first and find its length
+	s_replayLength = 0;
+	while (Rec_Next(&s_reader, &rec))
+	{
+		s_replayLength = rec.when;
+		if (rec.kind == SIM_RECORD_END)
+			break;
+	}
+	if (s_reader.error)
+		return 1;
+
+	g_simReplay.length = s_replayLength;
+	g_simReplay.fileSize = (uint32_t)s_reader.len;
+	if (s_reader.uid[0] || s_reader.uid[1] || s_reader.uid[2])
+		memcpy(uid, s_reader.uid, sizeof(s_reader.uid));
+
+	s_reader.pos = SIM_RECORD_HEADER_SIZE;
+	s_reader.time = 0;
+
+	SIM_MuteInputs(true);
+	if (Rec_Next(&s_reader, &s_next) && s_next.kind != SIM_RECORD_END)
+		SIM_ScheduleInput(s_next.when, Rec_ReplayEvent, NULL);
+
+	return 0;
+}
+
+/**************************************************************/
+
+sim_time_t SIM_ReplayLength(void)
+{
+	return s_replayLength;
+}
+
+
+/****************************************************************************
+ ************************** Tools *******************************************
+ ***************************************************************************/
+
+int SIM_RecordDump(const char *path, FILE *out)
+{
+	static const char *const ports = "ABCDE";
+	rec_reader_t r;
+	rec_record_t rec;
+	uint32_t records = 0, bytes = 0, pins = 0;
+	sim_time_t end = 0;
+
+	if (Rec_Read(&r, path))
+		return 1;
+
+	fprintf(out, "%s: %u ns ticks, UID %08X:%08X:%08X\n", path, r.tick, r.uid[0], r.uid[1], r.uid[2]);
+	while (Rec_Next(&r, &rec))
+	{
+		fprintf(out, "%16.9f %c ", SIM_Seconds(rec.when), rec.sameEvent ? '+' : ' ');
+		switch (rec.kind)
+		{
+			case SIM_RECORD_BYTE:
+				fprintf(out, "LPUART0 RX 0x%02X", rec.data);
+				if (rec.data >= 0x20 && rec.data < 0x7F)
+					fprintf(out, " '%c'", rec.data);
+				bytes++;
+				break;
+
+			case SIM_RECORD_PIN_LOW:
+			case SIM_RECORD_PIN_HIGH:
+				fprintf(out, "PT%c%u %s", (rec.data >> 5) < REC_PORTS ? ports[rec.data >> 5] : '?', rec.data & 0x1F,
+					rec.kind == SIM_RECORD_PIN_HIGH ? "high" : "low");
+				pins++;
+				break;
+
+			default:
+				fprintf(out, "end");
+				break;
+		}
+		fprintf(out, "\n");
+		records++;
+		end = rec.when;
+	}
+
+	fprintf(out, "%u records (%u LPUART0 bytes, %u pin changes) over %.3f s in %zu bytes%s\n",
+		records, bytes, pins, SIM_Seconds(end), r.len, r.error ? ", truncated" : "");
+	free(r.buf);
+
+	return r.error ? 1 : 0;
+}
+
+/**************************************************************/
+
+// Split a badge's console capture into its text (copied to text, if given) and
+// __NXH_RECORD frames (written to path as a recording). The badge only sees the
+// pin edges it takes interrupts on, so the opposite level is filled in 1 us
+// before a repeated one to keep every record an edge.
+int SIM_RecordFromConsole(const char *capture, const char *path, FILE *text)
+{
+	static const uint32_t noUid[3] = { 0, 0, 0 };
+	rec_writer_t w;
+	uint8_t *buf, kind, data, level[REC_PORTS * 32] = { 0 };	// pins idle low after reset
+	size_t len, i = 0;
+	uint64_t epoch = 0, t, last = 0;
+	uint32_t raw, prevRaw = 0, lost = 0, bad = 0;
+	int err;
+
+	buf = Rec_Load(capture, &len);
+	if (!buf)
+		return 1;
+
+	if (Rec_Open(&w, path, REC_CONSOLE_TICK_NS, noUid, &g_simRecord))
+	{
+		free(buf);
+		return 1;
+	}
+
+	while (i < len)
+	{
+		if (buf[i] != REC_CONSOLE_SYNC || i + REC_CONSOLE_FRAME_SIZE > len)
+		{
+			if (text && buf[i] != REC_CONSOLE_SYNC)
+				fputc(buf[i], text);
+			i++;
+			continue;
+		}
+
+		kind = buf[i + 1];
+		raw = Rec_GetU32(&buf[i + 2]);
+		data = buf[i + 6];
+		i += REC_CONSOLE_FRAME_SIZE;
+
+		// 32-bit microsecond count wraps every 71 minutes; the badge can also be
+		// a millisecond behind when SysTick reloads inside an ISR
+		if (raw < prevRaw && prevRaw - raw > 0x80000000U)
+			epoch += 1ULL << 32;
+		prevRaw = raw;
+		t = epoch + raw;
+		if (t < last)
+			t = last;
+
+		switch (kind)
+		{
+			case 'U':
+				Rec_Write(&w, t, SIM_RECORD_BYTE, data, false);
+				break;
+
+			case 'L':
+			case 'H':
+				if ((data >> 5) >= REC_PORTS)
+				{
+					bad++;
+					continue;
+				}
+				if (level[data] == (kind == 'H'))
+					Rec_Write(&w, (t > last) ? t - 1 : t, level[data] ? SIM_RECORD_PIN_LOW : SIM_RECORD_PIN_HIGH, data, false);
+				level[data] = (kind == 'H');
+				Rec_Write(&w, t, level[data] ? SIM_RECORD_PIN_HIGH : SIM_RECORD_PIN_LOW, data, false);
+				break;
+
+			case 'X':
+				lost += data;
+				continue;
+
+			default:
+				bad++;
+				continue;
+		}
+		last = t;
+	}
+
+	err = Rec_Close(&w, last);
+	free(buf);
+
+	if (lost || bad)
+		fprintf(stderr, "%s: %u events lost on the badge, %u bad frames\n", capture, lost, bad);
+
+	return err;
+}
@@ -0,0 +1,82 @@
+/*
+ * DEFCON 27 Official Badge - host simulation
+ *
+ * Record and replay of the inputs that reach the KL27 from outside: bytes on
+ * LPUART0 RX and levels driven onto input pins (NXH_DETECT, KL_RX). A run
+ * recorded in the simulator replays with the same interleaving against the
+ * firmware's interrupts and IRQ-disabled windows, so packet-path behaviour
+ * (overruns, lost frames, throughput) can be reproduced and benchmarked from a
+ * file. Recordings can also be made on a badge built with __NXH_RECORD and
+ * converted from its console capture.
+ *
+ * File format (little endian):
+ *   header   "DC27REC" + version (8 bytes), tick length in ns (u32),
+ *            UIDMH, UIDML, UIDL of the recorded badge (u32 each, 0 = unknown)
+ *   record   tag (bits 0-1 kind, bit 7 same event), then unless same event the
+ *            time since the previous record in ticks (LEB128), then unless
+ *            END a data byte: the RX byte, or port << 5 | pin for pin levels
+ *
+ * Records marked "same event" arrived together in the recording, with no
+ * chance for an interrupt in between (a byte overrunning the one before it),
+ * and are replayed that way. The END record marks the end of the run.
+ */
+
+#ifndef _SIM_RECORD_H_
+#define _SIM_RECORD_H_
+
+#include "sim_hal.h"
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+/***************************************************************************
+ **************************** Definitions **********************************
+ ***************************************************************************/
+
+#define SIM_RECORD_VERSION		1U
+#define SIM_RECORD_HEADER_SIZE	24U
+
+typedef enum
+{
+	SIM_RECORD_END = 0,
+	SIM_RECORD_BYTE,		// LPUART0 RX byte
+	SIM_RECORD_PIN_LOW,		// input pin driven low
+	SIM_RECORD_PIN_HIGH		// input pin driven high
+} sim_record_kind_t;
+
+#define SIM_RECORD_KIND_MASK		0x03U
+#define SIM_RECORD_SAME_EVENT		0x80U
+#define SIM_RECORD_PIN(port, pin)	((uint8_t)(((port) << 5) | (pin)))
+
+typedef struct
+{
+	uint32_t records;
+	uint32_t bytes;				// LPUART0 RX bytes
+	uint32_t pinChanges;
+	uint32_t fileSize;
+	sim_time_t length;			// time of the END record
+} sim_record_stats_t;
+
+extern sim_record_stats_t g_simRecord;		// --record
+extern sim_record_stats_t g_simReplay;		// --replay: records injected so far
+
+
+/****************************************************************************
+ ********************* Function Prototypes **********************************
+ ***************************************************************************/
+
+int SIM_RecordStart(const char *path, const uint32_t uid[3]);
+int SIM_RecordStop(void);
+
+int SIM_ReplayStart(const char *path, uint32_t uid[3]);
+sim_time_t SIM_ReplayLength(void);
+
+int SIM_RecordDump(const char *path, FILE *out);
+int SIM_RecordFromConsole(const char *capture, const char *path, FILE *text);
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif /* _SIM_RECORD_H_ */
@@ -0,0 +1,959 @@
+/*
+ * DEFCON 27 Official Badge - swarm simulation
+ *
+ * Conference-floor model: thousands of attendees walk between talks and
+ * villages wearing badges, and every badge's NXH2261 broadcasts its packet
+ * to whoever is within NFMI range. Stock badges (upstream firmware, one fixed
+ * __BADGE_TYPE each) run the DC27 quest from ATTRACT to COMPLETE using the
+ * rules in DC27_UpdateState(); Jackp0t badges sit in COMPLETE with the magic
+ * token set and rotate their advertised badge type like DC27_MagicPacket().
+ *
+ * The same crowd (same seed) is replayed once per rotation strategy and the
+ * report compares unlocks per hour and the time-to-COMPLETE distribution.
+ *
+ * Time advances in broadcast intervals. Each interval is three parallel
+ * passes over the badges (move, listen, run the game) on a work-stealing
+ * pool, with the contact grid (swarm_grid.c) brought up to date between the
+ * first two. A badge only writes its own state in each pass and only reads
+ * other badges' state from an earlier pass, so results don't depend on the
+ * number of threads.
+ *
+ * Usage: dc27_swarm [options]
+ *   --badges <n>            stock badges (default 1000)
+ *   --jackpots <n>          Jackp0t badges (default 10)
+ *   --magic-tokens <n>      stock __BADGE_MAGIC tokens (default 0)
+ *   --strategy <name,...>   firmware, useful, random, fixed or all (default all)
+ *   --hours <h>             conference time to simulate (default 4)
+ *   --density <n>           attendees per square metre of floor (default 0.05)
+ *   --range <m>             NFMI range (default 0.3)
+ *   --tick <ms>             broadcast interval (default 1000)
+ *   --rotate <ms>           Jackp0t rotation period (default 4650)
+ *   --threads <n>           worker threads (default: online CPUs)
+ *   --seed <n>
+ *   --naive                 check every pair of badges instead of using the grid
+ *   --bench                 time contact queries against crowd density and exit
+ */
+
+#include <getopt.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "swarm_grid.h"
+#include "swarm_pool.h"
+
+
+/***************************************************************************
+ **************************** Definitions **********************************
+ ***************************************************************************/
+
+// Game rules (same values as dc27_badge.c)
+#define FLAG_0_MASK					0x01	// Any Valid Communication
+#define FLAG_1_MASK					0x02	// Talk/Speaker
+#define FLAG_2_MASK					0x04	// Village
+#define FLAG_3_MASK					0x08	// Contest & Events
+#define FLAG_4_MASK					0x10	// Arts & Entertainment
+#define FLAG_5_MASK					0x20	// Parties
+#define FLAG_6_MASK					0x40	// Group Chat
+#define GROUP_ALL_MASK				0x3F
+
+// Firmware timings, measured with dc27_sim
+#define SWARM_BOOT_TIME				10700	// power-up to "[*] Initialization Complete" (ms)
+#define SWARM_JACKPOT_BOOT_TIME		29450	// ... plus the RickRoll, before the first rotation
+#define SWARM_PASS_TIME				550		// DC27_UpdateState() with a packet and no state change
+#define SWARM_UNLOCK_TIME			2300	// extra for a state change (1-Up, flash write, NXH update)
+#define SWARM_COMPLETE_TIME			20100	// extra for the win (RickRoll)
+
+// Crowd
+#define SWARM_PEOPLE_PER_HOTSPOT	50U
+#define SWARM_HOTSPOT_RADIUS		6.0f	// m
+#define SWARM_WALK_SPEED			1.2f	// m/s, +-0.3
+#define SWARM_MILL_SPEED			0.2f	// m/s while at a hotspot
+#define SWARM_DWELL_MIN				300U	// s
+#define SWARM_DWELL_MAX				1800U	// s
+
+#define SWARM_GRAIN					64U		// badges per work-stealing chunk
+#define SWARM_MAX_HEARD				256U	// badges in range handled from the grid (more: scan everyone)
+#define SWARM_MAX_STRATEGIES		4U
+
+typedef enum	// badge types, in badge_type_t order
+{
+	HUMAN,
+	GOON,
+	SPEAKER,
+	VENDOR,
+	PRESS,
+	VILLAGE,
+	CONTEST,
+	ARTIST,
+	CFP,
+	UBER,
+	BADGE_TYPES
+} badge_type_t;
+
+typedef enum	// badge states, in badge_state_t order
+{
+	ATTRACT,
+	D,
+	E,
+	F,
+	C,
+	O,
+	N,
+	COMPLETE
+} badge_state_t;
+
+typedef enum
+{
+	KIND_STOCK,		// upstream firmware, plays the game
+	KIND_MAGIC,		// upstream __BADGE_MAGIC build, broadcasts magic and never advances
+	KIND_JACKPOT	// this firmware: COMPLETE, magic, rotating type
+} badge_kind_t;
+
+typedef enum
+{
+	STRATEGY_FIRMWARE,	// DC27_MagicPacket(): all ten types in enum order
+	STRATEGY_USEFUL,	// only the eight types that can change someone's state
+	STRATEGY_RANDOM,	// a random useful type each period
+	STRATEGY_FIXED		// no rotation (stays __BADGE_TYPE)
+} strategy_t;
+
+
+/**************************************************************************
+************************** Structs ****************************************
+***************************************************************************/
+
+typedef struct
+{
+	uint32_t badges, jackpots, magicTokens;
+	double hours, density, range;
+	uint32_t tickMs, rotateMs;
+	uint32_t threads;
+	uint32_t seed;
+	bool naive;
+} swarm_config_t;
+
+// One attendee and their badge (position is kept separately, see swarm_t)
+typedef struct
+{
+	// Movement
+	float tx, ty;			// walking towards
+	float speed;
+	uint32_t hotspot;
+	uint32_t dwellUntil;	// s; 0 while walking between hotspots
+	uint32_t random;
+
+	// Radio: what this badge broadcasts, read by everyone else in the listen pass
+	uint8_t kind, type, magic, rotation;
+
+	// Listen pass output: a copy of the packet, since senders rotate during the update pass
+	bool heard;
+	uint8_t heardKind, heardType, heardMagic;
+	uint32_t contacts;
+
+	// Game
+	uint8_t state, flags, group;
+	uint32_t busyUntil;		// ms
+	uint32_t nextRotate;	// ms
+	uint32_t completedAt;	// ms, 0 if not yet
+} badge_t;
+
+typedef struct
+{
+	uint64_t contacts;			// sender in range of a listening badge, per interval
+	uint64_t heard;				// packets taken by a badge's game loop
+	uint64_t lostBusy;			// packets that arrived while the game loop was busy
+	uint64_t unlocks;			// stock badge state changes
+	uint64_t unlocksJackpot;	// ... caused by a Jackp0t packet
+	uint64_t rotations;
+} swarm_counts_t;
+
+typedef struct
+{
+	const swarm_config_t *config;
+	strategy_t strategy;
+	badge_t *badge;
+	float *x, *y;			// positions, structure-of-arrays for the grid
+	swarm_grid_t grid;
+	uint32_t count;
+	float width, height;
+	uint32_t hotspots;
+	float *hotspotX, *hotspotY;
+	uint32_t nowMs;
+	float dt;
+	float range2;
+	swarm_counts_t counts[SWARM_POOL_MAX_THREADS];	// per worker, summed at the end
+} swarm_t;
+
+
+/****************************************************************************
+ ************************** Global variables ********************************
+ ***************************************************************************/
+
+static const char *s_strategyNames[SWARM_MAX_STRATEGIES] = { "firmware", "useful", "random", "fixed" };
+
+// DC27_MagicPacket() order
+static const uint8_t s_rotationFirmware[] = { HUMAN, GOON, SPEAKER, VENDOR, PRESS, VILLAGE, CONTEST, ARTIST, CFP, UBER };
+
+// Flag types first (DC27_IncrementFlag()), then the rest of the group chat (CFP/UBER count as HUMAN)
+static const uint8_t s_rotationUseful[] = { GOON, SPEAKER, VILLAGE, CONTEST, ARTIST, VENDOR, PRESS, HUMAN };
+
+// Share of stock badges by type (per mille)
+static const uint16_t s_typeMix[BADGE_TYPES] = { 900, 30, 20, 10, 8, 15, 8, 5, 3, 1 };
+
+
+/****************************************************************************
+ ************************** Helpers *****************************************
+ ***************************************************************************/
+
+static uint32_t Swarm_Random(uint32_t *state)
+{
+	*state ^= *state << 13;
+	*state ^= *state >> 17;
+	*state ^= *state << 5;
+	return *state;
+}
+
+/**************************************************************/
+
+static float Swarm_RandomFloat(uint32_t *state)
+{
+	return (Swarm_Random(state) >> 8) * (1.0f / 16777216.0f);
+}
+
+/**************************************************************/
+
+static uint32_t Swarm_Seed(uint32_t seed, uint32_t index)
+{
+	uint32_t s = seed ^ (index * 0x9E3779B9U);
+
+	s ^= s >> 16;
+	s *= 0x85EBCA6BU;
+	s ^= s >> 13;
+	return s ? s : 1;
+}
+
+/**************************************************************/
+
+static void Swarm_PickPoint(swarm_t *sw, badge_t *b, float radius)
+{
+	float a = Swarm_RandomFloat(&b->random) * 6.2831853f;
+	float r = radius * sqrtf(Swarm_RandomFloat(&b->random));
+
+	b->tx = sw->hotspotX[b->hotspot] + r * cosf(a);
+	b->ty = sw->hotspotY[b->hotspot] + r * sinf(a);
+}
+
+/**************************************************************/
+
+static uint8_t Swarm_Rotate(const swarm_t *sw, badge_t *b)
+{
+	switch (sw->strategy)
+	{
+		case STRATEGY_FIRMWARE:
+			b->rotation = (b->rotation + 1) % sizeof(s_rotationFirmware);
+			return s_rotationFirmware[b->rotation];
+
+		case STRATEGY_USEFUL:
+			b->rotation = (b->rotation + 1) % sizeof(s_rotationUseful);
+			return s_rotationUseful[b->rotation];
+
+		case STRATEGY_RANDOM:
+			return s_rotationUseful[Swarm_Random(&b->random) % sizeof(s_rotationUseful)];
+
+		case STRATEGY_FIXED:
+		default:
+			return b->type;
+	}
+}
+
+
+/****************************************************************************
+ ************************** Game rules **************************************
+ ***************************************************************************/
+
+// DC27_IncrementFlag()
+static int Swarm_IncrementFlag(badge_t *b, uint8_t type)
+{
+	static const uint8_t flag[BADGE_TYPES] = { 0, FLAG_5_MASK, FLAG_1_MASK, 0, 0, FLAG_2_MASK, FLAG_3_MASK, FLAG_4_MASK, 0, 0 };
+
+	if (flag[type] && (b->flags & flag[type]) == 0)
+	{
+		b->flags |= flag[type];
+		return 1;
+	}
+
+	return 0;
+}
+
+/**************************************************************/
+
+// DC27_UpdateState() for a stock badge woken by a packet
+static void Swarm_Game(swarm_t *sw, badge_t *b, swarm_counts_t *counts)
+{
+	static const uint8_t group[BADGE_TYPES] = { FLAG_0_MASK, FLAG_1_MASK, FLAG_2_MASK, FLAG_3_MASK, FLAG_4_MASK,
+		FLAG_5_MASK, FLAG_0_MASK, FLAG_0_MASK, FLAG_0_MASK, FLAG_0_MASK };
+	uint8_t before = b->state;
+	uint32_t busy = SWARM_PASS_TIME;
+	int i, count = 0;
+
+	switch (b->state)
+	{
+		case ATTRACT:
+			b->flags |= FLAG_0_MASK;	// DC27_ProcessPacket()
+			for (i = 1; i <= 5; ++i)
+			{
+				count += (b->flags >> i) & 1;
+			}
+			b->state = D + count;
+			break;
+
+		case D:
+		case E:
+		case F:
+		case C:
+		case O:
+			if (b->heardMagic && Swarm_IncrementFlag(b, b->heardType))
+			{
+				b->state++;
+				if (b->state == N)
+					b->group = 0;
+			}
+			break;
+
+		case N:
+			b->group |= group[b->heardType];
+			if ((b->group & GROUP_ALL_MASK) == GROUP_ALL_MASK)
+			{
+				b->flags |= FLAG_6_MASK;
+				b->state = COMPLETE;
+				b->completedAt = sw->nowMs;
+				busy += SWARM_COMPLETE_TIME;
+			}
+			break;
+
+		default:
+			return;
+	}
+
+	if (b->state != before)
+	{
+		busy += SWARM_UNLOCK_TIME;
+		counts->unlocks++;
+		if (b->heardKind == KIND_JACKPOT)
+			counts->unlocksJackpot++;
+	}
+
+	b->busyUntil = sw->nowMs + busy;
+}
+
+
+/****************************************************************************
+ ************************** Passes ******************************************
+ ***************************************************************************/
+
+static void Swarm_Move(void *ctx, uint32_t worker, uint32_t begin, uint32_t end)
+{
+	swarm_t *sw = ctx;
+	uint32_t i, now = sw->nowMs / 1000U;
+	float dx, dy, d, step;
+	badge_t *b;
+
+	for (i = begin; i < end; ++i)
+	{
+		b = &sw->badge[i];
+
+		dx = b->tx - sw->x[i];
+		dy = b->ty - sw->y[i];
+		d = sqrtf(dx * dx + dy * dy);
+		step = (b->dwellUntil ? SWARM_MILL_SPEED : b->speed) * sw->dt;
+
+		if (d > step)
+		{
+			sw->x[i] += dx * step / d;
+			sw->y[i] += dy * step / d;
+			continue;
+		}
+
+		sw->x[i] = b->tx;
+		sw->y[i] = b->ty;
+
+		if (b->dwellUntil == 0)		// arrived: stay a while
+		{
+			b->dwellUntil = now + SWARM_DWELL_MIN + Swarm_Random(&b->random) % (SWARM_DWELL_MAX - SWARM_DWELL_MIN);
+		}
+		else if (now >= b->dwellUntil)	// head somewhere else
+		{
+			b->dwellUntil = 0;
+			b->hotspot = Swarm_Random(&b->random) % sw->hotspots;
+			b->speed = SWARM_WALK_SPEED - 0.3f + 0.6f * Swarm_RandomFloat(&b->random);
+		}
+
+		Swarm_PickPoint(sw, b, SWARM_HOTSPOT_RADIUS);
+	}
+}
+
+/**************************************************************/
+
+// Everyone in range of badge i, in index order
+static uint32_t Swarm_InRange(const swarm_t *sw, uint32_t i, uint32_t *ids)
+{
+	uint32_t j, k, id, n = 0, found;
+	float dx, dy;
+
+	if (!sw->config->naive)
+	{
+		found = Swarm_GridQuery(&sw->grid, sw->x[i], sw->y[i], sw->range2, ids, SWARM_MAX_HEARD);
+		if (found <= SWARM_MAX_HEARD)
+		{
+			for (j = 0; j < found; ++j)		// drop ourselves and sort; lists are short
+			{
+				if ((id = ids[j]) == i)
+					continue;
+				for (k = n; k > 0 && ids[k - 1] > id; --k)
+				{
+					ids[k] = ids[k - 1];
+				}
+				ids[k] = id;
+				n++;
+			}
+			return n;
+		}
+	}
+
+	for (j = 0; j < sw->count; ++j)
+	{
+		dx = sw->x[j] - sw->x[i];
+		dy = sw->y[j] - sw->y[i];
+		if (dx * dx + dy * dy > sw->range2 || j == i)
+			continue;
+
+		if (n < SWARM_MAX_HEARD)
+			ids[n] = j;
+		n++;
+	}
+
+	return n;
+}
+
+/**************************************************************/
+
+// Badges whose game loop is waiting for NXH_DETECT pick up one packet from
+// whoever is in range (the last one left in the ring buffer)
+static void Swarm_Listen(void *ctx, uint32_t worker, uint32_t begin, uint32_t end)
+{
+	swarm_t *sw = ctx;
+	swarm_counts_t *counts = &sw->counts[worker];
+	uint32_t ids[SWARM_MAX_HEARD], i, j, n, pick;
+	badge_t *b, *from = NULL;
+
+	for (i = begin; i < end; ++i)
+	{
+		b = &sw->badge[i];
+		b->heard = false;
+
+		if (b->kind != KIND_STOCK || b->state == COMPLETE || sw->nowMs < SWARM_BOOT_TIME)
+			continue;
+
+		n = Swarm_InRange(sw, i, ids);
+
+		// Reservoir pick, so each sender in range is equally likely to be last
+		for (j = 0, pick = 0; j < n && j < SWARM_MAX_HEARD; ++j)
+		{
+			if (Swarm_Random(&b->random) % (j + 1) == 0)
+				pick = ids[j];
+		}
+		if (n)
+			from = &sw->badge[pick];
+
+		b->contacts += n;
+		counts->contacts += n;
+
+		if (n == 0)
+			continue;
+
+		if (sw->nowMs < b->busyUntil)
+		{
+			counts->lostBusy += n;	// LPUART0 IRQ is off inside DC27_UpdateState()
+			continue;
+		}
+
+		b->heard = true;
+		b->heardKind = from->kind;
+		b->heardType = from->type;
+		b->heardMagic = from->magic;
+	}
+}
+
+/**************************************************************/
+
+static void Swarm_Update(void *ctx, uint32_t worker, uint32_t begin, uint32_t end)
+{
+	swarm_t *sw = ctx;
+	swarm_counts_t *counts = &sw->counts[worker];
+	uint32_t i;
+	badge_t *b;
+
+	for (i = begin; i < end; ++i)
+	{
+		b = &sw->badge[i];
+
+		if (b->kind == KIND_JACKPOT)
+		{
+			if (sw->nowMs >= b->nextRotate)
+			{
+				b->type = Swarm_Rotate(sw, b);
+				b->nextRotate += sw->config->rotateMs;
+				counts->rotations++;
+			}
+		}
+		else if (b->heard)
+		{
+			counts->heard++;
+			Swarm_Game(sw, b, counts);
+		}
+	}
+}
+
+
+/****************************************************************************
+ ************************** Runs ********************************************
+ ***************************************************************************/
+
+static void Swarm_Init(swarm_t *sw, const swarm_config_t *config, strategy_t strategy)
+{
+	uint32_t i, j, pick, sum, random = Swarm_Seed(config->seed, 0xFFFFFFFFU);
+	float side;
+	badge_t *b;
+
+	memset(sw, 0, sizeof(*sw));
+	sw->config = config;
+	sw->strategy = strategy;
+	sw->count = config->badges + config->jackpots + config->magicTokens;
+	sw->dt = config->tickMs / 1000.0f;
+	sw->range2 = (float)(config->range * config->range);
+
+	side = sqrtf(sw->count / (float)config->density);
+	sw->width = side * 1.5f;	// convention halls are wider than deep
+	sw->height = side / 1.5f;
+
+	sw->hotspots = sw->count / SWARM_PEOPLE_PER_HOTSPOT + 1;
+	sw->hotspotX = malloc(sw->hotspots * sizeof(float));
+	sw->hotspotY = malloc(sw->hotspots * sizeof(float));
+	sw->badge = calloc(sw->count, sizeof(badge_t));
+	sw->x = malloc(sw->count * sizeof(float));
+	sw->y = malloc(sw->count * sizeof(float));
+	if (!sw->hotspotX || !sw->hotspotY || !sw->badge || !sw->x || !sw->y ||
+		Swarm_GridInit(&sw->grid, sw->count, sw->width, sw->height, (float)config->range))
+	{
+		fprintf(stderr, "dc27_swarm: out of memory\n");
+		exit(1);
+	}
+
+	for (i = 0; i < sw->hotspots; ++i)
+	{
+		sw->hotspotX[i] = SWARM_HOTSPOT_RADIUS + Swarm_RandomFloat(&random) * (sw->width - 2 * SWARM_HOTSPOT_RADIUS);
+		sw->hotspotY[i] = SWARM_HOTSPOT_RADIUS + Swarm_RandomFloat(&random) * (sw->height - 2 * SWARM_HOTSPOT_RADIUS);
+	}
+
+	// Crowd and stock badges are identical for every strategy
+	for (i = 0; i < sw->count; ++i)
+	{
+		b = &sw->badge[i];
+		b->random = Swarm_Seed(config->seed, i);
+		sw->x[i] = Swarm_RandomFloat(&b->random) * sw->width;
+		sw->y[i] = Swarm_RandomFloat(&b->random) * sw->height;
+		b->hotspot = Swarm_Random(&b->random) % sw->hotspots;
+		b->speed = SWARM_WALK_SPEED - 0.3f + 0.6f * Swarm_RandomFloat(&b->random);
+		Swarm_PickPoint(sw, b, SWARM_HOTSPOT_RADIUS);
+
+		if (i < config->badges)
+		{
+			b->kind = KIND_STOCK;
+			pick = Swarm_Random(&b->random) % 1000U;
+			for (j = 0, sum = 0; j < BADGE_TYPES - 1; ++j)
+			{
+				sum += s_typeMix[j];
+				if (pick < sum)
+					break;
+			}
+			b->type = j;
+			b->state = ATTRACT;
+		}
+		else if (i < config->badges + config->jackpots)
+		{
+			b->kind = KIND_JACKPOT;
+			b->type = UBER;		// __BADGE_TYPE
+			b->magic = 1;
+			b->state = COMPLETE;
+			b->nextRotate = SWARM_JACKPOT_BOOT_TIME + Swarm_Random(&b->random) % config->rotateMs;
+			b->rotation = Swarm_Random(&b->random) % sizeof(s_rotationFirmware);
+		}
+		else
+		{
+			b->kind = KIND_MAGIC;
+			b->type = s_rotationUseful[Swarm_Random(&b->random) % sizeof(s_rotationUseful)];
+			b->magic = 1;
+			b->state = D;
+		}
+	}
+}
+
+/**************************************************************/
+
+static void Swarm_Free(swarm_t *sw)
+{
+	Swarm_GridFree(&sw->grid);
+	free(sw->badge);
+	free(sw->x);
+	free(sw->y);
+	free(sw->hotspotX);
+	free(sw->hotspotY);
+}
+
+/**************************************************************/
+
+static int Swarm_CompareU32(const void *a, const void *b)
+{
+	uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+
+	return (x > y) - (x < y);
+}
+
+/**************************************************************/
+
+static void Swarm_Report(const swarm_t *sw, double wall)
+{
+	const swarm_config_t *config = sw->config;
+	swarm_counts_t total;
+	uint32_t i, w, completed = 0, states[COMPLETE + 1] = { 0 };
+	uint32_t *times;
+	double hours = sw->nowMs / 3600000.0;
+
+	memset(&total, 0, sizeof(total));
+	for (w = 0; w < SWARM_POOL_MAX_THREADS; ++w)
+	{
+		total.contacts += sw->counts[w].contacts;
+		total.heard += sw->counts[w].heard;
+		total.lostBusy += sw->counts[w].lostBusy;
+		total.unlocks += sw->counts[w].unlocks;
+		total.unlocksJackpot += sw->counts[w].unlocksJackpot;
+		total.rotations += sw->counts[w].rotations;
+	}
+
+	times = malloc((config->badges + 1) * sizeof(uint32_t));
+	for (i = 0; i < config->badges; ++i)
+	{
+		states[sw->badge[i].state]++;
+		if (sw->badge[i].completedAt)
+			times[completed++] = sw->badge[i].completedAt;
+	}
+	qsort(times, completed, sizeof(uint32_t), Swarm_CompareU32);
+
+	printf("\n===== strategy: %s =====\n", s_strategyNames[sw->strategy]);
+	printf("Unlocks:            %llu (%.1f/hour), %llu from Jackp0t packets (%.1f/hour)\n",
+		(unsigned long long)total.unlocks, total.unlocks / hours,
+		(unsigned long long)total.unlocksJackpot, total.unlocksJackpot / hours);
+	printf("Completed:          %u of %u stock badges (%.1f%%)\n", completed, config->badges,
+		config->badges ? 100.0 * completed / config->badges : 0.0);
+	printf("Time to COMPLETE:   ");
+	if (completed)
+	{
+		printf("min %.1f, p10 %.1f, p25 %.1f, median %.1f, p75 %.1f, p90 %.1f, max %.1f min\n",
+			times[0] / 60000.0, times[completed / 10] / 60000.0, times[completed / 4] / 60000.0,
+			times[completed / 2] / 60000.0, times[completed * 3 / 4] / 60000.0,
+			times[completed * 9 / 10] / 60000.0, times[completed - 1] / 60000.0);
+	}
+	else
+	{
+		printf("none\n");
+	}
+	printf("Final states:       ATTRACT %u, D %u, E %u, F %u, C %u, O %u, N %u, COMPLETE %u\n",
+		states[ATTRACT], states[D], states[E], states[F], states[C], states[O], states[N], states[COMPLETE]);
+	printf("Radio:              %llu contacts, %llu packets handled, %llu lost while busy, %llu rotations\n",
+		(unsigned long long)total.contacts, (unsigned long long)total.heard,
+		(unsigned long long)total.lostBusy, (unsigned long long)total.rotations);
+	if (!config->naive)
+	{
+		printf("Contact grid:       %.2f m cells, %llu updates (%llu full rebuilds), %.1f cell changes/update\n",
+			sw->grid.cellSize, (unsigned long long)sw->grid.updates, (unsigned long long)sw->grid.fullRebuilds,
+			sw->grid.updates > 1 ? (double)sw->grid.moves / (sw->grid.updates - 1) : 0.0);
+	}
+	printf("Wall time:          %.2f s\n", wall);
+
+	free(times);
+}
+
+/**************************************************************/
+
+static double Swarm_WallClock(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/**************************************************************/
+
+static void Swarm_Run(const swarm_config_t *config, strategy_t strategy, swarm_pool_t *pool)
+{
+	uint32_t endMs = (uint32_t)(config->hours * 3600000.0);
+	double start = Swarm_WallClock();
+	swarm_t *sw = malloc(sizeof(swarm_t));
+
+	if (!sw)
+		return;
+
+	Swarm_Init(sw, config, strategy);
+
+	for (sw->nowMs = 0; sw->nowMs < endMs; sw->nowMs += config->tickMs)
+	{
+		Swarm_PoolFor(pool, sw->count, SWARM_GRAIN, Swarm_Move, sw);
+		if (!config->naive)
+			Swarm_GridUpdate(&sw->grid, sw->x, sw->y);
+		Swarm_PoolFor(pool, sw->count, SWARM_GRAIN, Swarm_Listen, sw);
+		Swarm_PoolFor(pool, sw->count, SWARM_GRAIN, Swarm_Update, sw);
+	}
+
+	Swarm_Report(sw, Swarm_WallClock() - start);
+	Swarm_Free(sw);
+	free(sw);
+}
+
+/**************************************************************/
+
+// Contact query cost as the crowd gets denser: the grid against checking
+// every pair, for the same number of badges spread uniformly over less floor
+static void Swarm_Bench(const swarm_config_t *config)
+{
+	static const double densities[] = { 0.01, 0.02, 0.05, 0.1, 0.2, 0.5, 1.0, 2.0, 4.0 };
+	uint32_t n = config->badges + config->jackpots + config->magicTokens;
+	uint32_t sample = (n < 1000) ? n : 1000, random = Swarm_Seed(config->seed, 0);
+	uint32_t ids[SWARM_MAX_HEARD], d, i, j;
+	uint64_t found, naiveFound;
+	double t0, build, update, query, naive, step;
+	float *x = malloc(n * sizeof(float)), *y = malloc(n * sizeof(float)), side, dx, dy;
+	float range2 = (float)(config->range * config->range);
+	swarm_grid_t grid;
+
+	if (!x || !y)
+		return;
+
+	printf("\n%u badges, NFMI range %.2f m, all-pairs timed on %u badges and scaled up\n", n, config->range, sample);
+	printf("  density  in range    build   update    query   per badge    all-pairs  speed-up\n");
+	printf("  (/m^2)   (mean)      (ms)    (ms)      (ms)    (ns)         (ms)\n");
+
+	for (d = 0; d < sizeof(densities) / sizeof(densities[0]); ++d)
+	{
+		side = sqrtf(n / (float)densities[d]);
+		for (i = 0; i < n; ++i)
+		{
+			x[i] = Swarm_RandomFloat(&random) * side;
+			y[i] = Swarm_RandomFloat(&random) * side;
+		}
+
+		if (Swarm_GridInit(&grid, n, side, side, (float)config->range))
+			break;
+
+		t0 = Swarm_WallClock();
+		Swarm_GridUpdate(&grid, x, y);
+		build = Swarm_WallClock() - t0;
+
+		// One broadcast interval of walking: everyone moves up to a metre
+		step = config->tickMs / 1000.0 * SWARM_WALK_SPEED;
+		for (i = 0; i < n; ++i)
+		{
+			x[i] += (float)((Swarm_RandomFloat(&random) - 0.5f) * step);
+			y[i] += (float)((Swarm_RandomFloat(&random) - 0.5f) * step);
+			x[i] = (x[i] < 0) ? 0 : (x[i] > side) ? side : x[i];
+			y[i] = (y[i] < 0) ? 0 : (y[i] > side) ? side : y[i];
+		}
+		t0 = Swarm_WallClock();
+		Swarm_GridUpdate(&grid, x, y);
+		update = Swarm_WallClock() - t0;
+
+		found = 0;
+		t0 = Swarm_WallClock();
+		for (i = 0; i < n; ++i)
+		{
+			found += Swarm_GridQuery(&grid, x[i], y[i], range2, ids, SWARM_MAX_HEARD) - 1;
+		}
+		query = Swarm_WallClock() - t0;
+
+		naiveFound = 0;
+		t0 = Swarm_WallClock();
+		for (i = 0; i < sample; ++i)
+		{
+			for (j = 0; j < n; ++j)
+			{
+				dx = x[j] - x[i];
+				dy = y[j] - y[i];
+				naiveFound += (dx * dx + dy * dy <= range2 && j != i);
+			}
+		}
+		naive = (Swarm_WallClock() - t0) * n / sample;
+
+		printf("  %7.2f  %8.3f  %8.2f %8.2f %8.2f %10.1f %12.1f %9.0fx\n", densities[d], (double)found / n,
+			build * 1e3, update * 1e3, query * 1e3, query * 1e9 / n, naive * 1e3, naive / query);
+
+		// Guard against the two disagreeing: same badges, same sums
+		if (sample == n && naiveFound != found)
+			printf("  ** grid found %llu contacts, all-pairs %llu\n", (unsigned long long)found, (unsigned long long)naiveFound);
+
+		Swarm_GridFree(&grid);
+	}
+
+	free(x);
+	free(y);
+}
+
+/**************************************************************/
+
+static void Swarm_Usage(const char *prog)
+{
+	fprintf(stderr,
+		"Usage: %s [--badges n] [--jackpots n] [--magic-tokens n] [--strategy name,...]\n"
+		"       [--hours h] [--density n] [--range m] [--tick ms] [--rotate ms] [--threads n] [--seed n]\n"
+		"       [--naive] [--bench]\n"
+		"Strategies: firmware, useful, random, fixed, all\n", prog);
+}
+
+/**************************************************************/
+
+static int Swarm_ParseStrategies(const char *list, bool *run)
+{
+	char name[16];
+	uint32_t i;
+	int n;
+
+	memset(run, 0, SWARM_MAX_STRATEGIES * sizeof(bool));
+
+	while (sscanf(list, "%15[^,]%n", name, &n) == 1)
+	{
+		for (i = 0; i < SWARM_MAX_STRATEGIES; ++i)
+		{
+			if (strcmp(name, s_strategyNames[i]) == 0 || strcmp(name, "all") == 0)
+				run[i] = true;
+		}
+		if (strcmp(name, "all") != 0)
+		{
+			for (i = 0; i < SWARM_MAX_STRATEGIES && strcmp(name, s_strategyNames[i]) != 0; ++i){};
+			if (i == SWARM_MAX_STRATEGIES)
+				return 1;
+		}
+
+		list += n;
+		if (*list != ',')
+			break;
+		++list;
+	}
+
+	return *list != '\0';
+}
+
+/**************************************************************/
+
+int main(int argc, char **argv)
+{
+	static const struct option options[] = {
+		{ "badges", required_argument, NULL, 'b' },
+		{ "jackpots", required_argument, NULL, 'j' },
+		{ "magic-tokens", required_argument, NULL, 'm' },
+		{ "strategy", required_argument, NULL, 's' },
+		{ "hours", required_argument, NULL, 'H' },
+		{ "density", required_argument, NULL, 'd' },
+		{ "range", required_argument, NULL, 'r' },
+		{ "tick", required_argument, NULL, 't' },
+		{ "rotate", required_argument, NULL, 'R' },
+		{ "threads", required_argument, NULL, 'T' },
+		{ "seed", required_argument, NULL, 'S' },
+		{ "naive", no_argument, NULL, 'n' },
+		{ "bench", no_argument, NULL, 'B' },
+		{ "help", no_argument, NULL, 'h' },
+		{ NULL, 0, NULL, 0 }
+	};
+	swarm_config_t config = { 1000, 10, 0, 4.0, 0.05, 0.3, 1000, 4650, 0, 27, false };
+	bool bench = false;
+	bool run[SWARM_MAX_STRATEGIES] = { true, true, true, true };
+	swarm_pool_stats_t stats;
+	swarm_pool_t *pool;
+	uint32_t i;
+	int opt;
+
+	while ((opt = getopt_long(argc, argv, "b:j:m:s:H:d:r:t:R:T:S:nBh", options, NULL)) != -1)
+	{
+		switch (opt)
+		{
+			case 'b': config.badges = strtoul(optarg, NULL, 0); break;
+			case 'j': config.jackpots = strtoul(optarg, NULL, 0); break;
+			case 'm': config.magicTokens = strtoul(optarg, NULL, 0); break;
+			case 'H': config.hours = strtod(optarg, NULL); break;
+			case 'd': config.density = strtod(optarg, NULL); break;
+			case 'r': config.range = strtod(optarg, NULL); break;
+			case 't': config.tickMs = strtoul(optarg, NULL, 0); break;
+			case 'R': config.rotateMs = strtoul(optarg, NULL, 0); break;
+			case 'T': config.threads = strtoul(optarg, NULL, 0); break;
+			case 'S': config.seed = strtoul(optarg, NULL, 0); break;
+			case 'n': config.naive = true; break;
+			case 'B': bench = true; break;
+
+			case 's':
+				if (Swarm_ParseStrategies(optarg, run))
+				{
+					Swarm_Usage(argv[0]);
+					return 1;
+				}
+				break;
+
+			case 'h':
+			default:
+				Swarm_Usage(argv[0]);
+				return (opt == 'h') ? 0 : 1;
+		}
+	}
+
+	if (config.tickMs == 0 || config.rotateMs == 0 || config.density <= 0 || config.badges + config.jackpots + config.magicTokens == 0)
+	{
+		Swarm_Usage(argv[0]);
+		return 1;
+	}
+
+	if (bench)
+	{
+		Swarm_Bench(&config);
+		return 0;
+	}
+
+	if (config.threads == 0)
+		config.threads = (uint32_t)sysconf(_SC_NPROCESSORS_ONLN);
+
+	pool = Swarm_PoolCreate(config.threads);
+	if (!pool)
+		return 1;
+
+	printf("dc27_swarm: %u stock badges, %u Jackp0t, %u magic tokens, %.1f hours, %u threads\n",
+		config.badges, config.jackpots, config.magicTokens, config.hours, Swarm_PoolThreads(pool));
+	printf("Floor %.0f m^2 (%.3f/m^2), NFMI range %.2f m, broadcast every %u ms, rotation every %u ms%s\n",
+		(config.badges + config.jackpots + config.magicTokens) / config.density, config.density,
+		config.range, config.tickMs, config.rotateMs, config.naive ? ", all-pairs contacts" : "");
+
+	for (i = 0; i < SWARM_MAX_STRATEGIES; ++i)
+	{
+		if (run[i])
+			Swarm_Run(&config, (strategy_t)i, pool);
+	}
+
+	Swarm_PoolStats(pool, &stats);
+	printf("\nScheduler:          %llu loops, %llu chunks, %llu steals (%llu chunks moved)\n",
+		(unsigned long long)stats.loops, (unsigned long long)stats.chunks,
+		(unsigned long long)stats.steals, (unsigned long long)stats.stolenChunks);
+
+	Swarm_PoolDestroy(pool);
+	return 0;
+}
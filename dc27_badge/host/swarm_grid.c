@@ -0,0 +1,388 @@
+/*
+ * DEFCON 27 Official Badge - swarm simulation
+ *
+ * Spatial hash grid for NFMI contact queries (see swarm_grid.h)
+ */
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "swarm_grid.h"
+
+
+/***************************************************************************
+ **************************** Definitions **********************************
+ ***************************************************************************/
+
+#define GRID_EMPTY				UINT32_MAX
+#define GRID_MAX_CELLS			(1UL << 30)		// cell numbers must fit a uint32_t
+#define GRID_INCREMENTAL_LIMIT	2U				// full rebuild once more than 1/2 of badges moved cell
+#define GRID_RADIX_BITS			10U				// three passes cover a 30-bit cell number
+#define GRID_RADIX_SIZE			(1U << GRID_RADIX_BITS)
+
+#define GRID_PAIR(cell, id)		(((uint64_t)(cell) << 32) | (id))
+
+
+/****************************************************************************
+ ************************** Helpers *****************************************
+ ***************************************************************************/
+
+static uint32_t Grid_Cell(const swarm_grid_t *g, float x, float y)
+{
+	int32_t cx = (int32_t)(x / g->cellSize), cy = (int32_t)(y / g->cellSize);
+
+	// The crowd stays on the floor, but don't trust float rounding at the walls
+	if (cx < 0)
+		cx = 0;
+	else if ((uint32_t)cx >= g->cols)
+		cx = g->cols - 1;
+	if (cy < 0)
+		cy = 0;
+	else if ((uint32_t)cy >= g->rows)
+		cy = g->rows - 1;
+
+	return (uint32_t)cy * g->cols + (uint32_t)cx;
+}
+
+/**************************************************************/
+
+static uint32_t Grid_Hash(const swarm_grid_t *g, uint32_t cell)
+{
+	cell *= 0x9E3779B1U;
+	return (cell ^ (cell >> 16)) & g->tableMask;
+}
+
+/**************************************************************/
+
+// Stable LSD radix sort of (cell, id) pairs by cell. Callers pass ids in
+// ascending order, so the result is ordered by (cell, id).
+static void Grid_Sort(swarm_grid_t *g, uint32_t *cell, uint32_t *id, uint32_t n)
+{
+	uint32_t count[GRID_RADIX_SIZE], *srcCell = cell, *srcId = id, *dstCell = g->scratchCell, *dstId = g->scratchId, *t;
+	uint32_t pass, shift, i, digit, sum, c;
+
+	for (pass = 0; pass < 3; ++pass)
+	{
+		shift = pass * GRID_RADIX_BITS;
+		memset(count, 0, sizeof(count));
+		for (i = 0; i < n; ++i)
+		{
+			count[(srcCell[i] >> shift) & (GRID_RADIX_SIZE - 1)]++;
+		}
+
+		for (digit = 0, sum = 0; digit < GRID_RADIX_SIZE; ++digit)
+		{
+			c = count[digit];
+			count[digit] = sum;
+			sum += c;
+		}
+
+		for (i = 0; i < n; ++i)
+		{
+			digit = (srcCell[i] >> shift) & (GRID_RADIX_SIZE - 1);
+			dstCell[count[digit]] = srcCell[i];
+			dstId[count[digit]] = srcId[i];
+			count[digit]++;
+		}
+
+		t = srcCell; srcCell = dstCell; dstCell = t;
+		t = srcId; srcId = dstId; dstId = t;
+	}
+
+	// Odd number of passes: the result is in the scratch buffers
+	memcpy(cell, srcCell, n * sizeof(uint32_t));
+	memcpy(id, srcId, n * sizeof(uint32_t));
+}
+
+/**************************************************************/
+
+// Sort every badge from scratch
+static void Grid_Rebuild(swarm_grid_t *g)
+{
+	uint32_t i;
+
+	for (i = 0; i < g->count; ++i)
+	{
+		g->cell[i] = g->key[i];
+		g->id[i] = i;
+	}
+	Grid_Sort(g, g->cell, g->id, g->count);
+
+	g->fullRebuilds++;
+}
+
+/**************************************************************/
+
+// Take the badges that changed cell out of the sorted order, sort just those,
+// and merge them back in: O(n + m) for m movers
+static void Grid_Reinsert(swarm_grid_t *g, uint32_t moved)
+{
+	uint32_t *movedCell = g->moveCell, *movedId = g->moved;
+	uint32_t i, kept = 0, k;
+	int64_t a, b;
+
+	// An entry is stale when its badge's current cell differs from the sorted one
+	for (i = 0; i < g->count; ++i)
+	{
+		if (g->cell[i] == g->key[g->id[i]])
+		{
+			g->cell[kept] = g->cell[i];
+			g->id[kept] = g->id[i];
+			kept++;
+		}
+	}
+
+	for (i = 0; i < moved; ++i)
+	{
+		movedCell[i] = g->key[movedId[i]];
+	}
+	Grid_Sort(g, movedCell, movedId, moved);
+
+	// Merge from the back so nothing is overwritten before it is read
+	a = (int64_t)kept - 1;
+	b = (int64_t)moved - 1;
+	for (k = g->count; k-- > 0;)
+	{
+		if (b >= 0 && (a < 0 || GRID_PAIR(movedCell[b], movedId[b]) > GRID_PAIR(g->cell[a], g->id[a])))
+		{
+			g->cell[k] = movedCell[b];
+			g->id[k] = movedId[b];
+			b--;
+		}
+		else
+		{
+			g->cell[k] = g->cell[a];
+			g->id[k] = g->id[a];
+			a--;
+		}
+	}
+}
+
+/**************************************************************/
+
+static void Grid_Index(swarm_grid_t *g)
+{
+	uint32_t i, start, slot;
+
+	for (i = 0; i < g->tableUsedCount; ++i)
+	{
+		g->tableCell[g->tableUsed[i]] = GRID_EMPTY;
+	}
+	g->tableUsedCount = 0;
+
+	for (start = 0; start < g->count; start = i)
+	{
+		for (i = start + 1; i < g->count && g->cell[i] == g->cell[start]; ++i){};
+
+		slot = Grid_Hash(g, g->cell[start]);
+		while (g->tableCell[slot] != GRID_EMPTY)
+		{
+			slot = (slot + 1) & g->tableMask;
+		}
+
+		g->tableCell[slot] = g->cell[start];
+		g->tableStart[slot] = start;
+		g->tableCount[slot] = i - start;
+		g->tableUsed[g->tableUsedCount++] = slot;
+	}
+}
+
+/**************************************************************/
+
+static bool Grid_Lookup(const swarm_grid_t *g, uint32_t cell, uint32_t *start, uint32_t *count)
+{
+	uint32_t slot = Grid_Hash(g, cell);
+
+	while (g->tableCell[slot] != GRID_EMPTY)
+	{
+		if (g->tableCell[slot] == cell)
+		{
+			*start = g->tableStart[slot];
+			*count = g->tableCount[slot];
+			return true;
+		}
+		slot = (slot + 1) & g->tableMask;
+	}
+
+	return false;
+}
+
+
+/****************************************************************************
+ ******************************** API ***************************************
+ ***************************************************************************/
+
+int Swarm_GridInit(swarm_grid_t *g, uint32_t count, float width, float height, float range)
+{
+	uint32_t size = 16, i;
+
+	memset(g, 0, sizeof(*g));
+
+	if (range <= 0 || width <= 0 || height <= 0 || count == 0)
+		return 1;
+
+	g->cellSize = range;
+	while ((double)(width / g->cellSize + 1) * (height / g->cellSize + 1) > GRID_MAX_CELLS)
+	{
+		g->cellSize *= 2;	// a coarser grid is still correct, just slower to query
+	}
+	g->cols = (uint32_t)(width / g->cellSize) + 1;
+	g->rows = (uint32_t)(height / g->cellSize) + 1;
+	g->count = count;
+
+	while (size < count * 2)
+	{
+		size <<= 1;
+	}
+	g->tableMask = size - 1;
+
+	g->cell = malloc(count * sizeof(uint32_t));
+	g->id = malloc(count * sizeof(uint32_t));
+	g->x = malloc(count * sizeof(float));
+	g->y = malloc(count * sizeof(float));
+	g->key = malloc(count * sizeof(uint32_t));
+	g->moved = malloc(count * sizeof(uint32_t));
+	g->moveCell = malloc(count * sizeof(uint32_t));
+	g->scratchCell = malloc(count * sizeof(uint32_t));
+	g->scratchId = malloc(count * sizeof(uint32_t));
+	g->tableCell = malloc(size * sizeof(uint32_t));
+	g->tableStart = malloc(size * sizeof(uint32_t));
+	g->tableCount = malloc(size * sizeof(uint32_t));
+	g->tableUsed = malloc(count * sizeof(uint32_t));
+
+	if (!g->cell || !g->id || !g->x || !g->y || !g->key || !g->moved ||
+		!g->moveCell || !g->scratchCell || !g->scratchId ||
+		!g->tableCell || !g->tableStart || !g->tableCount || !g->tableUsed)
+	{
+		Swarm_GridFree(g);
+		return 1;
+	}
+
+	for (i = 0; i < size; ++i)
+	{
+		g->tableCell[i] = GRID_EMPTY;
+	}
+	for (i = 0; i < count; ++i)
+	{
+		g->key[i] = GRID_EMPTY;	// forces a full build on the first update
+	}
+
+	return 0;
+}
+
+/**************************************************************/
+
+void Swarm_GridFree(swarm_grid_t *g)
+{
+	free(g->cell);
+	free(g->id);
+	free(g->x);
+	free(g->y);
+	free(g->key);
+	free(g->moved);
+	free(g->moveCell);
+	free(g->scratchCell);
+	free(g->scratchId);
+	free(g->tableCell);
+	free(g->tableStart);
+	free(g->tableCount);
+	free(g->tableUsed);
+	memset(g, 0, sizeof(*g));
+}
+
+/**************************************************************/
+
+void Swarm_GridUpdate(swarm_grid_t *g, const float *x, const float *y)
+{
+	uint32_t i, cell, moved = 0;
+	bool first = (g->updates == 0);
+
+	for (i = 0; i < g->count; ++i)
+	{
+		cell = Grid_Cell(g, x[i], y[i]);
+		if (cell != g->key[i])
+		{
+			g->key[i] = cell;
+			g->moved[moved++] = i;
+		}
+	}
+
+	g->updates++;
+	g->moves += first ? 0 : moved;
+
+	if (first || moved > g->count / GRID_INCREMENTAL_LIMIT)
+		Grid_Rebuild(g);
+	else if (moved)
+		Grid_Reinsert(g, moved);
+
+	// Everybody drifts a little, so positions are refreshed even when the order holds
+	for (i = 0; i < g->count; ++i)
+	{
+		g->x[i] = x[g->id[i]];
+		g->y[i] = y[g->id[i]];
+	}
+
+	if (first || moved)
+		Grid_Index(g);
+}
+
+/**************************************************************/
+
+// Ids of everyone within range of (x, y), in grid order. Returns how many
+// there are, which may be more than the max written to out.
+uint32_t Swarm_GridQuery(const swarm_grid_t *g, float x, float y, float range2, uint32_t *out, uint32_t max)
+{
+	uint32_t center = Grid_Cell(g, x, y), cx = center % g->cols, cy = center / g->cols;
+	uint32_t x0 = cx ? cx - 1 : 0, x1 = (cx + 1 < g->cols) ? cx + 1 : cx;
+	uint32_t y0 = cy ? cy - 1 : 0, y1 = (cy + 1 < g->rows) ? cy + 1 : cy;
+	uint32_t i, j, start, count, end, n = 0;
+	float dx, dy;
+#if defined(__SSE2__)
+	__m128 qx = _mm_set1_ps(x), qy = _mm_set1_ps(y), r2 = _mm_set1_ps(range2), vx, vy;
+	int mask;
+#endif
+
+	for (j = y0; j <= y1; ++j)
+	{
+		for (i = x0; i <= x1; ++i)
+		{
+			if (!Grid_Lookup(g, j * g->cols + i, &start, &count))
+				continue;
+
+			end = start + count;
+#if defined(__SSE2__)
+			for (; start + 4 <= end; start += 4)
+			{
+				vx = _mm_sub_ps(_mm_loadu_ps(&g->x[start]), qx);
+				vy = _mm_sub_ps(_mm_loadu_ps(&g->y[start]), qy);
+				mask = _mm_movemask_ps(_mm_cmple_ps(_mm_add_ps(_mm_mul_ps(vx, vx), _mm_mul_ps(vy, vy)), r2));
+				while (mask)
+				{
+					if (n < max)
+						out[n] = g->id[start + __builtin_ctz(mask)];
+					n++;
+					mask &= mask - 1;
+				}
+			}
+#endif
+			for (; start < end; ++start)
+			{
+				dx = g->x[start] - x;
+				dy = g->y[start] - y;
+				if (dx * dx + dy * dy <= range2)
+				{
+					if (n < max)
+						out[n] = g->id[start];
+					n++;
+				}
+			}
+		}
+	}
+
+	return n;
+}
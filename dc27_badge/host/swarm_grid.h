@@ -0,0 +1,71 @@
+/*
+ * DEFCON 27 Official Badge - swarm simulation
+ *
+ * Uniform grid for NFMI contact queries. Cells are at least one NFMI range
+ * wide, so everyone in range of a point is in its own cell or one of the
+ * eight around it. Only occupied cells are stored: badges are kept sorted by
+ * cell in structure-of-arrays form (cell, id, x, y) and an open-addressed hash
+ * table maps a cell to its run, so memory follows the crowd size rather than
+ * the floor area.
+ *
+ * Each update refreshes positions and re-sorts only the badges that changed
+ * cell (the rest keep their slots) and merges them back in; when too many
+ * have moved it falls back to a full radix sort. Queries test a run four
+ * badges at a time with SSE2 where available.
+ */
+
+#ifndef _SWARM_GRID_H_
+#define _SWARM_GRID_H_
+
+#include <stdint.h>
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+/***************************************************************************
+ **************************** Definitions **********************************
+ ***************************************************************************/
+
+typedef struct
+{
+	float cellSize;
+	uint32_t cols, rows;
+	uint32_t count;			// badges
+
+	// Sorted by (cell, id)
+	uint32_t *cell;
+	uint32_t *id;
+	float *x, *y;
+
+	uint32_t *key;			// current cell of each badge, by id
+	uint32_t *moved;		// scratch: ids that changed cell, and their new cells
+	uint32_t *moveCell;
+	uint32_t *scratchCell, *scratchId;	// radix sort buffers
+
+	// Occupied cell -> first index and length of its run
+	uint32_t tableMask;
+	uint32_t *tableCell;	// UINT32_MAX = empty slot
+	uint32_t *tableStart, *tableCount;
+	uint32_t *tableUsed;	// slots filled by the last update, to clear them cheaply
+	uint32_t tableUsedCount;
+
+	// Statistics
+	uint64_t updates, fullRebuilds, moves;
+} swarm_grid_t;
+
+
+/****************************************************************************
+ ********************* Function Prototypes **********************************
+ ***************************************************************************/
+
+int Swarm_GridInit(swarm_grid_t *, uint32_t count, float width, float height, float range);
+void Swarm_GridFree(swarm_grid_t *);
+void Swarm_GridUpdate(swarm_grid_t *, const float *x, const float *y);
+uint32_t Swarm_GridQuery(const swarm_grid_t *, float x, float y, float range2, uint32_t *out, uint32_t max);
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif /* _SWARM_GRID_H_ */
@@ -0,0 +1,276 @@
+/*
+ * DEFCON 27 Official Badge - swarm simulation
+ *
+ * Work-stealing thread pool (see swarm_pool.h)
+ */
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "swarm_pool.h"
+
+
+/***************************************************************************
+ **************************** Definitions **********************************
+ ***************************************************************************/
+
+#define POOL_CACHE_LINE		64U
+
+// A worker's remaining chunks [head, tail) packed in one word, so the owner
+// taking from the head and a thief taking from the tail race on a single CAS
+#define POOL_RANGE(head, tail)	(((uint64_t)(tail) << 32) | (uint32_t)(head))
+#define POOL_HEAD(range)		((uint32_t)(range))
+#define POOL_TAIL(range)		((uint32_t)((range) >> 32))
+
+
+/**************************************************************************
+************************** Structs ****************************************
+***************************************************************************/
+
+typedef struct
+{
+	uint64_t range;
+	uint64_t chunks;
+	uint64_t steals;
+	uint64_t stolenChunks;
+	uint32_t victim;		// where to start looking for work next time
+} __attribute__((aligned(POOL_CACHE_LINE))) pool_worker_t;
+
+typedef struct
+{
+	swarm_pool_t *pool;
+	uint32_t index;
+} pool_thread_arg_t;
+
+struct swarm_pool
+{
+	uint32_t threads;
+	pthread_t tid[SWARM_POOL_MAX_THREADS];
+	pool_thread_arg_t arg[SWARM_POOL_MAX_THREADS];
+	pthread_barrier_t start, done;
+	bool quit;
+	uint64_t loops;
+
+	// Current loop
+	swarm_task_fn_t fn;
+	void *ctx;
+	uint32_t count, grain;
+
+	pool_worker_t worker[SWARM_POOL_MAX_THREADS];
+};
+
+
+/****************************************************************************
+ ************************** Functions ***************************************
+ ***************************************************************************/
+
+static bool Pool_Take(pool_worker_t *w, uint32_t *chunk)
+{
+	uint64_t r = __atomic_load_n(&w->range, __ATOMIC_ACQUIRE);
+
+	while (POOL_HEAD(r) < POOL_TAIL(r))
+	{
+		if (__atomic_compare_exchange_n(&w->range, &r, POOL_RANGE(POOL_HEAD(r) + 1, POOL_TAIL(r)),
+				false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+		{
+			*chunk = POOL_HEAD(r);
+			return true;
+		}
+	}
+
+	return false;
+}
+
+/**************************************************************/
+
+// Move the upper half of the victim's remaining chunks to the thief
+static bool Pool_Steal(pool_worker_t *thief, pool_worker_t *victim)
+{
+	uint64_t r = __atomic_load_n(&victim->range, __ATOMIC_ACQUIRE);
+	uint32_t head, tail, mid;
+
+	while ((head = POOL_HEAD(r)) < (tail = POOL_TAIL(r)))
+	{
+		mid = head + (tail - head) / 2;
+		if (__atomic_compare_exchange_n(&victim->range, &r, POOL_RANGE(head, mid),
+				false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+		{
+			// Our own range is empty, so nobody else can be updating it
+			__atomic_store_n(&thief->range, POOL_RANGE(mid, tail), __ATOMIC_RELEASE);
+			thief->steals++;
+			thief->stolenChunks += tail - mid;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+/**************************************************************/
+
+static void Pool_Work(swarm_pool_t *pool, uint32_t index)
+{
+	pool_worker_t *w = &pool->worker[index];
+	uint32_t chunk, begin, end, i, v;
+
+	for (;;)
+	{
+		while (Pool_Take(w, &chunk))
+		{
+			begin = chunk * pool->grain;
+			end = (begin + pool->grain < pool->count) ? begin + pool->grain : pool->count;
+			pool->fn(pool->ctx, index, begin, end);
+			w->chunks++;
+		}
+
+		// No work is ever added during a loop, so one fruitless pass over the
+		// other workers means the loop is finished as far as we're concerned
+		for (i = 1; i < pool->threads; ++i)
+		{
+			v = (w->victim + i) % pool->threads;
+			if (v != index && Pool_Steal(w, &pool->worker[v]))
+			{
+				w->victim = v;
+				break;
+			}
+		}
+
+		if (i == pool->threads)
+			return;
+	}
+}
+
+/**************************************************************/
+
+static void *Pool_Thread(void *arg)
+{
+	pool_thread_arg_t *t = arg;
+
+	for (;;)
+	{
+		pthread_barrier_wait(&t->pool->start);
+		if (t->pool->quit)
+			return NULL;
+
+		Pool_Work(t->pool, t->index);
+		pthread_barrier_wait(&t->pool->done);
+	}
+}
+
+/**************************************************************/
+
+swarm_pool_t *Swarm_PoolCreate(uint32_t threads)
+{
+	swarm_pool_t *pool;
+	uint32_t i;
+
+	if (threads == 0)
+		threads = 1;
+	if (threads > SWARM_POOL_MAX_THREADS)
+		threads = SWARM_POOL_MAX_THREADS;
+
+	if (posix_memalign((void **)&pool, POOL_CACHE_LINE, sizeof(*pool)))
+		return NULL;
+
+	memset(pool, 0, sizeof(*pool));
+	pool->threads = threads;
+	pthread_barrier_init(&pool->start, NULL, threads);
+	pthread_barrier_init(&pool->done, NULL, threads);
+
+	for (i = 0; i < threads; ++i)
+	{
+		pool->worker[i].victim = i;
+	}
+
+	for (i = 1; i < threads; ++i)
+	{
+		pool->arg[i].pool = pool;
+		pool->arg[i].index = i;
+		pthread_create(&pool->tid[i], NULL, Pool_Thread, &pool->arg[i]);
+	}
+
+	return pool;
+}
+
+/**************************************************************/
+
+void Swarm_PoolDestroy(swarm_pool_t *pool)
+{
+	uint32_t i;
+
+	if (!pool)
+		return;
+
+	pool->quit = true;
+	pthread_barrier_wait(&pool->start);
+	for (i = 1; i < pool->threads; ++i)
+	{
+		pthread_join(pool->tid[i], NULL);
+	}
+
+	pthread_barrier_destroy(&pool->start);
+	pthread_barrier_destroy(&pool->done);
+	free(pool);
+}
+
+/**************************************************************/
+
+uint32_t Swarm_PoolThreads(const swarm_pool_t *pool)
+{
+	return pool->threads;
+}
+
+/**************************************************************/
+
+void Swarm_PoolFor(swarm_pool_t *pool, uint32_t count, uint32_t grain, swarm_task_fn_t fn, void *ctx)
+{
+	uint32_t chunks, i;
+
+	if (count == 0)
+		return;
+
+	if (grain == 0)
+		grain = 1;
+
+	chunks = (count + grain - 1) / grain;
+	pool->fn = fn;
+	pool->ctx = ctx;
+	pool->count = count;
+	pool->grain = grain;
+	pool->loops++;
+
+	// Deal the chunks out evenly; stealing evens out whatever imbalance is left
+	for (i = 0; i < pool->threads; ++i)
+	{
+		pool->worker[i].range = POOL_RANGE((uint64_t)chunks * i / pool->threads,
+			(uint64_t)chunks * (i + 1) / pool->threads);
+	}
+
+	if (pool->threads == 1)
+	{
+		Pool_Work(pool, 0);
+		return;
+	}
+
+	pthread_barrier_wait(&pool->start);
+	Pool_Work(pool, 0);
+	pthread_barrier_wait(&pool->done);
+}
+
+/**************************************************************/
+
+void Swarm_PoolStats(const swarm_pool_t *pool, swarm_pool_stats_t *stats)
+{
+	uint32_t i;
+
+	memset(stats, 0, sizeof(*stats));
+	stats->loops = pool->loops;
+	for (i = 0; i < pool->threads; ++i)
+	{
+		stats->chunks += pool->worker[i].chunks;
+		stats->steals += pool->worker[i].steals;
+		stats->stolenChunks += pool->worker[i].stolenChunks;
+	}
+}
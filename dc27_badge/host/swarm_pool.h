@@ -0,0 +1,56 @@
+/*
+ * DEFCON 27 Official Badge - swarm simulation
+ *
+ * Fixed pool of worker threads running parallel-for loops with work
+ * stealing. The index range of each loop is cut into chunks and dealt out
+ * evenly; a worker that runs out of chunks steals the upper half of the
+ * remaining range of another worker, so uneven chunks (crowded areas of the
+ * floor, badges busy with a state change) don't leave cores idle.
+ *
+ * The calling thread takes part as worker 0. Loops must not be nested.
+ */
+
+#ifndef _SWARM_POOL_H_
+#define _SWARM_POOL_H_
+
+#include <stdint.h>
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+/***************************************************************************
+ **************************** Definitions **********************************
+ ***************************************************************************/
+
+#define SWARM_POOL_MAX_THREADS		64U
+
+// Runs items [begin, end) on the given worker
+typedef void (*swarm_task_fn_t)(void *ctx, uint32_t worker, uint32_t begin, uint32_t end);
+
+typedef struct swarm_pool swarm_pool_t;
+
+typedef struct
+{
+	uint64_t loops;
+	uint64_t chunks;		// chunks executed
+	uint64_t steals;		// successful steals
+	uint64_t stolenChunks;	// chunks moved by those steals
+} swarm_pool_stats_t;
+
+
+/****************************************************************************
+ ********************* Function Prototypes **********************************
+ ***************************************************************************/
+
+swarm_pool_t *Swarm_PoolCreate(uint32_t threads);
+void Swarm_PoolDestroy(swarm_pool_t *);
+uint32_t Swarm_PoolThreads(const swarm_pool_t *);
+void Swarm_PoolFor(swarm_pool_t *, uint32_t count, uint32_t grain, swarm_task_fn_t fn, void *ctx);
+void Swarm_PoolStats(const swarm_pool_t *, swarm_pool_stats_t *);
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif /* _SWARM_POOL_H_ */
@@ -0,0 +1,36 @@
+/*
+ * DEFCON 27 Official Badge - host tests
+ *
+ * Checks shared by the test programs (make test). Each one is a single
+ * translation unit that includes the firmware like sim_main.c, runs its
+ * cases and exits non-zero if any check failed.
+ */
+
+#ifndef _TEST_H_
+#define _TEST_H_
+
+#include <stdio.h>
+
+static unsigned int s_testChecks, s_testFailures;
+
+// Count a check, and print it if it failed
+#define TEST_CHECK(cond, ...) \
+	do { \
+		s_testChecks++; \
+		if (!(cond)) \
+		{ \
+			s_testFailures++; \
+			printf("FAIL %s:%d: ", __FILE__, __LINE__); \
+			printf(__VA_ARGS__); \
+			printf("\n"); \
+		} \
+	} while (0)
+
+// Summary line and exit status for main()
+static inline int Test_Result(const char *name)
+{
+	printf("%s: %u checks, %u failed\n", name, s_testChecks, s_testFailures);
+	return s_testFailures ? 1 : 0;
+}
+
+#endif /* _TEST_H_ */
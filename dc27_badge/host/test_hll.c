@@ -0,0 +1,279 @@
+/*
+ * DEFCON 27 Official Badge - host tests
+ *
+ * Unique badge estimates (HLL_* in source/dc27_badge.c): the estimate against
+ * known numbers of distinct uids, and the sketches surviving a power cycle
+ * through their flash log, sector changes, torn writes and full peer database
+ * included.
+ *
+ * Usage: test_hll
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sim_hal.h"
+#include "test.h"
+
+// The firmware is compiled into this file so its static state can be observed
+#define main DC27_FirmwareMain
+#include "dc27_badge.c"
+#undef main
+
+
+/***************************************************************************
+ **************************** Definitions **********************************
+ ***************************************************************************/
+
+#define TEST_SEEDS			8U			// streams for each cardinality
+#define TEST_SIGMAS			3U			// an estimate may be off by this many standard errors...
+#define TEST_MEAN_SIGMAS	1U			// ...and the mean of TEST_SEEDS of them by this many
+
+
+/****************************************************************************
+ ************************** Functions ***************************************
+ ***************************************************************************/
+
+static uint32_t Test_Random(uint32_t *state)	// xorshift32
+{
+	*state ^= *state << 13;
+	*state ^= *state >> 17;
+	*state ^= *state << 5;
+	return *state;
+}
+
+/**************************************************************/
+
+// Distinct uids, sequential (like a production run of badges) or random, each added
+// twice: duplicates mustn't count
+static void Test_Accuracy(void)
+{
+	static const uint32_t counts[] = { 1, 10, 100, 300, 640, 1000, 3000, 10000, 30000, 100000, 300000 };
+	uint8_t sketch[HLL_REGISTERS / 2];
+	uint32_t c, seed, i, n, uid, state, e, once;
+	int64_t error, total;
+	bool sequential;
+
+	printf("  distinct   mean estimate (sequential)   mean estimate (random)\n");
+	for (c = 0; c < sizeof(counts) / sizeof(counts[0]); c++)
+	{
+		n = counts[c];
+		printf("  %8u", n);
+		for (sequential = true; ; sequential = false)
+		{
+			total = 0;
+			for (seed = 1; seed <= TEST_SEEDS; seed++)
+			{
+				memset(sketch, 0, sizeof(sketch));
+				state = seed * 0x9E3779B9U;
+				for (i = 0; i < n; i++)
+				{
+					uid = sequential ? state + i : Test_Random(&state);
+					HLL_Add(sketch, uid);
+				}
+				once = HLL_Estimate(sketch);
+
+				state = seed * 0x9E3779B9U;
+				for (i = 0; i < n; i++)
+				{
+					uid = sequential ? state + i : Test_Random(&state);
+					HLL_Add(sketch, uid);
+				}
+				e = HLL_Estimate(sketch);
+				TEST_CHECK(e == once, "%u uids added twice: estimate %u, %u after once", n, e, once);
+
+				// One standard error is n * HLL_ERROR_PERMILLE / 1000, rounded up
+				error = (int64_t)e - n;
+				total += error;
+				TEST_CHECK(llabs(error) * 1000 <= (int64_t)TEST_SIGMAS * n * HLL_ERROR_PERMILLE + 1000,
+					"%u %s uids (seed %u): estimate %u", n, sequential ? "sequential" : "random", seed, e);
+			}
+
+			TEST_CHECK(llabs(total) * 1000 <= (int64_t)TEST_MEAN_SIGMAS * TEST_SEEDS * n * HLL_ERROR_PERMILLE + 1000,
+				"%u %s uids: mean estimate %.1f", n, sequential ? "sequential" : "random", n + (double)total / TEST_SEEDS);
+			printf("   %12.1f (%+5.1f%%)     ", n + (double)total / TEST_SEEDS, 100.0 * total / TEST_SEEDS / n);
+
+			if (!sequential)
+				break;
+		}
+		printf("\n");
+	}
+}
+
+/**************************************************************/
+
+// What HLL_Load() gets back from flash must be what was saved
+static void Test_CheckLoad(const char *what)
+{
+	hll_record_t saved = hllState;
+
+	HLL_Load();
+	TEST_CHECK(!memcmp(hllState.met, saved.met, sizeof(saved.met)) && !memcmp(hllState.helped, saved.helped, sizeof(saved.helped)),
+		"%s: sketches not loaded back (estimates %u/%u, saved %u/%u)", what, HLL_Estimate(hllState.met),
+		HLL_Estimate(hllState.helped), HLL_Estimate(saved.met), HLL_Estimate(saved.helped));
+}
+
+/**************************************************************/
+
+static uint32_t Test_Erases(void)	// erases of the estimate sectors so far
+{
+	uint32_t s, n = 0;
+
+	for (s = 0; s < HLL_LOG_SECTORS; s++)
+		n += g_simStats.flashSectorErases[SIM_FLASH_SECTORS - HLL_SECTOR_FROM_END - s];
+	return n;
+}
+
+/**************************************************************/
+
+static void Test_Flash(void)
+{
+	uint32_t i, uid = 0x00270000, erases, deltas = 0;
+	uint32_t *p;
+
+	memset(SIM_FlashBase(), 0xFF, SIM_FLASH_SIZE);
+	HLL_Load();
+	TEST_CHECK(HLL_Estimate(hllState.met) == 0, "erased flash: estimate %u", HLL_Estimate(hllState.met));
+
+	// Save after every badge, as DC27_Flush() does, until the log has moved sector a few times
+	for (i = 0; i < 20000; i++)
+	{
+		HLL_Add(hllState.met, uid + i);
+		if (i % 5 == 0)
+			HLL_Add(hllState.helped, uid + i);
+		deltas += hllChanges;
+		TEST_CHECK(HLL_Save() == 0, "save %u failed", i);
+		if (i == 0 || i == 99 || i == 999 || i == 19999)
+		{
+			char what[32];
+
+			snprintf(what, sizeof(what), "after %u badges", i + 1);
+			Test_CheckLoad(what);
+		}
+	}
+
+	// Each register rises at most HLL_RANK_MAX times, so erases are bounded whatever happens
+	erases = Test_Erases();
+	printf("  20000 badges: %u register changes logged, %u erases of the estimate sectors\n", deltas, erases);
+	TEST_CHECK(erases <= 2 * HLL_REGISTERS * HLL_RANK_MAX / HLL_DELTAS + HLL_LOG_SECTORS,
+		"%u erases for %u register changes", erases, deltas);
+	TEST_CHECK(deltas <= 2 * HLL_REGISTERS * HLL_RANK_MAX, "%u register changes", deltas);
+
+	// A torn change (complement doesn't match) is skipped, the ones after it still count
+	p = (uint32_t *)(uintptr_t)(KL_Flash_Sector(HLL_SECTOR_FROM_END + hllSector) + sizeof(hll_record_t));
+	if (hllNext + 2 < HLL_DELTAS)
+	{
+		p[hllNext] = 0x0000FFF5;	// register 0xFF of helped to 5, half programmed
+		hllNext++;
+		HLL_Add(hllState.met, 0xDC27DC27);
+		HLL_Add(hllState.met, 0x12345678);
+		TEST_CHECK(HLL_Save() == 0, "save after a torn change failed");
+		Test_CheckLoad("torn change");
+	}
+
+	// A snapshot lost part way: the other sector still has everything up to it
+	memset(&hllSaved, 0, sizeof(hllSaved));	// nothing saved: the next HLL_Save() logs every register...
+	hllNext = HLL_DELTAS;					// ...but there's no room, so it starts the other sector
+	hllChanges = 1;
+	i = hllSector;
+	p = (uint32_t *)(uintptr_t)KL_Flash_Sector(HLL_SECTOR_FROM_END + (i + 1) % HLL_LOG_SECTORS);
+	TEST_CHECK(HLL_Save() == 0 && hllSector != i, "no new sector started");
+	p[offsetof(hll_record_t, seq) / 4] = 0xFFFFFFFF;	// as if the commit longword wasn't programmed
+	HLL_Load();
+	TEST_CHECK(hllSector == i, "uncommitted snapshot loaded");
+}
+
+/**************************************************************/
+
+// Sectors that don't start with HLL_MAGIC (or erased) aren't ours: never erased
+static void Test_Foreign(void)
+{
+	uint32_t *first = (uint32_t *)(uintptr_t)KL_Flash_Sector(HLL_SECTOR_FROM_END);
+	uint32_t *second = (uint32_t *)(uintptr_t)KL_Flash_Sector(HLL_SECTOR_FROM_END + 1);
+	uint32_t *erases = &g_simStats.flashSectorErases[SIM_FLASH_SECTORS - HLL_SECTOR_FROM_END];
+	uint32_t before, i;
+
+	memset(SIM_FlashBase(), 0xFF, SIM_FLASH_SIZE);
+	first[0] = 0x20001234;	// looks like a stack pointer, say
+	HLL_Load();
+
+	before = *erases;
+	for (i = 0; i < 1000; i++)
+	{
+		HLL_Add(hllState.met, i * 7919U);
+		HLL_Save();
+	}
+	TEST_CHECK(first[0] == 0x20001234, "foreign sector written");
+	TEST_CHECK(second[0] == HLL_MAGIC, "other sector not used");	// and taking turns with itself
+	Test_CheckLoad("next to a foreign sector");
+
+	second[0] = 0x00000000;	// both foreign: nothing is written at all
+	HLL_Load();
+	HLL_Add(hllState.met, 0xCAFE);
+	TEST_CHECK(HLL_Save() != 0, "save with no sector of ours succeeded");
+	TEST_CHECK(first[0] == 0x20001234 && second[0] == 0, "foreign sectors written");
+	TEST_CHECK(*erases == before, "%u foreign sector erases", *erases - before);
+}
+
+/**************************************************************/
+
+// Badges completing the quest still count once the peer database is full
+static void Test_HelpedWhenFull(void)
+{
+	struct packet_of_infamy packet = { 0 };
+	uint32_t i, before;
+
+	memset(SIM_FlashBase(), 0xFF, SIM_FLASH_SIZE);
+	PEER_Init();
+	HLL_Load();
+
+	for (i = 0; i < peerMax; i++)
+	{
+		packet.uid = 0x10000 + i;
+		packet.flags = 0;
+		PEER_See(&packet);
+	}
+	TEST_CHECK(peerCount == peerMax && peerDropped == 0, "%u badges met, %u dropped", peerCount, peerDropped);
+
+	before = HLL_Estimate(hllState.helped);
+	for (i = 0; i < 50; i++)
+	{
+		packet.uid = 0x20000 + i;
+		packet.flags = FLAG_ALL_MASK;
+		PEER_See(&packet);
+		packet.uid = 0x30000 + i;
+		packet.flags = FLAG_ALL_MASK & ~1;
+		PEER_See(&packet);
+	}
+	TEST_CHECK(peerDropped == 100, "%u dropped", peerDropped);
+	TEST_CHECK(HLL_Estimate(hllState.helped) - before >= 40 && HLL_Estimate(hllState.helped) - before <= 60,
+		"50 complete badges when full: helped estimate %u -> %u", before, HLL_Estimate(hllState.helped));
+	TEST_CHECK(HLL_Estimate(hllState.met) >= peerMax + 80, "met estimate %u", HLL_Estimate(hllState.met));
+}
+
+/**************************************************************/
+
+static void Test_Main(void)
+{
+	if (KL_Flash_Init())
+	{
+		TEST_CHECK(false, "KL_Flash_Init() failed");
+		return;
+	}
+
+	printf("Accuracy (%u streams each, standard error %u.%u%%)\n", TEST_SEEDS, HLL_ERROR_PERMILLE / 10, HLL_ERROR_PERMILLE % 10);
+	Test_Accuracy();
+	printf("Flash log (%u changes after each snapshot)\n", (uint32_t)HLL_DELTAS);
+	Test_Flash();
+	Test_Foreign();
+	Test_HelpedWhenFull();
+}
+
+/**************************************************************/
+
+int main(int argc, char **argv)
+{
+	SIM_Run(Test_Main, SIM_TIME_NEVER);
+	return Test_Result("test_hll");
+}
@@ -0,0 +1,271 @@
+/*
+ * DEFCON 27 Official Badge - host tests
+ *
+ * LP5569 engine programs (LP5569_Asm*() and LP5569_Engine_Load() in
+ * source/dc27_badge.c): the heartbeat and sparkle idle animations are
+ * assembled and loaded into the LP5569 model as the badge does at start-up,
+ * run on its engines, and the PWM the LEDs get is checked against what the
+ * LED_HEARTBEAT_ and LED_SPARKLE_ delays, state_leds[] and led_gamma[] say
+ * they should be, phase by phase.
+ *
+ * Usage: test_lp5569
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sim_hal.h"
+#include "sim_devices.h"
+#include "test.h"
+
+// The firmware is compiled into this file so its static state can be observed
+#define main DC27_FirmwareMain
+#include "dc27_badge.c"
+#undef main
+
+
+/***************************************************************************
+ **************************** Definitions **********************************
+ ***************************************************************************/
+
+#define TEST_CYCLES			2U			// times round each animation, to see it loop
+#define TEST_PHASES_MAX		64U
+#define TEST_TIME_PERCENT	8U			// a phase may be this much longer or shorter...
+#define TEST_TIME_MS		4U			// ...give or take an engine step
+#define TEST_GAMMA_PWM		12U			// PWM half way through a fade, either side of led_gamma[]
+
+typedef enum
+{
+	PHASE_DARK,		// all off
+	PHASE_RISE,		// fading in
+	PHASE_ON,		// at led_gamma[LED_LEVEL_MAX]
+	PHASE_FALL,		// fading out
+} test_phase_kind_t;
+
+typedef struct
+{
+	uint8_t leds;		// lit (bit 0 = LED 0)
+	uint8_t kind;		// test_phase_kind_t
+	uint32_t ms;		// how long
+	uint8_t middle;		// PWM half way through
+} test_phase_t;
+
+
+/***************************************************************************
+ ************************** Global variables ********************************
+ ***************************************************************************/
+
+static const char *const test_phase_names[] = { "dark", "rise", "on", "fall" };
+
+static uint8_t s_trace[1 << 17];	// PWM of the lit LEDs, every ms
+
+
+/****************************************************************************
+ ************************** Functions ***************************************
+ ***************************************************************************/
+
+// Run the engine for ms and split what the LEDs did into phases
+static uint32_t Test_Record(uint8_t engine, uint32_t ms, test_phase_t *phases)
+{
+	uint32_t t, start = 0, n = 0, led;
+	uint8_t leds, pwm, kind, last = 0, pwms[LP5569_LED_NUM];
+	bool mixed = false;
+
+	TEST_CHECK(LP5569_Engine_Run(engine) == 0, "engine %u not started", engine);
+
+	for (t = 0; t < ms && t < sizeof(s_trace); t++)
+	{
+		SIM_Advance(SIM_MS(1));
+
+		leds = pwm = 0;
+		for (led = 0; led < SIM_LP5569_LED_NUM; led++)
+		{
+			if (g_simLP5569.pwm[led] == 0)
+				continue;
+			if (leds && g_simLP5569.pwm[led] != pwm)
+				mixed = true;
+			leds |= 1U << led;
+			pwm = g_simLP5569.pwm[led];
+		}
+		s_trace[t] = pwm;
+
+		if (leds == 0)
+			kind = PHASE_DARK;
+		else if (pwm == led_gamma[LED_LEVEL_MAX])
+			kind = PHASE_ON;
+		else if (n && phases[n - 1].leds == leds && (phases[n - 1].kind == PHASE_RISE || phases[n - 1].kind == PHASE_FALL) && pwm == last)
+			kind = phases[n - 1].kind;	// between two steps of a ramp
+		else
+			kind = (pwm > last || n == 0 || phases[n - 1].kind == PHASE_DARK) ? PHASE_RISE : PHASE_FALL;
+		last = pwm;
+
+		if (n == 0 || phases[n - 1].leds != leds || phases[n - 1].kind != kind)
+		{
+			if (n)
+				phases[n - 1].middle = s_trace[start + phases[n - 1].ms / 2];
+			if (n == TEST_PHASES_MAX)
+				break;
+			phases[n++] = (test_phase_t){ .leds = leds, .kind = kind };
+			start = t;
+		}
+		phases[n - 1].ms++;
+	}
+	if (n)
+		phases[n - 1].middle = s_trace[start + phases[n - 1].ms / 2];
+
+	TEST_CHECK(!mixed, "engine %u: LEDs lit at different PWM", engine);
+	// Stopped, as FX_Service() does it: the engine lets go of the LEDs, which are written back
+	LP5569_Engine_Run(LP5569_ENGINE_NONE);
+	memset(pwms, 0, sizeof(pwms));
+	LP5569_Invalidate(LP5569_REG_LED0_PWM, LP5569_LED_NUM);
+	LP5569_Write(LP5569_REG_LED0_PWM, pwms, LP5569_LED_NUM);
+	SIM_Advance(SIM_MS(1));
+
+	return n;
+}
+
+/**************************************************************/
+
+// What the LEDs did against what they should have. The phase cut short at the
+// end of the recording is only checked for its LEDs
+static void Test_Compare(const char *name, const test_phase_t *got, uint32_t n, const test_phase_t *want, uint32_t count)
+{
+	uint32_t i, slack, mid;
+
+	if (n && got[0].kind == PHASE_DARK && want[0].kind != PHASE_DARK)
+	{
+		TEST_CHECK(got[0].ms <= TEST_TIME_MS * 4, "%s: dark for %ums before it started", name, got[0].ms);
+		got++;	// the first ramp step
+		n--;
+	}
+
+	TEST_CHECK(n >= count, "%s: %u phases, %u expected", name, n, count);
+
+	for (i = 0; i < n && i < count; i++)
+	{
+		TEST_CHECK(got[i].leds == want[i].leds && got[i].kind == want[i].kind, "%s phase %u: LEDs 0x%02X %s, expected 0x%02X %s",
+			name, i, got[i].leds, test_phase_names[got[i].kind], want[i].leds, test_phase_names[want[i].kind]);
+
+		if (i == n - 1)
+			break;
+
+		slack = want[i].ms * TEST_TIME_PERCENT / 100 + TEST_TIME_MS;
+		TEST_CHECK(got[i].ms + slack >= want[i].ms && got[i].ms <= want[i].ms + slack, "%s phase %u (%s): %ums, expected %ums",
+			name, i, test_phase_names[want[i].kind], got[i].ms, want[i].ms);
+
+		// Fades follow the gamma curve (straight, it would be half way at half the time)
+		if (want[i].kind == PHASE_RISE || want[i].kind == PHASE_FALL)
+		{
+			mid = led_gamma[LED_LEVEL_MAX / 2];
+			TEST_CHECK(got[i].middle + TEST_GAMMA_PWM >= mid && got[i].middle <= mid + TEST_GAMMA_PWM, "%s phase %u (%s): PWM %u half way, expected %u",
+				name, i, test_phase_names[want[i].kind], got[i].middle, mid);
+		}
+	}
+}
+
+/**************************************************************/
+
+static void Test_Heartbeat(void)
+{
+	test_phase_t want[TEST_PHASES_MAX], got[TEST_PHASES_MAX];
+	uint32_t cycle, row, n = 0, ms = 0, i;
+
+	// Each state's LEDs in turn: D, E, F, C, O, N
+	for (cycle = 0; cycle < TEST_CYCLES; cycle++)
+	{
+		for (row = D; row <= N; row++)
+		{
+			want[n++] = (test_phase_t){ state_leds[row], PHASE_RISE, LED_HEARTBEAT_FADE_DELAY };
+			want[n++] = (test_phase_t){ state_leds[row], PHASE_ON, LED_HEARTBEAT_WAIT_DELAY };
+			want[n++] = (test_phase_t){ state_leds[row], PHASE_FALL, LED_HEARTBEAT_FADE_DELAY };
+			want[n++] = (test_phase_t){ 0, PHASE_DARK, LPTMR0_TICKS };
+		}
+	}
+	for (i = 0; i < n; i++)
+		ms += want[i].ms;
+
+	Test_Compare("heartbeat", got, Test_Record(LP5569_ENGINE_HEARTBEAT, ms, got), want, n);
+}
+
+/**************************************************************/
+
+static void Test_Sparkle(void)
+{
+	static const uint8_t pairs[] = { 0x09, 0x12, 0x24, 0x12 };	// after LED 1 and 4
+	test_phase_t want[TEST_PHASES_MAX], got[TEST_PHASES_MAX];
+	uint32_t cycle, p, n = 0, ms = 0, i;
+
+	for (cycle = 0; cycle < TEST_CYCLES; cycle++)
+	{
+		want[n++] = (test_phase_t){ 0x12, PHASE_RISE, LED_SPARKLE_FADE_DELAY };
+		want[n++] = (test_phase_t){ 0x12, PHASE_ON, LED_SPARKLE_ON_DELAY };
+		for (p = 0; p < sizeof(pairs); p++)
+			want[n++] = (test_phase_t){ pairs[p], PHASE_ON, LED_SPARKLE_ON_DELAY };
+		want[n++] = (test_phase_t){ 0x12, PHASE_FALL, LED_SPARKLE_FADE_DELAY };
+		want[n++] = (test_phase_t){ 0, PHASE_DARK, LED_SPARKLE_WAIT_DELAY };
+	}
+	for (i = 0; i < n; i++)
+		ms += want[i].ms;
+
+	Test_Compare("sparkle", got, Test_Record(LP5569_ENGINE_SPARKLE, ms, got), want, n);
+}
+
+/**************************************************************/
+
+// Programs that don't fit are errors, not wrapped or cut short
+static void Test_Assembler(void)
+{
+	lp5569_asm_t a;
+	uint32_t i;
+
+	memset(&a, 0, sizeof(a));
+	LP5569_Asm_Wait(&a, LED_HEARTBEAT_WAIT_DELAY);
+	TEST_CHECK(!a.error && a.pc == 3, "%ums wait: %u instructions", LED_HEARTBEAT_WAIT_DELAY, a.pc);
+
+	LP5569_Asm_Wait(&a, (LP5569_LOOP_MAX + 3) * LP5569_STEP_MAX * LP5569_PRESCALE_CYCLES(1) * 1000U / LP5569_ENGINE_CLOCK_HZ);
+	TEST_CHECK(a.error, "wait longer than a loop allowed");
+
+	memset(&a, 0, sizeof(a));
+	LP5569_Asm_Ramp(&a, 256, 1000);
+	TEST_CHECK(a.error, "ramp of 256 allowed");
+
+	memset(&a, 0, sizeof(a));
+	for (i = 0; i < LP5569_PROG_MEM_SIZE; i++)
+		LP5569_Asm(&a, LP5569_INS_SET_PWM(i));
+	TEST_CHECK(!a.error, "%u instructions rejected", LP5569_PROG_MEM_SIZE);
+	LP5569_Asm(&a, LP5569_INS_SET_PWM(0));
+	TEST_CHECK(a.error && a.pc == LP5569_PROG_MEM_SIZE, "instruction past program memory accepted");
+}
+
+/**************************************************************/
+
+static void Test_Main(void)
+{
+	BOARD_InitBootPins();	// what KL_Setup_LP5569() needs of main()'s start-up
+	BOARD_InitBootClocks();
+	BOARD_InitBootPeripherals();
+	SysTick_Config(SystemCoreClock / 1000U);
+
+	Test_Assembler();
+
+	if (KL_Setup_LP5569())
+	{
+		TEST_CHECK(false, "KL_Setup_LP5569() failed");
+		return;
+	}
+	TEST_CHECK(g_simLP5569.engineStarts == 0, "engines running after loading");
+
+	Test_Heartbeat();
+	Test_Sparkle();
+	printf("  %u engine instructions run\n", g_simLP5569.engineInstructions);
+}
+
+/**************************************************************/
+
+int main(int argc, char **argv)
+{
+	SIM_LP5569_Attach();
+	SIM_Run(Test_Main, SIM_TIME_NEVER);
+	return Test_Result("test_lp5569");
+}
@@ -0,0 +1,299 @@
+/*
+ * DEFCON 27 Official Badge - host tests
+ *
+ * The NXH2261 link (KL_Setup_NXH2261(), KL_UpdatePacket_NXH2261() and
+ * KL_GetPacket_NXH2261() in source/dc27_badge.c) against the radio model in
+ * sim_nxh2261.c: the image loaded through the I2C bootloader, the "RO"
+ * handshake before each packet to broadcast, also among frames received, and
+ * the B...E framing both ways, including frames cut short, overlong or still
+ * arriving.
+ *
+ * Usage: test_nxh2261
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sim_hal.h"
+#include "sim_devices.h"
+#include "sim_nxh2261.h"
+#include "test.h"
+
+// The firmware is compiled into this file so its static state can be observed
+#define main DC27_FirmwareMain
+#include "dc27_badge.c"
+#undef main
+
+
+/***************************************************************************
+ **************************** Definitions **********************************
+ ***************************************************************************/
+
+#define TEST_SETTLE			SIM_MS(20)	// for the model to take a frame sent to it
+
+
+/***************************************************************************
+ ************************** Global variables ********************************
+ ***************************************************************************/
+
+// Packets both ways: every field, and bytes that look like frame markers ('B', 'E')
+static const struct packet_of_infamy test_packets[] = {
+	{ 0x12345678, HUMAN, 0, 0x00 },
+	{ 0xDEADBEEF, UBER, 1, FLAG_ALL_MASK },
+	{ 0x42454542, 'B', 'E', 'E', 'B' },
+	{ 0x00000000, 0x00, 0x00, 0x00 },
+	{ 0xFFFFFFFF, 0xFF, 0xFF, 0xFF },
+};
+
+
+/****************************************************************************
+ ************************** Functions ***************************************
+ ***************************************************************************/
+
+static void Test_Byte(void *arg)
+{
+	SIM_LPUART0_Receive((uint8_t)(uintptr_t)arg);
+}
+
+/**************************************************************/
+
+// Bytes from the NXH2261 that its model wouldn't send, one character time apart
+static void Test_Inject(const uint8_t *bytes, uint32_t n)
+{
+	uint32_t i;
+
+	for (i = 0; i < n; i++)
+		SIM_ScheduleInput(SIM_Now() + (i + 1) * SIM_LPUART0_ByteTime(), Test_Byte, (void *)(uintptr_t)bytes[i]);
+	SIM_Advance((n + 1) * SIM_LPUART0_ByteTime());
+}
+
+/**************************************************************/
+
+static uint32_t Test_Frame(uint8_t *frame, const struct packet_of_infamy *p)	// as the NXH2261 sends it
+{
+	const uint8_t payload[SIM_NXH2261_PAYLOAD_SIZE] = { p->uid >> 24, p->uid >> 16, p->uid >> 8, p->uid, p->type, p->magic, p->flags, 0 };
+	uint32_t i;
+
+	frame[0] = 'B';
+	for (i = 0; i < SIM_NXH2261_PAYLOAD_SIZE; i++)
+	{
+		frame[1 + i * 2] = 0xD0 | (payload[i] >> 4);
+		frame[2 + i * 2] = 0xD0 | (payload[i] & 0x0F);
+	}
+	frame[SIM_NXH2261_FRAME_SIZE - 1] = 'E';
+
+	return SIM_NXH2261_FRAME_SIZE;
+}
+
+/**************************************************************/
+
+static void Test_CheckPacket(const char *what, const struct packet_of_infamy *want)
+{
+	struct packet_of_infamy got = { 0 };
+	int res = KL_GetPacket_NXH2261(&got);
+
+	TEST_CHECK(res == 0, "%s: no packet", what);
+	TEST_CHECK(res || (got.uid == want->uid && got.type == want->type && got.magic == want->magic && got.flags == want->flags),
+		"%s: got %08X %02X %02X %02X, sent %08X %02X %02X %02X", what, got.uid, got.type, got.magic, got.flags,
+		want->uid, want->type, want->magic, want->flags);
+}
+
+/**************************************************************/
+
+static void Test_CheckEmpty(const char *what)
+{
+	struct packet_of_infamy got;
+
+	TEST_CHECK(KL_GetPacket_NXH2261(&got) != 0, "%s: packet %08X found", what, got.uid);
+}
+
+/**************************************************************/
+
+// Prevent Boot, the image written to EEPROM through the bootloader, booted from it and calibrated
+static void Test_Bootloader(void)
+{
+	const uint8_t *eeprom = SIM_NXH2261_EEPROM();
+	uint32_t i, blank = 0;
+
+	TEST_CHECK(KL_Setup_NXH2261() == 0, "KL_Setup_NXH2261() failed");
+	TEST_CHECK(g_simNXH2261.bootloaderEntries == 1, "%u bootloader entries", g_simNXH2261.bootloaderEntries);
+	TEST_CHECK(g_simNXH2261.i2cErrors == 0, "%u bootloader commands failed", g_simNXH2261.i2cErrors);
+	TEST_CHECK(!memcmp(eeprom, NxH2281Eep, NxH2281Eep_size), "EEPROM doesn't hold the image");
+	for (i = NxH2281Eep_size; i < SIM_NXH2261_EEPROM_SIZE; i++)
+		blank += (eeprom[i] != 0xFF);
+	TEST_CHECK(blank == 0, "%u bytes written past the image", blank);
+	TEST_CHECK(g_simNXH2261.eepromBoots == 1 && g_simNXH2261.blankBoots == 0 && SIM_NXH2261_Running(),
+		"not running the image (%u boots, %u blank)", g_simNXH2261.eepromBoots, g_simNXH2261.blankBoots);
+	TEST_CHECK(g_simNXH2261.calibrations == 1 && g_simNXH2261.calibrationsNoClock == 0,
+		"%u calibrations, %u without CLKOUT", g_simNXH2261.calibrations, g_simNXH2261.calibrationsNoClock);
+
+	printf("  %u byte image in %.3f s, %u bootloader commands\n", NxH2281Eep_size,
+		SIM_Seconds(g_simNXH2261.programTime), g_simNXH2261.i2cCommands);
+}
+
+/**************************************************************/
+
+// NXH_UPDATE, "RO", then one frame with the packet to broadcast
+static void Test_Update(void)
+{
+	static const sim_nxh2261_faults_t none = { 0 }, miss = { .seed = 1, .missUpdate = 1 };
+	uint8_t payload[SIM_NXH2261_PAYLOAD_SIZE];
+	sim_nxh2261_stats_t before;
+	const struct packet_of_infamy *p;
+	uint32_t i;
+
+	for (i = 0; i < sizeof(test_packets) / sizeof(test_packets[0]); i++)
+	{
+		p = &test_packets[i];
+		before = g_simNXH2261;
+
+		TEST_CHECK(KL_UpdatePacket_NXH2261(*p) == 0, "packet %u: no \"RO\"", i);
+		SIM_Advance(TEST_SETTLE);
+
+		TEST_CHECK(g_simNXH2261.updateRequests == before.updateRequests + 1, "packet %u: %u update requests",
+			i, g_simNXH2261.updateRequests - before.updateRequests);
+		TEST_CHECK(g_simNXH2261.txFrames == before.txFrames + 1 && g_simNXH2261.txFramesBad == before.txFramesBad
+			&& g_simNXH2261.updateTimeouts == before.updateTimeouts, "packet %u: %u frames, %u bad, %u timeouts", i,
+			g_simNXH2261.txFrames - before.txFrames, g_simNXH2261.txFramesBad - before.txFramesBad, g_simNXH2261.updateTimeouts - before.updateTimeouts);
+
+		TEST_CHECK(SIM_NXH2261_TxPayload(payload) && payload[0] == (uint8_t)(p->uid >> 24) && payload[1] == (uint8_t)(p->uid >> 16)
+			&& payload[2] == (uint8_t)(p->uid >> 8) && payload[3] == (uint8_t)p->uid && payload[4] == p->type
+			&& payload[5] == p->magic && payload[6] == p->flags, "packet %u: broadcasting %02X%02X%02X%02X %02X %02X %02X, sent %08X %02X %02X %02X",
+			i, payload[0], payload[1], payload[2], payload[3], payload[4], payload[5], payload[6], p->uid, p->type, p->magic, p->flags);
+	}
+
+	// No "RO": nothing is sent, and the last packet stays on the air
+	SIM_NXH2261_SetFaults(&miss);
+	before = g_simNXH2261;
+	TEST_CHECK(KL_UpdatePacket_NXH2261(test_packets[0]) != 0, "update without \"RO\" succeeded");
+	SIM_Advance(TEST_SETTLE);
+	TEST_CHECK(g_simNXH2261.txFrames == before.txFrames, "frame sent without \"RO\"");
+	TEST_CHECK(SIM_NXH2261_TxPayload(payload) && payload[4] == test_packets[i - 1].type, "broadcast changed without \"RO\"");
+	SIM_NXH2261_SetFaults(&none);
+}
+
+/**************************************************************/
+
+// The "RO" answering NXH_UPDATE among frames received: one left over from before the request
+// isn't the answer, and frames that come in while waiting for it are kept
+static void Test_UpdateFrames(void)
+{
+	static const sim_nxh2261_faults_t none = { 0 }, miss = { .seed = 1, .missUpdate = 1 };
+	uint8_t bytes[SIM_NXH2261_FRAME_SIZE + 2];
+	sim_nxh2261_stats_t before;
+	uint32_t n, seen;
+	sim_time_t start;
+
+	// A frame, then a stale "RO": the frame is taken, the "RO" is no answer
+	n = Test_Frame(bytes, &test_packets[1]);
+	bytes[n++] = 'R';
+	bytes[n++] = 'O';
+	Test_Inject(bytes, n);
+	SIM_NXH2261_SetFaults(&miss);
+	before = g_simNXH2261;
+	seen = peerSightings;
+	TEST_CHECK(KL_UpdatePacket_NXH2261(test_packets[0]) != 0, "stale \"RO\" after a frame taken as the answer");
+	SIM_Advance(TEST_SETTLE);
+	TEST_CHECK(g_simNXH2261.txFrames == before.txFrames, "frame sent on a stale \"RO\"");
+	TEST_CHECK(peerSightings == seen + 1, "frame before the request: %u sightings", peerSightings - seen);
+	Test_CheckEmpty("after a stale \"RO\"");
+	SIM_NXH2261_SetFaults(&none);
+
+	// Frames while NXH_UPDATE is high, just before the "RO" and after it: all kept
+	start = SIM_Now();
+	SIM_NXH2261_QueuePacket(start + SIM_MS(60), test_packets[2].uid, test_packets[2].type, test_packets[2].magic, test_packets[2].flags);
+	SIM_NXH2261_QueuePacket(start + SIM_MS(99), test_packets[3].uid, test_packets[3].type, test_packets[3].magic, test_packets[3].flags);
+	SIM_NXH2261_QueuePacket(start + SIM_MS(150), test_packets[4].uid, test_packets[4].type, test_packets[4].magic, test_packets[4].flags);
+	before = g_simNXH2261;
+	TEST_CHECK(KL_UpdatePacket_NXH2261(test_packets[0]) == 0, "no \"RO\" among frames");
+	SIM_Advance(TEST_SETTLE);
+	TEST_CHECK(g_simNXH2261.txFrames == before.txFrames + 1 && g_simNXH2261.txFramesBad == before.txFramesBad,
+		"%u frames, %u bad sent among frames", g_simNXH2261.txFrames - before.txFrames, g_simNXH2261.txFramesBad - before.txFramesBad);
+	Test_CheckPacket("during NXH_UPDATE", &test_packets[2]);
+	Test_CheckPacket("just before \"RO\"", &test_packets[3]);
+	Test_CheckPacket("after \"RO\"", &test_packets[4]);
+	Test_CheckEmpty("after the update");
+}
+
+/**************************************************************/
+
+// Frames from the NXH2261: whole, back to back, still arriving, and broken ones skipped
+static void Test_Receive(void)
+{
+	uint8_t bytes[8 * SIM_NXH2261_FRAME_SIZE];
+	const struct packet_of_infamy *p;
+	uint32_t i, n, before = g_simNXH2261.rxFrames;
+
+	Test_CheckEmpty("nothing received");
+
+	for (i = 0; i < sizeof(test_packets) / sizeof(test_packets[0]); i++)
+	{
+		p = &test_packets[i];
+		SIM_NXH2261_QueuePacket(SIM_Now() + SIM_MS(1) + i * SIM_NXH2261_FRAME_SIZE * SIM_LPUART0_ByteTime(), p->uid, p->type, p->magic, p->flags);
+	}
+	SIM_Advance(SIM_MS(50));
+	TEST_CHECK(g_simNXH2261.rxFrames == before + i, "%u frames sent by the model", g_simNXH2261.rxFrames - before);
+
+	for (i = 0; i < sizeof(test_packets) / sizeof(test_packets[0]); i++)
+		Test_CheckPacket("back to back", &test_packets[i]);
+	Test_CheckEmpty("after back to back");
+
+	// Half a frame: left in the buffer until the rest comes
+	n = Test_Frame(bytes, &test_packets[1]);
+	Test_Inject(bytes, n / 2);
+	Test_CheckEmpty("half a frame");
+	Test_Inject(bytes + n / 2, n - n / 2);
+	Test_CheckPacket("rest of the frame", &test_packets[1]);
+
+	// Noise, a frame missing bytes, one ended early and one too long, then a good one
+	n = 0;
+	bytes[n++] = 0x00;
+	bytes[n++] = 'x';
+	n += Test_Frame(&bytes[n], &test_packets[2]) - 4;	// cut short: the next 'B' starts again
+	Test_Frame(&bytes[n], &test_packets[3]);			// 'E' after 10 of the 16 bytes
+	bytes[n + 11] = 'E';
+	n += 12;
+	i = Test_Frame(&bytes[n], &test_packets[4]);		// 2 bytes too many
+	bytes[n + i - 1] = 0xD1;
+	bytes[n + i] = 0xD2;
+	bytes[n + i + 1] = 'E';
+	n += i + 2;
+	n += Test_Frame(&bytes[n], &test_packets[0]);
+	Test_Inject(bytes, n);
+	Test_CheckPacket("after broken frames", &test_packets[0]);
+	Test_CheckEmpty("broken frames");
+}
+
+/**************************************************************/
+
+static void Test_Main(void)
+{
+	BOARD_InitBootPins();	// what the NXH2261 link needs of main()'s start-up
+	BOARD_InitBootClocks();
+	BOARD_InitBootPeripherals();
+	SysTick_Config(SystemCoreClock / 1000U);
+	EnableIRQ(LPUART0_SERIAL_RX_TX_IRQN);
+
+	printf("Bootloader\n");
+	Test_Bootloader();
+	if (!SIM_NXH2261_Running())
+		return;
+
+	printf("Packets to broadcast\n");
+	Test_Update();
+	printf("Packets to broadcast among packets received\n");
+	Test_UpdateFrames();
+	printf("Packets received\n");
+	Test_Receive();
+}
+
+/**************************************************************/
+
+int main(int argc, char **argv)
+{
+	SIM_LP5569_Attach();
+	SIM_NXH2261_Attach(NULL);
+	SIM_Run(Test_Main, SIM_TIME_NEVER);
+	return Test_Result("test_nxh2261");
+}
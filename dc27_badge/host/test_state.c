@@ -0,0 +1,432 @@
+/*
+ * DEFCON 27 Official Badge - host tests
+ *
+ * The game (dc27_transitions[] driven by DC27_UpdateState()) against the
+ * per-state switch it replaced, transcribed below as Old_UpdateState(). Both
+ * are run from every badge state, game flags, group flags and last packet,
+ * over every sequence of passes (no packet, or one of each badge type with and
+ * without the magic token) up to TEST_DEPTH long, and must end up in the same
+ * state having done the same things: packet processed, state printed, flags
+ * saved, 1-up or Rick Roll played. The LEDs and delays aren't compared, they
+ * moved to effects that play on their own.
+ *
+ * Usage: test_state
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sim_hal.h"
+#include "test.h"
+
+// The firmware is compiled into this file so its static state can be observed
+#define main DC27_FirmwareMain
+#include "dc27_badge.c"
+#undef main
+
+
+/***************************************************************************
+ **************************** Definitions **********************************
+ ***************************************************************************/
+
+#define TEST_DEPTH			6U			// passes in the longest sequence
+#define TEST_UID			0x00DC2701	// uid of every packet received
+#define TEST_REPORTS		20U			// differences printed
+
+#define TEST_NO_PACKET		0xFF		// input: a pass with nothing received
+#define TEST_TYPES			(BADGE_TYPE_COUNT + 1)	// badge types, and one past them
+#define TEST_INPUTS			(1 + TEST_TYPES * 2)
+
+// Things a pass did
+#define DID_PROCESS			0x01		// DC27_ProcessPacket()
+#define DID_PRINT			0x02		// DC27_PrintState()
+#define DID_PERSIST			0x04		// DC27_UpdateFlags()
+#define DID_1UP				0x08		// KL_Piezo_1Up()
+#define DID_RICKROLL		0x10		// KL_Piezo_RickRoll()
+
+typedef struct	// what the game depends on between passes
+{
+	uint8_t state;		// badge_state_t
+	uint8_t game;		// game_flags
+	uint8_t group;		// group_flags
+	uint8_t type;		// last packet received (nxhRxPacket), which later passes still look at
+	uint8_t magic;
+} test_node_t;
+
+typedef struct
+{
+	test_node_t node;
+	uint8_t did;		// DID_*
+	uint8_t printed;	// state printed (badge_state_t)
+} test_result_t;
+
+
+/***************************************************************************
+ ************************** Global variables ********************************
+ ***************************************************************************/
+
+static uint32_t s_processed, s_printed;	// console lines seen this pass
+static char s_printedName[16];
+
+static uint8_t s_visited[1 << 21];		// test_node_t as Test_Key(), shallowest depth reached + 1
+
+static test_node_t s_queue[1 << 21];	// breadth first, so a node is expanded at its shallowest depth
+static uint8_t s_depth[1 << 21];
+static uint32_t s_head, s_tail, s_passes;
+
+
+/****************************************************************************
+ ************************** Functions ***************************************
+ ***************************************************************************/
+
+static void Test_Console(void *ctx, const char *line)
+{
+	if (!strncmp(line, "-> Unique ID", 12))
+		s_processed++;
+
+	if (!strncmp(line, "[*] Badge State = ", 18))
+	{
+		s_printed++;
+		snprintf(s_printedName, sizeof(s_printedName), "%s", line + 18);
+		s_printedName[strcspn(s_printedName, "\r\n")] = '\0';
+	}
+}
+
+/**************************************************************/
+
+// The old DC27_IncrementFlag(), for the game flag a magic token gives
+static int Old_IncrementFlag(test_node_t *m)
+{
+	static const struct { uint8_t type, flag; } flags[] = {
+		{ SPEAKER, FLAG_1_MASK }, { VILLAGE, FLAG_2_MASK }, { CONTEST, FLAG_3_MASK }, { ARTIST, FLAG_4_MASK }, { GOON, FLAG_5_MASK } };
+	uint32_t i;
+
+	for (i = 0; i < sizeof(flags) / sizeof(flags[0]); i++)
+	{
+		if (m->type == flags[i].type)
+		{
+			if ((m->game & flags[i].flag) == 0)
+			{
+				m->game |= flags[i].flag;
+				return 1;
+			}
+			break;
+		}
+	}
+
+	return 0;
+}
+
+/**************************************************************/
+
+// One pass of the old DC27_UpdateState(), with packet (type, magic) received unless type is TEST_NO_PACKET
+static void Old_UpdateState(test_node_t *m, uint8_t type, uint8_t magic, test_result_t *r)
+{
+	bool received = (type != TEST_NO_PACKET);
+	uint8_t ch, i, j;
+
+	r->did = 0;
+	r->printed = BADGE_STATE_COUNT;
+
+	if (m->state != COMPLETE && received)	// every state but COMPLETE processed the first packet
+	{
+		m->type = type;
+		m->magic = magic;
+		r->did |= DID_PROCESS;
+		m->game |= FLAG_0_MASK;
+	}
+
+	switch (m->state)
+	{
+		default:
+		case ATTRACT:
+			if ((m->game & FLAG_0_MASK) == 1)
+			{
+				ch = 0;
+				j = m->game >> 1;
+				for (i = 0; i < 5; ++i)
+				{
+					ch += (j & 0x01);
+					j >>= 1;
+				}
+				m->state = D + ch;
+				r->did |= DID_1UP | DID_PRINT | DID_PERSIST;
+				r->printed = m->state;
+			}
+			break;
+
+		case D:
+#ifdef __BADGE_MAGIC
+			break;
+#endif
+		case E:
+		case F:
+		case C:
+		case O:
+			if (m->magic == true && Old_IncrementFlag(m))
+			{
+				if (m->state == O)
+					m->group = 0;
+				m->state++;
+				r->did |= DID_1UP | DID_PRINT | DID_PERSIST;
+				r->printed = m->state;
+			}
+			break;
+
+		case N:
+			switch (m->type)
+			{
+				case HUMAN:
+				case CONTEST:
+				case ARTIST:
+				case CFP:
+				case UBER:
+					m->group |= FLAG_0_MASK;
+					break;
+				case GOON:
+					m->group |= FLAG_1_MASK;
+					break;
+				case SPEAKER:
+					m->group |= FLAG_2_MASK;
+					break;
+				case VENDOR:
+					m->group |= FLAG_3_MASK;
+					break;
+				case PRESS:
+					m->group |= FLAG_4_MASK;
+					break;
+				case VILLAGE:
+					m->group |= FLAG_5_MASK;
+					break;
+			}
+
+			if ((m->group & GROUP_ALL_MASK) == GROUP_ALL_MASK)
+			{
+				m->game |= FLAG_6_MASK;
+				m->state = COMPLETE;
+				r->did |= DID_RICKROLL | DID_PRINT | DID_PERSIST;
+				r->printed = m->state;
+			}
+			break;
+
+		case COMPLETE:
+			if (received)	// drained, but it's still the last packet
+			{
+				m->type = type;
+				m->magic = magic;
+			}
+			break;
+	}
+
+	r->node = *m;
+}
+
+/**************************************************************/
+
+// Put a packet in the receive ring buffer, framed as the NXH2261 sends it
+static void Test_Receive(uint8_t type, uint8_t magic)
+{
+	const uint8_t data[8] = { TEST_UID >> 24, (TEST_UID >> 16) & 0xFF, (TEST_UID >> 8) & 0xFF, TEST_UID & 0xFF, type, magic, 0, 0 };
+	uint8_t frame[NXH2261_DATA_PACKET_SIZE];
+	uint32_t i;
+
+	frame[0] = 'B';
+	for (i = 0; i < sizeof(data); i++)
+	{
+		frame[1 + i * 2] = 0xD0 | (data[i] >> 4);
+		frame[2 + i * 2] = 0xD0 | (data[i] & 0x0F);
+	}
+	frame[NXH2261_DATA_PACKET_SIZE - 1] = 'E';
+
+	for (i = 0; i < sizeof(frame); i++)
+	{
+		nxhRingBuffer[nxhRxIndex] = frame[i];
+		nxhRxIndex = (nxhRxIndex + 1) % LPUART0_RING_BUFFER_SIZE;
+	}
+}
+
+/**************************************************************/
+
+// One pass of the firmware's DC27_UpdateState() from node n
+static void New_UpdateState(const test_node_t *n, uint8_t type, uint8_t magic, test_result_t *r)
+{
+	uint32_t i;
+
+	badge_state = (badge_state_t)n->state;
+	game_flags = n->game;
+	group_flags = n->group;
+	memset(&nxhRxPacket, 0, sizeof(nxhRxPacket));
+	nxhRxPacket.type = n->type;
+	nxhRxPacket.magic = n->magic;
+
+	FX_Stop();	// an empty queue, so every effect of the pass is kept
+	memset(fxQueue, 0, sizeof(fxQueue));
+	nvmDirty = false;
+	nxhTxIndex = nxhRxIndex;
+	s_processed = s_printed = 0;
+	s_printedName[0] = '\0';
+
+	if (type != TEST_NO_PACKET)
+		Test_Receive(type, magic);
+
+	DC27_UpdateState();
+
+	r->node.state = badge_state;
+	r->node.game = game_flags;
+	r->node.group = group_flags;
+	r->node.type = nxhRxPacket.type;
+	r->node.magic = nxhRxPacket.magic;
+	r->did = (s_processed ? DID_PROCESS : 0) | (s_printed ? DID_PRINT : 0) | (nvmDirty ? DID_PERSIST : 0);
+	r->printed = BADGE_STATE_COUNT;
+
+	for (i = 0; i < FX_QUEUE_SIZE; i++)	// played or not, the steps are still there
+	{
+		if (fxQueue[i].show == show_1up)
+			r->did |= DID_1UP;
+		if (fxQueue[i].tune == tune_rickroll_chorus)
+			r->did |= DID_RICKROLL;
+	}
+
+	for (i = 0; i < BADGE_STATE_COUNT; i++)
+	{
+		if (!strcmp(s_printedName, badge_state_names[i]))
+			r->printed = i;
+	}
+
+	TEST_CHECK(s_processed <= 1 && s_printed <= 1, "state %s: packet processed %u times, state printed %u times",
+		badge_state_names[n->state], s_processed, s_printed);
+}
+
+/**************************************************************/
+
+static uint32_t Test_Key(const test_node_t *n)
+{
+	return (uint32_t)n->state << 18 | (uint32_t)n->game << 11 | (uint32_t)n->group << 5 | (uint32_t)n->type << 1 | (n->magic ? 1 : 0);
+}
+
+/**************************************************************/
+
+static void Test_Push(const test_node_t *n, uint8_t depth)
+{
+	uint32_t key = Test_Key(n);
+
+	if (s_visited[key])
+		return;
+
+	s_visited[key] = depth + 1;
+	if (s_tail < sizeof(s_queue) / sizeof(s_queue[0]))
+	{
+		s_queue[s_tail] = *n;
+		s_depth[s_tail++] = depth;
+	}
+	else
+		TEST_CHECK(false, "more than %u nodes", s_tail);
+}
+
+/**************************************************************/
+
+static const char *Test_Describe(uint8_t type, uint8_t magic)
+{
+	static char texts[2][32];	// two to a message
+	static uint32_t i;
+	char *text = texts[i++ & 1];
+
+	if (type == TEST_NO_PACKET)
+		return "nothing received";
+
+	snprintf(text, sizeof(texts[0]), "%s%s", DC27_BadgeInfo(type)->name, magic ? " (magic)" : "");
+	return text;
+}
+
+/**************************************************************/
+
+static void Test_Explore(void)
+{
+	test_node_t n, m;
+	test_result_t old, new;
+	uint32_t s, g, t, in, mismatches = 0;
+	uint8_t type, magic;
+	bool same;
+
+	// Every start: badge state, game flags and last packet, and in N (where they count) group flags
+	for (t = 0; t < TEST_TYPES * 2; t++)
+	{
+		for (s = 0; s < BADGE_STATE_COUNT; s++)
+		{
+			for (g = 0; g <= FLAG_ALL_MASK; g++)
+				Test_Push(&(test_node_t){ .state = s, .game = g, .type = t >> 1, .magic = t & 1 }, 0);
+		}
+
+		for (g = 0; g <= GROUP_ALL_MASK; g++)
+			Test_Push(&(test_node_t){ .state = N, .game = FLAG_0_MASK | FLAG_QUEST_MASK, .group = g, .type = t >> 1, .magic = t & 1 }, 0);
+	}
+	printf("  %u starting points\n", s_tail);
+
+	while (s_head < s_tail)
+	{
+		n = s_queue[s_head];
+
+		for (in = 0; in < TEST_INPUTS; in++)
+		{
+			type = in ? (in - 1) >> 1 : TEST_NO_PACKET;
+			magic = in ? (in - 1) & 1 : 0;
+
+			m = n;
+			Old_UpdateState(&m, type, magic, &old);
+			New_UpdateState(&n, type, magic, &new);
+			s_passes++;
+
+			same = (old.did == new.did && old.printed == new.printed && Test_Key(&old.node) == Test_Key(&new.node));
+			if (!same && mismatches++ < TEST_REPORTS)
+				TEST_CHECK(false, "%s, flags 0x%02X, group 0x%02X, last %s; then %s: old -> %s 0x%02X 0x%02X did 0x%02X, new -> %s 0x%02X 0x%02X did 0x%02X",
+					badge_state_names[n.state], n.game, n.group, Test_Describe(n.type, n.magic), Test_Describe(type, magic),
+					badge_state_names[old.node.state], old.node.game, old.node.group, old.did,
+					badge_state_names[new.node.state], new.node.game, new.node.group, new.did);
+			else
+			{
+				s_testChecks++;		// counted without printing every one
+				s_testFailures += !same;
+			}
+
+			if (s_depth[s_head] + 1U < TEST_DEPTH)
+				Test_Push(&old.node, s_depth[s_head] + 1);
+		}
+
+		s_head++;
+	}
+
+	printf("  %u states reached, %u passes compared, %u different\n", s_tail, s_passes, mismatches);
+}
+
+/**************************************************************/
+
+static void Test_Main(void)
+{
+	BOARD_InitBootPins();	// what DC27_UpdateFlags() and the effects need of main()'s start-up
+	BOARD_InitBootClocks();
+	BOARD_InitBootPeripherals();
+	SysTick_Config(SystemCoreClock / 1000U);
+	KL_Timer_Start();
+
+	memset(SIM_FlashBase(), 0xFF, SIM_FLASH_SIZE);
+	if (KL_Flash_Init())
+	{
+		TEST_CHECK(false, "KL_Flash_Init() failed");
+		return;
+	}
+	PEER_Init();
+	HLL_Load();
+	SIM_AttachConsole(Test_Console, NULL);
+
+	printf("Old and new game, sequences up to %u passes\n", TEST_DEPTH);
+	Test_Explore();
+}
+
+/**************************************************************/
+
+int main(int argc, char **argv)
+{
+	SIM_Run(Test_Main, SIM_TIME_NEVER);
+	return Test_Result("test_state");
+}
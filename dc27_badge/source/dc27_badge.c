@@ -50,6 +50,7 @@
  * @brief   Application entry point.
  */
 #include <stdio.h>
+#include <cr_section_macros.h>
 #include "board.h"
 #include "peripherals.h"
 #include "pin_mux.h"
@@ -58,8 +59,10 @@
 #include "fsl_debug_console.h"
 #include "fsl_smc.h"
 #include "fsl_flash.h"
+#include "fsl_crc.h"
 
 #include "LPBroadcast_NXH_DC27.eep.h"  // Pre-compiled firmware blob for NXH2261 (loaded during power-up)
+#include "dc27_show.h"					// LED and piezo show bytecode
 
 
 /***************************************************************************
@@ -85,14 +88,70 @@
 #define LOW		0U
 #define HIGH	1U
 
+// NXH2261 traffic capture for replay in the host simulation (host/sim_record.h).
+// LPUART0 RX bytes and pin interrupts are timestamped in the ISRs and written to
+// the console as binary frames between the normal text output
+//#define __NXH_RECORD
+
+#ifdef __NXH_RECORD
+#define KL_RECORD_BUFFER_SIZE	128U	// events held until the next console flush (power of 2)
+#define KL_RECORD_SYNC			0x00	// start of frame, never part of console text
+#define KL_RECORD_BYTE			'U'		// LPUART0 RX byte, data = byte
+#define KL_RECORD_PIN_LOW		'L'		// pin interrupt, data = port << 5 | pin
+#define KL_RECORD_PIN_HIGH		'H'
+#define KL_RECORD_LOST			'X'		// buffer overflowed, data = events dropped
+#define KL_RECORD_PIN(port, pin)	((uint8_t)(((port) << 5) | (pin)))	// port: 0 = A ... 4 = E
+#ifndef KL_IDLE
+#define KL_IDLE()	KL_Record_Flush()	// drain the capture while the firmware waits
+#endif
+#endif
+
+// Body of busy-wait loops. Empty on target; the host simulation (host/) hooks it
+// so that virtual time can advance while the firmware spins on a flag
+#ifndef KL_IDLE
+#define KL_IDLE()
+#endif
+
 // LED animation
-#define LED_HEARTBEAT_FADE_DELAY		6		// Time (ms) per brightness setting ramp up/down
+// (heartbeat and sparkle are LP5569 engine programs, see LP5569_Engine_Load())
+#define LED_HEARTBEAT_FADE_DELAY		288		// Time (ms) to ramp up/down
 #define LED_HEARTBEAT_WAIT_DELAY		1000	// Time (ms) to sleep at LED maximum brightness
 
-#define LED_SPARKLE_FADE_DELAY			2		// Time (ms) per brightness setting ramp up/down
+#define LED_SPARKLE_FADE_DELAY			384		// Time (ms) to ramp up/down
 #define LED_SPARKLE_ON_DELAY			350		// Time (ms) to remain on at LED maximum brightness
 #define LED_SPARKLE_WAIT_DELAY			1500 	// Time (ms) to sleep between LED updates
 
+// Effects (LED and piezo sequences played in the background, see FX_Begin())
+#define FX_QUEUE_SIZE					16U		// Number of steps waiting to play (power of 2)
+#define FX_ALL_LEDS						0x3F	// LEDs 0-5
+#define FX_KEEP							0x01	// Step leaves the LEDs as they are
+#define FX_FLICKER						0x02	// Light a random LED during each note of the tune
+#define FX_1UP_GAP						10		// Time (ms) of silence after each note
+#define FX_RICKROLL_GAP					30
+#define FX_RICKROLL_DELAY				250		// Time (ms) before the tune starts
+#define FX_LYRIC_QUEUE_SIZE				8U		// Lyrics waiting to be printed (power of 2)
+#define FX_SHOW_STEPS					32U		// Show instructions run in one ms at most (loops with nothing to wait for)
+
+// LED framebuffer (layers composed by LED_Compose())
+#define LED_CHANNELS					9U		// LP5569 outputs LED0-8
+#define LED_ALL_CHANNELS				0x01FF
+#define LED_FRAME_PERIOD				20		// Time (ms) between frames (50 Hz at most)
+#define LED_LEVEL_MAX					255		// Full brightness (perceptual, see led_gamma)
+#define LED_FADE_SEGMENTS				8		// Straight pieces of an engine fade along the gamma curve
+#define LED_BRIGHTNESS_NORMAL			LED_LEVEL_MAX
+#define LED_BRIGHTNESS_BATTERY			128		// Battery saver: half as bright, a quarter of the LED current
+
+// Perceptual brightness to PWM duty cycle (gamma 2, rounded up so only 0 is off), tabled by the
+// compiler because the M0+ has no divider
+#define LED_GAMMA(x)					(((x) * (x) + 255) / 256)
+#define LED_GAMMA4(x)					LED_GAMMA(x), LED_GAMMA((x) + 1), LED_GAMMA((x) + 2), LED_GAMMA((x) + 3)
+#define LED_GAMMA16(x)					LED_GAMMA4(x), LED_GAMMA4((x) + 4), LED_GAMMA4((x) + 8), LED_GAMMA4((x) + 12)
+#define LED_GAMMA64(x)					LED_GAMMA16(x), LED_GAMMA16((x) + 16), LED_GAMMA16((x) + 32), LED_GAMMA16((x) + 48)
+
+// Game
+#define GAME_STEP_DELAY					500		// Time (ms) to show a received packet or state change
+#define GAME_WIN_DELAY					1500	// Time (ms) to pause after completing the quest
+
 // Bit masks for badge quest flags
 #define FLAG_0_MASK						0x01	// Any Valid Communication
 #define FLAG_1_MASK						0x02	// Talk/Speaker
@@ -103,16 +162,74 @@
 #define FLAG_6_MASK						0x40	// Group Chat
 #define FLAG_ALL_MASK					0x7F
 #define GROUP_ALL_MASK					0x3F
+#define FLAG_QUEST_MASK					0x3E	// Flags 1-5, collected in any order in states D-O
+
+// Game state machine actions (see dc27_transitions[]), run in this order
+// LED and piezo actions are queued as effects, so a transition returns straight away
+#define ACT_PROCESS						0x0001	// Print the received packet, set flag 0
+#define ACT_WAIT						0x0002	// Pause before changing state
+#define ACT_SKIP_FLAGS					0x0004	// Next state moves on by the number of quest flags held
+#define ACT_SET_FLAG_6					0x0008
+#define ACT_CLEAR_GROUP					0x0010
+#define ACT_DISPLAY						0x0020	// Show the (new) state on the LEDs
+#define ACT_ALL_ON						0x0040
+#define ACT_1UP							0x0080
+#define ACT_BLANK						0x0100	// LEDs off, then pause
+#define ACT_RICKROLL					0x0200
+#define ACT_PRINT						0x0400	// Print state and game flags
+#define ACT_FLASH						0x0800	// Pause, then LEDs off
+#define ACT_PERSIST						0x1000	// Save game flags to Flash and the NXH2261 packet
+#define ACT_HOLD						0x2000	// Pause after winning
+#define ACT_DRAIN						0x4000	// Discard any packets left in the ring buffer
+#define ACT_TIMER						0x8000	// Start the LPTMR for the next heartbeat/sparkle, once effects have played
+
+#define ACT_RECEIVE						(ACT_PROCESS | ACT_DISPLAY | ACT_FLASH)
+#define ACT_ADVANCE						(ACT_WAIT | ACT_DISPLAY | ACT_1UP | ACT_PRINT | ACT_FLASH | ACT_PERSIST)
 
 #define CONSOLE_RCVBUF_SIZE				20  	// Number of bytes in debug console (interactive mode) receive buffer
+#define CONSOLE_RING_BUFFER_SIZE		64U		// Number of bytes received from the host waiting for the console task (power of 2)
 #define ART_DEFAULT						"DC27"	// Default string for ASCII art generator
 
-#define NVM_DATA_SIZE 					4U		// Number of bytes to store in KL27 Flash
+#define DATA_SECTORS					9U		// KL27 Flash sectors at the end kept out of the program image for the data below (PROGRAM_FLASH in the .ld scripts)
+#define NVM_DATA_SIZE 					4U		// Number of bytes stored in KL27 Flash by the original firmware (one per longword)
 #define SECTOR_INDEX_FROM_END 			1U		// Location of KL27 Flash sector to use for game data storage
+#define NVM_LOG_SECTORS					2U		// Sectors (from SECTOR_INDEX_FROM_END back) the game data log takes turns in
+#define NVM_VERSION						1U		// nvm_record_t layout written by this firmware
+#define NVM_COMMIT_DELAY				2000U	// ms without a state change before it's written to Flash (see DC27_MarkDirty())
+#define SHOW_SECTOR_FROM_END			3U		// Location of KL27 Flash sector holding the show uploaded with 'P'
+#define PEER_SECTOR_FROM_END			4U		// Location of the first KL27 Flash sector of the peer database...
+#define PEER_SECTORS					4U		// ...which takes turns across this many (further from the end)
+#define PEER_SECTOR_SIZE				1024U	// KL27 Flash sector (pflashSectorSize), for the sizes below
+#define PEER_SLOTS						(PEER_SECTOR_SIZE / 16U)	// peer_record_t per sector, the first slot holds its peer_header_t
+#define PEER_MAX						((PEER_SECTORS - 2U) * (PEER_SLOTS - 1U))	// Badges remembered, 126 (room to reclaim a sector; the flash the image leaves holds no more, HLL_Estimate() counts past it)
+#define PEER_INDEX_BITS					9U		// peerIndex has 2^n entries, at least twice PEER_SECTORS * PEER_SLOTS
+#define PEER_INDEX_SIZE					(1U << PEER_INDEX_BITS)
+#define PEER_QUEUE_SIZE					8U		// Badges seen since the peer database was last written
+#define PEER_MAGIC						0x52454550U	// "PEER", peer_header_t
+#define PEER_FOREIGN					0xFFFFFFFFU	// peerSeq of a sector holding something else: left alone
+#define PEER_COMPLETE					0x80	// peer_record_t flags: seen with all game flags set
+#define HLL_SECTOR_FROM_END				8U		// Location of KL27 Flash sector holding the unique badge estimates...
+#define HLL_LOG_SECTORS					2U		// ...taking turns with the next one
+#define HLL_MAGIC						0x204C4C48U	// "HLL ", hll_record_t
+#define HLL_BITS						8U		// Hash bits picking a register
+#define HLL_REGISTERS					(1U << HLL_BITS)	// per sketch, 4 bits each
+#define HLL_RANK_MAX					15U		// Largest register value (good for millions of badges)
+#define HLL_ERROR_PERMILLE				65U		// Relative standard error, 1.04 / sqrt(HLL_REGISTERS)
+#define HLL_ALPHA_M2					47073U	// Bias correction 0.7213 / (1 + 1.079 / HLL_REGISTERS), times HLL_REGISTERS^2
+#define HLL_DELTAS						((PEER_SECTOR_SIZE - sizeof(hll_record_t)) / 4U)	// register changes after the snapshot in each sector
+#define HLL_SAVE_BATCH					16U		// Register changes programmed together
+#define KL_VECTOR_COUNT					48U		// Vector table entries: 16 Cortex-M0+ exceptions, 32 interrupts
+
+// Scheduler
+#define KL_EVENT_QUEUE_SIZE				8U		// Events waiting for their task (power of 2, at least KL_EVENT_COUNT)
 
 // CLKOUT
 #define SIM_CLKOUT_SEL_OSCERCLK_CLK     6U 		// CLKOUT pin clock select: OSCERCLK (from clock_config.c)
 
+// UART2 (to/from host): RX interrupt feeds the console, enabled after DbgConsole_Init()
+#define UART2_SERIAL_RX_TX_IRQN			UART2_FLEXIO_IRQn
+#define UART2_SERIAL_RX_TX_IRQHANDLER	UART2_FLEXIO_IRQHandler
+
 // LPUART0 (to/from NXH2261)
 #define LPUART0_RING_BUFFER_SIZE 		2048U	// Number of bytes in ring buffer for receiving data from NXH
 
@@ -122,6 +239,9 @@
 
 // NXH2261
 #define NXH2261_DATA_PACKET_SIZE		18U		 // header + 16 user bytes + footer
+#define NXH2261_LISTEN_DELAY			20U		 // Time (ms) to stay out of VLPS after NXH_DETECT, for the packet to arrive on LPUART0
+#define KL_DELAY_SPIN_MAX				2U		 // Delays (ms) shorter than this spin on SysTick, longer ones sleep (see SysTick_DelayTicks())
+#define KL_CLOCK_PERIOD					60000U	 // LPTMR0 period (ms) with no timer running, so it keeps time (see KL_Time())
 #define NXH2261_MAX_CHUNK_SIZE			128U
 #define NXH2261_CMD_GET_VERSION			0x0F80	 // Get device version information
 #define NXH2261_CMD_PREVENT_BOOT		0x0F16	 // Aborts automatic boot procedure, puts device into bootloader
@@ -136,29 +256,57 @@
 // LP5569
 #define LP5569_LED_NUM			6U  	// Number of LEDs per badge
 
-#define LED_CONTROL_RED  		0x08	// No master fading, exponential adjustment, LED powered by charge pump
+// LP5569 execution engines (Section 8.5: Programming)
+#define LP5569_ENGINE_NONE				0U
+#define LP5569_ENGINE_HEARTBEAT			1U		// Attract mode
+#define LP5569_ENGINE_SPARKLE			2U		// Sparkle mode
+#define LP5569_PROG_MEM_SIZE			128U	// Instructions reachable by branch and mux addresses
+#define LP5569_PROG_MEM_PAGE			16U		// Instructions per page of PROGRAM_MEM registers
+#define LP5569_ENGINE_CLOCK_HZ			32768U	// Internal oscillator
+#define LP5569_PRESCALE_CYCLES(p)		((p) ? 512U : 16U)	// Ramp/wait step time unit: 15.6ms or 0.49ms
+#define LP5569_STEP_MAX					31U		// Step time units per ramp/wait instruction
+#define LP5569_LOOP_MAX					63U		// Branch loop count (0 = forever)
+
+#define LP5569_OP_DISABLED				0x00	// ENGINE_CONTROL2: engine stopped, PC at its starting address
+#define LP5569_OP_LOAD					0x01	// program memory writable
+#define LP5569_OP_RUN					0x02
+#define LP5569_EXEC_FREE_RUN			0x02	// ENGINE_CONTROL1
+#define LP5569_ENGINE_BITS(e, mode)		((uint8_t)((mode) << (8 - 2 * (e))))	// engine 1 = bits 7:6
+
+// Instruction set
+#define LP5569_INS_RAMP(prescale, step, down, incr)	((uint16_t)(((prescale) << 14) | ((step) << 9) | ((down) << 8) | (incr)))
+#define LP5569_INS_WAIT(prescale, step)		LP5569_INS_RAMP(prescale, step, 0, 0)
+#define LP5569_INS_SET_PWM(pwm)				((uint16_t)(0x4000 | (pwm)))
+#define LP5569_INS_MUX_LD_START(addr)		((uint16_t)(0x9E00 | (addr)))	// first row of the mapping table
+#define LP5569_INS_MUX_MAP_START(addr)		((uint16_t)(0x9C00 | (addr)))	// ...and map its LEDs
+#define LP5569_INS_MUX_LD_END(addr)			((uint16_t)(0x9C80 | (addr)))	// last row
+#define LP5569_INS_MUX_MAP_NEXT				((uint16_t)0x9D80)				// map the next row, wraps at the last
+#define LP5569_INS_BRANCH(loops, addr)		((uint16_t)(0xA000 | ((loops) << 7) | (addr)))	// run from addr loops more times
+#define LP5569_INS_END(reset)				((uint16_t)(0xC000 | ((reset) << 11)))
+
+#define LED_CONTROL_RED  		0x20	// Master fader 1, linear PWM (see led_gamma), LED powered by charge pump
 #define LED_CURRENT_RED			0x0A 	// 1.0mA
-#define LED_PWM_RED				0xC0	// 75% duty cycle
+#define LED_PWM_RED				0xC0	// 75% brightness (perceptual), applied by master fader 1
 
-#define LED_CONTROL_ORANGE  	0x08	// No master fading, exponential adjustment, LED powered by charge pump
+#define LED_CONTROL_ORANGE  	0x20	// Master fader 1, linear PWM (see led_gamma), LED powered by charge pump
 #define LED_CURRENT_ORANGE		0x07 	// 0.7mA
-#define LED_PWM_ORANGE			0xC0	// 75% duty cycle
+#define LED_PWM_ORANGE			0xC0	// 75% brightness (perceptual), applied by master fader 1
 
-#define LED_CONTROL_GREEN  		0x08	// No master fading, exponential adjustment, LED powered by charge pump
+#define LED_CONTROL_GREEN  		0x20	// Master fader 1, linear PWM (see led_gamma), LED powered by charge pump
 #define LED_CURRENT_GREEN		0x02 	// 0.2mA
-#define LED_PWM_GREEN			0xC0	// 75% duty cycle
+#define LED_PWM_GREEN			0xC0	// 75% brightness (perceptual), applied by master fader 1
 
-#define LED_CONTROL_BLUE  		0x08	// No master fading, exponential adjustment, LED powered by charge pump
+#define LED_CONTROL_BLUE  		0x20	// Master fader 1, linear PWM (see led_gamma), LED powered by charge pump
 #define LED_CURRENT_BLUE		0x07 	// 0.7mA
-#define LED_PWM_BLUE			0xC0	// 75% duty cycle
+#define LED_PWM_BLUE			0xC0	// 75% brightness (perceptual), applied by master fader 1
 
-#define LED_CONTROL_PURPLE  	0x08	// No master fading, exponential adjustment, LED powered by charge pump
+#define LED_CONTROL_PURPLE  	0x20	// Master fader 1, linear PWM (see led_gamma), LED powered by charge pump
 #define LED_CURRENT_PURPLE		0x07 	// 0.7mA
-#define LED_PWM_PURPLE			0xC0	// 75% duty cycle
+#define LED_PWM_PURPLE			0xC0	// 75% brightness (perceptual), applied by master fader 1
 
-#define LED_CONTROL_WHITE  		0x08	// No master fading, exponential adjustment, LED powered by charge pump
+#define LED_CONTROL_WHITE  		0x20	// Master fader 1, linear PWM (see led_gamma), LED powered by charge pump
 #define LED_CURRENT_WHITE		0x06 	// 0.6mA
-#define LED_PWM_WHITE			0xC0	// 75% duty cycle
+#define LED_PWM_WHITE			0xC0	// 75% brightness (perceptual), applied by master fader 1
 
 // From Section 8.6: Register Maps
 #define LP5569_REG_CONFIG                   0x00 	// Configuration Register
@@ -253,6 +401,8 @@
 #define LP5569_REG_LED_FAULT1               0x81 	// LED [8] Fault Status
 #define LP5569_REG_LED_FAULT2               0x82 	// LED [7:0] Fault Status
 #define LP5569_REG_GENERAL_FAULT            0x83 	// CP Cap UVLO and TSD Fault Status
+#define LP5569_REG_COUNT					0x84	// Size of the register file (shadowed by LP5569_Write())
+#define LP5569_CURRENT_RESET				0xAF	// LEDx_CURRENT reset value (17.5mA), all other registers reset to 0
 
 // Piezo
 // Table of notes/pitch (in Hz)
@@ -347,12 +497,23 @@
 #define NOTE_D8  	4699
 #define NOTE_DS8 	4978
 
+// TPM0 for a pitch: prescaler (top 3 bits) and MOD (bottom 13) for a period of at most 8192 counts,
+// worked out at compile time so a note is a table lookup and a few register writes (KL_Piezo_Note())
+#define PIEZO_FITS(hz, ps)				(TPM0_CLOCK_SOURCE / ((uint32_t)(hz) << (ps)) <= 0x2000U)
+#define PIEZO_PRESCALE(hz)				(PIEZO_FITS(hz, 0) ? 0 : PIEZO_FITS(hz, 1) ? 1 : PIEZO_FITS(hz, 2) ? 2 : \
+										 PIEZO_FITS(hz, 3) ? 3 : PIEZO_FITS(hz, 4) ? 4 : PIEZO_FITS(hz, 5) ? 5 : \
+										 PIEZO_FITS(hz, 6) ? 6 : 7)
+#define PIEZO_TPM(hz)					((PIEZO_PRESCALE(hz) << 13) | (TPM0_CLOCK_SOURCE / ((uint32_t)(hz) << PIEZO_PRESCALE(hz)) - 1))
+#define PIEZO_TICK						25		// Time (ms) of one tick of a packed note
+#define PIEZO_QUIET						SHOW_QUIET	// Packed note duty class: 25% instead of 50%
+
 
 /**************************************************************************
 ************************** Macros *****************************************
 ***************************************************************************/
 
 #define HIGH_BYTE(x)  ((x) >> 8)
+#define TONE(name, ms)	{ PITCH_##name, (ms) / PIEZO_TICK }	// packed note, ms a multiple of PIEZO_TICK
 #define LOW_BYTE(x)   ((x) & 0xFF)
 
 #define dc27_invalid_cmd() 	PRINTF("?")
@@ -362,20 +523,41 @@
 ************************** Structs ****************************************
 ***************************************************************************/
 
+// Badge types, in badge_type_t order: X(type, name, LED colour, quest flag, group flag, next type)
+// LED colour selects the LED_CONTROL_/LED_CURRENT_/LED_PWM_ profile, quest flag is the flag a magic token
+// of this type gives (DC27_IncrementFlag()), group flag its gemstone colour in the group chat and next type
+// the one DC27_MagicPacket() changes to. Everything about a type is generated from this one list.
+#define BADGE_TYPES(X) \
+	X(HUMAN,	"Human",	WHITE,	0,				FLAG_0_MASK,	GOON)		\
+	X(GOON,		"Goon",		RED,	FLAG_5_MASK,	FLAG_1_MASK,	SPEAKER)	\
+	X(SPEAKER,	"Speaker",	BLUE,	FLAG_1_MASK,	FLAG_2_MASK,	VENDOR)		\
+	X(VENDOR,	"Vendor",	PURPLE,	0,				FLAG_3_MASK,	PRESS)		\
+	X(PRESS,	"Press",	GREEN,	0,				FLAG_4_MASK,	VILLAGE)	\
+	X(VILLAGE,	"Village",	ORANGE,	FLAG_2_MASK,	FLAG_5_MASK,	CONTEST)	\
+	X(CONTEST,	"Contest",	WHITE,	FLAG_3_MASK,	FLAG_0_MASK,	ARTIST)		\
+	X(ARTIST,	"Artist",	WHITE,	FLAG_4_MASK,	FLAG_0_MASK,	CFP)		\
+	X(CFP,		"CFP",		WHITE,	0,				FLAG_0_MASK,	UBER)		\
+	X(UBER,		"Uber",		WHITE,	0,				FLAG_0_MASK,	HUMAN)
+
+#define BADGE_TYPE_ENUM(type, name, led, flag, group, next)		type,
+
 typedef enum	// badge types
 {
-	HUMAN,
-	GOON,
-	SPEAKER,
-	VENDOR,
-	PRESS,
-	VILLAGE,
-	CONTEST,
-	ARTIST,
-	CFP,
-	UBER
+	BADGE_TYPES(BADGE_TYPE_ENUM)
+	BADGE_TYPE_COUNT
 } badge_type_t;
 
+typedef struct	// everything known about a badge type (see BADGE_TYPES)
+{
+	const char *name;
+	uint8_t control;	// LP5569 LED control, current and full brightness
+	uint8_t current;
+	uint8_t pwm;
+	uint8_t flag;		// quest flag given by a magic token, 0 = none
+	uint8_t group;		// group chat flag
+	uint8_t next;		// badge_type_t after DC27_MagicPacket()
+} badge_info_t;
+
 typedef enum	// badge states
 {
 	ATTRACT,
@@ -388,6 +570,55 @@ typedef enum	// badge states
 	COMPLETE
 } badge_state_t;
 
+#define BADGE_STATE_COUNT	(COMPLETE + 1)
+
+typedef enum	// game state machine events, checked in this order
+{
+	EV_PACKET,		// a packet was received (first one in the buffer)
+	EV_PASS,		// every call to DC27_UpdateState()
+	EV_CONTACT,		// flag 0 is set
+	EV_FLAG,		// a magic token's packet gave a quest flag we didn't have
+	EV_GROUP,		// all six groups seen in the group chat
+	EV_TIMER,		// the LPTMR period started by ACT_TIMER is up
+	EV_COUNT
+} game_event_t;
+
+typedef enum	// scheduler events, posted by the ISRs (see KL_Post()), each runs one task
+{
+	KL_EVENT_PACKET,	// LPUART0 received the end of a packet from the NXH2261
+	KL_EVENT_TIMER,		// LPTMR period is up
+	KL_EVENT_IDLE,		// effects have finished playing
+	KL_EVENT_LED,		// LED frame due or lyric to print
+	KL_EVENT_ATTACH,	// KL_RX changed (USB-to-serial adapter plugged in or out)
+	KL_EVENT_CONSOLE,	// UART2 received a character from the host
+	KL_EVENT_SAVE,		// badge state hasn't changed for NVM_COMMIT_DELAY
+	KL_EVENT_COUNT
+} kl_event_t;
+
+typedef void (*kl_task_t)(kl_event_t);
+
+typedef enum	// users of LPTMR0, which runs for whichever is due first (see KL_Timer_Set())
+{
+	KL_TIMER_GAME,		// posts KL_EVENT_TIMER (see KL_StartTimer())
+	KL_TIMER_DELAY,		// wakes SysTick_DelayTicks() from VLPS
+	KL_TIMER_COUNT
+} kl_timer_t;
+
+typedef struct	// interactive mode command (see DC27_ConsoleCommand())
+{
+	char name;			// first character of the line (upper case, lower case accepted)
+	uint8_t minLen;		// length of the command line
+	uint8_t maxLen;		// 0 = no limit
+	bool complete;		// only once the quest is complete
+	void (*run)(uint8_t *, uint32_t);
+} console_command_t;
+
+typedef struct
+{
+	uint8_t next;		// badge_state_t
+	uint16_t actions;	// ACT_*, 0 = event ignored in this state
+} game_transition_t;
+
 struct packet_of_infamy  // data packet for NFMI transfer
 {
 	uint32_t uid;		// unique ID
@@ -397,20 +628,143 @@ struct packet_of_infamy  // data packet for NFMI transfer
 	uint8_t unused;		// unused
 };
 
-struct note		// sound generation
+#define PIEZO_PITCH_ENUM(name)		PITCH_##name,
+
+typedef enum	// index of a pitch in piezo_tpm[], numbered as a show's NOTE (see SHOW_PITCHES)
 {
-   long freq;		// frequency (Hz)
-   long duration;	// duration (ms)
-   char duty;		// duty cycle (%)
+	PITCH_REST,
+	SHOW_PITCHES(PIEZO_PITCH_ENUM)
+	PITCH_COUNT
+} pitch_t;
+
+struct note		// sound generation, packed (see TONE())
+{
+	uint8_t pitch;		// pitch_t, | PIEZO_QUIET for a 25% duty cycle instead of 50%
+	uint8_t ticks;		// duration (PIEZO_TICK ms)
 };
 
+typedef enum	// how an effect gets along with the ones already playing (see FX_Begin())
+{
+	FX_AMBIENT,		// idle animation: only starts when nothing is playing, stopped by anything else
+	FX_NOTIFY,		// feedback for a packet: only starts when nothing is playing
+	FX_EVENT		// state change: queued behind whatever is playing
+} fx_priority_t;
+
+typedef enum	// FX_Tick() progress through a step
+{
+	FX_START,
+	FX_RAMP,
+	FX_SHOW,
+	FX_NOTE,
+	FX_GAP,
+	FX_HOLD,
+	FX_NEXT
+} fx_phase_t;
+
+typedef enum	// LED framebuffer layers, bottom to top
+{
+	LED_LAYER_STATE,	// badge state display, covers every LED and stays when effects end
+	LED_LAYER_NOTIFY,	// packet and error feedback, cleared when effects end
+	LED_LAYER_MUSIC,	// LED flashing along with the tune
+	LED_LAYER_COUNT
+} led_layer_id_t;
+
+typedef struct	// what one layer draws: channels it doesn't cover show the layers below
+{
+	uint16_t cover;				// bit 0 = LED 0
+	uint8_t pwm[LED_CHANNELS];
+} led_layer_t;
+
+typedef struct	// badge state, one record of the game data log (see KL_Flash_Write())
+{
+	uint8_t flags;		// game_flags
+	uint8_t brightness;	// ledBrightness (battery saver), since version 1
+	uint8_t spare;		// 0, free for a later version
+	uint8_t version;	// NVM_VERSION. Version 0 records held the game flags as a uint32_t, so this was 0
+	uint16_t seq;		// one more than the record before (wraps, never 0xFFFF)
+	uint16_t crc;		// Get_CRC16() of everything above, a torn write doesn't match
+} nvm_record_t;		// the first longword is programmed first, the second one commits it
+
+_Static_assert(sizeof(nvm_record_t) == 8, "nvm_record_t: records are programmed as two longwords");
+
+typedef struct	// a badge we've heard from, one record of the peer log (see PEER_See())
+{
+	uint32_t uid;		// packet_of_infamy uid
+	uint32_t first;		// badge time (PEER_Time()) when we first heard from it...
+	uint32_t last;		// ...and most recently
+	uint8_t type;		// badge_type_t in its last packet
+	uint8_t flags;		// its game flags then, | PEER_COMPLETE once seen with all of them set
+	uint16_t crc;		// Get_CRC16() of everything above
+} peer_record_t;	// the first three longwords are programmed first, the last one commits it
+
+typedef struct	// first slot of each peer log sector
+{
+	uint32_t magic;		// PEER_MAGIC
+	uint32_t seq;		// one more than the sector opened before it (never 0)
+	uint32_t spare;		// 0xFFFFFFFF
+	uint32_t check;		// ~seq, a torn header doesn't match
+} peer_header_t;
+
+_Static_assert(sizeof(peer_record_t) == 16 && sizeof(peer_header_t) == 16, "peer log slots are 16 bytes");
+_Static_assert(PEER_INDEX_SIZE >= 2 * PEER_SECTORS * PEER_SLOTS, "peerIndex: keep it at most half full");
+
+typedef struct	// unique badge estimates, snapshot at the start of a sector (see HLL_Load())
+{
+	uint32_t magic;		// HLL_MAGIC
+	uint8_t met[HLL_REGISTERS / 2];		// HyperLogLog sketch of every uid heard from
+	uint8_t helped[HLL_REGISTERS / 2];	// ...of the ones heard from again with all game flags set
+	uint16_t seq;		// one more than the snapshot before (wraps, never 0xFFFF)
+	uint16_t crc;		// Get_CRC16() of everything above
+} hll_record_t;		// magic and sketches are programmed first, the last longword commits them
+
+_Static_assert(SECTOR_INDEX_FROM_END + NVM_LOG_SECTORS <= SHOW_SECTOR_FROM_END && SHOW_SECTOR_FROM_END < PEER_SECTOR_FROM_END &&
+			   PEER_SECTOR_FROM_END + PEER_SECTORS <= HLL_SECTOR_FROM_END &&
+			   HLL_SECTOR_FROM_END + HLL_LOG_SECTORS - 1 <= DATA_SECTORS, "Flash data sectors overlap or don't fit in DATA_SECTORS");
+
+typedef struct	// show uploaded with 'P', as stored in flash
+{
+	uint32_t magic;				// SHOW_FLASH_MAGIC (erased flash: no show)
+	uint32_t size;
+	uint8_t code[SHOW_MAX_SIZE];
+} show_flash_t;
+
+typedef struct	// built-in show
+{
+	const char *name;
+	const uint8_t *code;
+} show_info_t;
+
+typedef struct	// one step of an effect: LED ramp, then show, then tune, then hold
+{
+	const uint8_t *show;		// bytecode (see dc27_show.h), NULL = none
+	const struct note *tune;	// NULL = none
+	const char *const *lyrics;	// printed with each note of the tune, NULL = none
+	uint8_t notes;				// number of notes in the tune
+	uint8_t gap;				// silence after each note (ms)
+	uint8_t flags;				// FX_KEEP, FX_FLICKER
+	uint8_t layer;				// LED_LAYER_STATE or LED_LAYER_NOTIFY
+	uint8_t leds;				// LEDs lit (bit 0 = LED 0), the others are turned off (state) or uncovered (notify)
+	uint8_t from;				// brightness at the start of the ramp
+	uint8_t to;					// brightness at the end of the ramp (straight away if tick = 0)
+	uint8_t step;				// brightness change every tick ms
+	uint8_t tick;
+	uint16_t hold;				// time to stay at the end (ms)
+} fx_step_t;
+
+typedef struct	// LP5569 engine program being assembled (see LP5569_Asm())
+{
+	uint16_t code[LP5569_PROG_MEM_SIZE];
+	uint8_t pc;					// next free address
+	bool error;					// out of program memory or a value out of range
+} lp5569_asm_t;
+
 
 /****************************************************************************
  ************************** Global variables ********************************
  ***************************************************************************/
 
 // Badge
-volatile static badge_state_t badge_state, attract_state;
+volatile static badge_state_t badge_state;
 volatile static badge_type_t badge_type = __BADGE_TYPE;
 volatile static uint8_t game_flags, group_flags;  // tasks to complete, 1 = done, 0 = not done
 volatile unsigned char g_random; // PRNG
@@ -422,13 +776,63 @@ static ftfx_cache_config_t s_cacheDriver;
 static uint32_t pflashBlockBase = 0;
 static uint32_t pflashTotalSize = 0;
 static uint32_t pflashSectorSize = 0;
+static uint32_t nvmNext;					// where KL_Flash_Write() appends (0 until KL_Flash_Find())...
+static uint32_t nvmSector;					// ...in this sector
+static uint16_t nvmSeq;						// of the newest record
+static const nvm_record_t *nvmNewest;		// in flash, NULL if there is none
+static bool nvmDirty;						// badge state changed since it was last written
+volatile static uint16_t nvmWait;			// SysTick_Handler() only: ms until KL_EVENT_SAVE, 0 = not counting
+static void (*klVectors[KL_VECTOR_COUNT])(void) __attribute__((aligned(256)));	// vector table, copied to RAM (VTOR alignment)
+static uint32_t flashMasked;				// interrupts KL_Flash_Begin() masked
+volatile static bool flashBusy;				// between KL_Flash_Begin() and KL_Flash_End()
+
+// Peer database
+static uint16_t peerIndex[PEER_INDEX_SIZE];	// uid hash -> log slot of its newest record, 0 = empty (slot 0 is a header)
+static peer_record_t peerQueue[PEER_QUEUE_SIZE];	// sightings not written yet, newer than the log
+static uint32_t peerQueued;
+static bool peerUrgent;						// peerQueue has a new badge or new flags: write it before sleeping
+static uint32_t peerEpoch;					// badge time at power-up: the newest in the log (time switched off doesn't count)
+static uint32_t peerSightings;				// packets heard since power-up
+static uint32_t peerCount;					// badges in the log and peerQueue
+static uint32_t peerDropped;				// new badges turned away (full)
+static uint32_t peerMax;					// badges there's room for, PEER_MAX less any sectors that aren't ours
+static uint32_t peerSeq[PEER_SECTORS];		// header seq of each sector, 0 = erased, PEER_FOREIGN = not ours
+static uint32_t peerHead;					// sector the log is appended to...
+static uint32_t peerNext;					// ...at this slot, PEER_SLOTS = full
+static hll_record_t hllState;				// unique badge estimates
+static hll_record_t hllSaved;				// ...as they are in flash
+static uint32_t hllChanges;					// register changes since the last checkpoint
+static uint32_t hllSector;					// register changes go to this sector (from HLL_SECTOR_FROM_END)...
+static uint32_t hllNext;					// ...at this slot, HLL_DELTAS = full
 
 // Timer
-volatile uint32_t g_systickCounter;
-volatile bool g_lptmrFlag;
+volatile uint32_t g_systickCounter;			// SysTick interrupts since power-up (it stops in VLPS)
+volatile static uint32_t lptmrLeft[KL_TIMER_COUNT];	// ms until each timer is due, 0 = not running
+volatile static uint32_t lptmrPeriod;		// LPTMR0 was started for this many ms, 0 = stopped
+volatile static uint32_t lptmrSeconds, lptmrMs;	// LPTMR0 time charged since power-up (VLPS included)
+static uint32_t delaySpin, delayWait, delaySleep;	// ms spent in SysTick_DelayTicks() spinning, in WAIT and in VLPS
+static bool lptmrExpired;	// EV_TIMER fires (set by DC27_TaskGame())
+
+// Scheduler: events are queued once until their task has run
+volatile static uint8_t eventQueue[KL_EVENT_QUEUE_SIZE];
+volatile static uint8_t eventHead, eventTail;
+volatile static uint32_t eventPending;	// 1 << kl_event_t
 
 // UART2 (to/from host)
 extern const uart_config_t UART2_config;	// peripherals.c
+volatile static uint8_t consoleRingBuffer[CONSOLE_RING_BUFFER_SIZE];	// filled by UART2_SERIAL_RX_TX_IRQHANDLER
+volatile static uint8_t consoleTxIndex, consoleRxIndex;
+
+// Interactive mode
+static bool consoleActive;
+static bool consoleDrop;						// drop the next character
+static bool consoleReceive;						// 'R' waiting for packet(s)
+static void (*consoleNext)(uint8_t *, uint32_t);	// takes the next line instead of the command table (confirmation)
+static uint8_t consoleLine[CONSOLE_RCVBUF_SIZE];
+static show_flash_t consoleShow;			// being uploaded by 'P'
+static uint32_t consoleLen;
+static struct packet_of_infamy consoleTxPacket;	// 'U' waiting to be confirmed
+static uint8_t consoleTone[] = { SHOW_OP_TONE(0, 0, 0, 0), SHOW_OP_END };	// 'S'
 
 // LPUART0 (to/from NXH2261)
 /*
@@ -444,16 +848,60 @@ volatile static uint16_t nxhRxIndex; 	// Index of the memory to save new receive
 // LP5569 LED driver default settings
 unsigned char LP5569_Control;	// Control Register
 unsigned char LP5569_Current;	// Current Control
-unsigned char LP5569_PWM;		// PWM Duty Cycle
+unsigned char LP5569_PWM;		// Full brightness (perceptual), see LED_SetBrightness()
+
+// LP5569 register shadow: what the driver last wrote, so unchanged writes can be skipped
+static uint8_t lp5569Shadow[LP5569_REG_COUNT];
+static uint8_t lp5569Known[(LP5569_REG_COUNT + 7) / 8];	// 1 = shadow matches the device
+static uint32_t lp5569Writes, lp5569Skipped;				// I2C transactions made and avoided
 
 // NHX2261
-volatile bool g_nxhDetect = false;
+volatile static uint8_t nxhListen;		// ms left before a packet announced by NXH_DETECT is given up on
+static bool nxhUpdating;				// NXH2261 answers NXH_UPDATE on LPUART0, without NXH_DETECT
+volatile static uint32_t nxhOverruns;	// LPUART0 overruns: bytes from the NXH lost, the handler ran too late
 static struct packet_of_infamy nxhTxPacket; 	// Data packet to transmit
 static struct packet_of_infamy nxhRxPacket; 	// Received data packet
 
 // Piezo/PWM
 extern const tpm_chnl_pwm_signal_param_t TPM0_pwmSignalParams[];  	// peripherals.c
 
+// Effects: steps added by FX_Add() are played by FX_Tick() from SysTick_Handler
+static fx_step_t fxQueue[FX_QUEUE_SIZE];
+volatile static uint8_t fxHead, fxTail;		// fxTail is the step playing, fxHead the next free slot
+static uint8_t fxNew;						// end of the effect being added, published by FX_End()
+static bool fxOpen, fxAmbient;
+static fx_priority_t fxPriority;
+static fx_phase_t fxPhase;					// FX_Tick() only
+static uint8_t fxNote;
+static uint16_t fxWait;						// ms left in the current phase
+static uint8_t fxLeds, fxLevel;				// FX_Tick() only: fxLeds of the step playing lit at fxLevel
+static const char *fxLyricQueue[FX_LYRIC_QUEUE_SIZE];	// waiting to be printed by FX_Service()...
+static volatile uint8_t fxLyricHead, fxLyricTail;		// ...added by FX_Tick() at the head
+static const uint8_t *fxPc;					// FX_Show(): next instruction of the step's show...
+static const uint8_t *fxLoopPc[SHOW_LOOP_DEPTH];	// ...start of each LOOP it's in
+static uint8_t fxLoopCount[SHOW_LOOP_DEPTH], fxLoopDepth;
+static bool fxTimed;						// the WAIT or NOTE at fxPc has started
+static uint8_t fxEngine, fxEngineAdd;		// LP5569 engine playing the idle animation, one to start at FX_End()
+static uint8_t fxEngineShown;				// engine running on the LP5569, set by FX_Service()
+
+// LED framebuffer: layers drawn by FX_Tick() (and LED_Fill() callers), composed by FX_Service()
+static led_layer_t ledLayer[LED_LAYER_COUNT];
+static uint8_t ledFrame[LED_CHANNELS];		// last frame composed, as written to the LP5569
+volatile static bool ledDirty;				// a layer changed since the last frame
+volatile static bool ledDue;				// frame to compose, posted by LED_Tick()
+static uint8_t ledWait;						// LED_Tick() only: ms until the next frame may start
+static uint8_t ledBrightness = LED_BRIGHTNESS_NORMAL;	// scales LP5569_PWM for every LED
+static uint8_t ledFader, ledFaderShown;		// master fader 1: wanted, and on the LP5569 (set by FX_Service())
+
+#ifdef __NXH_RECORD
+// NXH2261 traffic capture: filled by the ISRs, emptied to the console by KL_Record_Flush()
+volatile static uint32_t g_recordMs;	// SysTick milliseconds (stops in VLPS)
+volatile static uint32_t recordTime[KL_RECORD_BUFFER_SIZE];	// microseconds
+volatile static uint8_t recordKind[KL_RECORD_BUFFER_SIZE];
+volatile static uint8_t recordData[KL_RECORD_BUFFER_SIZE];
+volatile static uint8_t recordHead, recordTail, recordLost;
+#endif
+
 
 /****************************************************************************
  *************************** Constants **************************************
@@ -461,10 +909,104 @@ extern const tpm_chnl_pwm_signal_param_t TPM0_pwmSignalParams[];  	// peripheral
 
 const char command_prompt[] = "\n\r> ";
 
+const char *const badge_state_names[BADGE_STATE_COUNT] = { "Attract", "D", "E", "F", "C", "O", "N", "Hax0r" };
+
+// Badge type metadata, indexed by badge_type_t (out of range types get badge_info_unknown)
+#define BADGE_TYPE_INFO(type, name, led, flag, group, next) \
+	[type] = { name, LED_CONTROL_##led, LED_CURRENT_##led, LED_PWM_##led, flag, group, next },
+
+const badge_info_t badge_info[BADGE_TYPE_COUNT] = { BADGE_TYPES(BADGE_TYPE_INFO) };
+const badge_info_t badge_info_unknown = { "Unknown", LED_CONTROL_WHITE, LED_CURRENT_WHITE, LED_PWM_WHITE, 0, 0, UBER };
+
+// Keep the list consistent: each quest flag given by exactly one type, every group colour
+// worn by someone, one group flag per type and every type reachable by DC27_MagicPacket()
+#define BADGE_TYPE_FLAG_OR(type, name, led, flag, group, next)		| (flag)
+#define BADGE_TYPE_FLAG_SUM(type, name, led, flag, group, next)		+ (flag)
+#define BADGE_TYPE_GROUP_OR(type, name, led, flag, group, next)		| (group)
+#define BADGE_TYPE_GROUP_ONE(type, name, led, flag, group, next)	&& (group) && !((group) & ((group) - 1))
+#define BADGE_TYPE_NEXT_SUM(type, name, led, flag, group, next)		+ (1UL << (next))
+
+_Static_assert((0 BADGE_TYPES(BADGE_TYPE_FLAG_OR)) == FLAG_QUEST_MASK, "BADGE_TYPES: quest flag missing or invalid");
+_Static_assert((0 BADGE_TYPES(BADGE_TYPE_FLAG_SUM)) == FLAG_QUEST_MASK, "BADGE_TYPES: quest flag given by two types");
+_Static_assert((0 BADGE_TYPES(BADGE_TYPE_GROUP_OR)) == GROUP_ALL_MASK, "BADGE_TYPES: group flag missing or invalid");
+_Static_assert((1 BADGE_TYPES(BADGE_TYPE_GROUP_ONE)), "BADGE_TYPES: each type needs exactly one group flag");
+_Static_assert((0 BADGE_TYPES(BADGE_TYPE_NEXT_SUM)) == (1UL << BADGE_TYPE_COUNT) - 1, "BADGE_TYPES: next types must be a rotation of all types");
+_Static_assert(BADGE_TYPE_COUNT <= UINT8_MAX, "BADGE_TYPES: badge type must fit in a packet");
+
+// LED frames are in perceptual brightness, this is what the LP5569 PWM registers get
+const uint8_t led_gamma[LED_LEVEL_MAX + 1] = { LED_GAMMA64(0), LED_GAMMA64(64), LED_GAMMA64(128), LED_GAMMA64(192) };
+
+// TPM0 prescaler and MOD for each pitch_t (see PIEZO_TPM())
+#define PIEZO_PITCH_TPM(name)		PIEZO_TPM(NOTE_##name),
+
+const uint16_t piezo_tpm[PITCH_COUNT] = { 0, SHOW_PITCHES(PIEZO_PITCH_TPM) };
+_Static_assert(PITCH_COUNT <= PIEZO_QUIET, "SHOW_PITCHES: a pitch must leave the PIEZO_QUIET bit clear");
+
+// LEDs lit (bit 0 = LED 0) to show each letter
+const uint8_t state_leds[BADGE_STATE_COUNT] = { [D] = 0x38, [E] = 0x17, [F] = 0x0F, [C] = 0x07, [O] = 0x3F, [N] = 0x1B };
+
+// Number of bits set in a nibble
+const uint8_t popcount_lut[16] = { 0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4 };
+
+// The game: (state, event) -> (next state, actions)
+const game_transition_t dc27_transitions[BADGE_STATE_COUNT][EV_COUNT] =
+{
+	[ATTRACT] = {	// Cycle through D, E, F, C, O, N LED states until we hear from anyone
+		[EV_PACKET]		= { ATTRACT, ACT_PROCESS },
+		[EV_TIMER]		= { ATTRACT, ACT_DISPLAY },
+		[EV_PASS]		= { ATTRACT, ACT_DRAIN | ACT_TIMER },
+		[EV_CONTACT]	= { D, ACT_SKIP_FLAGS | ACT_DISPLAY | ACT_1UP | ACT_PRINT | ACT_FLASH | ACT_PERSIST },
+	},
+	[D] = {
+#ifdef __BADGE_MAGIC	// magic token stays in this state
+		[EV_PACKET]		= { D, ACT_PROCESS | ACT_ALL_ON | ACT_FLASH },
+		[EV_PASS]		= { D, ACT_DRAIN },
+#else
+		[EV_PACKET]		= { D, ACT_RECEIVE },
+		[EV_PASS]		= { D, ACT_DRAIN },
+		[EV_FLAG]		= { E, ACT_ADVANCE },
+#endif
+	},
+	[E] = {
+		[EV_PACKET]		= { E, ACT_RECEIVE },
+		[EV_PASS]		= { E, ACT_DRAIN },
+		[EV_FLAG]		= { F, ACT_ADVANCE },
+	},
+	[F] = {
+		[EV_PACKET]		= { F, ACT_RECEIVE },
+		[EV_PASS]		= { F, ACT_DRAIN },
+		[EV_FLAG]		= { C, ACT_ADVANCE },
+	},
+	[C] = {
+		[EV_PACKET]		= { C, ACT_RECEIVE },
+		[EV_PASS]		= { C, ACT_DRAIN },
+		[EV_FLAG]		= { O, ACT_ADVANCE },
+	},
+	[O] = {
+		[EV_PACKET]		= { O, ACT_RECEIVE },
+		[EV_PASS]		= { O, ACT_DRAIN },
+		[EV_FLAG]		= { N, ACT_ADVANCE | ACT_CLEAR_GROUP },
+	},
+	[N] = {	// Group chat (all 6 gemstone colors: Human/Contest/Artist/CFP/Uber + Goon + Speaker + Vendor + Press + Village)
+		[EV_PACKET]		= { N, ACT_RECEIVE },
+		[EV_PASS]		= { N, ACT_DRAIN },
+		[EV_GROUP]		= { COMPLETE, ACT_SET_FLAG_6 | ACT_BLANK | ACT_RICKROLL | ACT_PRINT | ACT_PERSIST | ACT_HOLD },
+	},
+	[COMPLETE] = {	// Sparkle mode
+		[EV_PASS]		= { COMPLETE, ACT_DRAIN | ACT_TIMER },
+		[EV_TIMER]		= { COMPLETE, ACT_DISPLAY },
+	},
+};
+
 const char menu_banner[] = "\n\r\
 T: Display transmit packet\n\r\
 R: Receive packet(s)\n\r\
 C: Clear game flags\n\r\
+L: LED driver statistics\n\r\
+D: Delay statistics (spin/wait/sleep)\n\r\
+B: Battery saver (dim LEDs) on/off\n\r\
+Q [uid]: Badges met, or what we know about one\n\r\
+E: Export badges met (CSV)\n\r\
 H: Display available commands\n\r\
 ^: System reset\n\r\
 Ctrl-X: Exit interactive mode\n\r\
@@ -474,6 +1016,8 @@ const char menu_banner_complete[] = "\n\r\
 A <string>: ASCII art generator\n\r\
 S <freq> <ms>: Tone generator\n\r\
 U <hex bytes>: Update transmit packet\n\r\
+G [n]: List shows, or play show n\n\r\
+P [hex bytes]: Upload a show, then save it\n\r\
 ";
 
 const char msg_welcome[]          = "\n\r\n\rWelcome to the DEFCON 27 Official Badge\n\r\n\r";
@@ -490,37 +1034,72 @@ grandideastudio.com/portfolio/defcon-27-badge/\n\r\n\r\
 
 // NES Super Mario Bros. 1-Up
 // Sheet music from http://www.mariopiano.com/mario-sheet-music-1-up-mushroom-sound.html
-const struct note tune_1up[] = {
-	{NOTE_E6, 125, 50}, {NOTE_G6, 125, 50}, {NOTE_E7, 125, 50}, {NOTE_C7, 125, 50},
-	{NOTE_D7, 125, 50}, {NOTE_G7, 125, 50}
+const uint8_t show_1up[] = {
+	SHOW_OP_NOTE(PITCH_E6, 125), SHOW_OP_WAIT(FX_1UP_GAP), SHOW_OP_NOTE(PITCH_G6, 125), SHOW_OP_WAIT(FX_1UP_GAP),
+	SHOW_OP_NOTE(PITCH_E7, 125), SHOW_OP_WAIT(FX_1UP_GAP), SHOW_OP_NOTE(PITCH_C7, 125), SHOW_OP_WAIT(FX_1UP_GAP),
+	SHOW_OP_NOTE(PITCH_D7, 125), SHOW_OP_WAIT(FX_1UP_GAP), SHOW_OP_NOTE(PITCH_G7, 125), SHOW_OP_WAIT(FX_1UP_GAP),
+	SHOW_OP_END
+};
+
+const uint8_t show_defcon[] = {	// spell D-E-F-C-O-N, then fade out, twice
+	SHOW_OP_LOOP(2),
+		SHOW_OP_SET(0x00, 0),
+		SHOW_OP_RAMP(0x01, 255, 51, 20), SHOW_OP_RAMP(0x03, 255, 51, 20), SHOW_OP_RAMP(0x07, 255, 51, 20),
+		SHOW_OP_RAMP(0x0F, 255, 51, 20), SHOW_OP_RAMP(0x1F, 255, 51, 20), SHOW_OP_RAMP(0x3F, 255, 51, 20),
+		SHOW_OP_WAIT(500),
+		SHOW_OP_RAMP(0x3F, 0, 15, 20),
+	SHOW_OP_NEXT,
+	SHOW_OP_END
 };
 
+const uint8_t show_sparkle[] = {	// random LEDs, faster and faster
+	SHOW_OP_LOOP(3),
+		SHOW_OP_LOOP(8),
+			SHOW_OP_RANDOM(FX_ALL_LEDS, 255), SHOW_OP_WAIT(120), SHOW_OP_SET(0x00, 0), SHOW_OP_WAIT(60),
+		SHOW_OP_NEXT,
+		SHOW_OP_LOOP(16),
+			SHOW_OP_RANDOM(FX_ALL_LEDS, 255), SHOW_OP_NOTE(PITCH_C7, 30), SHOW_OP_SET(0x00, 0), SHOW_OP_WAIT(30),
+		SHOW_OP_NEXT,
+	SHOW_OP_NEXT,
+	SHOW_OP_END
+};
+
+const show_info_t show_builtin[] = {	// played with 'G', followed by the show uploaded with 'P'
+	{ "1UP", show_1up },
+	{ "DEFCON", show_defcon },
+	{ "Sparkle", show_sparkle }
+};
+
+#define SHOW_BUILTIN_COUNT	(sizeof(show_builtin) / sizeof(show_builtin[0]))
+
+const uint8_t show_op_sizes[SHOW_OP_COUNT] = SHOW_OP_SIZES;
+
 // He Who Shall Not Be Named
 // Ported from https://create.arduino.cc/projecthub/slagestee/rickroll-box-3c2245
 /*const struct note tune_rickroll_intro[] = {
-	{NOTE_CS5, 600, 50}, {NOTE_DS5, 1000, 50}, {NOTE_DS5, 600, 50}, {NOTE_F5, 600, 50},
-	{NOTE_GS5, 100, 50}, {NOTE_FS5, 100, 50}, {NOTE_F5, 100, 50}, {NOTE_DS5, 100, 50},
-	{NOTE_CS5, 600, 50}, {NOTE_DS5, 1000, 50}, {NOTE_REST, 400, 50}, {NOTE_GS4, 200, 50},
-	{NOTE_GS4, 1000, 50}
+	TONE(CS5, 600), TONE(DS5, 1000), TONE(DS5, 600), TONE(F5, 600),
+	TONE(GS5, 100), TONE(FS5, 100), TONE(F5, 100), TONE(DS5, 100),
+	TONE(CS5, 600), TONE(DS5, 1000), TONE(REST, 400), TONE(GS4, 200),
+	TONE(GS4, 1000)
 };*/
 
 /*const struct note tune_rickroll_verse[] = {
-	{NOTE_REST, 400, 50}, {NOTE_CS4, 200, 50}, {NOTE_CS4, 200, 50}, {NOTE_CS4, 200, 50},
-	{NOTE_CS4, 200, 50}, {NOTE_DS4, 400, 50}, {NOTE_REST, 200, 50}, {NOTE_C4, 200, 50},
-	{NOTE_AS3, 200, 50}, {NOTE_GS3, 1000, 50}, {NOTE_REST, 200, 50}, {NOTE_AS3, 200, 50},
-	{NOTE_AS3, 200, 50}, {NOTE_C4, 200, 50}, {NOTE_CS4, 600, 50}, {NOTE_GS3, 200, 50},
-	{NOTE_GS4, 400, 50}, {NOTE_GS4, 200, 50}, {NOTE_DS4, 1000, 50}, {NOTE_REST, 200, 50},
-	{NOTE_AS3, 200, 50}, {NOTE_AS3, 200, 50}, {NOTE_C4, 200, 50}, {NOTE_CS4, 200, 50},
-	{NOTE_AS3, 200, 50}, {NOTE_CS4, 200, 50}, {NOTE_DS4, 400, 50}, {NOTE_REST, 200, 50},
-	{NOTE_C4, 200, 50}, {NOTE_AS3, 200, 50}, {NOTE_AS3, 200, 50}, {NOTE_GS3, 600, 50},
-	{NOTE_REST, 200, 50}, {NOTE_AS3, 200, 50}, {NOTE_AS3, 200, 50}, {NOTE_C4, 200, 50},
-	{NOTE_CS4, 400, 50}, {NOTE_GS3, 200, 50}, {NOTE_GS3, 200, 50}, {NOTE_DS4, 200, 50},
-	{NOTE_DS4, 200, 50}, {NOTE_DS4, 200, 50}, {NOTE_F4, 200, 50}, {NOTE_DS4, 800, 50},
-	{NOTE_CS4, 1000, 50}, {NOTE_DS4, 200, 50}, {NOTE_F4, 200, 50}, {NOTE_CS4, 200, 50},
-	{NOTE_DS4, 200, 50}, {NOTE_DS4, 200, 50}, {NOTE_DS4, 200, 50}, {NOTE_F4, 200, 50},
-	{NOTE_DS4, 400, 50}, {NOTE_GS3, 400, 50}, {NOTE_REST, 400, 50}, {NOTE_AS3, 200, 50},
-	{NOTE_C4, 200, 50}, {NOTE_CS4, 200, 50}, {NOTE_GS3, 600, 50}, {NOTE_REST, 200, 50},
-	{NOTE_DS4, 200, 50}, {NOTE_F4, 200, 50}, {NOTE_DS4, 600, 50}
+	TONE(REST, 400), TONE(CS4, 200), TONE(CS4, 200), TONE(CS4, 200),
+	TONE(CS4, 200), TONE(DS4, 400), TONE(REST, 200), TONE(C4, 200),
+	TONE(AS3, 200), TONE(GS3, 1000), TONE(REST, 200), TONE(AS3, 200),
+	TONE(AS3, 200), TONE(C4, 200), TONE(CS4, 600), TONE(GS3, 200),
+	TONE(GS4, 400), TONE(GS4, 200), TONE(DS4, 1000), TONE(REST, 200),
+	TONE(AS3, 200), TONE(AS3, 200), TONE(C4, 200), TONE(CS4, 200),
+	TONE(AS3, 200), TONE(CS4, 200), TONE(DS4, 400), TONE(REST, 200),
+	TONE(C4, 200), TONE(AS3, 200), TONE(AS3, 200), TONE(GS3, 600),
+	TONE(REST, 200), TONE(AS3, 200), TONE(AS3, 200), TONE(C4, 200),
+	TONE(CS4, 400), TONE(GS3, 200), TONE(GS3, 200), TONE(DS4, 200),
+	TONE(DS4, 200), TONE(DS4, 200), TONE(F4, 200), TONE(DS4, 800),
+	TONE(CS4, 1000), TONE(DS4, 200), TONE(F4, 200), TONE(CS4, 200),
+	TONE(DS4, 200), TONE(DS4, 200), TONE(DS4, 200), TONE(F4, 200),
+	TONE(DS4, 400), TONE(GS3, 400), TONE(REST, 400), TONE(AS3, 200),
+	TONE(C4, 200), TONE(CS4, 200), TONE(GS3, 600), TONE(REST, 200),
+	TONE(DS4, 200), TONE(F4, 200), TONE(DS4, 600)
 };
 
 const char* tune_rickroll_verse_lyrics[] = {
@@ -533,21 +1112,21 @@ const char* tune_rickroll_verse_lyrics[] = {
 };*/
 
 const struct note tune_rickroll_chorus[] = {
-	{NOTE_AS4, 100, 50}, {NOTE_AS4, 100, 50}, {NOTE_GS4, 100, 50}, {NOTE_GS4, 100, 50},
-	{NOTE_F5, 300, 50}, {NOTE_F5, 300, 50}, {NOTE_DS5, 600, 50}, {NOTE_AS4, 100, 50},
-	{NOTE_AS4, 100, 50}, {NOTE_GS4, 100, 50}, {NOTE_GS4, 100, 50}, {NOTE_DS5, 300, 50},
-	{NOTE_DS5, 300, 50}, {NOTE_CS5, 300, 50}, {NOTE_C5, 100, 50}, {NOTE_AS4, 200, 50},
-	{NOTE_CS5, 100, 50}, {NOTE_CS5, 100, 50}, {NOTE_CS5, 100, 50}, {NOTE_CS5, 100, 50},
-	{NOTE_CS5, 300, 50}, {NOTE_DS5, 300, 50}, {NOTE_C5, 300, 50}, {NOTE_AS4, 100, 50},
-	{NOTE_GS4, 200, 50}, {NOTE_GS4, 200, 50}, {NOTE_GS4, 200, 50}, {NOTE_DS5, 400, 50},
-	{NOTE_CS5, 800, 50}, {NOTE_AS4, 100, 50}, {NOTE_AS4, 100, 50}, {NOTE_GS4, 100, 50},
-	{NOTE_GS4, 100, 50}, {NOTE_F5, 300, 50}, {NOTE_F5, 300, 50}, {NOTE_DS5, 600, 50},
-	{NOTE_AS4, 100, 50}, {NOTE_AS4, 100, 50}, {NOTE_GS4, 100, 50}, {NOTE_GS4, 100, 50},
-	{NOTE_GS5, 300, 50}, {NOTE_C5, 300, 50}, {NOTE_CS5, 300, 50}, {NOTE_C5, 100, 50},
-	{NOTE_AS4, 200, 50}, {NOTE_CS5, 100, 50}, {NOTE_CS5, 100, 50}, {NOTE_CS5, 100, 50},
-	{NOTE_CS5, 100, 50}, {NOTE_CS5, 300, 50}, {NOTE_DS5, 300, 50}, {NOTE_C5, 300, 50},
-	{NOTE_AS4, 100, 50}, {NOTE_GS4, 200, 50}, {NOTE_REST, 200, 50}, {NOTE_GS4, 200, 50},
-	{NOTE_DS5, 400, 50}, {NOTE_CS5, 800, 50}, {NOTE_REST, 400, 50}
+	TONE(AS4, 100), TONE(AS4, 100), TONE(GS4, 100), TONE(GS4, 100),
+	TONE(F5, 300), TONE(F5, 300), TONE(DS5, 600), TONE(AS4, 100),
+	TONE(AS4, 100), TONE(GS4, 100), TONE(GS4, 100), TONE(DS5, 300),
+	TONE(DS5, 300), TONE(CS5, 300), TONE(C5, 100), TONE(AS4, 200),
+	TONE(CS5, 100), TONE(CS5, 100), TONE(CS5, 100), TONE(CS5, 100),
+	TONE(CS5, 300), TONE(DS5, 300), TONE(C5, 300), TONE(AS4, 100),
+	TONE(GS4, 200), TONE(GS4, 200), TONE(GS4, 200), TONE(DS5, 400),
+	TONE(CS5, 800), TONE(AS4, 100), TONE(AS4, 100), TONE(GS4, 100),
+	TONE(GS4, 100), TONE(F5, 300), TONE(F5, 300), TONE(DS5, 600),
+	TONE(AS4, 100), TONE(AS4, 100), TONE(GS4, 100), TONE(GS4, 100),
+	TONE(GS5, 300), TONE(C5, 300), TONE(CS5, 300), TONE(C5, 100),
+	TONE(AS4, 200), TONE(CS5, 100), TONE(CS5, 100), TONE(CS5, 100),
+	TONE(CS5, 100), TONE(CS5, 300), TONE(DS5, 300), TONE(C5, 300),
+	TONE(AS4, 100), TONE(GS4, 200), TONE(REST, 200), TONE(GS4, 200),
+	TONE(DS5, 400), TONE(CS5, 800), TONE(REST, 400)
 };
 
 const char* tune_rickroll_chorus_lyrics[] = {
@@ -608,35 +1187,97 @@ const char ART_DATA[] = {                                       \
 // Badge
 void DC27_GameInit(void);
 void DC27_UpdateState(void);
+void DC27_Transition(const game_transition_t *);
+bool DC27_EventFired(game_event_t);
+const badge_info_t *DC27_BadgeInfo(uint8_t);
 void DC27_UpdateDisplay(void);
+void DC27_FlashDisplay(void);
+void DC27_SaveState(void);
+void DC27_MarkDirty(void);
+void DC27_Flush(bool);
 void DC27_UpdateFlags(bool);
 int DC27_IncrementFlag(void);
 void DC27_PrintBadgeType(badge_type_t);
 void DC27_PrintState(void);
 void DC27_PrintPacket(struct packet_of_infamy);
 void DC27_ProcessPacket(void);
-void DC27_InteractiveMode(void);
+void DC27_ConsoleStart(bool);
+void DC27_ConsoleStop(void);
+void DC27_ConsoleInput(uint8_t);
+void DC27_ConsoleCommand(uint8_t *, uint32_t);
+uint32_t DC27_ConsoleReceive(void);
+void DC27_CmdTransmit(uint8_t *, uint32_t);
+void DC27_CmdReceive(uint8_t *, uint32_t);
+void DC27_CmdClear(uint8_t *, uint32_t);
+void DC27_ConfirmClear(uint8_t *, uint32_t);
+void DC27_CmdReset(uint8_t *, uint32_t);
+void DC27_CmdArt(uint8_t *, uint32_t);
+void DC27_CmdTone(uint8_t *, uint32_t);
+void DC27_CmdUpdate(uint8_t *, uint32_t);
+void DC27_ConfirmUpdate(uint8_t *, uint32_t);
+void DC27_CmdShow(uint8_t *, uint32_t);
+void DC27_CmdProgram(uint8_t *, uint32_t);
+void DC27_ConfirmProgram(uint8_t *, uint32_t);
+const uint8_t *DC27_Show(uint8_t);
+int DC27_HexDigit(uint8_t);
+void DC27_CmdLED(uint8_t *, uint32_t);
+void DC27_CmdDelay(uint8_t *, uint32_t);
+void DC27_CmdBattery(uint8_t *, uint32_t);
+void DC27_CmdPeers(uint8_t *, uint32_t);
+void DC27_CmdExport(uint8_t *, uint32_t);
+void DC27_CmdHelp(uint8_t *, uint32_t);
 void DC27_ASCIIArt(uint8_t *);
 void DC27_MagicPacket(void);
+void DC27_TaskRadio(kl_event_t);
+void DC27_TaskGame(kl_event_t);
+void DC27_TaskLED(kl_event_t);
+void DC27_TaskConsole(kl_event_t);
+void DC27_TaskSave(kl_event_t);
 // I2C
 bool I2C_ReadRegister(I2C_Type *, uint8_t, uint8_t, uint8_t *, uint32_t);
 bool I2C_WriteRegister(I2C_Type *, uint8_t , uint8_t , uint8_t);
+bool I2C_WriteRegisters(I2C_Type *, uint8_t, uint8_t, const uint8_t *, uint32_t);
 bool I2C_ReadBulk(I2C_Type *, uint8_t, uint8_t *, uint32_t);
 bool I2C_WriteBulk(I2C_Type *, uint8_t , uint8_t *, uint32_t);
 void I2C_ReleaseBus(void);
 
 // LED Driver
 int KL_Setup_LP5569(void);
-void LP5569_SetLED(unsigned char, unsigned char);
-void LP5569_SetLED_AllOn(void);
-void LP5569_SetLED_AllOff(void);
-void LP5569_SetLED_D(unsigned char);
-void LP5569_SetLED_E(unsigned char);
-void LP5569_SetLED_F(unsigned char);
-void LP5569_SetLED_C(unsigned char);
-void LP5569_SetLED_O(unsigned char);
-void LP5569_SetLED_N(unsigned char);
-void LP5569_RampLED(badge_state_t);
+int LP5569_SetFrame(const uint8_t *, uint8_t, uint8_t);
+int LP5569_Write(uint8_t, const uint8_t *, uint8_t);
+int LP5569_WriteRegister(uint8_t, uint8_t);
+void LP5569_Invalidate(uint8_t, uint8_t);
+void LP5569_Shadow_Reset(void);
+uint8_t LP5569_Asm(lp5569_asm_t *, uint16_t);
+void LP5569_Asm_Ramp(lp5569_asm_t *, int, uint32_t);
+void LP5569_Asm_Fade(lp5569_asm_t *, bool, uint32_t);
+void LP5569_Asm_Wait(lp5569_asm_t *, uint32_t);
+uint8_t LP5569_Asm_Table(lp5569_asm_t *, const uint8_t *, uint8_t);
+int LP5569_Engine_Load(void);
+int LP5569_Engine_Run(uint8_t);
+
+// Effects
+void FX_Begin(fx_priority_t);
+void FX_Add(const fx_step_t *);
+void FX_End(void);
+void FX_Stop(void);
+void FX_Engine(uint8_t);
+void FX_Wait(void);
+bool FX_Busy(void);
+void FX_Tick(void);
+void FX_Draw(const fx_step_t *);
+uint16_t FX_Show(const fx_step_t *);
+int FX_ShowCheck(const uint8_t *, uint32_t);
+void FX_Service(void);
+
+// LED framebuffer
+void LED_Fill(uint8_t, uint16_t, uint16_t, uint8_t);
+void LED_Set(uint8_t, uint8_t, uint8_t);
+void LED_Update(void);
+void LED_Tick(void);
+void LED_SetBrightness(uint8_t);
+bool LED_Busy(void);
+uint16_t LED_Compose(const led_layer_t *, uint8_t, uint8_t *);
 
 // NFMI Radio
 int KL_Setup_NXH2261(void);
@@ -648,22 +1289,68 @@ void KL_Reset_NXH2261(void);
 
 // Piezo/PWM
 void KL_Piezo(uint32_t, uint32_t, uint8_t);
+void KL_Piezo_Tone(uint32_t, uint8_t);
+void KL_Piezo_Settings(uint32_t, uint8_t, uint8_t *, uint16_t *, uint16_t *);
+void KL_Piezo_Note(uint8_t);
+void KL_Piezo_Start(uint8_t, uint16_t, uint16_t);
 void KL_Piezo_1Up(void);
 void KL_Piezo_RickRoll(void);
 
 // Utilities
 unsigned char Get_Random_Byte(void);
+uint16_t Get_CRC16(const void *, uint32_t);
 void Print_Bits(uint8_t);
 void Reorder_Array(uint8_t *, uint8_t *, uint8_t);
 void SysTick_DelayTicks(uint32_t);
+#ifdef __NXH_RECORD
+void KL_Record(uint8_t, uint8_t);
+void KL_Record_Flush(void);
+#endif
 
 int KL_Flash_Init(void);
-int KL_Flash_Write(uint32_t);
-void KL_Flash_Read(uint32_t *);
+uint32_t KL_Flash_Sector(uint32_t);
+void KL_Flash_Begin(void);
+void KL_Flash_End(void);
+int KL_Flash_Erase(uint32_t);
+int KL_Flash_Program(uint32_t, const uint32_t *, uint32_t);
+void KL_Flash_Find(void);
+int KL_Flash_Write(nvm_record_t *);
+int KL_Flash_Read(nvm_record_t *);
 bool KL_Check_RX(void);
 void KL_Sleep(void);
+void KL_Wait(void);
+void KL_Post(kl_event_t);
+bool KL_Dispatch(void);
+void KL_Idle(void);
+void KL_StartTimer(uint32_t);
+void KL_Timer_Charge(void);
+void KL_Timer_Start(void);
+void KL_Timer_Set(kl_timer_t, uint32_t);
+uint32_t KL_Timer_Stop(kl_timer_t);
+bool KL_CanSleep(void);
+uint32_t KL_Time(void);
 void KL_Error(bool, bool);
 
+// Peer database
+const peer_record_t *PEER_Record(uint32_t);
+uint32_t PEER_Probe(uint32_t);
+void PEER_Init(void);
+void PEER_Index(uint32_t);
+int PEER_Open(void);
+int PEER_Reclaim(uint32_t);
+int PEER_Append(const peer_record_t *);
+void PEER_See(const struct packet_of_infamy *);
+uint32_t PEER_Time(void);
+void PEER_Flush(bool);
+int PEER_Get(uint32_t, peer_record_t *);
+uint32_t HLL_Register(const uint8_t *, uint32_t);
+void HLL_Add(uint8_t *, uint32_t);
+uint32_t HLL_Estimate(const uint8_t *);
+uint32_t HLL_Log2(uint32_t);
+void HLL_Load(void);
+int HLL_Save(void);
+int HLL_Snapshot(void);
+
 
 /****************************************************************************
  ************************** Functions ***************************************
@@ -674,8 +1361,6 @@ void KL_Error(bool, bool);
  */
 int main(void)
 {
-    static int b = 1;
-
   	// Initialize board hardware
 	BOARD_InitBootPins();
     BOARD_InitBootClocks();
@@ -683,6 +1368,8 @@ int main(void)
 
     // Initialize host console
 	DbgConsole_Init(UART2_BASE, UART2_config.baudRate_Bps, DEBUG_CONSOLE_DEVICE_TYPE_UART, UART2_CLOCK_SOURCE);
+	UART_EnableInterrupts(UART2_PERIPHERAL, kUART_RxDataRegFullInterruptEnable);	// characters from the host go to the console task
+	EnableIRQ(UART2_SERIAL_RX_TX_IRQN);
 
 	// Disable LPUART interrupts during power-up to avoid receiving data before we're ready
 	DisableIRQ(LPUART0_SERIAL_RX_TX_IRQN);
@@ -691,6 +1378,7 @@ int main(void)
     SMC_SetPowerModeProtection(SMC, kSMC_AllowPowerModeAll);	// Configure power mode protection settings
     CLOCK_SetClkOutClock(0); 					// Disable CLKOUT on power-up (used for NXH2261 calibration only)
 	SysTick_Config(SystemCoreClock / 1000U); 	// Set systick reload value to generate 1ms interrupt (for delay)
+	KL_Timer_Start();							// LPTMR0 keeps time from here on (KL_Time())
 	SysTick_DelayTicks(1000);					// Start-up delay
 	I2C_ReleaseBus();
 
@@ -711,68 +1399,19 @@ int main(void)
     if (KL_Flash_Init())
     	PRINTF("...Error!\n\r");
 
+    PRINTF("[*] Badges Met = ");
+    PEER_Init();
+    HLL_Load();
+    PRINTF("%u (~%u Ever)\n\r", peerCount, HLL_Estimate(hllState.met));
+
     // Display badge type and configure default badge-specific parameters
     // Different LED colors have different Vf, which affects brightness
     // We want all LEDs to visually appear at the same brightness regardless of color
     PRINTF("[*] Badge Type = ");
     DC27_PrintBadgeType(badge_type);
-    switch(badge_type)
-    {
-    	case HUMAN:
-    		LP5569_Control = LED_CONTROL_WHITE;  // Control Register
-    		LP5569_Current = LED_CURRENT_WHITE;  // Current Control
-    		LP5569_PWM = LED_PWM_WHITE;  		 // PWM Duty Cycle
-    		break;
-    	case GOON:
-    		LP5569_Control = LED_CONTROL_RED;
-    		LP5569_Current = LED_CURRENT_RED;
-    		LP5569_PWM = LED_PWM_RED;
-    		break;
-    	case SPEAKER:
-    		LP5569_Control = LED_CONTROL_BLUE;
-    		LP5569_Current = LED_CURRENT_BLUE;
-    		LP5569_PWM = LED_PWM_BLUE;
-    		break;
-    	case VENDOR:
-    		LP5569_Control = LED_CONTROL_PURPLE;
-    		LP5569_Current = LED_CURRENT_PURPLE;
-    		LP5569_PWM = LED_PWM_PURPLE;
-    		break;
-    	case PRESS:
-    		LP5569_Control = LED_CONTROL_GREEN;
-    		LP5569_Current = LED_CURRENT_GREEN;
-    		LP5569_PWM = LED_PWM_GREEN;
-    		break;
-    	case VILLAGE:
-    		LP5569_Control = LED_CONTROL_ORANGE;
-    		LP5569_Current = LED_CURRENT_ORANGE;
-    		LP5569_PWM = LED_PWM_ORANGE;
-    		break;
-    	case CONTEST:
-    		LP5569_Control = LED_CONTROL_WHITE;
-    		LP5569_Current = LED_CURRENT_WHITE;
-    		LP5569_PWM = LED_PWM_WHITE;
-    		break;
-    	case ARTIST:
-    		LP5569_Control = LED_CONTROL_WHITE;
-    		LP5569_Current = LED_CURRENT_WHITE;
-    		LP5569_PWM = LED_PWM_WHITE;
-    		break;
-    	case CFP:
-    		LP5569_Control = LED_CONTROL_WHITE;
-    		LP5569_Current = LED_CURRENT_WHITE;
-    		LP5569_PWM = LED_PWM_WHITE;
-    		break;
-    	case UBER:
-    		LP5569_Control = LED_CONTROL_WHITE;
-    		LP5569_Current = LED_CURRENT_WHITE;
-    		LP5569_PWM = LED_PWM_WHITE;
-    		break;
-    	default:
-    		LP5569_Control = LED_CONTROL_WHITE;
-    		LP5569_Current = LED_CURRENT_WHITE;
-    		LP5569_PWM = LED_PWM_WHITE;
-    }
+    LP5569_Control = DC27_BadgeInfo(badge_type)->control;  // Control Register
+    LP5569_Current = DC27_BadgeInfo(badge_type)->current;  // Current Control
+    LP5569_PWM = DC27_BadgeInfo(badge_type)->pwm;  		   // Full brightness
 
 	DC27_GameInit();
 
@@ -784,14 +1423,18 @@ int main(void)
 #endif
 
     PRINTF("[*] Testing Piezo...");
+    FX_Begin(FX_EVENT);
     KL_Piezo_1Up();
+    FX_End();
+    FX_Wait();
 	PRINTF("Done!\n\r");
     SysTick_DelayTicks(250);
 
     PRINTF("[*] Configuring LED Driver...");
     if (!KL_Setup_LP5569())
     {
-    	LP5569_SetLED_AllOn();
+    	LED_Fill(LED_LAYER_STATE, LED_ALL_CHANNELS, FX_ALL_LEDS, LED_LEVEL_MAX);
+    	LED_Update();
         PRINTF("Done!\n\r");
     }
     else
@@ -835,64 +1478,31 @@ int main(void)
     		PRINTF(msg_nfmi_packet_err);
     }
 
-	g_oldRx = KL_Check_RX();  // set current state of KL_RX (if USB-to-serial adapter is connected)
-
-	LP5569_SetLED(0, 0); // Update start-up progress via LEDs
-	LP5569_SetLED(5, 0);
+	LED_Set(LED_LAYER_STATE, 0, 0); // Update start-up progress via LEDs
+	LED_Set(LED_LAYER_STATE, 5, 0);
+	LED_Update();
 
 	PRINTF(msg_init_complete);
 
-	if (badge_state == COMPLETE)  // if the quest is done, play a friendly tune
+	if (badge_state == COMPLETE)  // if the quest is done, play a friendly tune (in the background)
 	{
-		SysTick_DelayTicks(100);
 		PRINTF("\n\r");
+		FX_Begin(FX_EVENT);
+		FX_Add(&(fx_step_t){ .flags = FX_KEEP, .hold = 100 });
 		KL_Piezo_RickRoll();
-		SysTick_DelayTicks(500);
+		FX_Add(&(fx_step_t){ .flags = FX_KEEP, .hold = 500 });
+		FX_End();
 	}
 
+	KL_Post(KL_EVENT_ATTACH);	// check for a USB-to-serial adapter
+	KL_Post(KL_EVENT_IDLE);		// first pass of the game
+
+	// Run-to-completion: one task per event, in the order they were posted
+	// Sleep whenever there is nothing to do, the ISRs post events to wake us up
 	while(1)
     {
-
-		g_newRx = KL_Check_RX();
-    	if (g_newRx && (!g_oldRx || b))	// if USB-to-Serial adapter has been plugged in, KL_RX pin will go HIGH
-    	{
-    		PRINTF("[*] USB-to-Serial Adapter Detected\n\r");
-    		if (!b) GETCHAR(); // if adapter is plugged in while the system is already active, drop first character
-    		DC27_InteractiveMode();
-    		b = 0; // if we're here for the first time after power-up
-    	}
-    	g_oldRx = g_newRx;
-
-    	if (badge_state != COMPLETE) // do this if all badge tasks have not been completed
-    	{
-        	// enter VLPS (Very Low Power Sleep)
-        	// MCU will wake up on NXH_DETECT external interrupt (when NXH successfully receives a data packet)
-    		// or if USB-to-serial adapter is connected
-        	PRINTF("[*] Sleeping...");
-        	DbgConsole_Flush();	// wait for TX buffer to empty
-        	PORT_SetPinInterruptConfig(BOARD_INITPINS_KL_RX_PORT, BOARD_INITPINS_KL_RX_PIN, kPORT_InterruptRisingEdge);
-        	LPTMR_SetTimerPeriod(LPTMR0_PERIPHERAL, LPTMR0_TICKS);	// Set time to sleep between LED update/heartbeat
-
-        	KL_Sleep();
-
-            PRINTF("Awake!\n\r");
-    	}
-
-    	if (g_lptmrFlag && badge_state != COMPLETE) 	// we must have woken up from the timer
-    	{
-    		if (badge_state == ATTRACT)
-    			DC27_UpdateDisplay();
-
-        	g_lptmrFlag = false;
-    	}
-
-    	// QUESTION: Should I be changing it in UpdateState? or in DisableIRQ?
-
-    	// Check badge state and update if needed
-    	DisableIRQ(LPUART0_SERIAL_RX_TX_IRQN);
-    	DC27_UpdateState();
-    	DC27_MagicPacket();
-        EnableIRQ(LPUART0_SERIAL_RX_TX_IRQN);
+		if (!KL_Dispatch())
+			KL_Idle();
     }
 
     return 0; // We should never reach here
@@ -902,7 +1512,7 @@ int main(void)
 
 void DC27_GameInit(void)	// Initialize DC27 badge game-related items
 {
-	uint32_t data;
+	nvm_record_t state;
 
 #ifdef __BADGE_MAGIC	// for magic token, skip attract mode to save battery
 	badge_state = COMPLETE;
@@ -910,7 +1520,6 @@ void DC27_GameInit(void)	// Initialize DC27 badge game-related items
 #else
 	badge_state = COMPLETE;
 	//badge_state = ATTRACT;
-	attract_state = D; // used for cycling through LED states during attract mode
 #endif
 
 	// Configure game flags (for development/debugging purposes)
@@ -919,21 +1528,16 @@ void DC27_GameInit(void)	// Initialize DC27 badge game-related items
 	//game_flags = FLAG_ALL_MASK; 	// Set all
 	//DC27_UpdateFlags(false);
 
-#ifdef __BADGE_MAGIC	// reset game flags, since they're not being used
-	game_flags = 0;
-	DC27_UpdateFlags(false);
-#endif
-
 	// read game flags from non-volatile Flash (persists between power cycles)
-    KL_Flash_Read(&data);
-    if (data == 0xFFFFFFFF)		// on first use/power-up of the badge, the flash area will be uninitialized
+    if (KL_Flash_Read(&state))	// on first use/power-up of the badge, the flash area will be uninitialized
     {
     	game_flags = 0;				// clear flags
-    	DC27_UpdateFlags(false);	// write back to flash
+    	DC27_UpdateFlags(false);	// written back to flash once the badge settles
     }
     else
     {
-    	game_flags = (uint8_t)data;
+    	ledBrightness = state.brightness;	// applied once the LED driver is set up
+    	game_flags = state.flags;
     	if ((game_flags & FLAG_ALL_MASK) == FLAG_ALL_MASK)	 // if quest is complete...
     	{
     		badge_state = COMPLETE;			// go straight to sparkle mode
@@ -944,6 +1548,11 @@ void DC27_GameInit(void)	// Initialize DC27 badge game-related items
     	}
     }
 
+#ifdef __BADGE_MAGIC	// reset game flags, since they're not being used
+	game_flags = 0;
+	DC27_UpdateFlags(false);
+#endif
+
 	DC27_PrintState();
 }
 
@@ -951,582 +1560,302 @@ void DC27_GameInit(void)	// Initialize DC27 badge game-related items
 
 void DC27_UpdateState(void)
 {
-    static int i, j;
-	uint8_t ch;
+	const game_transition_t *row = dc27_transitions[(badge_state < BADGE_STATE_COUNT) ? badge_state : ATTRACT];
+	game_event_t ev;
 
-	switch (badge_state)
+	if (row[EV_PACKET].actions && !KL_GetPacket_NXH2261(&nxhRxPacket)) // if we have packet(s) in the receive buffer
 	{
-		default:
-	    case ATTRACT: // Attract mode: Cycle through D, E, F, C, O, N LED states
-	    	if (g_nxhDetect && !KL_GetPacket_NXH2261(&nxhRxPacket)) // if we have packet(s) in the receive buffer
-    		{
-				DC27_ProcessPacket();	// process the first one
-    		}
-	    	while (!KL_GetPacket_NXH2261(&nxhRxPacket)){}; // clear the rest
-	    	g_nxhDetect = false;
-
-	    	if ((game_flags & FLAG_0_MASK) == 1) // Communication with anyone
-	        {
-	        	// set badge state accordingly based on game flags settings
-	        	// flags 1-5 can happen in any order, so badge state is determined
-	        	// by how many bits have been set so far
-            	ch = 0;
-            	j = game_flags >> 1;
-            	for (i = 0; i < 5; ++i)
-            	{
-            		ch += (j & 0x01);
-            		j >>= 1;
-            	}
-
-            	switch (ch)
-				{
-					case 0:
-						badge_state = D;
-						break;
-					case 1:
-						badge_state = E;
-						break;
-					case 2:
-						badge_state = F;
-						break;
-					case 3:
-						badge_state = C;
-						break;
-					case 4:
-						badge_state = O;
-						break;
-					case 5:
-						badge_state = N;
-						break;
-				}
-
-    			DC27_UpdateDisplay();
-    			KL_Piezo_1Up();
-            	DC27_PrintState();
-        		SysTick_DelayTicks(500);
-        		LP5569_SetLED_AllOff();
-	   			DC27_UpdateFlags(true);
-	        }
-	        break;
-
-	   	case D:
-	    	if (g_nxhDetect && !KL_GetPacket_NXH2261(&nxhRxPacket)) // if we have packet(s) in the receive buffer
-    		{
-				DC27_ProcessPacket();	// process the first one
-#ifdef __BADGE_MAGIC
-				LP5569_SetLED_AllOn();
-#else
-				DC27_UpdateDisplay();
-#endif
-				SysTick_DelayTicks(500);
-				LP5569_SetLED_AllOff();
-    		}
-	    	while (!KL_GetPacket_NXH2261(&nxhRxPacket)){}; // clear the rest
-	    	g_nxhDetect = false;
-
-#ifndef __BADGE_MAGIC  // magic token stays in this state
-	    	if (nxhRxPacket.magic == true) // if we've received data from a magic token
-	    	{
-		   		if (DC27_IncrementFlag())   // if we've received a flag we don't already have, move to the next state
-		   		{
-					SysTick_DelayTicks(500);
-			   		badge_state = E;
-	    			DC27_UpdateDisplay();
-	    			KL_Piezo_1Up();
-	            	DC27_PrintState();
-	        		SysTick_DelayTicks(500);
-	        		LP5569_SetLED_AllOff();
-		   			DC27_UpdateFlags(true);
-		   		}
-	    	}
-#endif
-	   		break;
-
-	   	case E:
-	    	if (g_nxhDetect && !KL_GetPacket_NXH2261(&nxhRxPacket)) // if we have packet(s) in the receive buffer
-    		{
-				DC27_ProcessPacket();	// process the first one
-				DC27_UpdateDisplay();
-				SysTick_DelayTicks(500);
-				LP5569_SetLED_AllOff();
-    		}
-	    	while (!KL_GetPacket_NXH2261(&nxhRxPacket)){}; // clear the rest
-	    	g_nxhDetect = false;
-
-	    	if (nxhRxPacket.magic == true) // if we've received data from a magic token
-	    	{
-		   		if (DC27_IncrementFlag())   // if we've received a flag we don't already have, move to the next state
-		   		{
-					SysTick_DelayTicks(500);
-			   		badge_state = F;
-	    			DC27_UpdateDisplay();
-	    			KL_Piezo_1Up();
-	            	DC27_PrintState();
-	        		SysTick_DelayTicks(500);
-	        		LP5569_SetLED_AllOff();
-		   			DC27_UpdateFlags(true);
-		   		}
-	    	}
-	        break;
-
-       	case F:
-	    	if (g_nxhDetect && !KL_GetPacket_NXH2261(&nxhRxPacket)) // if we have packet(s) in the receive buffer
-    		{
-				DC27_ProcessPacket();	// process the first one
-				DC27_UpdateDisplay();
-				SysTick_DelayTicks(500);
-				LP5569_SetLED_AllOff();
-    		}
-	    	while (!KL_GetPacket_NXH2261(&nxhRxPacket)){}; // clear the rest
-	    	g_nxhDetect = false;
-
-	    	if (nxhRxPacket.magic == true) // if we've received data from a magic token
-	    	{
-		   		if (DC27_IncrementFlag())   // if we've received a flag we don't already have, move to the next state
-		   		{
-					SysTick_DelayTicks(500);
-			   		badge_state = C;
-	    			DC27_UpdateDisplay();
-	    			KL_Piezo_1Up();
-	            	DC27_PrintState();
-	        		SysTick_DelayTicks(500);
-	        		LP5569_SetLED_AllOff();
-		   			DC27_UpdateFlags(true);
-		   		}
-	    	}
-       		break;
-
-       	case C:
-	    	if (g_nxhDetect && !KL_GetPacket_NXH2261(&nxhRxPacket)) // if we have packet(s) in the receive buffer
-    		{
-				DC27_ProcessPacket();	// process the first one
-				DC27_UpdateDisplay();
-				SysTick_DelayTicks(500);
-				LP5569_SetLED_AllOff();
-    		}
-	    	while (!KL_GetPacket_NXH2261(&nxhRxPacket)){}; // clear the rest
-	    	g_nxhDetect = false;
-
-	    	if (nxhRxPacket.magic == true) // if we've received data from a magic token
-	    	{
-		   		if (DC27_IncrementFlag())   // if we've received a flag we don't already have, move to the next state
-		   		{
-					SysTick_DelayTicks(500);
-			   		badge_state = O;
-	    			DC27_UpdateDisplay();
-	    			KL_Piezo_1Up();
-	            	DC27_PrintState();
-	        		SysTick_DelayTicks(500);
-	        		LP5569_SetLED_AllOff();
-		   			DC27_UpdateFlags(true);
-		   		}
-	    	}
-       		break;
-
-       	case O:
-	    	if (g_nxhDetect && !KL_GetPacket_NXH2261(&nxhRxPacket)) // if we have packet(s) in the receive buffer
-    		{
-				DC27_ProcessPacket();	// process the first one
-				DC27_UpdateDisplay();
-				SysTick_DelayTicks(500);
-				LP5569_SetLED_AllOff();
-    		}
-	    	while (!KL_GetPacket_NXH2261(&nxhRxPacket)){}; // clear the rest
-	    	g_nxhDetect = false;
-
-	    	if (nxhRxPacket.magic == true) // if we've received data from a magic token
-	    	{
-		   		if (DC27_IncrementFlag())   // if we've received a flag we don't already have, move to the next state
-		   		{
-					SysTick_DelayTicks(500);
-			   		badge_state = N;
-	    			DC27_UpdateDisplay();
-	    			KL_Piezo_1Up();
-	            	DC27_PrintState();
-	        		SysTick_DelayTicks(500);
-	        		LP5569_SetLED_AllOff();
-		   			DC27_UpdateFlags(true);
-		       		group_flags = 0;
-		   		}
-	    	}
-       		break;
-
-       	case N: // Group chat (all 6 gemstone colors: Human/Contest/Artist/CFP/Uber + Goon + Speaker + Vendor + Press + Village)
-	    	if (g_nxhDetect && !KL_GetPacket_NXH2261(&nxhRxPacket)) // if we have packet(s) in the receive buffer
-    		{
-				DC27_ProcessPacket();	// process the first one
-				DC27_UpdateDisplay();
-				SysTick_DelayTicks(500);
-				LP5569_SetLED_AllOff();
-    		}
-	    	while (!KL_GetPacket_NXH2261(&nxhRxPacket)){}; // clear the rest
-	    	g_nxhDetect = false;
-
-			switch (nxhRxPacket.type)
-			{
-				case HUMAN:
-				case CONTEST:
-				case ARTIST:
-				case CFP:
-				case UBER:
-					group_flags |= FLAG_0_MASK;
-					break;
-				case GOON:
-					group_flags |= FLAG_1_MASK;
-					break;
-				case SPEAKER:
-					group_flags |= FLAG_2_MASK;
-					break;
-				case VENDOR:
-					group_flags |= FLAG_3_MASK;
-					break;
-				case PRESS:
-					group_flags |= FLAG_4_MASK;
-					break;
-				case VILLAGE:
-					group_flags |= FLAG_5_MASK;
-					break;
-			}
+		DC27_Transition(&row[EV_PACKET]);	// process the first one
+	}
 
-       		// win!
-	    	if ((group_flags & GROUP_ALL_MASK) == GROUP_ALL_MASK)
-	    	{
-				game_flags |= FLAG_6_MASK;
-				badge_state = COMPLETE;
-				LP5569_SetLED_AllOff();
-				SysTick_DelayTicks(500);
-				KL_Piezo_RickRoll();
-				DC27_PrintState();
-				DC27_UpdateFlags(true);
-				SysTick_DelayTicks(1500);
-	    	}
-    		break;
+	DC27_Transition(&row[EV_PASS]);
 
-   	    case COMPLETE: // Sparkle mode
-   	    	DC27_UpdateDisplay();
-   	    	LPTMR_SetTimerPeriod(LPTMR0_PERIPHERAL, LED_SPARKLE_WAIT_DELAY);	// Set time to sleep between LED updates
-	    	while (!KL_GetPacket_NXH2261(&nxhRxPacket)){}; // clear any packets from buffer so we don't overflow
-	    	g_nxhDetect = false;
-   	    	KL_Sleep(); // Go to sleep until our delay period is complete
-	    	break;
+	for (ev = EV_CONTACT; ev < EV_COUNT; ++ev)	// the first game event that fires moves us on
+	{
+		if (row[ev].actions && DC27_EventFired(ev))
+		{
+			DC27_Transition(&row[ev]);
+			break;
+		}
 	}
 }
 
 /**************************************************************/
 
-void DC27_UpdateDisplay(void)	// update LEDs based on current state
+void DC27_Transition(const game_transition_t *t)
 {
-	static volatile int j;
-
-    switch (badge_state)
-    {
-    	default:
-    	case ATTRACT: // Attract mode: Cycle through D, E, F, C, O, N LED states
-    		switch (attract_state)
-    		{
-    			case D:
-    	    		LP5569_RampLED(D);
-    	    		attract_state = E;
-    				break;
-    			case E:
-    	    		LP5569_RampLED(E);
-    	    		attract_state = F;
-    				break;
-    			case F:
-    	    		LP5569_RampLED(F);
-    	    		attract_state = C;
-    				break;
-    			case C:
-    	    		LP5569_RampLED(C);
-    	    		attract_state = O;
-    				break;
-    			case O:
-    	    		LP5569_RampLED(O);
-    	    		attract_state = N;
-    				break;
-    			case N:
-    	    		LP5569_RampLED(N);
-    	    		attract_state = D;
-    				break;
-    			case ATTRACT:	// unused states
-    			case COMPLETE:
-    			default:
-    				attract_state = D;
-    				break;
-    		}
-    		break;
+	uint16_t actions = t->actions;
+	uint8_t next = t->next, quest;
 
-    	case D:
-    		LP5569_SetLED_D(LP5569_PWM);
-    		break;
+	FX_Begin((next != badge_state) ? FX_EVENT : (actions & ACT_PROCESS) ? FX_NOTIFY : FX_AMBIENT);
 
-    	case E:
-    		LP5569_SetLED_E(LP5569_PWM);
-    		break;
+	if (actions & ACT_PROCESS)
+		DC27_ProcessPacket();
 
-    	case F:
-    		LP5569_SetLED_F(LP5569_PWM);
-    		break;
+	if (actions & ACT_WAIT)
+		FX_Add(&(fx_step_t){ .flags = FX_KEEP, .hold = GAME_STEP_DELAY });
 
-    	case C:
-    		LP5569_SetLED_C(LP5569_PWM);
-    		break;
+	if (actions & ACT_SKIP_FLAGS) // flags 1-5 can happen in any order, so the state is set by how many we have
+	{
+		quest = (game_flags & FLAG_QUEST_MASK) >> 1;
+		next += popcount_lut[quest & 0x0F] + popcount_lut[quest >> 4];
+	}
 
-    	case O:
-    		LP5569_SetLED_O(LP5569_PWM);
-    		break;
+	badge_state = (badge_state_t)next;
 
-    	case N:
-    		LP5569_SetLED_N(LP5569_PWM);
-    		break;
+	if (actions & ACT_SET_FLAG_6)
+		game_flags |= FLAG_6_MASK;
 
-    	case COMPLETE:
-    		for (j = 0; j <= LP5569_PWM; j++)  // ramp up to maximum defined brightness
-    		{
-    			LP5569_SetLED(1, j);
-    			LP5569_SetLED(4, j);
+	if (actions & ACT_CLEAR_GROUP)
+		group_flags = 0;
 
-        		SysTick_DelayTicks(LED_SPARKLE_FADE_DELAY);
-    		}
+	if (actions & ACT_DISPLAY)
+		DC27_UpdateDisplay();
 
-    		SysTick_DelayTicks(LED_SPARKLE_ON_DELAY);
+	if (actions & ACT_ALL_ON)
+		FX_Add(&(fx_step_t){ .layer = LED_LAYER_NOTIFY, .leds = FX_ALL_LEDS, .to = LED_LEVEL_MAX });
 
-       		LP5569_SetLED_AllOff(); // clear display
-    		LP5569_SetLED(0, LP5569_PWM);
-    	    LP5569_SetLED(3, LP5569_PWM);
-       		SysTick_DelayTicks(LED_SPARKLE_ON_DELAY);
+	if (actions & ACT_1UP)
+		KL_Piezo_1Up();
 
-       		LP5569_SetLED_AllOff(); // clear display
-       		LP5569_SetLED(1, LP5569_PWM);
-       		LP5569_SetLED(4, LP5569_PWM);
-       		SysTick_DelayTicks(LED_SPARKLE_ON_DELAY);
+	if (actions & ACT_BLANK)
+		FX_Add(&(fx_step_t){ .hold = GAME_STEP_DELAY });
 
-       		LP5569_SetLED_AllOff(); // clear display
-    		LP5569_SetLED(2, LP5569_PWM);
-    	    LP5569_SetLED(5, LP5569_PWM);
-       		SysTick_DelayTicks(LED_SPARKLE_ON_DELAY);
+	if (actions & ACT_RICKROLL)
+		KL_Piezo_RickRoll();
 
-       		LP5569_SetLED_AllOff(); // clear display
-    		LP5569_SetLED(1, LP5569_PWM);
-    	    LP5569_SetLED(4, LP5569_PWM);
-       		SysTick_DelayTicks(LED_SPARKLE_ON_DELAY);
+	if (actions & ACT_PRINT)
+		DC27_PrintState();
 
-    		for (j = LP5569_PWM; j >= 0; j--)  // ramp down from maximum defined brightness
-    		{
-    			LP5569_SetLED(1, j);
-    			LP5569_SetLED(4, j);
+	if (actions & ACT_FLASH)
+	{
+		FX_Add(&(fx_step_t){ .flags = FX_KEEP, .hold = GAME_STEP_DELAY });
+		FX_Add(&(fx_step_t){ 0 });	// LEDs off
+	}
 
-        		SysTick_DelayTicks(LED_SPARKLE_FADE_DELAY);
-    		}
+	if (actions & ACT_PERSIST)
+		DC27_UpdateFlags(true);
 
-    		break;
-    }
-}
+	if (actions & ACT_HOLD)
+		FX_Add(&(fx_step_t){ .flags = FX_KEEP, .hold = GAME_WIN_DELAY });
 
-/**************************************************************/
+	FX_End();
 
-void DC27_UpdateFlags(bool updateNXH)
-{
-	// write game flags to non-volatile Flash (persists between power cycles)
-	if (KL_Flash_Write((uint32_t)game_flags))
+	if (actions & ACT_DRAIN)
 	{
-		if (KL_Flash_Write((uint32_t)game_flags))
-		{
-			KL_Error(true, false);  // Beep the piezo to indicate a failure
-			PRINTF("[*] Flash Write Error!\n\r");
-		}
+		while (!KL_GetPacket_NXH2261(&nxhRxPacket)) // clear the rest so we don't overflow
+			PEER_See(&nxhRxPacket);	// the badges that sent them still count
 	}
 
-	nxhTxPacket.flags = game_flags;	 // game flags (packed, MSB unused)
-
-	if (updateNXH)
-	{
-        EnableIRQ(LPUART0_SERIAL_RX_TX_IRQN);
-	    if (KL_UpdatePacket_NXH2261(nxhTxPacket))  // load updated transmit packet into the NXH2261
-	    {
-	        if (KL_UpdatePacket_NXH2261(nxhTxPacket))
-	    		PRINTF(msg_nfmi_packet_err);
-	    }
-        DisableIRQ(LPUART0_SERIAL_RX_TX_IRQN);
-	}
+	// time before the idle animation starts, unless it's already running on the LP5569
+	if ((actions & ACT_TIMER) && !FX_Busy() && lptmrLeft[KL_TIMER_GAME] == 0 && fxEngine == LP5569_ENGINE_NONE)
+		KL_StartTimer((badge_state == COMPLETE) ? LED_SPARKLE_WAIT_DELAY : LPTMR0_TICKS);
 }
 
 /**************************************************************/
 
-int DC27_IncrementFlag(void)
+// Checked against the last packet received (nxhRxPacket)
+bool DC27_EventFired(game_event_t ev)
 {
-	switch (nxhRxPacket.type)
+	switch (ev)
 	{
-		case SPEAKER:
-			if ((game_flags & FLAG_1_MASK) == 0)
-			{
-				game_flags |= FLAG_1_MASK;
-				return 1;
-			}
-			break;
+		case EV_CONTACT: // Communication with anyone
+			return (game_flags & FLAG_0_MASK) != 0;
 
-		case VILLAGE:
-			if ((game_flags & FLAG_2_MASK) == 0)
-			{
-				game_flags |= FLAG_2_MASK;
-				return 1;
-			}
-			break;
+		case EV_FLAG: // if we've received a flag we don't already have from a magic token
+			return (nxhRxPacket.magic == true) && DC27_IncrementFlag();
 
-		case CONTEST:
-			if ((game_flags & FLAG_3_MASK) == 0)
-			{
-				game_flags |= FLAG_3_MASK;
-				return 1;
-			}
-			break;
+		case EV_GROUP:
+			group_flags |= DC27_BadgeInfo(nxhRxPacket.type)->group;
+			return (group_flags & GROUP_ALL_MASK) == GROUP_ALL_MASK;
 
-		case ARTIST:
-			if ((game_flags & FLAG_4_MASK) == 0)
-			{
-				game_flags |= FLAG_4_MASK;
-				return 1;
-			}
-			break;
+		case EV_TIMER:
+			return lptmrExpired;
 
-		case GOON:
-			if ((game_flags & FLAG_5_MASK) == 0)
-			{
-				game_flags |= FLAG_5_MASK;
-				return 1;
-			}
-			break;
+		default:
+			return false;
 	}
-
-	return 0;
 }
 
 /**************************************************************/
 
-void DC27_PrintBadgeType(badge_type_t badge)	// print badge type to console
+const badge_info_t *DC27_BadgeInfo(uint8_t type)	// metadata for a badge type, including ones from other badges' packets
 {
-	switch(badge)
-	{
-	   	case HUMAN:
-	   		PRINTF("Human");
-	   		break;
-	   	case GOON:
-	   		PRINTF("Goon");
-	   		break;
-	   	case SPEAKER:
-	   		PRINTF("Speaker");
-	   		break;
-	   	case VENDOR:
-	   		PRINTF("Vendor");
-	   		break;
-	   	case PRESS:
-	   		PRINTF("Press");
-	   		break;
-	   	case VILLAGE:
-	   		PRINTF("Village");
-	   		break;
-	   	case CONTEST:
-	   		PRINTF("Contest");
-	   		break;
-	   	case ARTIST:
-	   		PRINTF("Artist");
-	   		break;
-	   	case CFP:
-	   		PRINTF("CFP");
-	   		break;
-	   	case UBER:
-	   		PRINTF("Uber");
-	   		//UNCHANGED: Print LEET HAXXOR;
-//	   		PRINTF("L33T HAXXOR");
-	   		break;
-	   	default:
-	   		PRINTF("Unknown");
-	}
-
-	PRINTF("\n\r");
+	return (type < BADGE_TYPE_COUNT) ? &badge_info[type] : &badge_info_unknown;
 }
 
 /**************************************************************/
 
-void DC27_PrintState(void)	// print current state and game flags to console
+void DC27_UpdateDisplay(void)	// show the current state on the LEDs (adds to the effect being built)
 {
-	PRINTF("[*] Badge State = ");
-
     switch (badge_state)
     {
     	default:
-    	case ATTRACT:
-    		PRINTF("Attract");
+    	case ATTRACT: // Attract mode: Cycle through D, E, F, C, O, N LED states
+    		FX_Engine(LP5569_ENGINE_HEARTBEAT);
     		break;
 
     	case D:
-    		PRINTF("D");
-    		break;
-
     	case E:
-    		PRINTF("E");
-    		break;
-
     	case F:
-    		PRINTF("F");
-    		break;
-
     	case C:
-    		PRINTF("C");
-    		break;
-
     	case O:
-    		PRINTF("O");
-    		break;
-
     	case N:
-    		PRINTF("N");
+    		FX_Add(&(fx_step_t){ .leds = state_leds[badge_state], .to = LED_LEVEL_MAX });
     		break;
 
     	case COMPLETE:
-    		PRINTF("Hax0r");
+    		FX_Engine(LP5569_ENGINE_SPARKLE);
     		break;
     }
-
-	PRINTF("\n\r");
-
-    PRINTF("[*] Game Flags = ");
-    Print_Bits(game_flags);
-    PRINTF("\n\r");
 }
 
 /**************************************************************/
 
-void DC27_PrintPacket(struct packet_of_infamy packet)
+void DC27_FlashDisplay(void)	// show a received packet on the LEDs (interactive mode)
 {
-	// display hex data from data packet struct
-	const unsigned char *buffer = (unsigned char*)&packet;
-
-	PRINTF("0x%02X%02X%02X%02X%02X%02X%02X%02X\n\r", buffer[3], buffer[2], buffer[1], buffer[0], buffer[4], buffer[5], buffer[6], buffer[7]);
-	PRINTF("-> Unique ID: 0x%08X\n\r", packet.uid);
-	PRINTF("-> Badge Type: ");
-	DC27_PrintBadgeType(packet.type);
-	PRINTF("-> Magic Token: ");
-	if (packet.magic != 0)
-		PRINTF("Yes");
+	FX_Begin(FX_EVENT);
+	if (badge_state == ATTRACT || badge_state == COMPLETE)
+		FX_Add(&(fx_step_t){ .layer = LED_LAYER_NOTIFY, .leds = FX_ALL_LEDS, .to = LED_LEVEL_MAX });
 	else
-		PRINTF("No");
-	PRINTF("\n\r-> Game Flags: ");
-	Print_Bits(packet.flags); // MSB unused
-    PRINTF("\n\r");
+		DC27_UpdateDisplay();	// update LEDs based on current state
+	FX_Add(&(fx_step_t){ .flags = FX_KEEP, .hold = GAME_STEP_DELAY });
+	FX_Add(&(fx_step_t){ 0 });	// LEDs off
+	FX_End();
 }
 
 /**************************************************************/
 
-void DC27_ProcessPacket(void)
+void DC27_SaveState(void)	// write the badge state to non-volatile Flash (persists between power cycles)
 {
-	DC27_PrintPacket(nxhRxPacket);   // print packet structure to debug console
-	PRINTF("\n\r");
+	nvm_record_t state = { .flags = game_flags, .brightness = ledBrightness };
 
-	if ((game_flags & FLAG_0_MASK) == 0) // on first read, set game flag
+	if (KL_Flash_Write(&state))
 	{
-		game_flags |= FLAG_0_MASK;
-	}
+		if (KL_Flash_Write(&state))
+		{
+			KL_Error(true, false);  // Beep the piezo to indicate a failure
+			PRINTF("[*] Flash Write Error!\n\r");
+		}
+	}
+}
+
+/**************************************************************/
+
+// The badge state changed: write it once it settles (NVM_COMMIT_DELAY without another change),
+// the badge goes to sleep or DC27_Flush() is called. A quest step or a run of packets costs one
+// Flash write, taken off the game's hot path
+void DC27_MarkDirty(void)
+{
+	nvmDirty = true;
+	nvmWait = NVM_COMMIT_DELAY;	// 16-bit store, SysTick_Handler() sees the old or the new count
+}
+
+/**************************************************************/
+
+void DC27_Flush(bool all)	// write the badge state now if it changed, and the badges seen (see PEER_Flush())
+{
+	if (all)
+		nvmWait = 0;
+
+	if (nvmDirty)
+	{
+		nvmDirty = false;
+		DC27_SaveState();
+	}
+
+	PEER_Flush(all);
+
+	if (HLL_Save() && HLL_Save())
+		PRINTF("[*] Flash Write Error!\n\r");
+}
+
+/**************************************************************/
+
+void DC27_UpdateFlags(bool updateNXH)
+{
+	DC27_MarkDirty();	// game flags
+
+	nxhTxPacket.flags = game_flags;	 // game flags (packed, MSB unused)
+
+	if (updateNXH)
+	{
+        EnableIRQ(LPUART0_SERIAL_RX_TX_IRQN);
+	    if (KL_UpdatePacket_NXH2261(nxhTxPacket))  // load updated transmit packet into the NXH2261
+	    {
+	        if (KL_UpdatePacket_NXH2261(nxhTxPacket))
+	    		PRINTF(msg_nfmi_packet_err);
+	    }
+        DisableIRQ(LPUART0_SERIAL_RX_TX_IRQN);
+	}
+}
+
+/**************************************************************/
+
+int DC27_IncrementFlag(void)
+{
+	uint8_t flag = DC27_BadgeInfo(nxhRxPacket.type)->flag;
+
+	if (flag && (game_flags & flag) == 0)
+	{
+		game_flags |= flag;
+		return 1;
+	}
+
+	return 0;
+}
+
+/**************************************************************/
+
+void DC27_PrintBadgeType(badge_type_t badge)	// print badge type to console
+{
+	PRINTF("%s\n\r", DC27_BadgeInfo(badge)->name);
+}
+
+/**************************************************************/
+
+void DC27_PrintState(void)	// print current state and game flags to console
+{
+	PRINTF("[*] Badge State = %s\n\r", badge_state_names[(badge_state < BADGE_STATE_COUNT) ? badge_state : ATTRACT]);
+
+    PRINTF("[*] Game Flags = ");
+    Print_Bits(game_flags);
+    PRINTF("\n\r");
+}
+
+/**************************************************************/
+
+void DC27_PrintPacket(struct packet_of_infamy packet)
+{
+	// display hex data from data packet struct
+	const unsigned char *buffer = (unsigned char*)&packet;
+
+	PRINTF("0x%02X%02X%02X%02X%02X%02X%02X%02X\n\r", buffer[3], buffer[2], buffer[1], buffer[0], buffer[4], buffer[5], buffer[6], buffer[7]);
+	PRINTF("-> Unique ID: 0x%08X\n\r", packet.uid);
+	PRINTF("-> Badge Type: ");
+	DC27_PrintBadgeType(packet.type);
+	PRINTF("-> Magic Token: ");
+	if (packet.magic != 0)
+		PRINTF("Yes");
+	else
+		PRINTF("No");
+	PRINTF("\n\r-> Game Flags: ");
+	Print_Bits(packet.flags); // MSB unused
+    PRINTF("\n\r");
+}
+
+/**************************************************************/
+
+void DC27_ProcessPacket(void)
+{
+	DC27_PrintPacket(nxhRxPacket);   // print packet structure to debug console
+	PRINTF("\n\r");
+	PEER_See(&nxhRxPacket);
+
+	if ((game_flags & FLAG_0_MASK) == 0) // on first read, set game flag
+	{
+		game_flags |= FLAG_0_MASK;
+	}
 
 }
 
@@ -1535,52 +1864,8 @@ void DC27_ProcessPacket(void)
 void DC27_MagicPacket(void)
 {
 	//CHANGED: Added Case Statement for Badge Type Changing
-    switch(badge_type)
-    {
-    	case HUMAN:
-    		badge_type = GOON;
-    		nxhTxPacket.type = (uint8_t)badge_type;	// badge type
-    		break;
-    	case GOON:
-    		badge_type = SPEAKER;
-    		nxhTxPacket.type = (uint8_t)badge_type;	// badge type
-    		break;
-    	case SPEAKER:
-    		badge_type = VENDOR;
-    		nxhTxPacket.type = (uint8_t)badge_type;	// badge type
-    		break;
-    	case VENDOR:
-    		badge_type = PRESS;
-    		nxhTxPacket.type = (uint8_t)badge_type;	// badge type
-    		break;
-    	case PRESS:
-    		badge_type = VILLAGE;
-    		nxhTxPacket.type = (uint8_t)badge_type;	// badge type
-    		break;
-    	case VILLAGE:
-    		badge_type = CONTEST;
-    		nxhTxPacket.type = (uint8_t)badge_type;	// badge type
-    		break;
-    	case CONTEST:
-    		badge_type = ARTIST;
-    		nxhTxPacket.type = (uint8_t)badge_type;	// badge type
-    		break;
-    	case ARTIST:
-    		badge_type = CFP;
-    		nxhTxPacket.type = (uint8_t)badge_type;	// badge type
-    		break;
-    	case CFP:
-    		badge_type = UBER;
-    		nxhTxPacket.type = (uint8_t)badge_type;	// badge type
-    		break;
-    	case UBER:
-    		badge_type = HUMAN;
-    		nxhTxPacket.type = (uint8_t)badge_type;	// badge type
-    		break;
-    	default:
-    		badge_type = UBER;
-    		nxhTxPacket.type = (uint8_t)badge_type;	// badge type
-    }
+    badge_type = (badge_type_t)DC27_BadgeInfo(badge_type)->next;
+    nxhTxPacket.type = (uint8_t)badge_type;	// badge type
     //send updated Packet information to the handler
     EnableIRQ(LPUART0_SERIAL_RX_TX_IRQN);
     if (KL_UpdatePacket_NXH2261(nxhTxPacket))  // load updated transmit packet into the NXH2261
@@ -1594,276 +1879,645 @@ void DC27_MagicPacket(void)
 
 /**************************************************************/
 
-void DC27_InteractiveMode(void)
+void DC27_TaskRadio(kl_event_t ev)	// KL_EVENT_PACKET: packet(s) waiting in the ring buffer
 {
-	size_t i;
-	uint8_t ch, inputString[CONSOLE_RCVBUF_SIZE];
-	uint32_t len;
+	DisableIRQ(LPUART0_SERIAL_RX_TX_IRQN);
+	if (consoleReceive)	// 'R' in interactive mode takes them
+	{
+		if (DC27_ConsoleReceive())
+			PRINTF(command_prompt);
+	}
+	else
+	{
+		DC27_UpdateState();
+	}
+	DC27_MagicPacket();
+	EnableIRQ(LPUART0_SERIAL_RX_TX_IRQN);
+}
 
-	PRINTF(msg_interactive_mode);
+/**************************************************************/
 
-	while(1)
+void DC27_TaskGame(kl_event_t ev)	// KL_EVENT_TIMER, KL_EVENT_IDLE: LED update due or effects finished
+{
+	DisableIRQ(LPUART0_SERIAL_RX_TX_IRQN);
+	lptmrExpired = (ev == KL_EVENT_TIMER);	// EV_TIMER, for this pass only
+	DC27_UpdateState();
+	lptmrExpired = false;
+
+	if (ev == KL_EVENT_TIMER)
+		DC27_MagicPacket();
+	EnableIRQ(LPUART0_SERIAL_RX_TX_IRQN);
+}
+
+/**************************************************************/
+
+void DC27_TaskLED(kl_event_t ev)	// KL_EVENT_LED: compose the LED frame and write it to the LP5569
+{
+	FX_Service();
+}
+
+/**************************************************************/
+
+// KL_EVENT_SAVE: the badge state settled. While effects play a flash erase would stall them,
+// so leave it to KL_Idle() before the badge goes to sleep
+void DC27_TaskSave(kl_event_t ev)
+{
+	if (!FX_Busy())
+		DC27_Flush(true);
+}
+
+/**************************************************************/
+
+// KL_EVENT_ATTACH: USB-to-serial adapter plugged in or out, KL_EVENT_CONSOLE: characters from the host
+void DC27_TaskConsole(kl_event_t ev)
+{
+	static bool b = true;
+	uint8_t ch;
+
+	if (ev == KL_EVENT_CONSOLE)
 	{
-		PRINTF(command_prompt);
-		len = 0;
-		while(1)
+		while (consoleTxIndex != consoleRxIndex)
 		{
-		  ch = GETCHAR();			// get character from the user (blocking)
-		  inputString[len] = ch;	// add to input buffer
-		  len += 1;
-		  if (ch == 24) // CAN (Ctrl-X)
-		  {
-			  PRINTF(msg_interactive_exit);
-			  return;
-		  }
-		  else if (ch == '\n' || ch == '\r' || (len > CONSOLE_RCVBUF_SIZE - 1))  // take input until CR, LF, or maximum length received
-		  {
-			  inputString[len - 1] = '\0';
-			  break;
-		  }
+			ch = consoleRingBuffer[consoleTxIndex];
+			consoleTxIndex = (consoleTxIndex + 1) & (CONSOLE_RING_BUFFER_SIZE - 1);
+			DC27_ConsoleInput(ch);
 		}
+		return;
+	}
 
-		len = strlen((char *)inputString);
-		switch(inputString[0])
-		{
-			case 'T': 	// Display transmit packet
-			case 't':
-				if (len != 1) // if input string is longer than allowable for this command, ignore it
-					dc27_invalid_cmd();
-				else
-				{
-					DC27_PrintPacket(nxhTxPacket);  // print packet structure to debug console
-				}
-				break;
+	g_newRx = KL_Check_RX();
+	if (g_newRx && (!g_oldRx || b))	// if USB-to-Serial adapter has been plugged in, KL_RX pin will go HIGH
+	{
+		PRINTF("[*] USB-to-Serial Adapter Detected\n\r");
+		DC27_ConsoleStart(!b);	// if adapter is plugged in while the system is already active, drop first character
+		b = false; // if we're here for the first time after power-up
+	}
+	else if (!g_newRx && consoleActive)
+	{
+		DC27_ConsoleStop();	// exit interactive mode if USB-to-serial adapter is removed
+	}
+	g_oldRx = g_newRx;
 
-			case 'R':	// Receive data packet(s)
-			case 'r':
-				if (len != 1) // if input string is longer than allowable for this command, ignore it
-					dc27_invalid_cmd();
-				else
-				{
-					i = 0;
-					while (KL_GetPacket_NXH2261(&nxhRxPacket))  // if there is no available packet...
-					{
-						if (i == 0)  // only print message one time
-						{
-							PRINTF("Waiting for Packet(s)...\n\r");
-							i = 1;
-						}
-
-						g_nxhDetect = false;
-						while (!g_nxhDetect)  // wait here until a new packet has been received
-						{
-							if (!KL_Check_RX())
-							{
-								PRINTF(msg_interactive_exit);
-								return;		// exit interactive mode if USB-to-serial adapter is removed
-							}
-						}
-						g_nxhDetect = false;
-					}
+	// Watch KL_RX for the adapter (KL_Check_RX() turned it off). In interactive mode it carries
+	// the console instead, and a break from the host (NUL) brings us back here
+	PORT_SetPinInterruptConfig(BOARD_INITPINS_KL_RX_PORT, BOARD_INITPINS_KL_RX_PIN,
+		consoleActive ? kPORT_InterruptOrDMADisabled : kPORT_InterruptEitherEdge);
+}
 
-					DC27_ProcessPacket();
-					if (badge_state == ATTRACT || badge_state == COMPLETE)
-					{
-						LP5569_SetLED_AllOn();
-					}
-					else
-					{
-						DC27_UpdateDisplay();	// update LEDs based on current state
-					}
-					SysTick_DelayTicks(500);
-					LP5569_SetLED_AllOff();
+/**************************************************************/
 
-					// get any other packet(s) from the ring buffer
-					while (!KL_GetPacket_NXH2261(&nxhRxPacket))
-					{
-						DC27_ProcessPacket();
-						if (badge_state == ATTRACT || badge_state == COMPLETE)
-						{
-							LP5569_SetLED_AllOn();
-						}
-						else
-						{
-							DC27_UpdateDisplay();	// update LEDs based on current state
-						}
-						SysTick_DelayTicks(500);
-						LP5569_SetLED_AllOff();
-					}
-				}
-				break;
+// Interactive mode runs alongside the game: characters arrive through the UART2 RX
+// interrupt and the console task, and each line is looked up in the command table
+void DC27_ConsoleStart(bool drop)
+{
+	consoleActive = true;
+	consoleDrop = drop;
+	consoleReceive = false;
+	consoleNext = NULL;
+	consoleLen = 0;
 
-			case 'C':	// Clear game flags
-			case 'c':
-				if (len != 1) // if input string is longer than allowable for this command, ignore it
-					dc27_invalid_cmd();
-				else
-				{
-					PRINTF("Clear Game Flags? Are You Sure? [y/N] ");
-					len = 0;
-					while(1)
-					{
-						ch = GETCHAR();			// get character from the user (blocking)
-						inputString[len] = ch;	// add to input buffer
-					    len += 1;
-					    if (ch == '\n' || ch == '\r' || (len > CONSOLE_RCVBUF_SIZE - 1))  // take input until CR, LF, or maximum length received
-						{
-					    	inputString[len - 1] = '\0';
-							break;
-						}
-					}
-					len = strlen((char *)inputString);
-					if (len == 1 && (inputString[0] == 'Y' || inputString[0] == 'y'))
-					{
-						game_flags = 0;	// Clear game flags
-						DC27_UpdateFlags(true);
-						PRINTF("-> Game Flags: ");
-						Print_Bits(game_flags); // MSB unused
-					    PRINTF("\n\r");
-					}
-				}
-				break;
+	PRINTF(msg_interactive_mode);
+	PRINTF(command_prompt);
+}
 
-			case '^':
-				NVIC_SystemReset(); // System reset (does not return)
-				break;
+/**************************************************************/
 
-			case 'A':	// ASCII art generator
-			case 'a':
-				if (badge_state != COMPLETE)
-					dc27_invalid_cmd();
-				else if (len <= 2)
-				{
-					strcpy((char *)inputString, ART_DEFAULT);
-					DC27_ASCIIArt(inputString); // use default string if none provided on the command line
-				}
-				else
-					DC27_ASCIIArt(inputString + 2); // send user-defined string to the ASCII art generator
-				break;
+void DC27_ConsoleStop(void)
+{
+	consoleActive = false;
+	consoleReceive = false;
+	consoleNext = NULL;
 
-			case 'S': 	// Tone generator
-			case 's':
-				if (len < 5 || badge_state != COMPLETE)
-					dc27_invalid_cmd();
-				else
-				{
-					uint32_t freq = 0, duration = 0;
-					sscanf((char *)(inputString + 2), "%d %d", &freq, &duration);
-					KL_Piezo(freq, duration, 50);
-				}
-				break;
+	PRINTF(msg_interactive_exit);
+	KL_Post(KL_EVENT_ATTACH);	// watch KL_RX again
+}
 
-			case 'U':  // Update outgoing data packet
-			case 'u':
-				if (len < 18 || badge_state != COMPLETE)
-					dc27_invalid_cmd();
-				else
-				{
-					// convert all alphabetic characters to upper case
-					for (i = 0; i < len; ++i)
-					{
-						if (inputString[i] >= 'a' && inputString[i] <= 'z')
-							inputString[i] -= 0x20;
-					}
-					unsigned long data_low = strtoul((const char*)(inputString + 10), NULL, 16);
-					inputString[10] = '\0';
-					unsigned long data_high = strtoul((const char*)(inputString + 2), NULL, 16);
-					PRINTF("0x%08X%08X\n\r", data_high, data_low);
-					PRINTF("Update Transmit Packet? Are You Sure? [y/N] ");
-					len = 0;
-					while(1)
-					{
-						ch = GETCHAR();			// get character from the user (blocking)
-						inputString[len] = ch;	// add to input buffer
-					    len += 1;
-					    if (ch == '\n' || ch == '\r' || (len > CONSOLE_RCVBUF_SIZE - 1))  // take input until CR, LF, or maximum length received
-						{
-					    	inputString[len - 1] = '\0';
-							break;
-						}
-					}
-					len = strlen((char *)inputString);
-					if (len == 1 && (inputString[0] == 'Y' || inputString[0] == 'y'))
-					{
-						// Craft new data packet for radio to transmit
-						nxhTxPacket.uid = data_high;					// unique ID
-						nxhTxPacket.type = (data_low >> 24) & 0xFF;		// badge type
-						nxhTxPacket.magic = (data_low >> 16) & 0xFF; 	// magic token (1 = enabled)
-					    nxhTxPacket.flags = (data_low >> 8) & 0xFF;   	// game flags (packed, MSB unused)
-						nxhTxPacket.unused = data_low & 0xFF;			// unused
-
-					    if (KL_UpdatePacket_NXH2261(nxhTxPacket))  // load packet to the NXH2261
-					    {
-					        if (KL_UpdatePacket_NXH2261(nxhTxPacket))
-					    		PRINTF(msg_nfmi_packet_err);
-					    }
-						else
-							PRINTF("-> Done!\n\r");
-					}
-				}
-				break;
+/**************************************************************/
 
-			case 'H':	// Display menu
-			case 'h':
-			case '?':
-				if (len != 1) // if input string is longer than allowable for this command, ignore it
-					dc27_invalid_cmd();
-				else
-				{
-					PRINTF(menu_banner);
+void DC27_ConsoleInput(uint8_t ch)	// line editor: one character from the user
+{
+	if (!consoleActive)
+		return;
 
-					if (badge_state == COMPLETE)  // if badge tasks are complete, display additional menu items
-						PRINTF(menu_banner_complete);
-				}
-				break;
-			default:	// Command not recognized
-				dc27_invalid_cmd();
-				break;
-		}
+	if (consoleDrop)
+	{
+		consoleDrop = false;
+		return;
+	}
+
+	if (ch == 24) // CAN (Ctrl-X)
+	{
+		DC27_ConsoleStop();
+		return;
+	}
+
+	if (ch == '\b' || ch == 0x7F) // backspace/delete
+	{
+		if (consoleLen > 0)
+			consoleLen--;
+		return;
+	}
+
+	consoleLine[consoleLen] = ch;	// add to input buffer
+	consoleLen += 1;
+	if (ch == '\n' || ch == '\r' || (consoleLen > CONSOLE_RCVBUF_SIZE - 1))  // take input until CR, LF, or maximum length received
+	{
+		consoleLine[consoleLen - 1] = '\0';
+		consoleLen = 0;
+		DC27_ConsoleCommand(consoleLine, strlen((char *)consoleLine));
+
+		if (consoleActive && !consoleReceive && consoleNext == NULL)
+			PRINTF(command_prompt);
 	}
 }
 
 /**************************************************************/
 
-// ASCII art generator
-// Inspired by:
-// https://twitter.com/ef1j95/status/1101865167741173760
-// http://www.vintage-basic.net/bcg/love.bas
-// https://www.associationforpublicart.org/artwork/love/
-void DC27_ASCIIArt(uint8_t *A)
+void DC27_ConsoleCommand(uint8_t *line, uint32_t len)
 {
-	volatile uint32_t I, J, L, C, P, A1, ptr;
-	uint8_t T[120];    // crafted line of text to print
+	static const console_command_t commands[] =
+	{
+		{ 'T', 1, 1, false, DC27_CmdTransmit },	// Display transmit packet
+		{ 'R', 1, 1, false, DC27_CmdReceive },	// Receive data packet(s)
+		{ 'C', 1, 1, false, DC27_CmdClear },	// Clear game flags
+		{ '^', 1, 0, false, DC27_CmdReset },	// System reset
+		{ 'A', 1, 0, true, DC27_CmdArt },		// ASCII art generator
+		{ 'S', 5, 0, true, DC27_CmdTone },		// Tone generator
+		{ 'U', 18, 0, true, DC27_CmdUpdate },	// Update outgoing data packet
+		{ 'G', 1, 0, true, DC27_CmdShow },		// Play a show
+		{ 'P', 1, 0, true, DC27_CmdProgram },	// Upload a show
+		{ 'L', 1, 1, false, DC27_CmdLED },		// LED driver statistics
+		{ 'D', 1, 1, false, DC27_CmdDelay },	// Delay statistics
+		{ 'B', 1, 1, false, DC27_CmdBattery },	// Battery saver brightness
+		{ 'Q', 1, 10, false, DC27_CmdPeers },	// Badges met
+		{ 'E', 1, 1, false, DC27_CmdExport },	// Export badges met
+		{ 'H', 1, 1, false, DC27_CmdHelp },		// Display menu
+		{ '?', 1, 1, false, DC27_CmdHelp }
+	};
+	void (*next)(uint8_t *, uint32_t) = consoleNext;
+	const console_command_t *cmd;
+	size_t i;
 
-	L = strlen((char *)A); // input text from user
+	consoleReceive = false;	// any input ends 'R'
 
-	// craft a line based on the input text from user
-	for (J = 0; J < (ART_WIDTH / L) + 1; J++)
+	if (next != NULL)	// answer to a question
 	{
-	    for (I = 0; I < L; I++) // repeat the input text for the entire line
-	    {
-	        T[(J * L) + I] = A[I];
-	    }
+		consoleNext = NULL;
+		next(line, len);
+		return;
 	}
 
-	C = 0;
-	A1 = 0;
-	ptr = 0;
-
-	while(1)
+	for (i = 0; i < sizeof(commands) / sizeof(commands[0]); ++i)
 	{
-	    if (A1 == 0 || A1 > ART_WIDTH)  // print one line at a time
-	    {
-	        A1 = 1;         // current column count into the line
-	        P = 0;          // flag to print message characters (true) or spaces (false)
-	        C += 1;
-	        if (C == ART_LINES)    // if we've reached the end of our artwork
-	        {
-		        PRINTF("\n\r");
-	            return;  // done!
-	        }
-	        PRINTF("\n\r ");
-	    }
+		cmd = &commands[i];
+		if (line[0] != cmd->name && !(cmd->name >= 'A' && cmd->name <= 'Z' && line[0] == cmd->name + 0x20))
+			continue;
+
+		// if input string is the wrong length for this command, ignore it
+		if (len < cmd->minLen || (cmd->maxLen && len > cmd->maxLen) || (cmd->complete && badge_state != COMPLETE))
+			break;
+
+		cmd->run(line, len);
+		return;
+	}
+
+	dc27_invalid_cmd();	// Command not recognized
+}
+
+/**************************************************************/
+
+uint32_t DC27_ConsoleReceive(void)	// show the packet(s) in the ring buffer for 'R', returns how many
+{
+	uint32_t n = 0;
+
+	while (!KL_GetPacket_NXH2261(&nxhRxPacket))
+	{
+		DC27_ProcessPacket();
+		DC27_FlashDisplay();
+		n++;
+	}
+
+	if (n)
+		consoleReceive = false;
+
+	return n;
+}
+
+/**************************************************************/
+
+void DC27_CmdTransmit(uint8_t *line, uint32_t len)
+{
+	DC27_PrintPacket(nxhTxPacket);  // print packet structure to debug console
+}
+
+/**************************************************************/
+
+void DC27_CmdReceive(uint8_t *line, uint32_t len)	// the radio task hands over packets until one has been shown
+{
+	consoleReceive = true;
+
+	PRINTF("-> LPUART0 Overruns: %u\n\r", nxhOverruns);
+	DisableIRQ(LPUART0_SERIAL_RX_TX_IRQN);
+	if (!DC27_ConsoleReceive())
+		PRINTF("Waiting for Packet(s)...\n\r");
+	EnableIRQ(LPUART0_SERIAL_RX_TX_IRQN);
+}
+
+/**************************************************************/
+
+void DC27_CmdClear(uint8_t *line, uint32_t len)
+{
+	PRINTF("Clear Game Flags? Are You Sure? [y/N] ");
+	consoleNext = DC27_ConfirmClear;
+}
+
+/**************************************************************/
+
+void DC27_ConfirmClear(uint8_t *line, uint32_t len)
+{
+	if (len == 1 && (line[0] == 'Y' || line[0] == 'y'))
+	{
+		game_flags = 0;	// Clear game flags
+		DisableIRQ(LPUART0_SERIAL_RX_TX_IRQN);
+		DC27_UpdateFlags(true);
+		DC27_Flush(false);	// cleared on purpose: write it now
+		EnableIRQ(LPUART0_SERIAL_RX_TX_IRQN);
+		PRINTF("-> Game Flags: ");
+		Print_Bits(game_flags); // MSB unused
+	    PRINTF("\n\r");
+	}
+}
+
+/**************************************************************/
+
+void DC27_CmdReset(uint8_t *line, uint32_t len)
+{
+	DC27_Flush(true);	// don't lose a change that hasn't been written yet
+	NVIC_SystemReset(); // System reset (does not return)
+}
+
+/**************************************************************/
+
+void DC27_CmdArt(uint8_t *line, uint32_t len)
+{
+	if (len <= 2)
+	{
+		strcpy((char *)line, ART_DEFAULT);
+		DC27_ASCIIArt(line); // use default string if none provided on the command line
+	}
+	else
+		DC27_ASCIIArt(line + 2); // send user-defined string to the ASCII art generator
+}
+
+/**************************************************************/
+
+void DC27_CmdTone(uint8_t *line, uint32_t len)	// played as an effect, so the console carries on
+{
+	uint32_t freq, duration;
+	uint16_t mod = 0, cnv = 0;	// 0 Hz: silence
+	uint8_t prescale = 0;
+	char *end;
+
+	freq = strtoul((char *)(line + 2), &end, 10);	// not sscanf(): it would link in the floating point scanf
+	duration = strtoul(end, NULL, 10);
+	freq = (freq > UINT16_MAX) ? UINT16_MAX : freq;
+	duration = (duration > UINT16_MAX) ? UINT16_MAX : duration;
+	if (freq)
+		KL_Piezo_Settings(freq, 50, &prescale, &mod, &cnv);	// here, so FX_Tick() doesn't divide
+	consoleTone[1] = prescale;
+	consoleTone[2] = mod & 0xFF;
+	consoleTone[3] = mod >> 8;
+	consoleTone[4] = cnv & 0xFF;
+	consoleTone[5] = cnv >> 8;
+	consoleTone[6] = duration & 0xFF;
+	consoleTone[7] = duration >> 8;
+
+	FX_Begin(FX_EVENT);
+	FX_Add(&(fx_step_t){ .show = consoleTone, .flags = FX_KEEP });
+	FX_End();
+}
+
+/**************************************************************/
+
+void DC27_CmdUpdate(uint8_t *line, uint32_t len)
+{
+	size_t i;
+
+	// convert all alphabetic characters to upper case
+	for (i = 0; i < len; ++i)
+	{
+		if (line[i] >= 'a' && line[i] <= 'z')
+			line[i] -= 0x20;
+	}
+	unsigned long data_low = strtoul((const char*)(line + 10), NULL, 16);
+	line[10] = '\0';
+	unsigned long data_high = strtoul((const char*)(line + 2), NULL, 16);
+	PRINTF("0x%08X%08X\n\r", data_high, data_low);
+
+	// Craft new data packet for radio to transmit
+	consoleTxPacket.uid = data_high;					// unique ID
+	consoleTxPacket.type = (data_low >> 24) & 0xFF;		// badge type
+	consoleTxPacket.magic = (data_low >> 16) & 0xFF; 	// magic token (1 = enabled)
+	consoleTxPacket.flags = (data_low >> 8) & 0xFF;   	// game flags (packed, MSB unused)
+	consoleTxPacket.unused = data_low & 0xFF;			// unused
+
+	PRINTF("Update Transmit Packet? Are You Sure? [y/N] ");
+	consoleNext = DC27_ConfirmUpdate;
+}
+
+/**************************************************************/
+
+void DC27_ConfirmUpdate(uint8_t *line, uint32_t len)
+{
+	if (len == 1 && (line[0] == 'Y' || line[0] == 'y'))
+	{
+		nxhTxPacket = consoleTxPacket;
+	    if (KL_UpdatePacket_NXH2261(nxhTxPacket))  // load packet to the NXH2261
+	    {
+	        if (KL_UpdatePacket_NXH2261(nxhTxPacket))
+	    		PRINTF(msg_nfmi_packet_err);
+	    }
+		else
+			PRINTF("-> Done!\n\r");
+	}
+}
+
+/**************************************************************/
+
+// Built-in shows, then the one uploaded to flash with 'P' (NULL if there is none)
+const uint8_t *DC27_Show(uint8_t n)
+{
+	const show_flash_t *flash;
+
+	if (n < SHOW_BUILTIN_COUNT)
+		return show_builtin[n].code;
+
+	if (n > SHOW_BUILTIN_COUNT || pflashSectorSize == 0)
+		return NULL;
+
+	flash = (const show_flash_t *)KL_Flash_Sector(SHOW_SECTOR_FROM_END);
+	if (flash->magic != SHOW_FLASH_MAGIC || flash->size > SHOW_MAX_SIZE || FX_ShowCheck(flash->code, flash->size))
+		return NULL;
+
+	return flash->code;
+}
+
+/**************************************************************/
+
+int DC27_HexDigit(uint8_t c)	// value of a hex digit, -1 if it isn't one
+{
+	if (c >= '0' && c <= '9')
+		return c - '0';
+
+	c |= 0x20;	// lower case
+	if (c >= 'a' && c <= 'f')
+		return c - 'a' + 10;
+
+	return -1;
+}
+
+/**************************************************************/
+
+void DC27_CmdShow(uint8_t *line, uint32_t len)	// G: list the shows, G <n>: play one
+{
+	const uint8_t *code;
+	uint32_t i;
+
+	if (len == 1)
+	{
+		for (i = 0; i <= SHOW_BUILTIN_COUNT; ++i)
+		{
+			code = DC27_Show(i);
+			PRINTF("-> %u: %s\n\r", i, (i < SHOW_BUILTIN_COUNT) ? show_builtin[i].name : code ? "Uploaded" : "(Empty)");
+		}
+		return;
+	}
+
+	i = strtoul((const char *)(line + 1), NULL, 10);
+	code = (i <= SHOW_BUILTIN_COUNT) ? DC27_Show(i) : NULL;
+	if (code == NULL)
+	{
+		PRINTF("-> No Such Show\n\r");
+		return;
+	}
+
+	FX_Begin(FX_EVENT);
+	FX_Add(&(fx_step_t){ .layer = LED_LAYER_NOTIFY, .show = code, .flags = FX_KEEP });
+	FX_End();
+}
+
+/**************************************************************/
+
+// P <hex bytes>: add to the show being uploaded (8 bytes fit on a line)
+// P: check it and save it to flash, in place of the last one
+void DC27_CmdProgram(uint8_t *line, uint32_t len)
+{
+	uint32_t i;
+	int hi, lo;
+
+	if (len == 1)
+	{
+		if (consoleShow.size == 0 || FX_ShowCheck(consoleShow.code, consoleShow.size))
+		{
+			PRINTF("-> Invalid Show\n\r");
+			consoleShow.size = 0;
+			return;
+		}
+
+		PRINTF("Save %u Byte Show? Are You Sure? [y/N] ", consoleShow.size);
+		consoleNext = DC27_ConfirmProgram;
+		return;
+	}
+
+	for (i = 1; i < len; )
+	{
+		if (line[i] == ' ')
+		{
+			i++;
+			continue;
+		}
+
+		hi = (i + 1 < len) ? DC27_HexDigit(line[i]) : -1;
+		lo = (i + 1 < len) ? DC27_HexDigit(line[i + 1]) : -1;
+		if (hi < 0 || lo < 0 || consoleShow.size == SHOW_MAX_SIZE)
+		{
+			PRINTF("-> Upload Error, Start Again\n\r");
+			consoleShow.size = 0;
+			return;
+		}
+
+		consoleShow.code[consoleShow.size++] = (hi << 4) | lo;
+		i += 2;
+	}
+
+	PRINTF("-> %u Bytes\n\r", consoleShow.size);
+}
+
+/**************************************************************/
+
+void DC27_ConfirmProgram(uint8_t *line, uint32_t len)
+{
+	if (len == 1 && (line[0] == 'Y' || line[0] == 'y'))
+	{
+		consoleShow.magic = SHOW_FLASH_MAGIC;
+		if (KL_Flash_Erase(SHOW_SECTOR_FROM_END) ||
+			KL_Flash_Program(KL_Flash_Sector(SHOW_SECTOR_FROM_END), (const uint32_t *)&consoleShow, sizeof(consoleShow)))
+			PRINTF("-> Flash Write Error!\n\r");
+		else
+		{
+			PRINTF("-> Done!\n\r");
+			FX_Begin(FX_EVENT);
+			FX_Add(&(fx_step_t){ .layer = LED_LAYER_NOTIFY, .show = DC27_Show(SHOW_BUILTIN_COUNT), .flags = FX_KEEP });
+			FX_End();
+		}
+	}
+
+	consoleShow.size = 0;
+}
+
+/**************************************************************/
+
+void DC27_CmdLED(uint8_t *line, uint32_t len)
+{
+	PRINTF("-> LP5569 Writes: %u\n\r", lp5569Writes);
+	PRINTF("-> Skipped (Unchanged): %u\n\r", lp5569Skipped);
+}
+
+/**************************************************************/
+
+void DC27_CmdDelay(uint8_t *line, uint32_t len)	// where the time in SysTick_DelayTicks() went
+{
+	PRINTF("-> Spinning: %u ms\n\r", delaySpin);
+	PRINTF("-> WAIT: %u ms\n\r", delayWait);
+	PRINTF("-> VLPS: %u ms\n\r", delaySleep);
+}
+
+/**************************************************************/
+
+void DC27_CmdBattery(uint8_t *line, uint32_t len)
+{
+	LED_SetBrightness((ledBrightness == LED_BRIGHTNESS_NORMAL) ? LED_BRIGHTNESS_BATTERY : LED_BRIGHTNESS_NORMAL);
+	DC27_MarkDirty();	// stays on across power cycles
+	PRINTF("-> Battery Saver: %s\n\r", (ledBrightness == LED_BRIGHTNESS_NORMAL) ? "Off" : "On");
+}
+
+/**************************************************************/
+
+void DC27_CmdPeers(uint8_t *line, uint32_t len)	// Q: peer database summary, Q <uid>: one badge
+{
+	peer_record_t peer;
+	uint32_t i, complete = 0, estimate;
+
+	if (len > 1)
+	{
+		if (PEER_Get(strtoul((const char *)(line + 1), NULL, 16), &peer))
+		{
+			PRINTF("-> Never Met\n\r");
+			return;
+		}
+
+		PRINTF("-> Unique ID: 0x%08X\n\r", peer.uid);
+		PRINTF("-> Badge Type: ");
+		DC27_PrintBadgeType(peer.type);
+		PRINTF("-> Game Flags: ");
+		Print_Bits(peer.flags & FLAG_ALL_MASK);
+		PRINTF("\n\r-> Quest Complete: %s\n\r", (peer.flags & PEER_COMPLETE) ? "Yes" : "No");
+		PRINTF("-> First Seen: %us\n\r", peer.first);
+		PRINTF("-> Last Seen: %us (%us Ago)\n\r", peer.last, PEER_Time() - peer.last);
+		return;
+	}
+
+	PEER_Flush(true);	// so the log has them all
+	for (i = 0; i < PEER_INDEX_SIZE; i++)
+	{
+		if (peerIndex[i] != 0 && (PEER_Record(peerIndex[i])->flags & PEER_COMPLETE))
+			complete++;
+	}
+
+	PRINTF("-> Badges Met: %u of %u (%u Quest Complete)\n\r", peerCount, peerMax, complete);
+	PRINTF("-> Badge Time: %us\n\r", PEER_Time());
+	PRINTF("-> Sightings Since Power-Up: %u\n\r", peerSightings);
+
+	estimate = HLL_Estimate(hllState.met);	// every badge ever heard from, +/- one standard error
+	PRINTF("-> Unique Badges Ever: ~%u (+/- %u)\n\r", estimate, (estimate * HLL_ERROR_PERMILLE + 500) / 1000);
+	estimate = HLL_Estimate(hllState.helped);
+	PRINTF("-> Completed Since Contact: ~%u (+/- %u)\n\r", estimate, (estimate * HLL_ERROR_PERMILLE + 500) / 1000);
+	if (peerDropped)
+		PRINTF("-> Not Remembered (Full): %u\n\r", peerDropped);
+}
+
+/**************************************************************/
+
+void DC27_CmdExport(uint8_t *line, uint32_t len)	// E: all badges met, one CSV line each
+{
+	const peer_record_t *peer;
+	uint32_t i;
+
+	PEER_Flush(true);
+
+	PRINTF("uid,type,flags,complete,first_s,last_s\n\r");
+	for (i = 0; i < PEER_INDEX_SIZE; i++)
+	{
+		if (peerIndex[i] == 0)
+			continue;
+
+		peer = PEER_Record(peerIndex[i]);
+		PRINTF("%08X,%u,%02X,%u,%u,%u\n\r", peer->uid, peer->type, peer->flags & FLAG_ALL_MASK,
+			(peer->flags & PEER_COMPLETE) ? 1 : 0, peer->first, peer->last);
+	}
+}
+
+/**************************************************************/
+
+void DC27_CmdHelp(uint8_t *line, uint32_t len)
+{
+	PRINTF(menu_banner);
+
+	if (badge_state == COMPLETE)  // if badge tasks are complete, display additional menu items
+		PRINTF(menu_banner_complete);
+}
+
+/**************************************************************/
+
+// ASCII art generator
+// Inspired by:
+// https://twitter.com/ef1j95/status/1101865167741173760
+// http://www.vintage-basic.net/bcg/love.bas
+// https://www.associationforpublicart.org/artwork/love/
+void DC27_ASCIIArt(uint8_t *A)
+{
+	volatile uint32_t I, J, L, C, P, A1, ptr;
+	uint8_t T[120];    // crafted line of text to print
+
+	L = strlen((char *)A); // input text from user
+
+	// craft a line based on the input text from user
+	for (J = 0; J < (ART_WIDTH / L) + 1; J++)
+	{
+	    for (I = 0; I < L; I++) // repeat the input text for the entire line
+	    {
+	        T[(J * L) + I] = A[I];
+	    }
+	}
+
+	C = 0;
+	A1 = 0;
+	ptr = 0;
+
+	while(1)
+	{
+	    if (A1 == 0 || A1 > ART_WIDTH)  // print one line at a time
+	    {
+	        A1 = 1;         // current column count into the line
+	        P = 0;          // flag to print message characters (true) or spaces (false)
+	        C += 1;
+	        if (C == ART_LINES)    // if we've reached the end of our artwork
+	        {
+		        PRINTF("\n\r");
+	            return;  // done!
+	        }
+	        PRINTF("\n\r ");
+	    }
 
 	    A[0] = ART_DATA[ptr++];  // read from the data array (number of the next set of characters or spaces)
 	    A1 += A[0];
@@ -1884,910 +2538,2628 @@ void DC27_ASCIIArt(uint8_t *A)
 	        P = 1;
 	    }
 	}
-}
+}
+
+/**************************************************************/
+
+int KL_Flash_Init(void)
+{
+	ftfx_security_state_t securityStatus = kFTFx_SecurityStateNotSecure;  // Memory protection status
+	status_t result;    // Return code from each flash driver function
+
+    // Clear structs
+    memset(&s_flashDriver, 0, sizeof(flash_config_t));
+    memset(&s_cacheDriver, 0, sizeof(ftfx_cache_config_t));
+
+    // Setup flash driver
+    result = FLASH_Init(&s_flashDriver);
+    if (result != kStatus_FTFx_Success)
+    {
+    	return 1;
+    }
+
+    // Setup flash cache driver
+    result = FTFx_CACHE_Init(&s_cacheDriver);
+    if (result != kStatus_FTFx_Success)
+    {
+    	return 1;
+    }
+
+    // Check security status
+    result = FLASH_GetSecurityState(&s_flashDriver, &securityStatus);
+    if (result != kStatus_FTFx_Success)
+    {
+    	return 1;
+    }
+
+    // Only proceed with unprotected memory (we won't be able to read/write otherwise)
+    if (securityStatus != kFTFx_SecurityStateNotSecure)
+    {
+    	return 1;
+    }
+
+    // Get flash properties
+    FLASH_GetProperty(&s_flashDriver, kFLASH_PropertyPflash0BlockBaseAddr, &pflashBlockBase);
+    FLASH_GetProperty(&s_flashDriver, kFLASH_PropertyPflash0TotalSize, &pflashTotalSize);
+    FLASH_GetProperty(&s_flashDriver, kFLASH_PropertyPflash0SectorSize, &pflashSectorSize);
+
+    // Move the vector table to RAM, so interrupts can still be taken during flash commands
+    memcpy(klVectors, (const void *)SCB->VTOR, sizeof(klVectors));
+    SCB->VTOR = (uintptr_t)klVectors;
+
+    // Print flash information to debug console
+    PRINTF("\n\r-> Memory Size = %dKB [0x%X]\n\r", (pflashTotalSize / 1024), pflashTotalSize);
+    PRINTF("-> Sector Size = %dKB [0x%X]\n\r", (pflashSectorSize / 1024), pflashSectorSize);
+
+    return 0;
+}
+
+/**************************************************************/
+
+// Address of a Flash sector counted from the end
+// In case of the protected sectors at the end of the pFlash just select
+// the block from the end of pFlash to be used for operations
+// sector = 1 means the last sector
+// sector = 2 means (the last sector - 1)
+uint32_t KL_Flash_Sector(uint32_t sector)
+{
+	return pflashBlockBase + (pflashTotalSize - (sector * pflashSectorSize));
+}
+
+/**************************************************************/
+
+// While a flash command runs the core can't fetch from flash, only RAM: the driver waits for it
+// from RAM, and the vector table, LPUART0 handler and KL_Post() are there too (__RAMFUNC) so bytes
+// from the NXH are still read. Every other interrupt, SysTick included, runs from flash and is
+// masked until KL_Flash_End(). Commands are only issued from tasks, one at a time
+void KL_Flash_Begin(void)
+{
+	uint32_t irq;
+
+	SysTick->CTRL &= ~SysTick_CTRL_TICKINT_Msk;	// reading CTRL also clears COUNTFLAG
+
+	flashMasked = 0;
+	for (irq = 0; irq < 32; irq++)
+	{
+		if (NVIC_GetEnableIRQ((IRQn_Type)irq))
+		{
+			NVIC_DisableIRQ((IRQn_Type)irq);
+			flashMasked |= 1UL << irq;
+		}
+	}
+
+	flashBusy = true;
+#ifndef __NXH_RECORD	// KL_Record() runs from flash
+	NVIC_EnableIRQ(LPUART0_SERIAL_RX_TX_IRQN);	// even if the task had it masked: the ISR only appends to the ring buffer
+#endif
+}
+
+/**************************************************************/
+
+void KL_Flash_End(void)
+{
+	uint32_t irq;
+
+	NVIC_DisableIRQ(LPUART0_SERIAL_RX_TX_IRQN);
+	flashBusy = false;
+
+	if (LPUART0_PERIPHERAL->STAT & LPUART_STAT_OR_MASK)	// left for us by the ISR
+	{
+		nxhOverruns++;
+		LPUART_ReadByte(LPUART0_PERIPHERAL);
+		LPUART_ClearStatusFlags(LPUART0_PERIPHERAL, kLPUART_RxOverrunFlag);
+	}
+
+	if (SysTick->CTRL & SysTick_CTRL_COUNTFLAG_Msk)		// a tick went by: take it now
+		SCB->ICSR = SCB_ICSR_PENDSTSET_Msk;
+	SysTick->CTRL |= SysTick_CTRL_TICKINT_Msk;
+
+	for (irq = 0; irq < 32; irq++)
+	{
+		if (flashMasked & (1UL << irq))
+			NVIC_EnableIRQ((IRQn_Type)irq);
+	}
+}
+
+/**************************************************************/
+
+// Erase a single Flash sector (sector 1 is the last)
+int KL_Flash_Erase(uint32_t sector)
+{
+	status_t result;    	// Return code from each flash driver function
+
+	if (sector == 0 || sector > DATA_SECTORS)	// only the data sectors, never the program image
+		return 1;
+
+    KL_Flash_Begin(); // Only the NXH receive interrupt during Flash write operations
+
+	// Prepare flash cache/prefetch/speculation
+	FTFx_CACHE_ClearCachePrefetchSpeculation(&s_cacheDriver, true);
+
+    result = FLASH_Erase(&s_flashDriver, KL_Flash_Sector(sector), pflashSectorSize, kFTFx_ApiEraseKey);
+
+    // Clean-up
+    FTFx_CACHE_ClearCachePrefetchSpeculation(&s_cacheDriver, false);
+
+    KL_Flash_End();
+    return (kStatus_FTFx_Success == result) ? 0 : 1;
+}
+
+/**************************************************************/
+
+// Program size bytes (multiple of 4) into erased Flash at destAddress and verify them
+int KL_Flash_Program(uint32_t destAddress, const uint32_t *data, uint32_t size)
+{
+	status_t result;    	// Return code from each flash driver function
+    uint32_t failAddr, failDat;
+
+	if (destAddress < KL_Flash_Sector(DATA_SECTORS) || destAddress + size > KL_Flash_Sector(0))	// only the data sectors
+		return 1;
+
+    KL_Flash_Begin(); // Only the NXH receive interrupt during Flash write operations
+
+	// Prepare flash cache/prefetch/speculation
+	FTFx_CACHE_ClearCachePrefetchSpeculation(&s_cacheDriver, true);
+
+    // Program user buffer into flash
+    result = FLASH_Program(&s_flashDriver, destAddress, (uint8_t *)data, size);
+
+    // Verify programming
+    if (kStatus_FTFx_Success == result)
+    	result = FLASH_VerifyProgram(&s_flashDriver, destAddress, size, (const uint8_t *)data, kFTFx_MarginValueUser,
+                                     &failAddr, &failDat);
+
+    // Clean-up
+    FTFx_CACHE_ClearCachePrefetchSpeculation(&s_cacheDriver, false);
+
+    KL_Flash_End();
+    return (kStatus_FTFx_Success == result) ? 0 : 1;
+}
+
+/**************************************************************/
+
+// Game data is a log of records appended across NVM_LOG_SECTORS sectors, so an update is a
+// single program. A sector is only erased once the log fills the other one and moves on to it,
+// and the newest record stays in the full sector until then. Records are only ever appended, so
+// in each sector the written ones come first: find where each sector's log ends (binary search),
+// the newest record is the last one there that was committed with a good CRC, usually the very
+// last. New records go after everything written, a torn one included.
+// Run once: sets nvmNewest and where the next record goes, KL_Flash_Write() keeps them up to date
+void KL_Flash_Find(void)
+{
+	static const nvm_record_t erased = { 0xFF, 0xFF, 0xFF, 0xFF, 0xFFFF, 0xFFFF };
+	const nvm_record_t *base;
+	uint32_t count = pflashSectorSize / sizeof(nvm_record_t);
+	uint32_t s, lo, hi, mid;
+
+	nvmNewest = NULL;
+	nvmSector = SECTOR_INDEX_FROM_END;
+	nvmSeq = 0;
+
+	for (s = 0; s < NVM_LOG_SECTORS; s++)
+	{
+		base = (const nvm_record_t *)KL_Flash_Sector(SECTOR_INDEX_FROM_END + s);
+
+		lo = 0;
+		hi = count;
+		while (lo < hi)
+		{
+			mid = (lo + hi) / 2;
+			if (!memcmp(&base[mid], &erased, sizeof(erased)))
+				hi = mid;
+			else
+				lo = mid + 1;
+		}
+
+		while (lo-- > 0)	// skip torn writes (and the original firmware's game data)
+		{
+			if (base[lo].seq == 0xFFFF || base[lo].crc != Get_CRC16(&base[lo], offsetof(nvm_record_t, crc)))
+				continue;	// not committed, or not all there
+
+			if (nvmNewest == NULL || (int16_t)(base[lo].seq - nvmNewest->seq) > 0)
+			{
+				nvmNewest = &base[lo];
+				nvmSector = SECTOR_INDEX_FROM_END + s;
+				nvmNext = KL_Flash_Sector(nvmSector) + hi * sizeof(nvm_record_t);
+				nvmSeq = nvmNewest->seq;
+			}
+			break;
+		}
+
+		if (s == 0 && nvmNewest == NULL)	// nothing valid (yet): start after whatever is there
+			nvmNext = KL_Flash_Sector(SECTOR_INDEX_FROM_END) + hi * sizeof(nvm_record_t);
+	}
+}
+
+/**************************************************************/
+
+// Append the badge state to the log (version, seq and crc are filled in here)
+// Two phases: the data longword, then seq and crc. Until the second one is programmed the
+// record doesn't count, so power lost at any point leaves the previous record the newest
+int KL_Flash_Write(nvm_record_t *record)
+{
+	const uint32_t *longwords = (const uint32_t *)record;
+	uint32_t sector;
+	int result;
+
+	if (nvmNext == 0)
+		KL_Flash_Find();
+
+	// At the end of the sector: erase the next one round and carry on there
+	if (nvmNext == KL_Flash_Sector(nvmSector) + pflashSectorSize)
+	{
+		sector = (nvmSector + 1 < SECTOR_INDEX_FROM_END + NVM_LOG_SECTORS) ? nvmSector + 1 : SECTOR_INDEX_FROM_END;
+		if (KL_Flash_Erase(sector))
+			return 1;
+		nvmSector = sector;
+		nvmNext = KL_Flash_Sector(sector);
+	}
+
+	record->version = NVM_VERSION;
+	record->seq = (nvmSeq + 1 == 0xFFFF) ? 0 : nvmSeq + 1;	// 0xFFFF is an erased commit longword
+	record->crc = Get_CRC16(record, offsetof(nvm_record_t, crc));
+
+	result = KL_Flash_Program(nvmNext, &longwords[0], 4);
+	if (result == 0)
+		result = KL_Flash_Program(nvmNext + 4, &longwords[1], 4);	// commit
+	nvmNext += sizeof(nvm_record_t);	// a failed record is skipped, the caller tries again in the next one
+	if (result == 0)
+	{
+		nvmNewest = (const nvm_record_t *)(nvmNext - sizeof(nvm_record_t));
+		nvmSeq = record->seq;
+	}
+
+	return result;
+}
+
+/**************************************************************/
+
+// Newest badge state, in this firmware's layout. Returns 1 if there is none (first power-up).
+// Older layouts are migrated: version 0 records only kept the game flags, and the original
+// firmware kept them at the start of the last sector, one byte per longword (they still count
+// if no record has been written since)
+int KL_Flash_Read(nvm_record_t *state)
+{
+	uint32_t i, data = 0;
+    uint32_t destAddress; 	// Base address of the target memory location
+
+	if (nvmNext == 0)
+		KL_Flash_Find();
+
+	memset(state, 0, sizeof(*state));
+	state->brightness = LED_BRIGHTNESS_NORMAL;
+	state->version = NVM_VERSION;
+
+	if (nvmNewest != NULL)
+	{
+		state->flags = nvmNewest->flags;
+		if (nvmNewest->version >= 1)
+			state->brightness = nvmNewest->brightness;
+		return 0;
+	}
+
+    // calculate address
+	destAddress = KL_Flash_Sector(SECTOR_INDEX_FROM_END);
+
+    for (i = 0; i < NVM_DATA_SIZE; i++)
+    {
+        data <<= 8;
+        data |= (*(volatile uint32_t *)(destAddress + i * 4) & 0xFF);
+    }
+
+    if (data == 0xFFFFFFFF)		// on first use/power-up of the badge, the flash area will be uninitialized
+    	return 1;
+
+    state->flags = (uint8_t)data;
+    return 0;
+}
+
+/**************************************************************/
+
+// Peer database: every badge we've heard from, keyed on its uid. Records are appended to a log
+// that takes turns across PEER_SECTORS sectors (like the game data, an update is one program),
+// each sector starting with a header whose seq orders them. peerIndex finds a uid's newest
+// record without reading the log. When the last erased sector is opened, the oldest one's
+// live records are copied into it and the oldest is erased, so there's always a sector to go to.
+// Sightings are queued in RAM and written together (see PEER_Flush())
+const peer_record_t *PEER_Record(uint32_t slot)	// log slot: sector * PEER_SLOTS + record (0 = the header)
+{
+	return (const peer_record_t *)(KL_Flash_Sector(PEER_SECTOR_FROM_END + slot / PEER_SLOTS) + (slot % PEER_SLOTS) * sizeof(peer_record_t));
+}
+
+/**************************************************************/
+
+// Position in peerIndex holding uid, or the empty one where it goes (open addressing, the
+// index is never more than half full)
+uint32_t PEER_Probe(uint32_t uid)
+{
+	uint32_t i = (uid * 2654435761U) >> (32 - PEER_INDEX_BITS);	// Fibonacci hashing
+
+	while (peerIndex[i] != 0 && PEER_Record(peerIndex[i])->uid != uid)
+		i = (i + 1) & (PEER_INDEX_SIZE - 1);
+
+	return i;
+}
+
+/**************************************************************/
+
+// Read the log into peerIndex, oldest sector first so newer records replace older ones
+void PEER_Init(void)
+{
+	static const peer_record_t erased = { 0xFFFFFFFF, 0xFFFFFFFF, 0xFFFFFFFF, 0xFF, 0xFF, 0xFFFF };
+	const peer_header_t *header;
+	const peer_record_t *record;
+	uint8_t order[PEER_SECTORS];
+	uint32_t i, j, s, n = 0, foreign = 0, slot;
+
+	memset(peerIndex, 0, sizeof(peerIndex));
+	peerCount = 0;
+	peerEpoch = 0;
+	peerNext = PEER_SLOTS;	// no sector to append to until PEER_Open()
+
+	for (s = 0; s < PEER_SECTORS; s++)
+	{
+		header = (const peer_header_t *)PEER_Record(s * PEER_SLOTS);
+		peerSeq[s] = 0;
+		if (header->magic == PEER_MAGIC && header->seq != 0 && header->check == ~header->seq)
+		{
+			peerSeq[s] = header->seq;
+			for (i = n++; i > 0 && peerSeq[order[i - 1]] > header->seq; i--)
+				order[i] = order[i - 1];
+			order[i] = s;
+		}
+		else if (header->magic == PEER_MAGIC)	// torn header (the magic goes first), start the sector again
+			KL_Flash_Erase(PEER_SECTOR_FROM_END + s);
+		else if (header->magic != 0xFFFFFFFF)	// can't tell it's ours: never erased, never used
+		{
+			peerSeq[s] = PEER_FOREIGN;
+			foreign++;
+		}
+	}
+
+	peerMax = (foreign + 2U < PEER_SECTORS) ? PEER_MAX - foreign * (PEER_SLOTS - 1U) : 0;
+
+	for (j = 0; j < n; j++)
+	{
+		s = order[j];
+		for (i = 1; i < PEER_SLOTS; i++)
+		{
+			slot = s * PEER_SLOTS + i;
+			record = PEER_Record(slot);
+			if (!memcmp(record, &erased, sizeof(erased)))
+				break;	// end of the log in this sector
+			if (record->crc != Get_CRC16(record, offsetof(peer_record_t, crc)))
+				continue;	// torn write, or not committed
+
+			if (peerIndex[PEER_Probe(record->uid)] == 0)
+				peerCount++;
+			PEER_Index(slot);
+			if (record->last > peerEpoch)
+				peerEpoch = record->last;
+		}
+		peerHead = s;
+		peerNext = i;
+	}
+
+	// Power lost while the oldest sector was being reclaimed: finish the job
+	if (n > 1 && n + foreign == PEER_SECTORS)
+		PEER_Reclaim(order[0]);
+}
+
+/**************************************************************/
+
+void PEER_Index(uint32_t slot)	// make the record in slot its uid's newest
+{
+	const peer_record_t *record = PEER_Record(slot);
+
+	peerIndex[PEER_Probe(record->uid)] = slot;
+}
+
+/**************************************************************/
+
+// Start appending to an erased sector. If it was the last one, reclaim the oldest sector
+int PEER_Open(void)
+{
+	peer_header_t header = { PEER_MAGIC, 0, 0xFFFFFFFF, 0 };
+	const uint32_t *p;
+	uint32_t s, i, address, free = PEER_SECTORS, oldest = PEER_SECTORS, erased = 0;
+
+	for (s = 0; s < PEER_SECTORS; s++)
+	{
+		if (peerSeq[s] == PEER_FOREIGN)
+			continue;
+
+		if (peerSeq[s] == 0)
+		{
+			free = s;
+			erased++;
+		}
+		else if (oldest == PEER_SECTORS || peerSeq[s] < peerSeq[oldest])
+			oldest = s;
+
+		if (peerSeq[s] > header.seq)
+			header.seq = peerSeq[s];
+	}
+
+	if (free == PEER_SECTORS)
+		return 1;
+
+	header.seq++;
+	header.check = ~header.seq;
+
+	// An erase cut short may have left bits programmed
+	address = KL_Flash_Sector(PEER_SECTOR_FROM_END + free);
+	p = (const uint32_t *)address;
+	for (i = 0; i < PEER_SECTOR_SIZE / 4 && p[i] == 0xFFFFFFFF; i++) {}
+
+	if ((i < PEER_SECTOR_SIZE / 4 && KL_Flash_Erase(PEER_SECTOR_FROM_END + free)) ||
+		KL_Flash_Program(address, (const uint32_t *)&header, sizeof(header)))
+		return 1;
+
+	peerSeq[free] = header.seq;
+	peerHead = free;
+	peerNext = 1;
+
+	if (erased == 1 && oldest != PEER_SECTORS)
+		return PEER_Reclaim(oldest);
+
+	return 0;
+}
+
+/**************************************************************/
+
+// Copy the records in sector s that are still their uid's newest to the end of the log, then
+// erase s. They fit: the head sector was just opened. A power loss part way leaves both copies,
+// the new ones win (newer seq)
+int PEER_Reclaim(uint32_t s)
+{
+	uint32_t i, slot;
+
+	for (i = 1; i < PEER_SLOTS; i++)
+	{
+		slot = s * PEER_SLOTS + i;
+		if (peerIndex[PEER_Probe(PEER_Record(slot)->uid)] != slot)
+			continue;	// superseded, torn or erased
+
+		if (peerNext == PEER_SLOTS || PEER_Append(PEER_Record(slot)))
+			return 1;
+	}
+
+	if (KL_Flash_Erase(PEER_SECTOR_FROM_END + s))
+		return 1;
+
+	peerSeq[s] = 0;
+	return 0;
+}
+
+/**************************************************************/
+
+// Append a record to the log (crc is filled in here) and index it
+// Two phases like KL_Flash_Write(): uid, first and last, then type, flags and crc commit it
+int PEER_Append(const peer_record_t *record)
+{
+	peer_record_t r = *record;	// may be in the sector PEER_Open() is about to reclaim
+	uint32_t slot, address;
+	int result;
+
+	if (peerNext == PEER_SLOTS && PEER_Open())
+		return 1;
+
+	r.crc = Get_CRC16(&r, offsetof(peer_record_t, crc));
+
+	slot = peerHead * PEER_SLOTS + peerNext;
+	address = KL_Flash_Sector(PEER_SECTOR_FROM_END + peerHead) + peerNext * sizeof(peer_record_t);
+	peerNext++;	// a failed record is skipped, the caller tries again in the next one
+
+	result = KL_Flash_Program(address, (const uint32_t *)&r, 12);
+	if (result == 0)
+		result = KL_Flash_Program(address + 12, (const uint32_t *)&r + 3, 4);	// commit
+	if (result == 0)
+		PEER_Index(slot);
+
+	return result;
+}
+
+/**************************************************************/
+
+// Note the sender of a packet. Sightings of the same badge are merged while they're queued
+void PEER_See(const struct packet_of_infamy *packet)
+{
+	peer_record_t *peer = NULL;
+	uint32_t i, slot, now;
+	uint8_t flags = packet->flags & FLAG_ALL_MASK;
+
+	now = PEER_Time();
+	peerSightings++;
+	HLL_Add(hllState.met, packet->uid);	// counted even once the database is full
+	nvmWait = NVM_COMMIT_DELAY;	// written once things settle (DC27_Flush())
+
+	for (i = 0; i < peerQueued; i++)
+	{
+		if (peerQueue[i].uid == packet->uid)
+			peer = &peerQueue[i];
+	}
+
+	if (peer == NULL)
+	{
+		if (peerQueued == PEER_QUEUE_SIZE)
+			PEER_Flush(true);
+
+		slot = peerIndex[PEER_Probe(packet->uid)];
+		if (slot == 0 && peerCount >= peerMax)
+		{
+			// Full: with no record to say whether it was complete before, the packet alone decides
+			if (flags == FLAG_ALL_MASK)
+				HLL_Add(hllState.helped, packet->uid);
+			peerDropped++;
+			return;
+		}
+
+		peer = &peerQueue[peerQueued++];
+		if (slot != 0)
+			*peer = *PEER_Record(slot);
+		else
+		{
+			memset(peer, 0, sizeof(*peer));
+			peer->uid = packet->uid;
+			peer->first = now;
+			peer->type = packet->type;
+			peer->flags = flags | ((flags == FLAG_ALL_MASK) ? PEER_COMPLETE : 0);
+			peerCount++;
+			peerUrgent = true;
+		}
+	}
+
+	if (peer->type != packet->type || (peer->flags & FLAG_ALL_MASK) != flags)
+		peerUrgent = true;
+
+	if (flags == FLAG_ALL_MASK && !(peer->flags & PEER_COMPLETE))
+		HLL_Add(hllState.helped, packet->uid);	// completed the quest since we first heard from it
+
+	peer->last = now;
+	peer->type = packet->type;
+	peer->flags = (peer->flags & PEER_COMPLETE) | flags | ((flags == FLAG_ALL_MASK) ? PEER_COMPLETE : 0);
+}
+
+/**************************************************************/
+
+// Badge time: seconds switched on over every power-up, carried over from the log (see PEER_Init())
+uint32_t PEER_Time(void)
+{
+	return peerEpoch + KL_Time();
+}
+
+/**************************************************************/
+
+// Write the queued sightings: all of them, or only if there's news (a new badge or new flags).
+// Just having seen a badge again can wait for a full queue, only its last sighting is lost if
+// the badge is switched off first
+void PEER_Flush(bool all)
+{
+	bool error = false;
+	uint32_t i;
+
+	if (peerQueued == 0 || (!all && !peerUrgent && peerQueued < PEER_QUEUE_SIZE))
+		return;
+
+	for (i = 0; i < peerQueued; i++)
+	{
+		if (PEER_Append(&peerQueue[i]) == 0 || PEER_Append(&peerQueue[i]) == 0)
+			continue;
+
+		if (peerIndex[PEER_Probe(peerQueue[i].uid)] == 0)
+			peerCount--;	// lost
+		error = true;
+	}
+
+	peerQueued = 0;
+	peerUrgent = false;
+
+	if (error)
+	{
+		KL_Error(true, false);  // Beep the piezo to indicate a failure
+		PRINTF("[*] Flash Write Error!\n\r");
+	}
+}
+
+/**************************************************************/
+
+int PEER_Get(uint32_t uid, peer_record_t *peer)	// what we know about uid, 1 if we've never heard from it
+{
+	uint32_t i, slot;
+
+	for (i = 0; i < peerQueued; i++)
+	{
+		if (peerQueue[i].uid == uid)
+		{
+			*peer = peerQueue[i];
+			return 0;
+		}
+	}
+
+	slot = peerIndex[PEER_Probe(uid)];
+	if (slot == 0)
+		return 1;
+
+	*peer = *PEER_Record(slot);
+	return 0;
+}
+
+/**************************************************************/
+
+// Unique badge estimates: HyperLogLog sketches of the uids heard from, which keep counting
+// once the peer database is full. A uid's hash picks one of HLL_REGISTERS registers, which
+// keeps the longest run of leading zeros seen in the rest of the hash (+1, up to HLL_RANK_MAX)
+uint32_t HLL_Register(const uint8_t *sketch, uint32_t j)
+{
+	return (sketch[j >> 1] >> ((j & 1) * 4)) & 0x0F;
+}
+
+/**************************************************************/
+
+void HLL_Add(uint8_t *sketch, uint32_t uid)
+{
+	uint32_t h = uid, j, rank = 1;
+
+	// MurmurHash3 finalizer: uids are often sequential, the registers need them spread out
+	h ^= h >> 16;
+	h *= 0x85EBCA6BU;
+	h ^= h >> 13;
+	h *= 0xC2B2AE35U;
+	h ^= h >> 16;
+
+	j = h >> (32 - HLL_BITS);
+	h <<= HLL_BITS;
+	while (rank < HLL_RANK_MAX && !(h & 0x80000000U))
+	{
+		rank++;
+		h <<= 1;
+	}
+
+	if (rank > HLL_Register(sketch, j))
+	{
+		sketch[j >> 1] = (sketch[j >> 1] & ~(0x0F << ((j & 1) * 4))) | (rank << ((j & 1) * 4));
+		hllChanges++;
+	}
+}
+
+/**************************************************************/
+
+// Distinct uids added. Relative standard error is HLL_ERROR_PERMILLE, less while under
+// 2.5 * HLL_REGISTERS, where it's worked out from the empty registers instead (linear counting)
+// Integer only: 0.7213 / (1 + 1.079 / m) * m^2 / sum(2^-register), sum scaled by 2^HLL_RANK_MAX
+uint32_t HLL_Estimate(const uint8_t *sketch)
+{
+	uint32_t j, r, sum = 0, zeros = 0, e;
+
+	for (j = 0; j < HLL_REGISTERS; j++)
+	{
+		r = HLL_Register(sketch, j);
+		sum += 1UL << (HLL_RANK_MAX - r);
+		if (r == 0)
+			zeros++;
+	}
+
+	e = HLL_ALPHA_M2 * (1UL << HLL_RANK_MAX) / sum;
+	if (e <= HLL_REGISTERS * 5 / 2 && zeros != 0)	// m * ln(m / zeros), ln 2 = 45426 / 2^16
+		e = (HLL_REGISTERS * (((HLL_BITS << 16) - HLL_Log2(zeros)) * 45426ULL >> 16) + 0x8000) >> 16;
+
+	return e;
+}
+
+/**************************************************************/
+
+uint32_t HLL_Log2(uint32_t x)	// log2(x) with 16 fractional bits, 1 <= x < 2^16
+{
+	uint32_t y = 0, z;
+	int i;
+
+	while ((x >> (y + 1)) != 0)	// integer part
+		y++;
+
+	z = x << (15 - y);	// x / 2^y, 15 fractional bits: 1 <= z < 2
+	y <<= 16;
+	for (i = 15; i >= 0; i--)	// squaring z doubles its log: each overflow is the next bit
+	{
+		z = (z * z) >> 15;
+		if (z >= (2UL << 15))
+		{
+			z >>= 1;
+			y |= 1UL << i;
+		}
+	}
+
+	return y;
+}
+
+/**************************************************************/
+
+// The sketches are kept in HLL_LOG_SECTORS sectors taking turns. Each starts with a snapshot of
+// them, followed by a log of the registers that rose since, a longword each: the change in the low
+// half, its complement in the high half so torn or erased ones don't count. A register only rises
+// (at most HLL_RANK_MAX times), so replaying them in any order gives the sketches back, and a sector
+// is only erased once a log fills up. Load the newest snapshot into hllState and replay its log
+void HLL_Load(void)
+{
+	const hll_record_t *record, *newest = NULL;
+	const uint32_t *delta;
+	uint8_t *sketch;
+	uint32_t s, i, d, j;
+
+	memset(&hllState, 0, sizeof(hllState));
+	hllSector = HLL_LOG_SECTORS;	// none: HLL_Save() starts one
+	hllNext = HLL_DELTAS;
+
+	for (s = 0; s < HLL_LOG_SECTORS; s++)
+	{
+		record = (const hll_record_t *)KL_Flash_Sector(HLL_SECTOR_FROM_END + s);
+		if (record->magic != HLL_MAGIC || record->seq == 0xFFFF || record->crc != Get_CRC16(record, offsetof(hll_record_t, crc)))
+			continue;	// not ours, not committed, or not all there
+
+		if (newest == NULL || (int16_t)(record->seq - newest->seq) > 0)
+		{
+			newest = record;
+			hllSector = s;
+		}
+	}
+
+	if (newest != NULL)
+	{
+		hllState = *newest;
+		delta = (const uint32_t *)(newest + 1);
+		hllNext = 0;
+		for (i = 0; i < HLL_DELTAS; i++)
+		{
+			d = delta[i];
+			if (d != 0xFFFFFFFF)
+				hllNext = i + 1;	// after anything written, a torn one included
+			if ((d >> 16) != (~d & 0xFFFF))
+				continue;
+
+			sketch = (d & 0x1000) ? hllState.helped : hllState.met;
+			j = (d >> 4) & (HLL_REGISTERS - 1);
+			if ((d & 0x0F) > HLL_Register(sketch, j))
+				sketch[j >> 1] = (sketch[j >> 1] & ~(0x0F << ((j & 1) * 4))) | ((d & 0x0F) << ((j & 1) * 4));
+		}
+	}
+
+	hllSaved = hllState;
+	hllChanges = 0;
+}
+
+/**************************************************************/
+
+// Log the registers that rose since the last save, HLL_SAVE_BATCH to a program. A new badge
+// changes a register less and less often and each change is a longword, so there's no waiting
+// for more of them. With no room left, start the other sector with a snapshot instead
+int HLL_Save(void)
+{
+	uint32_t delta[HLL_SAVE_BATCH];
+	uint32_t k, j, r, n = 0, value, address;
+	const uint8_t *sketch, *saved;
+	int result = 0;
+
+	if (hllChanges == 0)
+		return 0;
+
+	for (k = 0; k < 2 * HLL_REGISTERS && result == 0; k++)
+	{
+		j = k % HLL_REGISTERS;
+		sketch = (k < HLL_REGISTERS) ? hllState.met : hllState.helped;
+		saved = (k < HLL_REGISTERS) ? hllSaved.met : hllSaved.helped;
+		r = HLL_Register(sketch, j);
+		if (r != HLL_Register(saved, j))
+		{
+			if (hllNext + n >= HLL_DELTAS)
+				return HLL_Snapshot();	// has them all
+
+			value = ((k / HLL_REGISTERS) << 12) | (j << 4) | r;
+			delta[n++] = (~value << 16) | value;
+		}
+
+		if (n == HLL_SAVE_BATCH || (n != 0 && k == 2 * HLL_REGISTERS - 1))
+		{
+			address = KL_Flash_Sector(HLL_SECTOR_FROM_END + hllSector) + sizeof(hll_record_t) + hllNext * 4;
+			result = KL_Flash_Program(address, delta, n * 4);
+			hllNext += n;	// failed ones are skipped, and saved again next time
+			n = 0;
+		}
+	}
+
+	if (result == 0)
+	{
+		hllSaved = hllState;
+		hllChanges = 0;
+	}
+
+	return result;
+}
+
+/**************************************************************/
+
+// Start the other sector with a snapshot of the sketches, erasing it first if it isn't blank.
+// Only a sector starting with HLL_MAGIC or erased is taken: anything else isn't ours to erase.
+// The one it replaces is left whole until the snapshot is committed, unless it's the only one
+int HLL_Snapshot(void)
+{
+	const uint32_t *p = NULL;
+	uint32_t i, s = 0, address = 0;
+	int result;
+
+	for (i = 1; i <= HLL_LOG_SECTORS; i++)
+	{
+		s = (hllSector + i) % HLL_LOG_SECTORS;
+		address = KL_Flash_Sector(HLL_SECTOR_FROM_END + s);
+		p = (const uint32_t *)address;
+		if (p[0] == HLL_MAGIC || p[0] == 0xFFFFFFFF)
+			break;	// the current sector comes last
+	}
+
+	if (i > HLL_LOG_SECTORS)
+		return 1;	// nowhere to go
+
+	for (i = 0; i < PEER_SECTOR_SIZE / 4 && p[i] == 0xFFFFFFFF; i++) {}
+	if (i < PEER_SECTOR_SIZE / 4 && KL_Flash_Erase(HLL_SECTOR_FROM_END + s))
+		return 1;
+
+	hllState.magic = HLL_MAGIC;
+	hllState.seq = (hllState.seq + 1 == 0xFFFF) ? 0 : hllState.seq + 1;	// 0xFFFF is an erased commit longword
+	hllState.crc = Get_CRC16(&hllState, offsetof(hll_record_t, crc));
+
+	result = KL_Flash_Program(address, (const uint32_t *)&hllState, offsetof(hll_record_t, seq));
+	if (result == 0)
+		result = KL_Flash_Program(address + offsetof(hll_record_t, seq), (const uint32_t *)&hllState.seq, 4);	// commit
+	if (result)
+		return result;	// erased again next time
+
+	hllSector = s;
+	hllNext = 0;
+	hllSaved = hllState;
+	hllChanges = 0;
+	return 0;
+}
+
+/**************************************************************/
+
+bool KL_Check_RX(void)  // check if USB-to-Serial adapter is connected
+{
+	bool res;
+
+	// re-map pin from KL_RX to GPIO E23
+	gpio_pin_config_t KL_RX_config = {
+	        .pinDirection = kGPIO_DigitalInput,
+	        .outputLogic = 0U
+	    };
+	GPIO_PinInit(GPIOE, BOARD_INITPINS_KL_RX_PIN, &KL_RX_config);
+    PORT_SetPinMux(BOARD_INITPINS_KL_RX_PORT, BOARD_INITPINS_KL_RX_PIN, kPORT_MuxAsGpio);
+	    PORTE->PCR[BOARD_INITPINS_KL_RX_PIN] = ((PORTE->PCR[BOARD_INITPINS_KL_RX_PIN] &
+	                      /* Mask bits to zero which are setting */
+	                      (~(PORT_PCR_PS_MASK | PORT_PCR_PE_MASK | PORT_PCR_ISF_MASK)))
+
+	                     /* Pull Select: Internal pulldown resistor is enabled on the corresponding pin, if the
+	                      * corresponding PE field is set. */
+	                     | (uint32_t)(kPORT_PullDown));
+	SysTick_DelayTicks(10);
+
+	res = (bool)GPIO_PinRead(GPIOE, BOARD_INITPINS_KL_RX_PIN);
+
+	// set KL_RX back to UART2_RX
+    PORT_SetPinInterruptConfig(BOARD_INITPINS_KL_RX_PORT, BOARD_INITPINS_KL_RX_PIN, kPORT_InterruptOrDMADisabled);
+	    PORT_SetPinMux(BOARD_INITPINS_KL_RX_PORT, BOARD_INITPINS_KL_RX_PIN, kPORT_MuxAlt4);
+	    SysTick_DelayTicks(10);
+
+	return res;
+}
+
+/**************************************************************/
+
+void KL_Error(bool error_piezo, bool error_led)
+{
+	int i;
+
+	if (error_piezo || error_led)
+	{
+		FX_Stop();	// we drive the LEDs and piezo ourselves
+
+		for (i = 0; i < 5; ++i)
+		{
+			if (error_led)
+			{
+				LED_Fill(LED_LAYER_NOTIFY, LED_ALL_CHANNELS, FX_ALL_LEDS, LED_LEVEL_MAX);
+				LED_Update();
+			}
+
+			if (error_piezo)
+				KL_Piezo(2600, 250, 50);
+			else
+				SysTick_DelayTicks(250);
+
+			if (error_led)
+			{
+				LED_Fill(LED_LAYER_NOTIFY, LED_ALL_CHANNELS, 0, 0);
+				LED_Update();
+			}
+
+			SysTick_DelayTicks(250);
+		}
+
+		if (error_led)
+		{
+			LED_Fill(LED_LAYER_NOTIFY, 0, 0, 0);	// back to the state display
+			LED_Update();
+		}
+	}
+}
+
+/**************************************************************/
+
+void KL_Sleep(void)	// VLPS until the next interrupt (LPTMR, NXH_DETECT or KL_RX)
+{
+	SysTick->CTRL = SysTick_CTRL_CLKSOURCE_Msk | SysTick_CTRL_ENABLE_Msk; // Disable SysTick timer interrupt while we sleep
+
+	SMC_PreEnterStopModes();
+    SMC_SetPowerModeVlps(SMC);  // Zzzz...
+    SMC_PostExitStopModes();
+
+    SysTick->CTRL = SysTick_CTRL_CLKSOURCE_Msk | SysTick_CTRL_TICKINT_Msk  | SysTick_CTRL_ENABLE_Msk; // Re-enable SysTick timer interrupt
+}
+
+/**************************************************************/
+
+void KL_Wait(void)	// WAIT mode until the next interrupt (SysTick keeps running, unlike VLPS)
+{
+	SMC_PreEnterWaitModes();
+	SMC_SetPowerModeWait(SMC);
+	SMC_PostExitWaitModes();
+}
+
+/**************************************************************/
+
+// Queue an event for its task (ISR or main context)
+// An event already waiting isn't queued again, so the queue can't overflow
+__RAMFUNC(RAM) void KL_Post(kl_event_t ev)	// in RAM for the LPUART0 handler (see KL_Flash_Begin())
+{
+	uint32_t primask = DisableGlobalIRQ();
+
+	if (!(eventPending & (1U << ev)))
+	{
+		eventPending |= 1U << ev;
+		eventQueue[eventHead] = ev;
+		eventHead = (eventHead + 1) & (KL_EVENT_QUEUE_SIZE - 1);
+	}
+
+	EnableGlobalIRQ(primask);
+}
+
+/**************************************************************/
+
+bool KL_Dispatch(void)	// run the task for the oldest event, false if there are none
+{
+	static const kl_task_t kl_tasks[KL_EVENT_COUNT] =
+	{
+		[KL_EVENT_PACKET] = DC27_TaskRadio,
+		[KL_EVENT_TIMER] = DC27_TaskGame,
+		[KL_EVENT_IDLE] = DC27_TaskGame,
+		[KL_EVENT_LED] = DC27_TaskLED,
+		[KL_EVENT_ATTACH] = DC27_TaskConsole,
+		[KL_EVENT_CONSOLE] = DC27_TaskConsole,
+		[KL_EVENT_SAVE] = DC27_TaskSave
+	};
+	uint32_t primask;
+	kl_event_t ev;
+
+	if (eventTail == eventHead)
+		return false;
+
+	primask = DisableGlobalIRQ();
+	ev = (kl_event_t)eventQueue[eventTail];
+	eventTail = (eventTail + 1) & (KL_EVENT_QUEUE_SIZE - 1);
+	eventPending &= ~(1U << ev);	// from here on, the ISRs can post it again
+	EnableGlobalIRQ(primask);
+
+	kl_tasks[ev](ev);
+	return true;
+}
+
+/**************************************************************/
+
+// VLPS (Very Low Power Sleep) is fine unless effects are playing, a packet is on its way over LPUART0
+// or we're in interactive mode, which need SysTick and the UART clocks, or the piezo or CLKOUT
+// (NXH2261 calibration) are on, which need the bus clock: then it's WAIT mode
+bool KL_CanSleep(void)
+{
+	return !FX_Busy() && !LED_Busy() && nxhListen == 0 && !nxhUpdating && !consoleActive &&
+		!(TPM0_PERIPHERAL->SC & TPM_SC_CMOD_MASK) && !(SIM->SOPT2 & SIM_SOPT2_CLKOUTSEL_MASK);
+}
+
+/**************************************************************/
+
+// Nothing to do: sleep until an ISR posts an event, in VLPS if we can (see KL_CanSleep())
+void KL_Idle(void)
+{
+	bool deep = KL_CanSleep();
+	uint32_t primask;
+
+	if (deep)
+	{
+		DC27_Flush(false);	// the badge may be switched off while it sleeps
+
+		// MCU will wake up on NXH_DETECT external interrupt (when NXH successfully receives a data packet),
+		// the LPTMR (LED heartbeat/sparkle) or if USB-to-serial adapter is connected
+		if (badge_state != COMPLETE)
+			PRINTF("[*] Sleeping...");
+#ifdef __NXH_RECORD
+		KL_Record_Flush();
+#endif
+		DbgConsole_Flush();	// wait for TX buffer to empty
+	}
+
+	primask = DisableGlobalIRQ();	// an event posted from here on still wakes us up
+	if (eventTail == eventHead)
+	{
+		if (deep && nxhListen == 0)
+			KL_Sleep();
+		else
+			KL_Wait();
+	}
+	EnableGlobalIRQ(primask);
+
+	if (deep && badge_state != COMPLETE)
+		PRINTF("Awake!\n\r");
+}
+
+/**************************************************************/
+
+void KL_StartTimer(uint32_t ms)	// post KL_EVENT_TIMER after ms (LPTMR runs in VLPS)
+{
+	KL_Timer_Set(KL_TIMER_GAME, ms);
+}
+
+/**************************************************************/
+
+// LPTMR0 is shared by the game timer and delays sleeping in VLPS: it's started for the timer
+// due first, and when it stops (it's due, or another timer is set), the time it ran is taken
+// off all of them and added to the clock. Stop it and charge that time, posting the game
+// timer's event if it's up. IRQs disabled (or from LPTMR0_IRQHandler()), KL_Timer_Start() follows
+void KL_Timer_Charge(void)
+{
+	uint32_t elapsed, i;
+
+	if (lptmrPeriod == 0U)
+		return;
+
+	if (LPTMR_GetStatusFlags(LPTMR0_PERIPHERAL) & kLPTMR_TimerCompareFlag)
+		elapsed = lptmrPeriod;	// the counter has started over
+	else
+		elapsed = LPTMR_GetCurrentTimerCount(LPTMR0_PERIPHERAL);
+
+	LPTMR_StopTimer(LPTMR0_PERIPHERAL);	// also clears the counter
+	LPTMR_ClearStatusFlags(LPTMR0_PERIPHERAL, kLPTMR_TimerCompareFlag);
+	lptmrPeriod = 0U;
+
+	lptmrMs += elapsed;
+	if (lptmrMs >= 1000U)
+	{
+		lptmrSeconds += lptmrMs / 1000U;
+		lptmrMs %= 1000U;
+	}
+
+	for (i = 0; i < KL_TIMER_COUNT; ++i)
+	{
+		if (lptmrLeft[i] == 0U)
+			continue;
+
+		lptmrLeft[i] = (lptmrLeft[i] > elapsed) ? lptmrLeft[i] - elapsed : 0U;
+		if (lptmrLeft[i] == 0U && i == KL_TIMER_GAME)
+			KL_Post(KL_EVENT_TIMER);
+	}
+}
+
+/**************************************************************/
+
+void KL_Timer_Start(void)	// start LPTMR0 for the timer due first (after KL_Timer_Charge())
+{
+	uint32_t i;
+
+	for (i = 0; i < KL_TIMER_COUNT; ++i)
+	{
+		if (lptmrLeft[i] != 0U && (lptmrPeriod == 0U || lptmrLeft[i] < lptmrPeriod))
+			lptmrPeriod = lptmrLeft[i];
+	}
+
+	if (lptmrPeriod == 0U)
+		lptmrPeriod = KL_CLOCK_PERIOD;	// none running: keep counting for KL_Time()
+
+	LPTMR_SetTimerPeriod(LPTMR0_PERIPHERAL, lptmrPeriod);
+	LPTMR_StartTimer(LPTMR0_PERIPHERAL);
+}
+
+/**************************************************************/
+
+void KL_Timer_Set(kl_timer_t timer, uint32_t ms)	// (re)start a timer, 0 = stop it
+{
+	uint32_t primask = DisableGlobalIRQ();
+
+	KL_Timer_Charge();
+	lptmrLeft[timer] = ms;
+	KL_Timer_Start();
+
+	EnableGlobalIRQ(primask);
+}
+
+/**************************************************************/
+
+uint32_t KL_Timer_Stop(kl_timer_t timer)	// stop a timer, returns the ms it had left
+{
+	uint32_t primask = DisableGlobalIRQ();
+	uint32_t left;
+
+	KL_Timer_Charge();
+	left = lptmrLeft[timer];
+	lptmrLeft[timer] = 0U;
+	KL_Timer_Start();
+
+	EnableGlobalIRQ(primask);
+	return left;
+}
+
+/**************************************************************/
+
+// Seconds since power-up, asleep or not: LPTMR0 never stops (SysTick does in VLPS). It's restarted
+// whenever a timer is set, so it loses a fraction of a ms each time, fine for when we met a badge
+uint32_t KL_Time(void)
+{
+	uint32_t primask = DisableGlobalIRQ();
+	uint32_t ms = lptmrMs, seconds = lptmrSeconds;
+
+	if (LPTMR_GetStatusFlags(LPTMR0_PERIPHERAL) & kLPTMR_TimerCompareFlag)
+		ms += lptmrPeriod;	// LPTMR0_IRQHandler() hasn't run yet
+	else
+		ms += LPTMR_GetCurrentTimerCount(LPTMR0_PERIPHERAL);
+
+	EnableGlobalIRQ(primask);
+	return seconds + ms / 1000U;
+}
+
+/**************************************************************/
+
+// Output square wave to the piezo element using the provided parameters
+// frequency (Hz), duration (ms), duty cycle (%)
+void KL_Piezo(uint32_t freq_Hz, uint32_t duration_ms, uint8_t pwm_duty)
+{
+	KL_Piezo_Tone(freq_Hz, pwm_duty);
+
+	if (duration_ms > 0)
+		SysTick_DelayTicks(duration_ms); // Duration of note (delay for specified length in ms)
+
+	KL_Piezo_Tone(0, 0);
+}
+
+/**************************************************************/
+
+// Start a square wave on the piezo element (0 Hz = stop, all FX_Tick() uses it for: notes and tones are worked out beforehand)
+void KL_Piezo_Tone(uint32_t freq_Hz, uint8_t pwm_duty)
+{
+	uint16_t mod, cnv;
+	uint8_t prescale;
+
+	if (freq_Hz == 0)
+	{
+		TPM_StopTimer(TPM0_PERIPHERAL);  // Stop the TPM counter
+		return;
+	}
+
+	KL_Piezo_Settings(freq_Hz, pwm_duty, &prescale, &mod, &cnv);
+	KL_Piezo_Start(prescale, mod, cnv);
+}
+
+/**************************************************************/
+
+// TPM0 prescaler, MOD and CnV for a square wave (freq_Hz > 0), for KL_Piezo_Start()
+void KL_Piezo_Settings(uint32_t freq_Hz, uint8_t pwm_duty, uint8_t *prescale, uint16_t *mod, uint16_t *cnv)
+{
+	uint32_t period;
+
+	// Same prescaler and MOD as PIEZO_TPM() would give
+	period = TPM0_CLOCK_SOURCE / freq_Hz;
+	*prescale = 0;
+	while (period > 0x2000U && *prescale < 7)
+	{
+		period >>= 1;
+		(*prescale)++;
+	}
+	if (period > 0xFFFFU)	// too low to play, and CnV (a full duty cycle is period) has to fit too
+		period = 0xFFFFU;
+
+	*mod = period - 1;
+	*cnv = (pwm_duty >= 100) ? period : (period * pwm_duty) / 100;
+}
+
+/**************************************************************/
+
+// Play a packed note's pitch (struct note), or a show's NOTE, from FX_Tick(): no division, unlike KL_Piezo_Tone()
+void KL_Piezo_Note(uint8_t pitch)
+{
+	uint16_t tpm = piezo_tpm[pitch & ~PIEZO_QUIET];
+	uint16_t mod = tpm & 0x1FFFU;
+
+	if (tpm == 0)	// PITCH_REST
+		TPM_StopTimer(TPM0_PERIPHERAL);
+	else
+		KL_Piezo_Start(tpm >> 13, mod, (mod + 1) >> ((pitch & PIEZO_QUIET) ? 2 : 1));
+}
+
+/**************************************************************/
+
+// Program TPM0 directly: the channel was set up for edge-aligned PWM by TPM0_init(), and while
+// the counter runs, MOD and CnV only take effect at the end of the period, so notes change cleanly
+void KL_Piezo_Start(uint8_t prescale, uint16_t mod, uint16_t cnv)
+{
+	if ((TPM0_PERIPHERAL->SC & TPM_SC_PS_MASK) != prescale)
+	{
+		TPM_StopTimer(TPM0_PERIPHERAL);	// the prescaler can only change while the counter is off
+		TPM0_PERIPHERAL->SC = (TPM0_PERIPHERAL->SC & ~TPM_SC_PS_MASK) | TPM_SC_PS(prescale);
+	}
+
+	TPM0_PERIPHERAL->MOD = mod;
+	TPM0_PERIPHERAL->CONTROLS[TPM0_pwmSignalParams->chnlNumber].CnV = cnv;
+	TPM_StartTimer(TPM0_PERIPHERAL, kTPM_SystemClock);  // Start the TPM counter (if it isn't running)
+}
+
+/**************************************************************/
+
+void KL_Piezo_1Up(void)	// adds to the effect being built
+{
+	FX_Add(&(fx_step_t){ .show = show_1up, .flags = FX_KEEP });
+}
+
+/**************************************************************/
+
+void KL_Piezo_RickRoll(void)	// adds to the effect being built
+{
+	g_random = (unsigned char)SysTick->VAL;  // Seed PRNG with current value of SysTick timer
+
+	// tune_rickroll_intro and tune_rickroll_verse (unused) would go in as steps like the chorus
+	FX_Add(&(fx_step_t){ .flags = FX_KEEP, .hold = FX_RICKROLL_DELAY });
+	FX_Add(&(fx_step_t){ .tune = tune_rickroll_chorus, .lyrics = tune_rickroll_chorus_lyrics,
+		.notes = sizeof(tune_rickroll_chorus) / sizeof(struct note), .gap = FX_RICKROLL_GAP, .flags = FX_KEEP | FX_FLICKER });
+}
+
+/**************************************************************/
+
+int KL_Setup_NXH2261(void) // Configure NXH2261 NFMI Radio
+{
+	// Program the NXH binary via I2C
+	if (KL_Program_NXH2261(NxH2281Eep_size, NxH2281Eep))
+	{
+		return 1; // Fail!
+	}
+
+	LED_Set(LED_LAYER_STATE, 2, 0); // Update start-up progress via LEDs
+	LED_Set(LED_LAYER_STATE, 3, 0);
+	LED_Update();
+
+    PRINTF("-> Executing Program...");
+    KL_Reset_NXH2261();
+	SysTick_DelayTicks(200); // maximum delay of NXH2261 low-power state
+    PRINTF("Done!\n\r");
+
+	// Calibration process
+    PRINTF("-> Calibrating...");
+    CLOCK_SetClkOutClock(SIM_CLKOUT_SEL_OSCERCLK_CLK); // Set OSCERCLK to CLKOUT
+    SysTick_DelayTicks(100);
+
+	// Toggle NXH_UPDATE to switch NXH2261 into UART Open State (we need to be here in order to calibrate)
+	GPIO_PinWrite(BOARD_INITPINS_NXH_UPDATE_GPIO, BOARD_INITPINS_NXH_UPDATE_GPIO_PIN, HIGH);
+    SysTick_DelayTicks(500);
+	GPIO_PinWrite(BOARD_INITPINS_NXH_UPDATE_GPIO, BOARD_INITPINS_NXH_UPDATE_GPIO_PIN, LOW);
+
+    SysTick_DelayTicks(100);
+
+    // Toggle NXH_CAL to tell NXH2261 that we're ready to start calibration
+	GPIO_PinWrite(BOARD_INITPINS_NXH_CAL_GPIO, BOARD_INITPINS_NXH_CAL_GPIO_PIN, HIGH);
+    SysTick_DelayTicks(500);
+	GPIO_PinWrite(BOARD_INITPINS_NXH_CAL_GPIO, BOARD_INITPINS_NXH_CAL_GPIO_PIN, LOW);
+
+    SysTick_DelayTicks(500); // wait for calibration to complete (typical 50-150ms)
+    CLOCK_SetClkOutClock(0); // Turn off CLKOUT
+
+    PRINTF("Done!\n\r");
+
+	LED_Set(LED_LAYER_STATE, 1, 0); // Update start-up progress via LEDs
+	LED_Set(LED_LAYER_STATE, 4, 0);
+	LED_Update();
+
+	return 0; // Success!
+}
+
+/**************************************************************/
+
+int KL_Program_NXH2261(const uint32_t NxH2281Eep_size, const unsigned char *NxH2281Eep)
+{
+	uint8_t i = 0;
+	uint32_t res;
+	uint8_t txbuf[12], rxbuf[12];
+
+    PRINTF("-> Entering Bootloader...");
+	KL_Reset_NXH2261();
+
+	// After reset, the NXH2261 waits 30ms before loading code from its internal EEPROM.
+	// Within this time, the host controller can send a Prevent Boot command, which forces
+	// the device into bootloader mode and allows us to send new firmware to its EEPROM.
+	do
+	{
+		res = 1;
+		txbuf[0] = LOW_BYTE(NXH2261_CMD_PREVENT_BOOT);
+		txbuf[1] = HIGH_BYTE(NXH2261_CMD_PREVENT_BOOT);
+		txbuf[2] = 0; // tag
+		I2C_WriteBulk(I2C0_PERIPHERAL, I2C_NXH2261_ADDR, txbuf, 3);
+		if (!I2C_ReadBulk(I2C0_PERIPHERAL, I2C_NXH2261_ADDR, rxbuf, 4))
+		{
+			// if I2C was successful, response should be all 0x00
+			res = rxbuf[0] | rxbuf[1] | rxbuf[2] | rxbuf[3];
+		}
+        SysTick_DelayTicks(5);
+        ++i;
+	} while (res != 0 && i < 100);
+
+	if (i >= 100)  // Timeout
+	{
+		PRINTF("Error!\n\r");
+		return 1;
+	}
+
+	PRINTF("Done!\n\r");
+
+    // Get version information
+	txbuf[0] = LOW_BYTE(NXH2261_CMD_GET_VERSION);
+	txbuf[1] = HIGH_BYTE(NXH2261_CMD_GET_VERSION);
+	txbuf[2] = 0; // tag
+	I2C_WriteBulk(I2C0_PERIPHERAL, I2C_NXH2261_ADDR, txbuf, 3);
+	I2C_ReadBulk(I2C0_PERIPHERAL, I2C_NXH2261_ADDR, rxbuf, 9);
+	PRINTF("-> Firmware Version: 0x%02X 0x%02X\n\r", rxbuf[0], rxbuf[1]);
+	PRINTF("-> Hardware Version: 0x%02X%02X 0x%02X%02X\n\r", rxbuf[3], rxbuf[2], rxbuf[6], rxbuf[5]);
+	PRINTF("-> ROM Version: 0x%02X 0x%02X\n\r", rxbuf[7], rxbuf[8]);
+
+    PRINTF("-> Programming...");
+
+    // Enable the EEPROM in preparation to program
+	txbuf[0] = LOW_BYTE(NXH2261_CMD_EEPROM_ENABLE);
+	txbuf[1] = HIGH_BYTE(NXH2261_CMD_EEPROM_ENABLE);
+	txbuf[2] = 0; // tag
+	I2C_WriteBulk(I2C0_PERIPHERAL, I2C_NXH2261_ADDR, txbuf, 3);
+	if (!I2C_ReadBulk(I2C0_PERIPHERAL, I2C_NXH2261_ADDR, rxbuf, 4))
+	{
+		// if I2C was successful, response should be all 0x00
+		res = rxbuf[0] | rxbuf[1] | rxbuf[2] | rxbuf[3];
+	}
+	if (res != 0)
+	{
+    	PRINTF("Error!\n\r");
+		return 1;
+	}
+
+	// Program the Cortex image at the primary boot location
+	// EEPROM has a write endurance of 100k cycles
+	if (KL_LoadImage_NXH2261(NxH2281Eep_size, NxH2281Eep, 0x0000UL))
+	{
+	    PRINTF("Error!\n\r");
+		return 1;
+	}
+
+	// Disable the EEPROM when programming is complete
+	txbuf[0] = LOW_BYTE(NXH2261_CMD_EEPROM_DISABLE);
+	txbuf[1] = HIGH_BYTE(NXH2261_CMD_EEPROM_DISABLE);
+	txbuf[2] = 0; // tag
+	I2C_WriteBulk(I2C0_PERIPHERAL, I2C_NXH2261_ADDR, txbuf, 3);
+	if (!I2C_ReadBulk(I2C0_PERIPHERAL, I2C_NXH2261_ADDR, rxbuf, 4))
+	{
+		// if I2C was successful, response should be all 0x00
+		res = rxbuf[0] | rxbuf[1] | rxbuf[2] | rxbuf[3];
+	}
+	if (res != 0)
+	{
+	   	PRINTF("Error!\n\r");
+		return 1;
+	}
+
+	PRINTF("Done!\n\r");
+
+	return 0; // Success!
+}
+
+/**************************************************************/
+
+int KL_LoadImage_NXH2261(uint32_t size, const uint8_t *data, uint32_t address)
+{
+    uint32_t i;
+    uint16_t txaddr, chunkSize, cnt;
+	uint32_t res = 0;
+	uint8_t txbuf[NXH2261_MAX_CHUNK_SIZE + 8], rxbuf[NXH2261_MAX_CHUNK_SIZE + 8];
+
+    i = 0;
+    while (i < size)
+    {
+    	// Setup parameters
+    	chunkSize = ((size - i) > NXH2261_MAX_CHUNK_SIZE ? NXH2261_MAX_CHUNK_SIZE : (size - i)); // number of bytes to write
+    	txaddr = address + (i / 4UL); // offset (word address) into the EEPROM
+
+    	// Unlock EEPROM memory region for a single write
+    	txbuf[0] = LOW_BYTE(NXH2261_CMD_EEPROM_UNLOCK);
+    	txbuf[1] = HIGH_BYTE(NXH2261_CMD_EEPROM_UNLOCK);
+    	txbuf[2] = 0; // tag
+    	txbuf[3] = LOW_BYTE(txaddr);
+    	txbuf[4] = HIGH_BYTE(txaddr);
+    	txbuf[5] = LOW_BYTE(chunkSize);
+    	txbuf[6] = HIGH_BYTE(chunkSize);
+    	I2C_WriteBulk(I2C0_PERIPHERAL, I2C_NXH2261_ADDR, txbuf, 7);
+    	if (!I2C_ReadBulk(I2C0_PERIPHERAL, I2C_NXH2261_ADDR, rxbuf, 4))
+    	{
+    		// if I2C was successful, response should be all 0x00
+    		res = rxbuf[0] | rxbuf[1] | rxbuf[2] | rxbuf[3];
+    	}
+    	if (res != 0)
+    	{
+    		return 1;
+    	}
+
+    	// Write data to EEPROM
+    	txbuf[0] = LOW_BYTE(NXH2261_CMD_EEPROM_WRITE);
+    	txbuf[1] = HIGH_BYTE(NXH2261_CMD_EEPROM_WRITE);
+    	txbuf[2] = 0; // tag
+    	txbuf[3] = LOW_BYTE(txaddr);
+    	txbuf[4] = HIGH_BYTE(txaddr);
+    	txbuf[5] = 0;
+    	txbuf[6] = 0;
+    	txbuf[7] = LOW_BYTE(chunkSize);
+    	txbuf[8] = HIGH_BYTE(chunkSize);
+    	txbuf[9] = 0;
+    	txbuf[10] = 0;
+    	cnt = chunkSize; // move length into its own variable so memcpy doesn't erase it
+    	memcpy(&txbuf[11], data + i, cnt);
+    	I2C_WriteBulk(I2C0_PERIPHERAL, I2C_NXH2261_ADDR, txbuf, 11 + chunkSize);
+    	if (!I2C_ReadBulk(I2C0_PERIPHERAL, I2C_NXH2261_ADDR, rxbuf, 4))
+    	{
+    		// if I2C was successful, response should be all 0x00
+    		res = rxbuf[0] | rxbuf[1] | rxbuf[2] | rxbuf[3];
+    	}
+    	if (res != 0)
+    	{
+    		return 1;
+    	}
+
+      i += chunkSize;
+    }
+
+	return 0; // Success!
+}
+
+/**************************************************************/
+
+// retrieve the most recently received data packet from the ring buffer, if it exists
+// A packet still arriving is left in the buffer for next time
+int KL_GetPacket_NXH2261(struct packet_of_infamy *rxPacket)
+{
+	size_t i;
+	uint16_t index;
+	uint8_t ch, dataBlob[NXH2261_DATA_PACKET_SIZE], buf[NXH2261_DATA_PACKET_SIZE >> 1];
+
+	while (1)
+	{
+		// increment through the buffer until we find the packet header
+		do
+		{
+			if (nxhRxIndex == nxhTxIndex)  // we've reached the end of the buffer
+				return 1;
+
+			ch = nxhRingBuffer[nxhTxIndex];
+			nxhTxIndex++;
+			nxhTxIndex %= LPUART0_RING_BUFFER_SIZE;
+		} while (ch != 'B');
+
+		// extract the data contents from the buffer until we reach the packet footer
+		i = 0;
+		index = nxhTxIndex;
+		while (1)
+		{
+			if (nxhRxIndex == index)  // rest of the packet hasn't arrived yet
+			{
+				nxhTxIndex = (nxhTxIndex + LPUART0_RING_BUFFER_SIZE - 1) % LPUART0_RING_BUFFER_SIZE;	// back to the header
+				return 1;
+			}
+
+			ch = nxhRingBuffer[index];
+			index++;
+			index %= LPUART0_RING_BUFFER_SIZE;
+			if (ch == 'E' || ch == 'B' || i == NXH2261_DATA_PACKET_SIZE - 2)
+				break;
+
+			dataBlob[i] = ch;
+			i++;
+		}
+
+		if (ch == 'E' && i == NXH2261_DATA_PACKET_SIZE - 2)
+		{
+			nxhTxIndex = index;
+			break;
+		}
+
+		// bytes were lost: look for the next header
+		if (ch == 'B')
+			nxhTxIndex = (index + LPUART0_RING_BUFFER_SIZE - 1) % LPUART0_RING_BUFFER_SIZE;
+	}
+
+	// remove 0xD0 padding from each nibble
+	for (i = 0; i < (NXH2261_DATA_PACKET_SIZE >> 1) - 1; i++)
+	{
+		buf[i] = (dataBlob[i*2] & 0x0F) << 4;
+		buf[i] |= dataBlob[i*2 + 1] & 0x0F;
+	}
+
+	// Place data into proper structure
+	rxPacket->uid = (uint32_t)((buf[0] << 24) | (buf[1] << 16) | (buf[2] << 8) | buf[3]); 	// unique ID
+	rxPacket->type = buf[4];	// badge type
+	rxPacket->magic = buf[5];	// magic token (1 = enabled)
+	rxPacket->flags = buf[6];   // game flags (packed, MSB unused)
+	rxPacket->unused = buf[7];	// unused
+
+	return 0;
+}
+
+/**************************************************************/
+
+// update NXH2261 with data packet to transmit
+int KL_UpdatePacket_NXH2261(struct packet_of_infamy txPacket)
+{
+	struct packet_of_infamy rxPacket;
+	size_t i = 0;
+	uint16_t mark, rx, next;
+	uint8_t ch, dataBlob[NXH2261_DATA_PACKET_SIZE];
+	bool fresh;
+
+	dataBlob[0] = 'B';  // header
+	dataBlob[NXH2261_DATA_PACKET_SIZE - 1] = 'E';  // footer
+
+	const unsigned char *buf = (unsigned char*)&txPacket;
+
+	// pad each nibble of buf with 0xD0 per the custom NXH UART protocol
+	for (i = 0; i < ((NXH2261_DATA_PACKET_SIZE - 2) >> 1); i++)
+	{
+		dataBlob[i*2 + 1] = (0xD0 + ((buf[i] & 0xF0) >> 4));
+		dataBlob[i*2 + 2] = (0xD0 + ((buf[i] & 0x0F)));
+	}
 
-/**************************************************************/
+	// flip ordering due to endianness
+	uint8_t index[] = {0, 7, 8, 5, 6, 3, 4, 1, 2, 9, 10, 11, 12, 13, 14, 15, 16, 17};
+	Reorder_Array(dataBlob, index, NXH2261_DATA_PACKET_SIZE);
 
-int KL_Flash_Init(void)
-{
-	ftfx_security_state_t securityStatus = kFTFx_SecurityStateNotSecure;  // Memory protection status
-	status_t result;    // Return code from each flash driver function
+	// display hex data from data packet struct (without header and footer)
+	PRINTF("[*] Loading Data: 0x");
+	for (i = 1; i < NXH2261_DATA_PACKET_SIZE - 1; ++i)
+	{
+		PRINTF("%02X", dataBlob[i]);
+	}
+	PRINTF("\n\r");
 
-    // Clear structs
-    memset(&s_flashDriver, 0, sizeof(flash_config_t));
-    memset(&s_cacheDriver, 0, sizeof(ftfx_cache_config_t));
+	// Frames that have already come in would be mistaken for the answer, and an "RO" left from an
+	// earlier request (or calibration) isn't the answer to this one: take them out of the way first
+	while (!KL_GetPacket_NXH2261(&rxPacket))
+		PEER_See(&rxPacket);	// the badges that sent them still count
+	mark = nxhRxIndex;	// anything from here on arrived after the request
 
-    // Setup flash driver
-    result = FLASH_Init(&s_flashDriver);
-    if (result != kStatus_FTFx_Success)
-    {
-    	return 1;
-    }
+	// Toggle NXH_UPDATE to tell NXH2261 that we want to update data being sent
+	nxhUpdating = true;	// stay out of VLPS for the answer
+	GPIO_PinWrite(BOARD_INITPINS_NXH_UPDATE_GPIO, BOARD_INITPINS_NXH_UPDATE_GPIO_PIN, HIGH);
+	SysTick_DelayTicks(100);
+	GPIO_PinWrite(BOARD_INITPINS_NXH_UPDATE_GPIO, BOARD_INITPINS_NXH_UPDATE_GPIO_PIN, LOW);
+	SysTick_DelayTicks(100);
+	nxhUpdating = false;
 
-    // Setup flash cache driver
-    result = FTFx_CACHE_Init(&s_cacheDriver);
-    if (result != kStatus_FTFx_Success)
-    {
-    	return 1;
-    }
+	// Wait until we receive "RO" from NXH to indicate that it is ready to receive new data.
+	// Frames received meanwhile are stepped over and left for KL_GetPacket_NXH2261()
+	rx = nxhTxIndex;
+	fresh = (rx == mark);
+	while (1)
+	{
+		if (nxhRxIndex == rx)  // we've reached the end of the buffer
+			return 1;
 
-    // Check security status
-    result = FLASH_GetSecurityState(&s_flashDriver, &securityStatus);
-    if (result != kStatus_FTFx_Success)
-    {
-    	return 1;
-    }
+		ch = nxhRingBuffer[rx];
+		next = (rx + 1) % LPUART0_RING_BUFFER_SIZE;
+		if (ch == 'B')
+		{
+			// header and nibbles padded with 0xD0, up to the footer or whatever cuts it short
+			while (next != nxhRxIndex && (nxhRingBuffer[next] & 0xF0) == 0xD0)
+			{
+				if (next == mark)
+					fresh = true;
+				next = (next + 1) % LPUART0_RING_BUFFER_SIZE;
+			}
+			if (next != nxhRxIndex && nxhRingBuffer[next] == 'E')
+			{
+				if (next == mark)
+					fresh = true;
+				next = (next + 1) % LPUART0_RING_BUFFER_SIZE;
+			}
+		}
+		else if (ch == 'R' && fresh)
+		{
+			// now check if 'O' is next door
+			if (nxhRxIndex == next)  // we've reached the end of the buffer
+				return 1;
+			if (nxhRingBuffer[next] == 'O')
+				break;
+		}
 
-    // Only proceed with unprotected memory (we won't be able to read/write otherwise)
-    if (securityStatus != kFTFx_SecurityStateNotSecure)
-    {
-    	return 1;
-    }
+		rx = next;
+		if (rx == mark)
+			fresh = true;
+	}
 
-    // Get flash properties
-    FLASH_GetProperty(&s_flashDriver, kFLASH_PropertyPflash0BlockBaseAddr, &pflashBlockBase);
-    FLASH_GetProperty(&s_flashDriver, kFLASH_PropertyPflash0TotalSize, &pflashTotalSize);
-    FLASH_GetProperty(&s_flashDriver, kFLASH_PropertyPflash0SectorSize, &pflashSectorSize);
+	// "RO" is used up, frames before it stay where they are
+	next = (rx + 2) % LPUART0_RING_BUFFER_SIZE;
+	if (rx == nxhTxIndex)
+		nxhTxIndex = next;
+	else
+		nxhRingBuffer[rx] = nxhRingBuffer[(rx + 1) % LPUART0_RING_BUFFER_SIZE] = 0;	// skipped by KL_GetPacket_NXH2261()
 
-    // Print flash information to debug console
-    PRINTF("\n\r-> Memory Size = %dKB [0x%X]\n\r", (pflashTotalSize / 1024), pflashTotalSize);
-    PRINTF("-> Sector Size = %dKB [0x%X]\n\r", (pflashSectorSize / 1024), pflashSectorSize);
+	// send our updated data packet to the NXH
+	LPUART_WriteBlocking(LPUART0_PERIPHERAL, dataBlob, sizeof(dataBlob));
 
-    return 0;
+	return 0;
 }
 
 /**************************************************************/
 
-// Erase and write a single Flash sector
-int KL_Flash_Write(uint32_t data)
+void KL_Reset_NXH2261(void)
 {
-	status_t result;    	// Return code from each flash driver function
-    uint32_t destAddress; 	// Base address of the target memory location
-    uint32_t s_buffer[NVM_DATA_SIZE];
-    uint32_t i, failAddr, failDat;
+	GPIO_PinWrite(BOARD_INITPINS_NXH_nRESET_GPIO, BOARD_INITPINS_NXH_nRESET_GPIO_PIN, LOW);  // Disable NXH2261
+	SysTick_DelayTicks(250);
 
-    __disable_irq(); // Disable all interrupts during Flash write operations
+	GPIO_PinWrite(BOARD_INITPINS_NXH_nRESET_GPIO, BOARD_INITPINS_NXH_nRESET_GPIO_PIN, HIGH); // Enable NXH2261
+	SysTick_DelayTicks(10);
+}
 
-	// Prepare flash cache/prefetch/speculation
-	FTFx_CACHE_ClearCachePrefetchSpeculation(&s_cacheDriver, true);
+/**************************************************************/
 
-	// In case of the protected sectors at the end of the pFlash just select
-	// the block from the end of pFlash to be used for operations
-	// SECTOR_INDEX_FROM_END = 1 means the last sector
-	// SECTOR_INDEX_FROM_END = 2 means (the last sector - 1)
+int KL_Setup_LP5569(void) // Configure LP5569 LED Driver
+{
+	uint8_t regs[LP5569_LED_NUM], err = 0;
 
-	// Erase a sector starting from destAddress
-	destAddress = pflashBlockBase + (pflashTotalSize - (SECTOR_INDEX_FROM_END * pflashSectorSize));
-    result = FLASH_Erase(&s_flashDriver, destAddress, pflashSectorSize, kFTFx_ApiEraseKey);
-    if (kStatus_FTFx_Success != result)
-    {
-        __enable_irq();
-    	return 1;
-    }
+	GPIO_PinWrite(BOARD_INITPINS_LED_EN_GPIO, BOARD_INITPINS_LED_EN_GPIO_PIN, LOW);
+	SysTick_DelayTicks(10);
 
-    // Prepare user buffer with data
-    for (i = 0; i < NVM_DATA_SIZE; i++)
-    {
-        s_buffer[i] = (data >> (24-(i*8))) & 0xFF;
-    }
+	GPIO_PinWrite(BOARD_INITPINS_LED_EN_GPIO, BOARD_INITPINS_LED_EN_GPIO_PIN, HIGH); // Enable LP5569
+	SysTick_DelayTicks(10);
+	LP5569_Shadow_Reset();	// registers are back to their reset values
 
-    // Program user buffer into flash
-     result = FLASH_Program(&s_flashDriver, destAddress, (uint8_t *)s_buffer, sizeof(s_buffer));
-     if (kStatus_FTFx_Success != result)
-     {
-        __enable_irq();
-     	return 1;
-     }
+	// Load default LED settings
+	err += LP5569_WriteRegister(LP5569_REG_CONFIG, 0x00); // Disable LP5569 while setting MISC register
+	SysTick_DelayTicks(1); // Wait for register to be updated
 
-     // Verify programming
-     result = FLASH_VerifyProgram(&s_flashDriver, destAddress, sizeof(s_buffer), (const uint8_t *)s_buffer, kFTFx_MarginValueUser,
-                                  &failAddr, &failDat);
-     if (kStatus_FTFx_Success != result)
-     {
-        __enable_irq();
-      	return 1;
-     }
+	err += LP5569_WriteRegister(LP5569_REG_MISC, 0x79); 		// Auto-increment enabled, auto-power save, auto-charge pump, internal 32.768kHz oscillator
+	err += LP5569_WriteRegister(LP5569_REG_CONFIG, 0x40); 	// Turn on LP5569
+	SysTick_DelayTicks(1); // Wait for register to be updated
 
-     // Clean-up
-     FTFx_CACHE_ClearCachePrefetchSpeculation(&s_cacheDriver, false);
+	err += LP5569_WriteRegister(LP5569_REG_LED_ENGINE_CONTROL2, 0xFA); // Halt all engines, enable direct LED control
 
-     __enable_irq();
-     return 0;
-}
+	// One auto-increment burst per register bank
+	memset(regs, LP5569_Control, LP5569_LED_NUM);  // Control Register
+	err += LP5569_Write(LP5569_REG_LED0_CONTROL, regs, LP5569_LED_NUM);
 
-/**************************************************************/
+	memset(regs, LP5569_Current, LP5569_LED_NUM);  // Current Control
+	err += LP5569_Write(LP5569_REG_LED0_CURRENT, regs, LP5569_LED_NUM);
 
-void KL_Flash_Read(uint32_t *data)
-{
-	uint32_t i;
-    uint32_t s_buffer_rbc[NVM_DATA_SIZE];
-    uint32_t destAddress; 	// Base address of the target memory location
+	memset(regs, 0x00, LP5569_LED_NUM);  // PWM Duty Cycle
+	err += LP5569_Write(LP5569_REG_LED0_PWM, regs, LP5569_LED_NUM); // All LEDs off
 
-	// In case of the protected sectors at the end of the pFlash just select
-	// the block from the end of pFlash to be used for operations
-	// SECTOR_INDEX_FROM_END = 1 means the last sector
-	// SECTOR_INDEX_FROM_END = 2 means (the last sector - 1)
+	LED_SetBrightness(ledBrightness);	// the LEDs are all on master fader 1
+	err += LP5569_WriteRegister(LP5569_REG_MASTER_FADER1, ledFader);
+	ledFaderShown = ledFader;
 
-    // calculate address
-	destAddress = pflashBlockBase + (pflashTotalSize - (SECTOR_INDEX_FROM_END * pflashSectorSize));
+	// Disable unused LED channels
+	err += LP5569_WriteRegister(LP5569_REG_LED6_CONTROL, 0x00);
+	err += LP5569_WriteRegister(LP5569_REG_LED7_CONTROL, 0x00);
+	err += LP5569_WriteRegister(LP5569_REG_LED8_CONTROL, 0x00);
 
-    for (i = 0; i < NVM_DATA_SIZE; i++)
-    {
-        s_buffer_rbc[i] = *(volatile uint32_t *)(destAddress + i * 4);
-    }
+	// Map LED to register control (not execution engine)
+	err += LP5569_WriteRegister(LP5569_REG_ENGINE1_MAPPING1, 0x00); // LED8
+	err += LP5569_WriteRegister(LP5569_REG_ENGINE1_MAPPING2, 0x00); // LED7..0
+	err += LP5569_WriteRegister(LP5569_REG_ENGINE2_MAPPING1, 0x00); // LED8
+	err += LP5569_WriteRegister(LP5569_REG_ENGINE2_MAPPING2, 0x00); // LED7..0
+	err += LP5569_WriteRegister(LP5569_REG_ENGINE3_MAPPING1, 0x00); // LED8
+	err += LP5569_WriteRegister(LP5569_REG_ENGINE3_MAPPING2, 0x00); // LED7..0
 
-    for (i = 0; i < NVM_DATA_SIZE; i++)
-    {
-        *data <<= 8;
-        *data |= (s_buffer_rbc[i] & 0xFF);
-    }
+	err += LP5569_Engine_Load();	// idle animations (the engines map their own LEDs when running)
+
+	return err;
 }
 
 /**************************************************************/
 
-bool KL_Check_RX(void)  // check if USB-to-Serial adapter is connected
+// Write the PWM duty cycle of LEDs first..last (pwm[0] is LED first) in one
+// auto-increment burst, rather than one I2C transaction per LED. Only the LEDs
+// that changed are written (see LP5569_Write())
+int LP5569_SetFrame(const uint8_t *pwm, uint8_t first, uint8_t last)
 {
-	bool res;
+	int i, err;
 
-	// re-map pin from KL_RX to GPIO E23
-	gpio_pin_config_t KL_RX_config = {
-	        .pinDirection = kGPIO_DigitalInput,
-	        .outputLogic = 0U
-	    };
-	GPIO_PinInit(GPIOE, BOARD_INITPINS_KL_RX_PIN, &KL_RX_config);
-    PORT_SetPinMux(BOARD_INITPINS_KL_RX_PORT, BOARD_INITPINS_KL_RX_PIN, kPORT_MuxAsGpio);
-	    PORTE->PCR[BOARD_INITPINS_KL_RX_PIN] = ((PORTE->PCR[BOARD_INITPINS_KL_RX_PIN] &
-	                      /* Mask bits to zero which are setting */
-	                      (~(PORT_PCR_PS_MASK | PORT_PCR_PE_MASK | PORT_PCR_ISF_MASK)))
+	err = LP5569_Write(LP5569_REG_LED0_PWM + first, pwm, last - first + 1);
+	if (err)
+	{
+		// if write fails, try to release the bus
+		PRINTF("[*] I2C Bus Clear...");
+		I2C_ReleaseBus();
+		SysTick_DelayTicks(100);
 
-	                     /* Pull Select: Internal pulldown resistor is enabled on the corresponding pin, if the
-	                      * corresponding PE field is set. */
-	                     | (uint32_t)(kPORT_PullDown));
-	SysTick_DelayTicks(10);
+		// re-initialize I2C
+		I2C_MasterDeinit(I2C0_PERIPHERAL);
+		SysTick_DelayTicks(10);
+		I2C_MasterInit(I2C0_PERIPHERAL, &I2C0_config, I2C0_CLK_FREQ);
+		SysTick_DelayTicks(10);
 
-	res = (bool)GPIO_PinRead(GPIOE, BOARD_INITPINS_KL_RX_PIN);
+		// and re-attempt the transaction
+		err = LP5569_Write(LP5569_REG_LED0_PWM + first, pwm, last - first + 1);
+		if (err)
+		{
+			PRINTF("Error!\n\r");
+		}
+		else
+		{
+			PRINTF("Done!\n\r");
+		}
+	}
 
-	// set KL_RX back to UART2_RX
-    PORT_SetPinInterruptConfig(BOARD_INITPINS_KL_RX_PORT, BOARD_INITPINS_KL_RX_PIN, kPORT_InterruptOrDMADisabled);
-	    PORT_SetPinMux(BOARD_INITPINS_KL_RX_PORT, BOARD_INITPINS_KL_RX_PIN, kPORT_MuxAlt4);
-	    SysTick_DelayTicks(10);
+	for (i = 0; i < 100; ++i){};  // poor man's delay (us)
 
-	return res;
+	return err;
 }
 
 /**************************************************************/
 
-void KL_Error(bool error_piezo, bool error_led)
+// Write consecutive registers through the shadow: the burst is trimmed to the bytes that
+// differ from what was last written, and skipped if there are none. Registers the LP5569
+// changes itself, and program memory (paged), are always written
+int LP5569_Write(uint8_t reg, const uint8_t *data, uint8_t len)
 {
-	int i;
+	uint8_t i, first = len, last = 0;
+	bool cached = (reg + len <= LP5569_REG_COUNT);
+	int err;
 
-	if (error_piezo || error_led)
+	for (i = 0; i < len && cached; i++)
 	{
-		for (i = 0; i < 5; ++i)
+		switch (reg + i)
 		{
-			if (error_led)
-				LP5569_SetLED_AllOn();
+			case LP5569_REG_LED_ENGINE_CONTROL1:	// engines go to hold at the end of their program
+			case LP5569_REG_ENGINE1_PC:
+			case LP5569_REG_ENGINE2_PC:
+			case LP5569_REG_ENGINE3_PC:
+			case LP5569_REG_RESET:
+				cached = false;
+				break;
 
-			if (error_piezo)
-				KL_Piezo(2600, 250, 50);
-			else
-				SysTick_DelayTicks(250);
+			default:
+				if (reg + i >= LP5569_REG_PROGRAM_MEM_00 && reg + i <= LP5569_REG_PROGRAM_MEM_31)
+					cached = false;
+				break;
+		}
+	}
 
-			if (error_led)
-				LP5569_SetLED_AllOff();
+	if (cached)
+	{
+		for (i = 0; i < len; i++)
+		{
+			if (!(lp5569Known[(reg + i) >> 3] & (1U << ((reg + i) & 7))) || lp5569Shadow[reg + i] != data[i])
+			{
+				if (first == len)
+					first = i;
+				last = i;
+			}
+		}
 
-			SysTick_DelayTicks(250);
+		if (first == len)	// nothing to do
+		{
+			lp5569Skipped++;
+			return 0;
 		}
 	}
-}
+	else
+	{
+		first = 0;
+		last = len - 1;
+	}
 
-/**************************************************************/
+	lp5569Writes++;
+	err = I2C_WriteRegisters(I2C0_PERIPHERAL, I2C_LP5569_ADDR, reg + first, &data[first], last - first + 1);
 
-void KL_Sleep(void)
-{
-	if (badge_state == ATTRACT || badge_state == COMPLETE)		// set timer for attract mode, otherwise only wake via NXH
+	if (err || !cached)
+	{
+		LP5569_Invalidate(reg + first, last - first + 1);	// don't know what the device has now
+	}
+	else
 	{
-		LPTMR_StartTimer(LPTMR0_PERIPHERAL); 	// Start LPTMR for periodic interrupt (LED heartbeat)
+		for (i = first; i <= last; i++)
+		{
+			lp5569Shadow[reg + i] = data[i];
+			lp5569Known[(reg + i) >> 3] |= 1U << ((reg + i) & 7);
+		}
 	}
 
-	SysTick->CTRL = SysTick_CTRL_CLKSOURCE_Msk | SysTick_CTRL_ENABLE_Msk; // Disable SysTick timer interrupt while we sleep
+	return err;
+}
 
-	SMC_PreEnterStopModes();
-    SMC_SetPowerModeVlps(SMC);  // Zzzz...
-    SMC_PostExitStopModes();
+/**************************************************************/
 
-    SysTick->CTRL = SysTick_CTRL_CLKSOURCE_Msk | SysTick_CTRL_TICKINT_Msk  | SysTick_CTRL_ENABLE_Msk; // Re-enable SysTick timer interrupt
-	LPTMR_StopTimer(LPTMR0_PERIPHERAL); // Stop timer once we wake up
+int LP5569_WriteRegister(uint8_t reg, uint8_t value)
+{
+	return LP5569_Write(reg, &value, 1);
 }
 
 /**************************************************************/
 
-// Output square wave to the piezo element using the provided parameters
-// frequency (Hz), duration (ms), duty cycle (%)
-void KL_Piezo(uint32_t freq_Hz, uint32_t duration_ms, uint8_t pwm_duty)
+void LP5569_Invalidate(uint8_t reg, uint8_t len)	// next write to these registers goes to the device
 {
-    // Update parameters
-	if (freq_Hz > 0)
+	while (len-- && reg < LP5569_REG_COUNT)
 	{
-		TPM_SetupPwm(TPM0_PERIPHERAL, TPM0_pwmSignalParams, 1, kTPM_EdgeAlignedPwm, freq_Hz, TPM0_CLOCK_SOURCE); // Frequency
-		TPM_UpdatePwmDutycycle(TPM0_PERIPHERAL,TPM0_pwmSignalParams->chnlNumber, kTPM_EdgeAlignedPwm, pwm_duty); // Duty cycle
-
-	    TPM_StartTimer(TPM0_PERIPHERAL, kTPM_SystemClock);  // Start the TPM counter
+		lp5569Known[reg >> 3] &= ~(1U << (reg & 7));
+		reg++;
 	}
-
-	if (duration_ms > 0)
-		SysTick_DelayTicks(duration_ms); // Duration of note (delay for specified length in ms)
-
-    TPM_StopTimer(TPM0_PERIPHERAL);  // Stop the TPM counter
 }
 
 /**************************************************************/
 
-void KL_Piezo_1Up(void)
+void LP5569_Shadow_Reset(void)	// after LED_EN has been low: start from the reset values
 {
-	int i;
-
-    for (i = 0; i < sizeof(tune_1up) / sizeof(struct note); ++i)
-    {
-    	KL_Piezo(tune_1up[i].freq, tune_1up[i].duration, tune_1up[i].duty);
-        SysTick_DelayTicks(10);
-    }
+	memset(lp5569Shadow, 0x00, sizeof(lp5569Shadow));
+	memset(&lp5569Shadow[LP5569_REG_LED0_CURRENT], LP5569_CURRENT_RESET, LP5569_REG_LED8_CURRENT - LP5569_REG_LED0_CURRENT + 1);
+	memset(lp5569Known, 0xFF, sizeof(lp5569Known));
 }
 
 /**************************************************************/
 
-void KL_Piezo_RickRoll(void)
+// Engine program assembler: instructions are added at the next free address, which is
+// returned for branches and mux tables. Any error sticks until the program is loaded
+uint8_t LP5569_Asm(lp5569_asm_t *a, uint16_t ins)
 {
-	int i, led_num;
+	uint8_t addr = a->pc;
 
-    SysTick_DelayTicks(250);
-	g_random = (unsigned char)SysTick->VAL;  // Seed PRNG with current value of SysTick timer
+	if (a->pc >= LP5569_PROG_MEM_SIZE)
+	{
+		a->error = true;
+		return addr;
+	}
 
-    /*for (i = 0; i < sizeof(tune_rickroll_intro) / sizeof(struct note); ++i)
-    {
-    	led_num = Get_Random_Byte() % LP5569_LED_NUM;
-    	if (tune_rickroll_intro[i].freq != NOTE_REST) LP5569_SetLED(led_num, LP5569_PWM[led_num]);  // Enable LED to flash along with the music
-    	KL_Piezo(tune_rickroll_intro[i].freq, tune_rickroll_intro[i].duration, tune_rickroll_intro[i].duty);
-    	LP5569_SetLED(led_num, 0x00);
-        SysTick_DelayTicks(45);
-    }
-    for (i = 0; i < sizeof(tune_rickroll_verse) / sizeof(struct note); ++i)
-    {
-    	led_num = Get_Random_Byte() % LP5569_LED_NUM;
-    	if (tune_rickroll_verse[i].freq != NOTE_REST) LP5569_SetLED(led_num, LP5569_PWM[led_num]);  // Enable LED to flash along with the music
-    	PRINTF("%s", tune_rickroll_verse_lyrics[i]);
-    	KL_Piezo(tune_rickroll_verse[i].freq, tune_rickroll_verse[i].duration, tune_rickroll_verse[i].duty);
-    	LP5569_SetLED(led_num, 0x00);
-        SysTick_DelayTicks(30);
-    }*/
-    for (i = 0; i < sizeof(tune_rickroll_chorus) / sizeof(struct note); ++i)
-    {
-    	led_num = Get_Random_Byte() % LP5569_LED_NUM;
-    	if (tune_rickroll_chorus[i].freq != NOTE_REST) LP5569_SetLED(led_num, LP5569_PWM);  // Enable LED to flash along with the music
-    	PRINTF("%s", tune_rickroll_chorus_lyrics[i]);
-    	KL_Piezo(tune_rickroll_chorus[i].freq, tune_rickroll_chorus[i].duration, tune_rickroll_chorus[i].duty);
-    	LP5569_SetLED(led_num, 0x00);
-        SysTick_DelayTicks(30);
-    }
+	a->code[a->pc++] = ins;
+	return addr;
 }
 
 /**************************************************************/
 
-int KL_Setup_NXH2261(void) // Configure NXH2261 NFMI Radio
+static uint16_t LP5569_Asm_Step(uint32_t cycles, uint8_t *prescale)	// step time for a number of engine clock cycles
 {
-	// Program the NXH binary via I2C
-	if (KL_Program_NXH2261(NxH2281Eep_size, NxH2281Eep))
-	{
-		return 1; // Fail!
-	}
-
-	LP5569_SetLED(2, 0); // Update start-up progress via LEDs
-	LP5569_SetLED(3, 0);
-
-    PRINTF("-> Executing Program...");
-    KL_Reset_NXH2261();
-	SysTick_DelayTicks(200); // maximum delay of NXH2261 low-power state
-    PRINTF("Done!\n\r");
-
-	// Calibration process
-    PRINTF("-> Calibrating...");
-    CLOCK_SetClkOutClock(SIM_CLKOUT_SEL_OSCERCLK_CLK); // Set OSCERCLK to CLKOUT
-    SysTick_DelayTicks(100);
-
-	// Toggle NXH_UPDATE to switch NXH2261 into UART Open State (we need to be here in order to calibrate)
-	GPIO_PinWrite(BOARD_INITPINS_NXH_UPDATE_GPIO, BOARD_INITPINS_NXH_UPDATE_GPIO_PIN, HIGH);
-    SysTick_DelayTicks(500);
-	GPIO_PinWrite(BOARD_INITPINS_NXH_UPDATE_GPIO, BOARD_INITPINS_NXH_UPDATE_GPIO_PIN, LOW);
-
-    SysTick_DelayTicks(100);
-
-    // Toggle NXH_CAL to tell NXH2261 that we're ready to start calibration
-	GPIO_PinWrite(BOARD_INITPINS_NXH_CAL_GPIO, BOARD_INITPINS_NXH_CAL_GPIO_PIN, HIGH);
-    SysTick_DelayTicks(500);
-	GPIO_PinWrite(BOARD_INITPINS_NXH_CAL_GPIO, BOARD_INITPINS_NXH_CAL_GPIO_PIN, LOW);
-
-    SysTick_DelayTicks(500); // wait for calibration to complete (typical 50-150ms)
-    CLOCK_SetClkOutClock(0); // Turn off CLKOUT
-
-    PRINTF("Done!\n\r");
+	uint32_t step;
 
-	LP5569_SetLED(1, 0); // Update start-up progress via LEDs
-	LP5569_SetLED(4, 0);
+	*prescale = (cycles > LP5569_STEP_MAX * LP5569_PRESCALE_CYCLES(0)) ? 1 : 0;
+	step = (cycles + LP5569_PRESCALE_CYCLES(*prescale) / 2) / LP5569_PRESCALE_CYCLES(*prescale);	// nearest
 
-	return 0; // Success!
+	return (step < 1) ? 1 : (step > LP5569_STEP_MAX) ? LP5569_STEP_MAX : step;
 }
 
 /**************************************************************/
 
-int KL_Program_NXH2261(const uint32_t NxH2281Eep_size, const unsigned char *NxH2281Eep)
+void LP5569_Asm_Ramp(lp5569_asm_t *a, int delta, uint32_t us)	// change the PWM of the mapped LEDs by delta, one step every us
 {
-	uint8_t i = 0;
-	uint32_t res;
-	uint8_t txbuf[12], rxbuf[12];
-
-    PRINTF("-> Entering Bootloader...");
-	KL_Reset_NXH2261();
-
-	// After reset, the NXH2261 waits 30ms before loading code from its internal EEPROM.
-	// Within this time, the host controller can send a Prevent Boot command, which forces
-	// the device into bootloader mode and allows us to send new firmware to its EEPROM.
-	do
-	{
-		res = 1;
-		txbuf[0] = LOW_BYTE(NXH2261_CMD_PREVENT_BOOT);
-		txbuf[1] = HIGH_BYTE(NXH2261_CMD_PREVENT_BOOT);
-		txbuf[2] = 0; // tag
-		I2C_WriteBulk(I2C0_PERIPHERAL, I2C_NXH2261_ADDR, txbuf, 3);
-		if (!I2C_ReadBulk(I2C0_PERIPHERAL, I2C_NXH2261_ADDR, rxbuf, 4))
-		{
-			// if I2C was successful, response should be all 0x00
-			res = rxbuf[0] | rxbuf[1] | rxbuf[2] | rxbuf[3];
-		}
-        SysTick_DelayTicks(5);
-        ++i;
-	} while (res != 0 && i < 100);
+	uint8_t prescale, step;
 
-	if (i >= 100)  // Timeout
+	if (delta == 0 || delta < -255 || delta > 255)
 	{
-		PRINTF("Error!\n\r");
-		return 1;
+		a->error = true;
+		return;
 	}
 
-	PRINTF("Done!\n\r");
+	step = LP5569_Asm_Step(((uint64_t)us * LP5569_ENGINE_CLOCK_HZ) / 1000000U, &prescale);
+	LP5569_Asm(a, LP5569_INS_RAMP(prescale, step, (delta < 0), (delta < 0) ? -delta : delta));
+}
 
-    // Get version information
-	txbuf[0] = LOW_BYTE(NXH2261_CMD_GET_VERSION);
-	txbuf[1] = HIGH_BYTE(NXH2261_CMD_GET_VERSION);
-	txbuf[2] = 0; // tag
-	I2C_WriteBulk(I2C0_PERIPHERAL, I2C_NXH2261_ADDR, txbuf, 3);
-	I2C_ReadBulk(I2C0_PERIPHERAL, I2C_NXH2261_ADDR, rxbuf, 9);
-	PRINTF("-> Firmware Version: 0x%02X 0x%02X\n\r", rxbuf[0], rxbuf[1]);
-	PRINTF("-> Hardware Version: 0x%02X%02X 0x%02X%02X\n\r", rxbuf[3], rxbuf[2], rxbuf[6], rxbuf[5]);
-	PRINTF("-> ROM Version: 0x%02X 0x%02X\n\r", rxbuf[7], rxbuf[8]);
+/**************************************************************/
 
-    PRINTF("-> Programming...");
+// Fade the mapped LEDs in (up) or out over ms, following the gamma curve with a ramp for each
+// of LED_FADE_SEGMENTS equal steps in perceptual brightness
+void LP5569_Asm_Fade(lp5569_asm_t *a, bool up, uint32_t ms)
+{
+	uint8_t k, from, to;
 
-    // Enable the EEPROM in preparation to program
-	txbuf[0] = LOW_BYTE(NXH2261_CMD_EEPROM_ENABLE);
-	txbuf[1] = HIGH_BYTE(NXH2261_CMD_EEPROM_ENABLE);
-	txbuf[2] = 0; // tag
-	I2C_WriteBulk(I2C0_PERIPHERAL, I2C_NXH2261_ADDR, txbuf, 3);
-	if (!I2C_ReadBulk(I2C0_PERIPHERAL, I2C_NXH2261_ADDR, rxbuf, 4))
-	{
-		// if I2C was successful, response should be all 0x00
-		res = rxbuf[0] | rxbuf[1] | rxbuf[2] | rxbuf[3];
-	}
-	if (res != 0)
+	for (k = 0; k < LED_FADE_SEGMENTS; k++)
 	{
-    	PRINTF("Error!\n\r");
-		return 1;
+		from = led_gamma[(up ? k : LED_FADE_SEGMENTS - k) * LED_LEVEL_MAX / LED_FADE_SEGMENTS];
+		to = led_gamma[(up ? k + 1 : LED_FADE_SEGMENTS - k - 1) * LED_LEVEL_MAX / LED_FADE_SEGMENTS];
+		LP5569_Asm_Ramp(a, to - from, ms * 1000U / LED_FADE_SEGMENTS / ((to > from) ? to - from : from - to));
 	}
+}
 
-	// Program the Cortex image at the primary boot location
-	// EEPROM has a write endurance of 100k cycles
-	if (KL_LoadImage_NXH2261(NxH2281Eep_size, NxH2281Eep, 0x0000UL))
+/**************************************************************/
+
+void LP5569_Asm_Wait(lp5569_asm_t *a, uint32_t ms)	// longer than one wait instruction is a loop
+{
+	const uint32_t longest = LP5569_STEP_MAX * LP5569_PRESCALE_CYCLES(1);
+	uint32_t cycles = ((uint64_t)ms * LP5569_ENGINE_CLOCK_HZ) / 1000U;
+	uint32_t loops = cycles / longest;
+	uint8_t prescale, step, addr;
+
+	if (loops > LP5569_LOOP_MAX + 1)
 	{
-	    PRINTF("Error!\n\r");
-		return 1;
+		a->error = true;
+		return;
 	}
 
-	// Disable the EEPROM when programming is complete
-	txbuf[0] = LOW_BYTE(NXH2261_CMD_EEPROM_DISABLE);
-	txbuf[1] = HIGH_BYTE(NXH2261_CMD_EEPROM_DISABLE);
-	txbuf[2] = 0; // tag
-	I2C_WriteBulk(I2C0_PERIPHERAL, I2C_NXH2261_ADDR, txbuf, 3);
-	if (!I2C_ReadBulk(I2C0_PERIPHERAL, I2C_NXH2261_ADDR, rxbuf, 4))
+	if (loops)
 	{
-		// if I2C was successful, response should be all 0x00
-		res = rxbuf[0] | rxbuf[1] | rxbuf[2] | rxbuf[3];
+		addr = LP5569_Asm(a, LP5569_INS_WAIT(1, LP5569_STEP_MAX));
+		if (loops > 1)
+			LP5569_Asm(a, LP5569_INS_BRANCH(loops - 1, addr));
+		cycles -= loops * longest;
 	}
-	if (res != 0)
+
+	if (cycles >= LP5569_PRESCALE_CYCLES(0))
 	{
-	   	PRINTF("Error!\n\r");
-		return 1;
+		step = LP5569_Asm_Step(cycles, &prescale);
+		LP5569_Asm(a, LP5569_INS_WAIT(prescale, step));
 	}
+}
 
-	PRINTF("Done!\n\r");
+/**************************************************************/
 
-	return 0; // Success!
+uint8_t LP5569_Asm_Table(lp5569_asm_t *a, const uint8_t *leds, uint8_t rows)	// LED mapping table, returns its address
+{
+	uint8_t addr = a->pc;
+
+	while (rows--)
+		LP5569_Asm(a, *leds++);	// bit 0 = LED 0
+
+	return addr;
 }
 
 /**************************************************************/
 
-int KL_LoadImage_NXH2261(uint32_t size, const uint8_t *data, uint32_t address)
+// Assemble the heartbeat and sparkle animations and upload them to the LP5569 once.
+// They loop forever, so the MCU only starts and stops them (LP5569_Engine_Run())
+int LP5569_Engine_Load(void)
 {
-    uint32_t i;
-    uint16_t txaddr, chunkSize, cnt;
-	uint32_t res = 0;
-	uint8_t txbuf[NXH2261_MAX_CHUNK_SIZE + 8], rxbuf[NXH2261_MAX_CHUNK_SIZE + 8];
+	static const uint8_t sparkle[] = { 0x12, 0x09, 0x12, 0x24, 0x12 };	// LED pairs lit after 1 and 4 fade in
+	static lp5569_asm_t a;
+	uint8_t page[2 * LP5569_PROG_MEM_PAGE];
+	uint8_t i, table, loop, start[2], err = 0;
+
+	memset(&a, 0, sizeof(a));
+
+	// Heartbeat: ramp up, stay at maximum brightness, ramp down, then the next state's LEDs
+	table = LP5569_Asm_Table(&a, &state_leds[D], N - D + 1);	// D, E, F, C, O, N
+	start[0] = LP5569_Asm(&a, LP5569_INS_MUX_MAP_START(table));
+	LP5569_Asm(&a, LP5569_INS_MUX_LD_END(table + N - D));
+	loop = a.pc;
+	LP5569_Asm_Fade(&a, true, LED_HEARTBEAT_FADE_DELAY);
+	LP5569_Asm_Wait(&a, LED_HEARTBEAT_WAIT_DELAY);
+	LP5569_Asm_Fade(&a, false, LED_HEARTBEAT_FADE_DELAY);
+	LP5569_Asm_Wait(&a, LPTMR0_TICKS);
+	LP5569_Asm(&a, LP5569_INS_MUX_MAP_NEXT);
+	LP5569_Asm(&a, LP5569_INS_BRANCH(0, loop));
+
+	// Sparkle: 1 and 4 fade in, then the pairs light in turn, 1 and 4 fade out
+	table = LP5569_Asm_Table(&a, sparkle, sizeof(sparkle));
+	start[1] = LP5569_Asm(&a, LP5569_INS_MUX_MAP_START(table));
+	LP5569_Asm(&a, LP5569_INS_MUX_LD_END(table + sizeof(sparkle) - 1));
+	loop = a.pc;
+	LP5569_Asm_Fade(&a, true, LED_SPARKLE_FADE_DELAY);
+	LP5569_Asm_Wait(&a, LED_SPARKLE_ON_DELAY);
+	i = LP5569_Asm(&a, LP5569_INS_SET_PWM(0));
+	LP5569_Asm(&a, LP5569_INS_MUX_MAP_NEXT);
+	LP5569_Asm(&a, LP5569_INS_SET_PWM(led_gamma[LED_LEVEL_MAX]));
+	LP5569_Asm_Wait(&a, LED_SPARKLE_ON_DELAY);
+	LP5569_Asm(&a, LP5569_INS_BRANCH(sizeof(sparkle) - 2, i));
+	LP5569_Asm_Fade(&a, false, LED_SPARKLE_FADE_DELAY);
+	LP5569_Asm_Wait(&a, LED_SPARKLE_WAIT_DELAY);
+	LP5569_Asm(&a, LP5569_INS_MUX_MAP_NEXT);	// back to the first row
+	LP5569_Asm(&a, LP5569_INS_BRANCH(0, loop));
+
+	if (a.error)
+		return 1;
 
-    i = 0;
-    while (i < size)
-    {
-    	// Setup parameters
-    	chunkSize = ((size - i) > NXH2261_MAX_CHUNK_SIZE ? NXH2261_MAX_CHUNK_SIZE : (size - i)); // number of bytes to write
-    	txaddr = address + (i / 4UL); // offset (word address) into the EEPROM
+	err += LP5569_WriteRegister(LP5569_REG_LED_ENGINE_CONTROL2,
+		LP5569_ENGINE_BITS(1, LP5569_OP_LOAD) | LP5569_ENGINE_BITS(2, LP5569_OP_LOAD) | LP5569_ENGINE_BITS(3, LP5569_OP_LOAD));
+	SysTick_DelayTicks(1); // Wait for engines to enter load mode
 
-    	// Unlock EEPROM memory region for a single write
-    	txbuf[0] = LOW_BYTE(NXH2261_CMD_EEPROM_UNLOCK);
-    	txbuf[1] = HIGH_BYTE(NXH2261_CMD_EEPROM_UNLOCK);
-    	txbuf[2] = 0; // tag
-    	txbuf[3] = LOW_BYTE(txaddr);
-    	txbuf[4] = HIGH_BYTE(txaddr);
-    	txbuf[5] = LOW_BYTE(chunkSize);
-    	txbuf[6] = HIGH_BYTE(chunkSize);
-    	I2C_WriteBulk(I2C0_PERIPHERAL, I2C_NXH2261_ADDR, txbuf, 7);
-    	if (!I2C_ReadBulk(I2C0_PERIPHERAL, I2C_NXH2261_ADDR, rxbuf, 4))
-    	{
-    		// if I2C was successful, response should be all 0x00
-    		res = rxbuf[0] | rxbuf[1] | rxbuf[2] | rxbuf[3];
-    	}
-    	if (res != 0)
-    	{
-    		return 1;
-    	}
+	for (i = 0; i < a.pc; i++)	// one burst per page (MSB first)
+	{
+		page[2 * (i % LP5569_PROG_MEM_PAGE)] = a.code[i] >> 8;
+		page[2 * (i % LP5569_PROG_MEM_PAGE) + 1] = a.code[i] & 0xFF;
 
-    	// Write data to EEPROM
-    	txbuf[0] = LOW_BYTE(NXH2261_CMD_EEPROM_WRITE);
-    	txbuf[1] = HIGH_BYTE(NXH2261_CMD_EEPROM_WRITE);
-    	txbuf[2] = 0; // tag
-    	txbuf[3] = LOW_BYTE(txaddr);
-    	txbuf[4] = HIGH_BYTE(txaddr);
-    	txbuf[5] = 0;
-    	txbuf[6] = 0;
-    	txbuf[7] = LOW_BYTE(chunkSize);
-    	txbuf[8] = HIGH_BYTE(chunkSize);
-    	txbuf[9] = 0;
-    	txbuf[10] = 0;
-    	cnt = chunkSize; // move length into its own variable so memcpy doesn't erase it
-    	memcpy(&txbuf[11], data + i, cnt);
-    	I2C_WriteBulk(I2C0_PERIPHERAL, I2C_NXH2261_ADDR, txbuf, 11 + chunkSize);
-    	if (!I2C_ReadBulk(I2C0_PERIPHERAL, I2C_NXH2261_ADDR, rxbuf, 4))
-    	{
-    		// if I2C was successful, response should be all 0x00
-    		res = rxbuf[0] | rxbuf[1] | rxbuf[2] | rxbuf[3];
-    	}
-    	if (res != 0)
-    	{
-    		return 1;
-    	}
+		if (i % LP5569_PROG_MEM_PAGE == LP5569_PROG_MEM_PAGE - 1 || i == a.pc - 1)
+		{
+			err += LP5569_WriteRegister(LP5569_REG_PROG_MEM_PAGE_SELECT, i / LP5569_PROG_MEM_PAGE);
+			err += LP5569_Write(LP5569_REG_PROGRAM_MEM_00, page, 2 * (i % LP5569_PROG_MEM_PAGE + 1));
+		}
+	}
 
-      i += chunkSize;
-    }
+	err += LP5569_WriteRegister(LP5569_REG_ENGINE1_PROG_START, start[0]);
+	err += LP5569_WriteRegister(LP5569_REG_ENGINE2_PROG_START, start[1]);
 
-	return 0; // Success!
+	// Engines free run as soon as their operating mode is set to run
+	err += LP5569_WriteRegister(LP5569_REG_LED_ENGINE_CONTROL1,
+		LP5569_ENGINE_BITS(LP5569_ENGINE_HEARTBEAT, LP5569_EXEC_FREE_RUN) | LP5569_ENGINE_BITS(LP5569_ENGINE_SPARKLE, LP5569_EXEC_FREE_RUN));
+	err += LP5569_Engine_Run(LP5569_ENGINE_NONE);
+
+	return err;
 }
 
 /**************************************************************/
 
-// retrieve the most recently received data packet from the ring buffer, if it exists
-int KL_GetPacket_NXH2261(struct packet_of_infamy *rxPacket)
+// Start one engine program from the beginning, or stop them all (LP5569_ENGINE_NONE),
+// with a single register write. A stopped engine leaves its LEDs as they are
+int LP5569_Engine_Run(uint8_t engine)
 {
-	size_t i;
-	uint8_t ch, dataBlob[NXH2261_DATA_PACKET_SIZE], buf[NXH2261_DATA_PACKET_SIZE >> 1];
+	return LP5569_WriteRegister(LP5569_REG_LED_ENGINE_CONTROL2,
+		(engine == LP5569_ENGINE_NONE) ? LP5569_OP_DISABLED : LP5569_ENGINE_BITS(engine, LP5569_OP_RUN));
+}
 
-	// increment through the buffer until we find the packet header
-	do
-	{
-		if (nxhRxIndex == nxhTxIndex)  // we've reached the end of the buffer
-			return 1;
+/**************************************************************/
+
+// Effects are LED and piezo sequences played from SysTick_Handler, so that game logic
+// doesn't wait for them. The steps of an effect are added between FX_Begin() and FX_End()
+void FX_Begin(fx_priority_t priority)
+{
+	if (fxAmbient && priority != FX_AMBIENT)	// idle animations give way to everything else
+		FX_Stop();
+
+	fxPriority = priority;
+	fxNew = fxHead;
+	fxOpen = (priority == FX_EVENT) || !FX_Busy();
+	fxEngineAdd = LP5569_ENGINE_NONE;
+}
+
+/**************************************************************/
+
+void FX_Add(const fx_step_t *step)
+{
+	uint8_t next = (fxNew + 1) & (FX_QUEUE_SIZE - 1);
 
-		ch = nxhRingBuffer[nxhTxIndex];
-		nxhTxIndex++;
-		nxhTxIndex %= LPUART0_RING_BUFFER_SIZE;
-	} while (ch != 'B');
+	if (!fxOpen)
+		return;
 
-	// extract the data contents from the buffer until we reach the packet footer
-	i = 0;
-	while ((ch = nxhRingBuffer[nxhTxIndex]) != 'E')
+	if (next == fxTail)	// no room, drop the whole effect
 	{
-		if (nxhRxIndex == nxhTxIndex)  // we've reached the end of the buffer
-			return 1;
+		fxOpen = false;
+		return;
+	}
+
+	fxQueue[fxNew] = *step;
+	fxNew = next;
+}
+
+/**************************************************************/
 
-		dataBlob[i] = ch;
-		i++;
-		nxhTxIndex++;
-		nxhTxIndex %= LPUART0_RING_BUFFER_SIZE;
+void FX_End(void)	// start playing the effect
+{
+	if (fxOpen && fxNew != fxHead)
+	{
+		fxAmbient = (fxPriority == FX_AMBIENT);
+		fxHead = fxNew;
+	}
+	else if (fxOpen && fxEngineAdd != LP5569_ENGINE_NONE && fxEngineAdd != fxEngine)
+	{
+		fxEngine = fxEngineAdd;	// started by FX_Service()
+		fxAmbient = true;
+		KL_Post(KL_EVENT_LED);
 	}
 
-	// remove 0xD0 padding from each nibble
-	for (i = 0; i < (NXH2261_DATA_PACKET_SIZE >> 1) - 1; i++)
+	fxOpen = false;
+}
+
+/**************************************************************/
+
+// Drop all effects and silence the piezo. The state display stays as it is, notifications
+// and the music LED go with their effects
+void FX_Stop(void)
+{
+	uint32_t primask = DisableGlobalIRQ();
+
+	fxHead = fxTail = 0;
+	fxPhase = FX_START;
+	fxWait = 0;
+	fxLeds = fxLevel = 0;
+	fxPc = NULL;
+	fxTimed = false;
+	LED_Fill(LED_LAYER_NOTIFY, 0, 0, 0);
+	LED_Fill(LED_LAYER_MUSIC, 0, 0, 0);
+	KL_Piezo_Tone(0, 0);
+	EnableGlobalIRQ(primask);
+
+	fxOpen = false;
+	fxAmbient = false;
+
+	if (fxEngine != LP5569_ENGINE_NONE)	// FX_Service() stops it and puts the frame back
 	{
-		buf[i] = (dataBlob[i*2] & 0x0F) << 4;
-		buf[i] |= dataBlob[i*2 + 1] & 0x0F;
+		fxEngine = LP5569_ENGINE_NONE;
+		KL_Post(KL_EVENT_LED);
 	}
 
-	// Place data into proper structure
-	rxPacket->uid = (uint32_t)((buf[0] << 24) | (buf[1] << 16) | (buf[2] << 8) | buf[3]); 	// unique ID
-	rxPacket->type = buf[4];	// badge type
-	rxPacket->magic = buf[5];	// magic token (1 = enabled)
-	rxPacket->flags = buf[6];   // game flags (packed, MSB unused)
-	rxPacket->unused = buf[7];	// unused
+	KL_Post(KL_EVENT_IDLE);
+}
 
-	return 0;
+/**************************************************************/
+
+// Idle animation played by an LP5569 execution engine, while the MCU sleeps (adds to
+// the effect being built). Like other FX_AMBIENT effects, it stops when anything else plays
+void FX_Engine(uint8_t engine)
+{
+	if (fxOpen && fxPriority == FX_AMBIENT && fxNew == fxHead)
+		fxEngineAdd = engine;
 }
 
 /**************************************************************/
 
-// update NXH2261 with data packet to transmit
-int KL_UpdatePacket_NXH2261(struct packet_of_infamy txPacket)
+bool FX_Busy(void)
 {
-	size_t i = 0;
-	uint8_t ch, dataBlob[NXH2261_DATA_PACKET_SIZE];
+	return fxHead != fxTail;
+}
 
-	dataBlob[0] = 'B';  // header
-	dataBlob[NXH2261_DATA_PACKET_SIZE - 1] = 'E';  // footer
+/**************************************************************/
 
-	const unsigned char *buf = (unsigned char*)&txPacket;
+void FX_Wait(void)	// wait until all effects have played
+{
+	while (FX_Busy())
+		SysTick_DelayTicks(1);
+}
 
-	// pad each nibble of buf with 0xD0 per the custom NXH UART protocol
-	for (i = 0; i < ((NXH2261_DATA_PACKET_SIZE - 2) >> 1); i++)
-	{
-		dataBlob[i*2 + 1] = (0xD0 + ((buf[i] & 0xF0) >> 4));
-		dataBlob[i*2 + 2] = (0xD0 + ((buf[i] & 0x0F)));
-	}
+/**************************************************************/
 
-	// flip ordering due to endianness
-	uint8_t index[] = {0, 7, 8, 5, 6, 3, 4, 1, 2, 9, 10, 11, 12, 13, 14, 15, 16, 17};
-	Reorder_Array(dataBlob, index, NXH2261_DATA_PACKET_SIZE);
+// Play the queue, from SysTick_Handler (every 1ms)
+// The LEDs are on I2C, so only the layers are drawn here and FX_Service() writes the frame
+void FX_Tick(void)
+{
+	const fx_step_t *step;
+	const struct note *note;
+	uint8_t led, next;
 
-	// display hex data from data packet struct (without header and footer)
-	PRINTF("[*] Loading Data: 0x");
-	for (i = 1; i < NXH2261_DATA_PACKET_SIZE - 1; ++i)
+	if (fxWait > 1)
 	{
-		PRINTF("%02X", dataBlob[i]);
+		fxWait--;
+		return;
 	}
-	PRINTF("\n\r");
-
-	// Toggle NXH_UPDATE to tell NXH2261 that we want to update data being sent
-	GPIO_PinWrite(BOARD_INITPINS_NXH_UPDATE_GPIO, BOARD_INITPINS_NXH_UPDATE_GPIO_PIN, HIGH);
-	SysTick_DelayTicks(100);
-	GPIO_PinWrite(BOARD_INITPINS_NXH_UPDATE_GPIO, BOARD_INITPINS_NXH_UPDATE_GPIO_PIN, LOW);
-	SysTick_DelayTicks(100);
 
-	// Wait until we receive "RO" from NXH to indicate that it is ready to receive new data
-	do
+	fxWait = 0;
+	while (fxWait == 0 && fxTail != fxHead)
 	{
-		if (nxhRxIndex == nxhTxIndex)  // we've reached the end of the buffer
-			return 1;
+		step = &fxQueue[fxTail];
+
+		switch (fxPhase)
+		{
+			case FX_START:
+				fxNote = 0;
+				fxPc = step->show;
+				fxLoopDepth = 0;
+				fxTimed = false;
+				fxPhase = FX_RAMP;
+				if (step->flags & FX_KEEP)
+					break;
+
+				fxLeds = step->leds;
+				fxLevel = (step->tick && step->step) ? step->from : step->to;
+				fxWait = (fxLevel != step->to) ? step->tick : 0;
+				FX_Draw(step);
+				break;
+
+			case FX_RAMP:	// one brightness step every tick ms
+				if (fxLevel == step->to || (step->flags & FX_KEEP) || !step->tick || !step->step)
+				{
+					fxPhase = FX_SHOW;
+					break;
+				}
+
+				if (fxLevel < step->to)
+					fxLevel = (step->to - fxLevel > step->step) ? fxLevel + step->step : step->to;
+				else
+					fxLevel = (fxLevel - step->to > step->step) ? fxLevel - step->step : step->to;
+				fxWait = step->tick;
+				FX_Draw(step);
+				break;
+
+			case FX_SHOW:
+				fxWait = fxPc ? FX_Show(step) : 0;
+				if (fxWait == 0)
+					fxPhase = FX_NOTE;
+				break;
+
+			case FX_NOTE:
+				if (fxNote >= step->notes)
+				{
+					fxPhase = FX_HOLD;
+					break;
+				}
+
+				note = &step->tune[fxNote];
+				if (step->flags & FX_FLICKER)
+				{
+					led = Get_Random_Byte() % LP5569_LED_NUM;
+					if ((note->pitch & ~PIEZO_QUIET) != PITCH_REST)  // Enable LED to flash along with the music
+						LED_Fill(LED_LAYER_MUSIC, 1U << led, 1U << led, LED_LEVEL_MAX);
+				}
+				if (step->lyrics)
+				{
+					next = (fxLyricHead + 1) & (FX_LYRIC_QUEUE_SIZE - 1);
+					if (next != fxLyricTail)	// full: the console is that far behind anyway
+					{
+						fxLyricQueue[fxLyricHead] = step->lyrics[fxNote];
+						fxLyricHead = next;
+					}
+					KL_Post(KL_EVENT_LED);
+				}
+
+				KL_Piezo_Note(note->pitch);
+				fxWait = note->ticks * PIEZO_TICK;
+				fxPhase = FX_GAP;
+				break;
 
-		ch = nxhRingBuffer[nxhTxIndex];
-		nxhTxIndex++;
-		nxhTxIndex %= LPUART0_RING_BUFFER_SIZE;
-	} while (ch != 'R');
+			case FX_GAP:
+				KL_Piezo_Tone(0, 0);
+				if (ledLayer[LED_LAYER_MUSIC].cover)
+					LED_Fill(LED_LAYER_MUSIC, 0, 0, 0);
 
-	// now check if 'O' is next door
-	if (nxhRxIndex == nxhTxIndex)  // we've reached the end of the buffer
-		return 1;
+				fxNote++;
+				fxWait = step->gap;
+				fxPhase = FX_NOTE;
+				break;
 
-	ch = nxhRingBuffer[nxhTxIndex];
-	nxhTxIndex++;
-	nxhTxIndex %= LPUART0_RING_BUFFER_SIZE;
-	if (ch == 'O')
-	{
-		// send our updated data packet to the NXH
-		LPUART_WriteBlocking(LPUART0_PERIPHERAL, dataBlob, sizeof(dataBlob));
-	}
-	else
-		return 1;
+			case FX_HOLD:
+				fxWait = step->hold;
+				fxPhase = FX_NEXT;
+				break;
 
-	return 0;
+			case FX_NEXT:
+			default:
+				fxTail = (fxTail + 1) & (FX_QUEUE_SIZE - 1);
+				fxPhase = FX_START;
+				if (fxTail == fxHead)
+				{
+					if (ledLayer[LED_LAYER_NOTIFY].cover)	// uncover the state display
+						LED_Fill(LED_LAYER_NOTIFY, 0, 0, 0);
+					KL_Post(KL_EVENT_IDLE);
+				}
+				break;
+		}
+	}
 }
 
 /**************************************************************/
 
-void KL_Reset_NXH2261(void)
+void FX_Draw(const fx_step_t *step)	// fxLeds at fxLevel, on the step's layer
 {
-	GPIO_PinWrite(BOARD_INITPINS_NXH_nRESET_GPIO, BOARD_INITPINS_NXH_nRESET_GPIO_PIN, LOW);  // Disable NXH2261
-	SysTick_DelayTicks(250);
-
-	GPIO_PinWrite(BOARD_INITPINS_NXH_nRESET_GPIO, BOARD_INITPINS_NXH_nRESET_GPIO_PIN, HIGH); // Enable NXH2261
-	SysTick_DelayTicks(10);
+	LED_Fill(step->layer, (step->layer == LED_LAYER_STATE) ? LED_ALL_CHANNELS : fxLeds, fxLeds, fxLevel);
 }
 
 /**************************************************************/
 
-int KL_Setup_LP5569(void) // Configure LP5569 LED Driver
+// Play the step's show from fxPc (FX_Tick()) until an instruction takes time, returns
+// how long (ms), or 0 once it has ended. Shows are checked by FX_ShowCheck() beforehand
+uint16_t FX_Show(const fx_step_t *step)
 {
-	uint8_t i, err = 0;
+	const uint8_t *pc = fxPc;
+	uint16_t ms;
+	uint8_t n, led;
 
-	GPIO_PinWrite(BOARD_INITPINS_LED_EN_GPIO, BOARD_INITPINS_LED_EN_GPIO_PIN, LOW);
-	SysTick_DelayTicks(10);
+	for (n = 0; n < FX_SHOW_STEPS; n++)
+	{
+		switch (pc[0])
+		{
+			case SHOW_SET:
+				fxLeds = pc[1];
+				fxLevel = pc[2];
+				FX_Draw(step);
+				break;
 
-	GPIO_PinWrite(BOARD_INITPINS_LED_EN_GPIO, BOARD_INITPINS_LED_EN_GPIO_PIN, HIGH); // Enable LP5569
-	SysTick_DelayTicks(10);
+			case SHOW_RAMP:	// stays on the instruction until the level is reached
+				if (fxLevel != pc[2] && pc[3])
+				{
+					if (fxLevel < pc[2])
+						fxLevel = (pc[2] - fxLevel > pc[3]) ? fxLevel + pc[3] : pc[2];
+					else
+						fxLevel = (fxLevel - pc[2] > pc[3]) ? fxLevel - pc[3] : pc[2];
+					fxLeds = pc[1];
+					FX_Draw(step);
+					fxPc = pc;
+					return pc[4] ? pc[4] : 1;
+				}
 
-	// Load default LED settings
-	err += I2C_WriteRegister(I2C0_PERIPHERAL, I2C_LP5569_ADDR, LP5569_REG_CONFIG, 0x00); // Disable LP5569 while setting MISC register
-	SysTick_DelayTicks(1); // Wait for register to be updated
+				if (fxLeds != pc[1])
+				{
+					fxLeds = pc[1];
+					FX_Draw(step);
+				}
+				break;
 
-	err += I2C_WriteRegister(I2C0_PERIPHERAL, I2C_LP5569_ADDR, LP5569_REG_MISC, 0x39); 		// Auto-increment disabled, auto-power save, auto-charge pump, internal 32.768kHz oscillator
-	err += I2C_WriteRegister(I2C0_PERIPHERAL, I2C_LP5569_ADDR, LP5569_REG_CONFIG, 0x40); 	// Turn on LP5569
-	SysTick_DelayTicks(1); // Wait for register to be updated
+			case SHOW_WAIT:
+			case SHOW_NOTE:	// started on the first pass, silenced on the second
+			case SHOW_TONE:
+				if (!fxTimed)
+				{
+					if (pc[0] == SHOW_NOTE)
+					{
+						KL_Piezo_Note(pc[1]);
+						ms = pc[2] | (pc[3] << 8);
+					}
+					else if (pc[0] == SHOW_TONE)
+					{
+						KL_Piezo_Start(pc[1], pc[2] | (pc[3] << 8), pc[4] | (pc[5] << 8));
+						ms = pc[6] | (pc[7] << 8);
+					}
+					else
+						ms = pc[1] | (pc[2] << 8);
 
-	err += I2C_WriteRegister(I2C0_PERIPHERAL, I2C_LP5569_ADDR, LP5569_REG_LED_ENGINE_CONTROL2, 0xFA); // Halt all engines, enable direct LED control
+					if (ms)
+					{
+						fxTimed = true;
+						fxPc = pc;
+						return ms;
+					}
+				}
 
-	for (i = 0; i < LP5569_LED_NUM; i++)  // Control Register
-	{
-		err += I2C_WriteRegister(I2C0_PERIPHERAL, I2C_LP5569_ADDR, LP5569_REG_LED0_CONTROL + i, LP5569_Control);
-	}
+				fxTimed = false;
+				if (pc[0] != SHOW_WAIT)
+					KL_Piezo_Tone(0, 0);
+				break;
 
-	for (i = 0; i < LP5569_LED_NUM; i++)  // Current Control
-	{
-		err += I2C_WriteRegister(I2C0_PERIPHERAL, I2C_LP5569_ADDR, LP5569_REG_LED0_CURRENT + i, LP5569_Current);
-	}
+			case SHOW_RANDOM:
+				led = Get_Random_Byte() & 7;
+				while (!(pc[1] & (1U << led)))
+					led = (led + 1) & 7;
 
-	for (i = 0; i < LP5569_LED_NUM; i++)  // PWM Duty Cycle
-	{
-		err += I2C_WriteRegister(I2C0_PERIPHERAL, I2C_LP5569_ADDR, LP5569_REG_LED0_PWM + i, 0x00); // All LEDs off
-	}
+				fxLeds = 1U << led;
+				fxLevel = pc[2];
+				FX_Draw(step);
+				break;
 
-	// Disable unused LED channels
-	err += I2C_WriteRegister(I2C0_PERIPHERAL, I2C_LP5569_ADDR, LP5569_REG_LED6_CONTROL, 0x00);
-	err += I2C_WriteRegister(I2C0_PERIPHERAL, I2C_LP5569_ADDR, LP5569_REG_LED7_CONTROL, 0x00);
-	err += I2C_WriteRegister(I2C0_PERIPHERAL, I2C_LP5569_ADDR, LP5569_REG_LED8_CONTROL, 0x00);
+			case SHOW_LOOP:
+				fxLoopPc[fxLoopDepth] = pc + show_op_sizes[SHOW_LOOP];
+				fxLoopCount[fxLoopDepth++] = pc[1];
+				break;
 
-	// Map LED to register control (not execution engine)
-	err += I2C_WriteRegister(I2C0_PERIPHERAL, I2C_LP5569_ADDR, LP5569_REG_ENGINE1_MAPPING1, 0x00); // LED8
-	err += I2C_WriteRegister(I2C0_PERIPHERAL, I2C_LP5569_ADDR, LP5569_REG_ENGINE1_MAPPING2, 0x00); // LED7..0
-	err += I2C_WriteRegister(I2C0_PERIPHERAL, I2C_LP5569_ADDR, LP5569_REG_ENGINE2_MAPPING1, 0x00); // LED8
-	err += I2C_WriteRegister(I2C0_PERIPHERAL, I2C_LP5569_ADDR, LP5569_REG_ENGINE2_MAPPING2, 0x00); // LED7..0
-	err += I2C_WriteRegister(I2C0_PERIPHERAL, I2C_LP5569_ADDR, LP5569_REG_ENGINE3_MAPPING1, 0x00); // LED8
-	err += I2C_WriteRegister(I2C0_PERIPHERAL, I2C_LP5569_ADDR, LP5569_REG_ENGINE3_MAPPING2, 0x00); // LED7..0
+			case SHOW_NEXT:
+				if (--fxLoopCount[fxLoopDepth - 1])
+				{
+					pc = fxLoopPc[fxLoopDepth - 1];
+					continue;
+				}
 
-	return err;
+				fxLoopDepth--;
+				break;
+
+			case SHOW_END:
+			default:
+				fxPc = NULL;
+				return 0;
+		}
+
+		pc += show_op_sizes[pc[0]];
+	}
+
+	fxPc = pc;	// enough for one tick, carry on with the next
+	return 1;
 }
 
 /**************************************************************/
 
-void LP5569_SetLED(unsigned char led_num, unsigned char led_pwm)
+// 0 if the show is safe to play: known instructions with their operands, a pitch in piezo_tpm[]
+// for NOTE, a TPM0 prescaler for TONE, a LED for RANDOM, LOOPs that count, are closed and not nested too deep, and an END
+int FX_ShowCheck(const uint8_t *code, uint32_t size)
 {
-	int i;
-
-	//PRINTF("[*] Setting LED %d @ PWM %d\n\r", led_num, led_pwm);
+	uint32_t pc = 0;
+	uint8_t depth = 0;
 
-	if (I2C_WriteRegister(I2C0_PERIPHERAL, I2C_LP5569_ADDR, LP5569_REG_LED0_PWM + led_num, led_pwm))
+	while (pc < size)
 	{
-		// if write fails, try to release the bus
-		PRINTF("[*] I2C Bus Clear...");
-		I2C_ReleaseBus();
-		SysTick_DelayTicks(100);
-
-		// re-initialize I2C
-		I2C_MasterDeinit(I2C0_PERIPHERAL);
-		SysTick_DelayTicks(10);
-		I2C_MasterInit(I2C0_PERIPHERAL, &I2C0_config, I2C0_CLK_FREQ);
-		SysTick_DelayTicks(10);
+		if (code[pc] >= SHOW_OP_COUNT || pc + show_op_sizes[code[pc]] > size)
+			return 1;
 
-		// and re-attempt the transaction
-		if (I2C_WriteRegister(I2C0_PERIPHERAL, I2C_LP5569_ADDR, LP5569_REG_LED0_PWM + led_num, led_pwm))
-		{
-			PRINTF("Error!\n\r");
-		}
-		else
+		switch (code[pc])
 		{
-			PRINTF("Done!\n\r");
+			case SHOW_END:
+				return (depth == 0) ? 0 : 1;
+
+			case SHOW_NOTE:
+				if ((code[pc + 1] & ~SHOW_QUIET) >= PITCH_COUNT)
+					return 1;
+				break;
+
+			case SHOW_TONE:
+				if (code[pc + 1] > (TPM_SC_PS_MASK >> TPM_SC_PS_SHIFT))
+					return 1;
+				break;
+
+			case SHOW_RANDOM:
+				if (code[pc + 1] == 0)
+					return 1;
+				break;
+
+			case SHOW_LOOP:
+				if (code[pc + 1] == 0 || depth == SHOW_LOOP_DEPTH)
+					return 1;
+				depth++;
+				break;
+
+			case SHOW_NEXT:
+				if (depth == 0)
+					return 1;
+				depth--;
+				break;
+
+			default:
+				break;
 		}
+
+		pc += show_op_sizes[code[pc]];
 	}
 
-	for (i = 0; i < 100; ++i){};  // poor man's delay (us)
+	return 1;	// no END
 }
 
 /**************************************************************/
 
-void LP5569_SetLED_AllOn(void)
+// Compose and write the LED frame when one is due, start or stop the engine for the idle animation
+// and print lyrics. Called whenever the main loop waits, only the LEDs that changed are written
+void FX_Service(void)
 {
-	static volatile int i;
+	static bool busy;
+	led_layer_t layers[LED_LAYER_COUNT];
+	uint16_t changed = 0;
+	uint8_t i, first, last, pwm[LED_CHANNELS];
+	uint32_t primask;
+	bool due;
+
+	if (busy || (!ledDue && fxLyricTail == fxLyricHead && fxEngine == fxEngineShown && ledFader == ledFaderShown))
+		return;
+	busy = true;
+
+	if (ledFader != ledFaderShown && !LP5569_WriteRegister(LP5569_REG_MASTER_FADER1, ledFader))
+		ledFaderShown = ledFader;
 
-	for (i = 0; i < LP5569_LED_NUM; i++)  // each LED
+	if (fxEngine != fxEngineShown)
 	{
-		LP5569_SetLED(i, LP5569_PWM); // default brightness
+		if (!LP5569_Engine_Run(fxEngine))
+			fxEngineShown = fxEngine;
+		LP5569_Invalidate(LP5569_REG_LED0_PWM, LED_CHANNELS);	// the engine changes the LEDs behind our back
+		changed = LED_ALL_CHANNELS;								// so put the whole frame back when it stops
 	}
-}
 
-/**************************************************************/
+	primask = DisableGlobalIRQ();
+	due = ledDue;
+	ledDue = false;
+	if (due)
+	{
+		memcpy(layers, ledLayer, sizeof(layers));
+		ledDirty = false;
+	}
+	EnableGlobalIRQ(primask);
 
-void LP5569_SetLED_AllOff(void)
-{
-	static volatile int i;
+	while (fxLyricTail != fxLyricHead)	// all of them, FX_Tick() may have got ahead of us
+	{
+		PRINTF("%s", fxLyricQueue[fxLyricTail]);
+		fxLyricTail = (fxLyricTail + 1) & (FX_LYRIC_QUEUE_SIZE - 1);
+	}
+
+	if (due)
+		changed |= LED_Compose(layers, LED_LAYER_COUNT, ledFrame);
 
-	for (i = 0; i < LP5569_LED_NUM; i++)  // each LED
+	if (changed && fxEngineShown == LP5569_ENGINE_NONE)	// a running engine owns the LEDs
 	{
-		LP5569_SetLED(i, 0); // off
+		for (first = 0; !(changed & (1U << first)); first++);
+		for (last = LED_CHANNELS - 1; !(changed & (1U << last)); last--);
+		for (i = first; i <= last; i++)
+			pwm[i] = led_gamma[ledFrame[i]];
+		LP5569_SetFrame(&pwm[first], first, last);
 	}
+
+	busy = false;
 }
 
 /**************************************************************/
 
-void LP5569_SetLED_D(unsigned char pwm_val)
+// Draw on a layer: it covers the channels in cover (the others show the layers below), with
+// those in leds at level and the rest off. Called from FX_Tick() and, with effects stopped, from
+// code that drives the LEDs itself
+void LED_Fill(uint8_t layer, uint16_t cover, uint16_t leds, uint8_t level)
 {
-	LP5569_SetLED(0, 0);
-	LP5569_SetLED(1, 0);
-	LP5569_SetLED(2, 0);
-	LP5569_SetLED(3, pwm_val);
-	LP5569_SetLED(4, pwm_val);
-	LP5569_SetLED(5, pwm_val);
+	led_layer_t *l = &ledLayer[layer];
+	uint8_t i;
+
+	for (i = 0; i < LED_CHANNELS; i++)
+		l->pwm[i] = (leds & (1U << i)) ? level : 0;
+	l->cover = cover & LED_ALL_CHANNELS;
+	ledDirty = true;
 }
 
 /**************************************************************/
 
-void LP5569_SetLED_E(unsigned char pwm_val)
+void LED_Set(uint8_t layer, uint8_t led, uint8_t pwm)	// one channel of a layer, which now covers it
 {
-	LP5569_SetLED(0, pwm_val);
-	LP5569_SetLED(1, pwm_val);
-	LP5569_SetLED(2, pwm_val);
-	LP5569_SetLED(3, 0);
-	LP5569_SetLED(4, pwm_val);
-	LP5569_SetLED(5, 0);
+	ledLayer[layer].pwm[led] = pwm;
+	ledLayer[layer].cover |= 1U << led;
+	ledDirty = true;
 }
 
 /**************************************************************/
 
-void LP5569_SetLED_F(unsigned char pwm_val)
+void LED_Update(void)	// write the layers drawn so far now, rather than at the next frame
 {
-	LP5569_SetLED(0, pwm_val);
-	LP5569_SetLED(1, pwm_val);
-	LP5569_SetLED(2, pwm_val);
-	LP5569_SetLED(3, pwm_val);
-	LP5569_SetLED(4, 0);
-	LP5569_SetLED(5, 0);
+	ledDue = true;
+	KL_Post(KL_EVENT_LED);	// in case FX_Service() is busy further up the stack
+	FX_Service();
 }
 
 /**************************************************************/
 
-void LP5569_SetLED_C(unsigned char pwm_val)
+// Frame clock, from SysTick_Handler: a frame is composed at most every LED_FRAME_PERIOD ms,
+// and only when a layer has changed (the first change after a quiet spell goes straight out)
+void LED_Tick(void)
 {
-	LP5569_SetLED(0, pwm_val);
-	LP5569_SetLED(1, pwm_val);
-	LP5569_SetLED(2, pwm_val);
-	LP5569_SetLED(3, 0);
-	LP5569_SetLED(4, 0);
-	LP5569_SetLED(5, 0);
+	if (ledWait)
+		ledWait--;
+
+	if (ledDirty && !ledDue && ledWait == 0)
+	{
+		ledWait = LED_FRAME_PERIOD;
+		ledDue = true;
+		KL_Post(KL_EVENT_LED);
+	}
 }
 
 /**************************************************************/
 
-void LP5569_SetLED_O(unsigned char pwm_val)
+// Dim or brighten every LED, engine animations included, with one master fader write (by
+// FX_Service()) rather than rewriting the frame. brightness is perceptual, LED_LEVEL_MAX = LP5569_PWM
+void LED_SetBrightness(uint8_t brightness)
 {
-	LP5569_SetLED(0, pwm_val);
-	LP5569_SetLED(1, pwm_val);
-	LP5569_SetLED(2, pwm_val);
-	LP5569_SetLED(3, pwm_val);
-	LP5569_SetLED(4, pwm_val);
-	LP5569_SetLED(5, pwm_val);
+	ledBrightness = brightness;
+	ledFader = led_gamma[LP5569_PWM * brightness / LED_LEVEL_MAX];
+	KL_Post(KL_EVENT_LED);
 }
 
 /**************************************************************/
 
-void LP5569_SetLED_N(unsigned char pwm_val)
+bool LED_Busy(void)	// a frame waiting to be written (SysTick must keep running)
 {
-	LP5569_SetLED(0, pwm_val);
-	LP5569_SetLED(1, pwm_val);
-	LP5569_SetLED(2, 0);
-	LP5569_SetLED(3, pwm_val);
-	LP5569_SetLED(4, pwm_val);
-	LP5569_SetLED(5, 0);
+	return ledDirty || ledDue;
 }
 
 /**************************************************************/
 
-void LP5569_RampLED(badge_state_t ch)  // display heartbeat (ramp up/down) of specified LED pattern
+// Compose the layers (bottom first) into frame: each channel takes the value of the top layer
+// covering it, or off. Returns the channels that changed. No hardware access, so the host can run it
+uint16_t LED_Compose(const led_layer_t *layers, uint8_t count, uint8_t *frame)
 {
-	static volatile int j;
+	uint16_t changed = 0, covered = 0, cover;
+	uint8_t i, pwm[LED_CHANNELS] = { 0 };
+	int8_t l;
 
-	for (j = 0; j <= LP5569_PWM; j += 4)  // ramp up to maximum defined brightness
+	for (l = count - 1; l >= 0 && covered != LED_ALL_CHANNELS; l--)
 	{
-		if (g_nxhDetect)
-		{
-			g_nxhDetect = false;
-			return; // exit the heartbeat if new badge data has just been received
-		}
-
-		switch (ch)
+		cover = layers[l].cover & ~covered;
+		for (i = 0; cover; i++, cover >>= 1)
 		{
-			case D:
-				LP5569_SetLED_D(j);
-				break;
-
-			case E:
-				LP5569_SetLED_E(j);
-				break;
-
-			case F:
-				LP5569_SetLED_F(j);
-				break;
-
-			case C:
-				LP5569_SetLED_C(j);
-				break;
-
-			case O:
-				LP5569_SetLED_O(j);
-				break;
-
-			case N:
-				LP5569_SetLED_N(j);
-				break;
-
-			case ATTRACT:
-			case COMPLETE:
-			default:
-				break;
+			if (cover & 1U)
+				pwm[i] = layers[l].pwm[i];
 		}
-
-		SysTick_DelayTicks(LED_HEARTBEAT_FADE_DELAY);
-	}
-
-	LPTMR_SetTimerPeriod(LPTMR0_PERIPHERAL, LED_HEARTBEAT_WAIT_DELAY);	// Set time to sleep at LED maximum brightness
-	KL_Sleep(); // Go to sleep until our delay period is complete
-	if (g_nxhDetect)
-	{
-		g_nxhDetect = false;
-		return; // exit the heartbeat if new badge data has just been received
+		covered |= layers[l].cover;
 	}
 
-	for (j = LP5569_PWM; j >= 0; j -= 4)  // ramp down from maximum defined brightness
+	for (i = 0; i < LED_CHANNELS; i++)
 	{
-		if (g_nxhDetect)
-		{
-			g_nxhDetect = false;
-			return; // exit the heartbeat if new badge data has just been received
-		}
-
-		switch (ch)
+		if (frame[i] != pwm[i])
 		{
-			case D:
-				LP5569_SetLED_D(j);
-				break;
-
-			case E:
-				LP5569_SetLED_E(j);
-				break;
-
-			case F:
-				LP5569_SetLED_F(j);
-				break;
-
-			case C:
-				LP5569_SetLED_C(j);
-				break;
-
-			case O:
-				LP5569_SetLED_O(j);
-				break;
-
-			case N:
-				LP5569_SetLED_N(j);
-				break;
-
-			case ATTRACT:
-			case COMPLETE:
-			default:
-				break;
+			frame[i] = pwm[i];
+			changed |= 1U << i;
 		}
-
-		SysTick_DelayTicks(LED_HEARTBEAT_FADE_DELAY);
 	}
+
+	return changed;
 }
 
 /**************************************************************/
@@ -2844,6 +5216,30 @@ bool I2C_WriteRegister(I2C_Type *base, uint8_t device_addr, uint8_t reg_addr, ui
 
 /**************************************************************/
 
+// Utility function to write consecutive registers of the I2C device, starting at reg_addr,
+// in one transaction (the device must auto-increment its register address)
+bool I2C_WriteRegisters(I2C_Type *base, uint8_t device_addr, uint8_t reg_addr, const uint8_t *txBuff, uint32_t txSize)
+{
+    i2c_master_transfer_t masterXfer;
+    memset(&masterXfer, 0, sizeof(masterXfer));
+
+    masterXfer.slaveAddress = device_addr;
+    masterXfer.direction = kI2C_Write;
+    masterXfer.subaddress = reg_addr;
+    masterXfer.subaddressSize = 1;
+    masterXfer.data = (uint8_t *)txBuff;
+    masterXfer.dataSize = txSize;
+    masterXfer.flags = kI2C_TransferDefaultFlag;
+
+    // does not return until the transfer succeeds or fails due to arbitration lost or receiving a NAK
+    if (I2C_MasterTransferBlocking(base, &masterXfer) == kStatus_Success)
+    	return 0;
+    else
+    	return 1;
+}
+
+/**************************************************************/
+
 // Utility function to read multiple bytes (rxSize) from the specified I2C device
 bool I2C_ReadBulk(I2C_Type *base, uint8_t device_addr, uint8_t *rxBuff, uint32_t rxSize)
 {
@@ -2955,6 +5351,19 @@ unsigned char Get_Random_Byte(void)  // PRNG
 
 /**************************************************************/
 
+uint16_t Get_CRC16(const void *data, uint32_t len)	// CRC-16/CCITT-FALSE, on the CRC module
+{
+	crc_config_t config;
+
+	CRC_GetDefaultConfig(&config);	// polynomial 0x1021, seed 0xFFFF, no reflection
+	CRC_Init(CRC0, &config);		// clocks the module and starts from the seed
+	CRC_WriteData(CRC0, data, len);
+
+	return CRC_Get16bitResult(CRC0);
+}
+
+/**************************************************************/
+
 // print all 8 bits of a byte including leading zeros
 // from https://forum.arduino.cc/index.php?topic=46320.0
 void Print_Bits(uint8_t myByte)
@@ -2992,11 +5401,131 @@ void Reorder_Array(uint8_t *array, uint8_t *index, uint8_t N)
 
 /**************************************************************/
 
+// Delay n ms (effects keep playing). Short delays spin on SysTick, as they always did; longer
+// ones sleep: in VLPS with LPTMR0 to wake us when we can (see KL_CanSleep()), or else in WAIT mode
+// until each SysTick. Whatever wakes us early, we sleep again for the rest. Time is measured from
+// SysTick, which can't preempt us, and LPTMR0, so nested delays (from FX_Service()) are fine
 void SysTick_DelayTicks(uint32_t n)
 {
-    g_systickCounter = n;
-    while(g_systickCounter != 0U){};  // wait here until counter is done
+	uint32_t start, elapsed, primask;
+
+	while (n >= KL_DELAY_SPIN_MAX)
+	{
+		FX_Service();
+
+		if (KL_CanSleep())
+		{
+			DbgConsole_Flush();	// UART2 stops in VLPS
+
+			primask = DisableGlobalIRQ();
+			KL_Timer_Set(KL_TIMER_DELAY, n);
+			KL_Sleep();	// until LPTMR0, unless another interrupt comes first
+			EnableGlobalIRQ(primask);
+
+			elapsed = n - KL_Timer_Stop(KL_TIMER_DELAY);
+			delaySleep += elapsed;
+		}
+		else
+		{
+			primask = DisableGlobalIRQ();
+			start = g_systickCounter;
+			KL_Wait();	// until the next SysTick at the latest
+			EnableGlobalIRQ(primask);
+
+			elapsed = g_systickCounter - start;
+			delayWait += elapsed;
+		}
+
+		n = (elapsed < n) ? n - elapsed : 0U;
+	}
+
+	if (n != 0U)
+	{
+		start = g_systickCounter;
+		while (g_systickCounter - start < n)	// wait here until counter is done (effects keep playing)
+		{
+			FX_Service();
+			KL_IDLE();
+		}
+		delaySpin += n;
+	}
+}
+
+/**************************************************************/
+
+#ifdef __NXH_RECORD
+// Microseconds since power-up, from the SysTick millisecond count and current value.
+// Only called from ISRs, which SysTick_Handler (lowest priority) can't preempt
+static uint32_t KL_Record_Time(void)
+{
+	uint32_t ms = g_recordMs;
+	uint32_t ticks = SysTick->LOAD - SysTick->VAL;
+
+	if (SCB->ICSR & SCB_ICSR_PENDSTSET_Msk) // reloaded, but SysTick_Handler hasn't run yet
+	{
+		ms++;
+		ticks = SysTick->LOAD - SysTick->VAL;
+	}
+
+	return (ms * 1000U) + (ticks / (SystemCoreClock / 1000000U));
+}
+
+/**************************************************************/
+
+// Timestamp an event (ISR context)
+void KL_Record(uint8_t kind, uint8_t data)
+{
+	uint8_t next = (recordHead + 1) & (KL_RECORD_BUFFER_SIZE - 1);
+
+	if (next == recordTail) // full, the flush is running behind
+	{
+		if (recordLost < 0xFF)
+			recordLost++;
+		return;
+	}
+
+	recordTime[recordHead] = KL_Record_Time();
+	recordKind[recordHead] = kind;
+	recordData[recordHead] = data;
+	recordHead = next;
+}
+
+/**************************************************************/
+
+// Write captured events to the console as 7-byte frames:
+// sync, kind, time (us, little endian), data
+void KL_Record_Flush(void)
+{
+	uint32_t time = 0, primask;
+	uint8_t lost, i;
+
+	while (recordTail != recordHead)
+	{
+		time = recordTime[recordTail];
+		PUTCHAR(KL_RECORD_SYNC);
+		PUTCHAR(recordKind[recordTail]);
+		for (i = 0; i < 4; i++)
+			PUTCHAR((time >> (8 * i)) & 0xFF);
+		PUTCHAR(recordData[recordTail]);
+
+		recordTail = (recordTail + 1) & (KL_RECORD_BUFFER_SIZE - 1);
+	}
+
+	primask = DisableGlobalIRQ();
+	lost = recordLost;
+	recordLost = 0;
+	EnableGlobalIRQ(primask);
+
+	if (lost)
+	{
+		PUTCHAR(KL_RECORD_SYNC);
+		PUTCHAR(KL_RECORD_LOST);
+		for (i = 0; i < 4; i++)
+			PUTCHAR((time >> (8 * i)) & 0xFF);
+		PUTCHAR(lost);
+	}
 }
+#endif
 
 
 /****************************************************************************
@@ -3005,22 +5534,39 @@ void SysTick_DelayTicks(uint32_t n)
 
 void SysTick_Handler(void)
 {
-    if (g_systickCounter != 0U)
+    g_systickCounter++;
+
+    if (nxhListen != 0U)
     {
-        g_systickCounter--;
+    	nxhListen--;
     }
+
+    if (nvmWait != 0U && --nvmWait == 0U)
+    	KL_Post(KL_EVENT_SAVE);
+
+    FX_Tick();
+    LED_Tick();
+
+#ifdef __NXH_RECORD
+    g_recordMs++;
+#endif
 }
 
 /**************************************************************/
 
-void LPUART0_SERIAL_RX_TX_IRQHANDLER(void)
+// In RAM, so it runs during flash commands (see KL_Flash_Begin()). The driver's status
+// functions are in flash: use the registers
+__RAMFUNC(RAM) void LPUART0_SERIAL_RX_TX_IRQHANDLER(void)
 {
 	volatile uint8_t data;
 
 	// If new data has arrived from the NXH...
-	if (kLPUART_RxDataRegFullFlag & LPUART_GetStatusFlags(LPUART0_PERIPHERAL))
+	if (LPUART0_PERIPHERAL->STAT & LPUART_STAT_RDRF_MASK)
 	{
 		data = LPUART_ReadByte(LPUART0_PERIPHERAL);
+#ifdef __NXH_RECORD
+		KL_Record(KL_RECORD_BYTE, data);
+#endif
 
 		// If ring buffer isn't full, add the data
 		if (((nxhRxIndex + 1) % LPUART0_RING_BUFFER_SIZE) != nxhTxIndex)
@@ -3029,11 +5575,18 @@ void LPUART0_SERIAL_RX_TX_IRQHANDLER(void)
 			nxhRxIndex++;
 			nxhRxIndex %= LPUART0_RING_BUFFER_SIZE;
 		}
+
+		if (data == 'E')	// end of a packet
+		{
+			nxhListen = 0;
+			KL_Post(KL_EVENT_PACKET);
+		}
 	}
 
 	// If the UART buffer has overrun and can't store incoming data...
-	if (kLPUART_RxOverrunFlag & LPUART_GetStatusFlags(LPUART0_PERIPHERAL))
+	if ((LPUART0_PERIPHERAL->STAT & LPUART_STAT_OR_MASK) && !flashBusy)	// KL_Flash_End() clears it then
 	{
+		nxhOverruns++;
 		data = LPUART_ReadByte(LPUART0_PERIPHERAL); // dummy read to clear buffer (could cause misalignment of data packet)
 		LPUART_ClearStatusFlags(LPUART0_PERIPHERAL, kLPUART_RxOverrunFlag);
 	}
@@ -3041,11 +5594,32 @@ void LPUART0_SERIAL_RX_TX_IRQHANDLER(void)
 
 /**************************************************************/
 
-void LPTMR0_IRQHandler(void)
+void UART2_SERIAL_RX_TX_IRQHANDLER(void)
 {
-	g_lptmrFlag = true; // Set state of global variable
+	uint8_t data, next;
 
-	LPTMR_ClearStatusFlags(LPTMR0_PERIPHERAL, kLPTMR_TimerCompareFlag);
+	// If a character has arrived from the host (reading it also clears an overrun)...
+	if ((kUART_RxDataRegFullFlag | kUART_RxOverrunFlag) & UART_GetStatusFlags(UART2_PERIPHERAL))
+	{
+		data = UART_ReadByte(UART2_PERIPHERAL);
+
+		next = (consoleRxIndex + 1) & (CONSOLE_RING_BUFFER_SIZE - 1);
+		if (next != consoleTxIndex)	// If ring buffer isn't full, add the data
+		{
+			consoleRingBuffer[consoleRxIndex] = data;
+			consoleRxIndex = next;
+		}
+
+		KL_Post(data ? KL_EVENT_CONSOLE : KL_EVENT_ATTACH);	// a break may be the adapter being unplugged
+	}
+}
+
+/**************************************************************/
+
+void LPTMR0_IRQHandler(void)	// a timer is due (see KL_Timer_Charge())
+{
+	KL_Timer_Charge();
+	KL_Timer_Start();
 }
 
 /**************************************************************/
@@ -3054,13 +5628,22 @@ void PORTB_PORTC_PORTD_PORTE_IRQHandler(void)
 {
 	if (GPIO_PortGetInterruptFlags(GPIOC_GPIO))  // If interrupt was from Port C (NXH_DETECT)
 	{
-		g_nxhDetect = true;	// Set state of global variable
+		nxhListen = NXH2261_LISTEN_DELAY;	// packet follows on LPUART0
+#ifdef __NXH_RECORD
+		KL_Record(GPIO_PinRead(GPIOC_GPIO, BOARD_INITPINS_NXH_DETECT_PIN) ? KL_RECORD_PIN_HIGH : KL_RECORD_PIN_LOW,
+			KL_RECORD_PIN(2, BOARD_INITPINS_NXH_DETECT_PIN));
+#endif
 
 		GPIO_PortClearInterruptFlags(GPIOC_GPIO, 1U << BOARD_INITPINS_NXH_DETECT_PIN); 	// Clear external interrupt flag
 	}
 	else // Otherwise, interrupt must have been from Port E (KL_RX) via USB-to-Serial connection
 	{
+#ifdef __NXH_RECORD
+		KL_Record(GPIO_PinRead(GPIOE, BOARD_INITPINS_KL_RX_PIN) ? KL_RECORD_PIN_HIGH : KL_RECORD_PIN_LOW,
+			KL_RECORD_PIN(4, BOARD_INITPINS_KL_RX_PIN));
+#endif
 		GPIO_PortClearInterruptFlags(GPIOE, 1U << BOARD_INITPINS_KL_RX_PIN);  // Clear external interrupt flag
+		KL_Post(KL_EVENT_ATTACH);
 	}
 }
 
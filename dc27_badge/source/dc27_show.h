@@ -0,0 +1,92 @@
+/*
+ * DEFCON 27 Official Badge - LED and piezo show bytecode
+ *
+ * A show is a list of instructions played by FX_Tick() from SysTick, one opcode
+ * byte followed by its operands (16-bit values little endian). LED levels are
+ * perceptual (0-255), leds is a bit mask (bit 0 = LED 0):
+ *
+ *   SET    leds level              light leds at level
+ *   RAMP   leds to step tick       from the last level towards to, step every tick ms
+ *   WAIT   ms(16)
+ *   NOTE   pitch ms(16)            play pitch for ms, then silence
+ *   RANDOM leds level              light one of leds, picked at random, at level
+ *   LOOP   count                   play up to the matching NEXT count times (1-255)
+ *   NEXT
+ *   END
+ *   TONE   prescale mod(16) cnv(16) ms(16)
+ *                                  TPM0 settings as they are (KL_Piezo_Start()) for ms, then
+ *                                  silence: any frequency, worked out before the show plays
+ *
+ * A pitch is a note of SHOW_PITCHES, numbered from 1 (0 is a rest), plus
+ * SHOW_QUIET for a 25% duty cycle instead of 50%. The badge has the timer
+ * settings for each worked out beforehand, so playing a note from SysTick
+ * doesn't divide.
+ *
+ * Built-in shows are written with the SHOW_ macros below. Others are compiled
+ * on the host (host/show.c) and uploaded over the console into a flash sector.
+ * TONE depends on the badge's TPM0 clock, so the host doesn't compile it: the
+ * 'S' console command plays its tone with one.
+ */
+
+#ifndef _DC27_SHOW_H_
+#define _DC27_SHOW_H_
+
+/***************************************************************************
+ **************************** Definitions **********************************
+ ***************************************************************************/
+
+#define SHOW_MAX_SIZE			256U	// Bytes in a show, END included
+#define SHOW_LOOP_DEPTH			4U		// Nested LOOPs
+#define SHOW_FLASH_MAGIC		0x32574853UL	// "SHW2": the flash sector holds a show (NOTE with a pitch)
+#define SHOW_QUIET				0x80	// NOTE pitch: 25% duty cycle instead of 50%
+
+// Pitches a NOTE can play, from 1 (B0) in semitones
+#define SHOW_PITCHES(X) \
+	X(B0) X(C1) X(CS1) X(D1) X(DS1) X(E1) X(F1) X(FS1) X(G1) X(GS1) X(A1) X(AS1) \
+	X(B1) X(C2) X(CS2) X(D2) X(DS2) X(E2) X(F2) X(FS2) X(G2) X(GS2) X(A2) X(AS2) \
+	X(B2) X(C3) X(CS3) X(D3) X(DS3) X(E3) X(F3) X(FS3) X(G3) X(GS3) X(A3) X(AS3) \
+	X(B3) X(C4) X(CS4) X(D4) X(DS4) X(E4) X(F4) X(FS4) X(G4) X(GS4) X(A4) X(AS4) \
+	X(B4) X(C5) X(CS5) X(D5) X(DS5) X(E5) X(F5) X(FS5) X(G5) X(GS5) X(A5) X(AS5) \
+	X(B5) X(C6) X(CS6) X(D6) X(DS6) X(E6) X(F6) X(FS6) X(G6) X(GS6) X(A6) X(AS6) \
+	X(B6) X(C7) X(CS7) X(D7) X(DS7) X(E7) X(F7) X(FS7) X(G7) X(GS7) X(A7) X(AS7) \
+	X(B7) X(C8) X(CS8) X(D8) X(DS8)
+
+enum
+{
+	SHOW_END,
+	SHOW_SET,
+	SHOW_RAMP,
+	SHOW_WAIT,
+	SHOW_NOTE,
+	SHOW_RANDOM,
+	SHOW_LOOP,
+	SHOW_NEXT,
+	SHOW_TONE,
+	SHOW_OP_COUNT
+};
+
+#define SHOW_PITCH_ENUM(name)	SHOW_PITCH_##name,
+
+enum
+{
+	SHOW_PITCH_REST,
+	SHOW_PITCHES(SHOW_PITCH_ENUM)
+	SHOW_PITCH_COUNT
+};
+
+// Instruction length (opcode and operands), indexed by opcode
+#define SHOW_OP_SIZES			{ 1, 3, 5, 3, 4, 3, 2, 1, 8 }
+
+#define SHOW_U16(x)				((x) & 0xFF), (((x) >> 8) & 0xFF)
+
+#define SHOW_OP_SET(leds, level)			SHOW_SET, (leds), (level)
+#define SHOW_OP_RAMP(leds, to, step, tick)	SHOW_RAMP, (leds), (to), (step), (tick)
+#define SHOW_OP_WAIT(ms)					SHOW_WAIT, SHOW_U16(ms)
+#define SHOW_OP_NOTE(pitch, ms)				SHOW_NOTE, (pitch), SHOW_U16(ms)
+#define SHOW_OP_RANDOM(leds, level)			SHOW_RANDOM, (leds), (level)
+#define SHOW_OP_LOOP(count)					SHOW_LOOP, (count)
+#define SHOW_OP_NEXT						SHOW_NEXT
+#define SHOW_OP_END							SHOW_END
+#define SHOW_OP_TONE(prescale, mod, cnv, ms)	SHOW_TONE, (prescale), SHOW_U16(mod), SHOW_U16(cnv), SHOW_U16(ms)
+
+#endif /* _DC27_SHOW_H_ */